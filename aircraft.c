@@ -14,20 +14,6 @@ uint32_t aircraftHash(uint32_t addr) {
 
     return h & (AIRCRAFT_BUCKETS - 1);
 }
-uint32_t dbHash(uint32_t addr) {
-    uint64_t h = 0x30732349f7810465ULL ^ (4 * 0x2127599bf4325c37ULL);
-    uint64_t in = addr;
-    uint64_t v = in << 48;
-    v ^= in << 24;
-    v ^= in;
-    h ^= mix_fasthash(v);
-
-    h -= (h >> 32);
-    h &= (1ULL << 32) - 1;
-    h -= (h >> DB_HASH_BITS);
-
-    return h & (DB_BUCKETS - 1);
-}
 struct aircraft *aircraftGet(uint32_t addr) {
     struct aircraft *a = Modes.aircraft[aircraftHash(addr)];
 
@@ -387,36 +373,6 @@ void toBinCraft(struct aircraft *a, struct binCraft *new, uint64_t now) {
 #undef F
 }
 
-// rudimentary sanitization so the json output hopefully won't be invalid
-static inline void sanitize(char *str, unsigned len) {
-    char b2 = (1<<7) + (1<<6); // 2 byte code or more
-    char b3 = (1<<7) + (1<<6) + (1<<5); // 3 byte code or more
-    char b4 = (1<<7) + (1<<6) + (1<<5) + (1<<4); // 4 byte code
-
-    if (len >= 3 && (str[len - 3] & b4) == b4) {
-        //fprintf(stderr, "%c\n", str[len - 3]);
-        str[len - 3] = '\0';
-    }
-    if (len >= 2 && (str[len - 2] & b3) == b3) {
-        //fprintf(stderr, "%c\n", str[len - 2]);
-        str[len - 2] = '\0';
-    }
-    if (len >= 1 && (str[len - 1] & b2) == b2) {
-        //fprintf(stderr, "%c\n", str[len - 1]);
-        str[len - 1] = '\0';
-    }
-    char *p = str;
-    while(p < str + len && *p) {
-        if (*p == '"')
-            *p = '\'';
-        if (*p > 0 && *p < 0x1f)
-            *p = ' ';
-        p++;
-    }
-    if (p - 1 >= str && *(p - 1) == '\\') {
-        *(p - 1) = '\0';
-    }
-}
 static char *sprintDB(char *p, char *end, dbEntry *d) {
     p = safe_snprintf(p, end, "\n\"%s%06x\":{", (d->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", d->addr & 0xFFFFFF);
     char *regInfo = p;
@@ -435,21 +391,21 @@ static char *sprintDB(char *p, char *end, dbEntry *d) {
     p = safe_snprintf(p, end, "},");
     return p;
 }
-static void dbToJson() {
+static void dbToJson(struct aircraftDb *db) {
     size_t buflen = 32 * 1024 * 1024;
-    char *buf = (char *) malloc(buflen), *p = buf, *end = buf + buflen;
+    char *buf = (char *) arenaMalloc(buflen), *p = buf, *end = buf + buflen;
     p = safe_snprintf(p, end, "{");
 
-    for (int j = 0; j < DB_BUCKETS; j++) {
-        for (dbEntry *d = Modes.db2Index[j]; d; d = d->next) {
-            p = sprintDB(p, end, d);
-            if ((p + 1000) >= end) {
-                int used = p - buf;
-                buflen *= 2;
-                buf = (char *) realloc(buf, buflen);
-                p = buf + used;
-                end = buf + buflen;
-            }
+    for (int j = 0; j < db->count; j++) {
+        dbEntry entry;
+        dbEntryAt(db, j, &entry);
+        p = sprintDB(p, end, &entry);
+        if ((p + 1000) >= end) {
+            int used = p - buf;
+            buflen *= 2;
+            buf = (char *) arenaRealloc(buf, buflen);
+            p = buf + used;
+            end = buf + buflen;
         }
     }
 
@@ -462,22 +418,14 @@ static void dbToJson() {
     writeJsonToFile(Modes.json_dir, "db.json", cb2); // location changed
 }
 
-// get next CSV token based on the assumption eot points to the previous delimiter
-static inline int nextToken(char delim, char **sot, char **eot, char **eol) {
-    *sot = *eot + 1;
-    if (*sot >= *eol)
-        return 0;
-    *eot = memchr(*sot, delim, *eol - *sot);
-
-    if (!*eot)
-        return 0;
-
-    **eot = '\0';
-    return 1;
-}
-
+// Load the db file, hand the new db over via Modes.db2.
+// Runs in the db thread (except once on startup), the tracker picks up
+// the new db in dbFinishUpdate.
+// Files in the binary format (oneoff/dbconvert) are mapped, anything else
+// is read as (gzipped) csv.
 int dbUpdate() {
     struct char_buffer cb = {0};
+    struct aircraftDb *db = NULL;
     char *filename = Modes.db_file;
     if (!filename || !strlen(filename) || !strcmp(filename, "none"))
         return 0;
@@ -501,141 +449,115 @@ int dbUpdate() {
     if (Modes.dbModificationTime == modTime)
         goto DBU0;
 
-    int alloc = (1<<20);
-    Modes.db2 = malloc(alloc * sizeof(dbEntry));
-    Modes.db2Index = calloc(DB_BUCKETS, sizeof(void*));
-
-    if (!Modes.db2 || !Modes.db2Index) {
+    db = calloc(1, sizeof(struct aircraftDb));
+    if (!db) {
         fprintf(stderr, "db update error: malloc failure!\n");
         goto DBU0;
     }
 
-    gzFile gzfp = gzdopen(fd, "r");
-    if (!gzfp) {
-        fprintf(stderr, "db update error: gzdopen failed.\n");
-        goto DBU0;
-    }
-
+    if (dbIsBinary(fd)) {
+        if (dbMapBinary(db, fd, filename))
+            goto DBU0;
+        close(fd);
+        fd = -1;
+    } else {
+        gzFile gzfp = gzdopen(fd, "r");
+        if (!gzfp) {
+            fprintf(stderr, "db update error: gzdopen failed.\n");
+            goto DBU0;
+        }
+        fd = -1; // closed by gzclose
 
-    cb = readWholeGz(gzfp, filename);
-    if (!cb.buffer) {
-        fprintf(stderr, "readWholeGz failed.\n");
-        gzclose(gzfp);
-        goto DBU0;
-    }
-    if (cb.len < 1000) {
-        fprintf(stderr, "database file very small, bailing out of dbUpdate.\n");
+        cb = readWholeGz(gzfp, filename);
         gzclose(gzfp);
-        goto DBU0;
-    }
+        if (!cb.buffer) {
+            fprintf(stderr, "readWholeGz failed.\n");
+            goto DBU0;
+        }
+        if (cb.len < 1000) {
+            fprintf(stderr, "database file very small, bailing out of dbUpdate.\n");
+            goto DBU0;
+        }
 
-    char *eob = cb.buffer + cb.len;
-    char *sol = cb.buffer;
-    char *eol;
-    for (int i = 0; eob > sol && (eol = memchr(sol, '\n', eob - sol)); sol = eol + 1) {
+        if (dbParseCsv(db, cb.buffer, cb.len))
+            goto DBU0;
 
-        char *sot;
-        char *eot = sol - 1; // this pointer must not be dereferenced, nextToken will increment it.
+        free(cb.buffer);
+    }
 
-        dbEntry *curr = &Modes.db2[i];
-        memset(curr, 0, sizeof(dbEntry));
+    Modes.dbModificationTime = modTime;
 
-        if (!nextToken(';', &sot, &eot, &eol)) continue;
-        curr->addr = strtol(sot, NULL, 16);
-        if (curr->addr == 0)
-            continue;
+    if (Modes.debug_dbJson)
+        dbToJson(db);
 
-        if (!nextToken(';', &sot, &eot, &eol)) continue;
-        memcpy(curr->registration, sot, min(sizeof(curr->registration), eot - sot));
-        sanitize(curr->registration, sizeof(curr->registration));
-
-        if (!nextToken(';', &sot, &eot, &eol)) continue;
-        memcpy(curr->typeCode, sot, min(sizeof(curr->typeCode), eot - sot));
-        sanitize(curr->typeCode, sizeof(curr->typeCode));
-
-        if (!nextToken(';', &sot, &eot, &eol)) continue;
-        for (int j = 0; j < 16 && sot < eot; j++, sot++)
-            curr->dbFlags |= ((*sot == '1') << j);
-
-
-        // nextToken wouldn't work as there is no trailing ;, set sot / eot by hand
-        sot = eot + 1;
-        eot = eol;
-        memcpy(curr->typeLong, sot, min(sizeof(curr->typeLong), eot - sot));
-        sanitize(curr->typeLong, sizeof(curr->typeLong));
-
-        if (false) // debugging output
-            fprintf(stdout, "%06X;%.12s;%.4s;%c%c;%.54s\n",
-                    curr->addr,
-                    curr->registration,
-                    curr->typeCode,
-                    curr->dbFlags & 1 ? '1' : '0',
-                    curr->dbFlags & 2 ? '1' : '0',
-                    curr->typeLong);
-
-        i++; // increment db array index
-        // add to hashtable
-        dbPut(curr->addr, Modes.db2Index, curr);
-    }
-    //fflush(stdout);
+    // hand over the new db, replacing a previous one that wasn't picked up yet
+    pthread_mutex_lock(&Modes.dbUpdateMutex);
+    dbFree(Modes.db2);
+    Modes.db2 = db;
+    pthread_mutex_unlock(&Modes.dbUpdateMutex);
 
-    gzclose(gzfp);
-    free(cb.buffer);
-    Modes.dbModificationTime = modTime;
     fprintf(stderr, "db update done!\n");
     writeJsonToFile(Modes.json_dir, "receiver.json", generateReceiverJson());
     return 1;
 DBU0:
     free(cb.buffer);
-    free(Modes.db2);
-    free(Modes.db2Index);
-    Modes.db2 = NULL;
-    Modes.db2Index = NULL;
-    close(fd);
+    dbFree(db);
+    if (fd != -1)
+        close(fd);
     return 0;
 }
 
+// Swap in a new db if the db thread has one ready.
+// Must be called with the decode thread locked, aircraft pick up the new
+// registration / type data lazily via Modes.dbGeneration.
 void dbFinishUpdate() {
-    // finish db update
-    if (Modes.db2 && Modes.db2Index) {
-        if (Modes.debug_dbJson)
-            dbToJson();
-        free(Modes.dbIndex);
-        free(Modes.db);
-        Modes.dbIndex = Modes.db2Index;
+    // don't wait for the db thread, check again next time
+    if (pthread_mutex_trylock(&Modes.dbUpdateMutex))
+        return;
+
+    if (Modes.db2) {
+        dbFree(Modes.db);
         Modes.db = Modes.db2;
-        Modes.db2Index = NULL;
         Modes.db2 = NULL;
-
-        for (int j = 0; j < AIRCRAFT_BUCKETS; j++) {
-            for (struct aircraft *a = Modes.aircraft[j]; a; a = a->next) {
-                updateTypeReg(a);
-            }
-        }
+        Modes.dbGeneration++;
     }
+
+    pthread_mutex_unlock(&Modes.dbUpdateMutex);
 }
 
+void *dbThreadEntryPoint(void *arg) {
+    MODES_NOTUSED(arg);
 
-dbEntry *dbGet(uint32_t addr, dbEntry **index) {
-    if (!index)
-        return NULL;
-    dbEntry *d = index[dbHash(addr)];
+    pthread_mutex_lock(&Modes.dbThreadMutex);
 
-    while (d && d->addr != addr) {
-        d = d->next;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    while (!Modes.exit) {
+        // db update check every 5 min
+        incTimedwait(&ts, 5 * MINUTES);
+
+        int res = 0;
+        while (!Modes.exit && res == 0) {
+            res = pthread_cond_timedwait(&Modes.dbThreadCond, &Modes.dbThreadMutex, &ts);
+        }
+        if (Modes.exit)
+            break;
+
+        dbUpdate();
     }
-    return d;
-}
 
-void dbPut(uint32_t addr, dbEntry **index, dbEntry *d) {
-    uint32_t hash = dbHash(addr);
-    d->next = index[hash];
-    index[hash] = d;
+    pthread_mutex_unlock(&Modes.dbThreadMutex);
+
+    return NULL;
 }
 
+
 void updateTypeReg(struct aircraft *a) {
-    dbEntry *d = dbGet(a->addr, Modes.dbIndex);
-    if (d) {
+    a->dbGeneration = Modes.dbGeneration;
+    dbEntry entry;
+    dbEntry *d = &entry;
+    if (dbLookup(Modes.db, a->addr, d)) {
         memcpy(a->registration, d->registration, sizeof(a->registration));
         memcpy(a->typeCode, d->typeCode, sizeof(a->typeCode));
         memcpy(a->typeLong, d->typeLong, sizeof(a->typeLong));
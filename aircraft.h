@@ -7,19 +7,6 @@ uint32_t aircraftHash(uint32_t addr);
 struct aircraft *aircraftGet(uint32_t addr);
 struct aircraft *aircraftCreate(struct modesMessage *mm);
 
-typedef struct dbEntry {
-    struct dbEntry *next;
-    uint32_t addr;
-    char typeCode[4];
-    char registration[12];
-    char typeLong[63];
-    uint8_t dbFlags;
-} dbEntry;
-
-uint32_t dbHash(uint32_t addr);
-dbEntry *dbGet(uint32_t addr, dbEntry **index);
-void dbPut(uint32_t addr, dbEntry **index, dbEntry *d);
-
 void apiClear();
 void apiAdd(struct aircraft *a, uint64_t now);
 void apiSort();
@@ -163,6 +150,7 @@ struct binCraft {
 void toBinCraft(struct aircraft *a, struct binCraft *new, uint64_t now);
 int dbUpdate();
 void dbFinishUpdate();
+void *dbThreadEntryPoint(void *arg);
 
 void updateTypeReg(struct aircraft *a);
 
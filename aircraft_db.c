@@ -0,0 +1,444 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// aircraft_db.c: aircraft registration / type database (csv and binary format)
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <sys/mman.h>
+
+#include "readsb.h"
+
+uint32_t dbHash(uint32_t addr) {
+    uint64_t h = 0x30732349f7810465ULL ^ (4 * 0x2127599bf4325c37ULL);
+    uint64_t in = addr;
+    uint64_t v = in << 48;
+    v ^= in << 24;
+    v ^= in;
+    h ^= mix_fasthash(v);
+
+    h -= (h >> 32);
+    h &= (1ULL << 32) - 1;
+    h -= (h >> DB_HASH_BITS);
+
+    return h & (DB_BUCKETS - 1);
+}
+
+dbEntry *dbGet(uint32_t addr, dbEntry **index) {
+    if (!index)
+        return NULL;
+    dbEntry *d = index[dbHash(addr)];
+
+    while (d && d->addr != addr) {
+        d = d->next;
+    }
+    return d;
+}
+
+void dbPut(uint32_t addr, dbEntry **index, dbEntry *d) {
+    uint32_t hash = dbHash(addr);
+    d->next = index[hash];
+    index[hash] = d;
+}
+
+
+// rudimentary sanitization so the json output hopefully won't be invalid
+static inline void sanitize(char *str, unsigned len) {
+    char b2 = (1<<7) + (1<<6); // 2 byte code or more
+    char b3 = (1<<7) + (1<<6) + (1<<5); // 3 byte code or more
+    char b4 = (1<<7) + (1<<6) + (1<<5) + (1<<4); // 4 byte code
+
+    if (len >= 3 && (str[len - 3] & b4) == b4) {
+        //fprintf(stderr, "%c\n", str[len - 3]);
+        str[len - 3] = '\0';
+    }
+    if (len >= 2 && (str[len - 2] & b3) == b3) {
+        //fprintf(stderr, "%c\n", str[len - 2]);
+        str[len - 2] = '\0';
+    }
+    if (len >= 1 && (str[len - 1] & b2) == b2) {
+        //fprintf(stderr, "%c\n", str[len - 1]);
+        str[len - 1] = '\0';
+    }
+    char *p = str;
+    while(p < str + len && *p) {
+        if (*p == '"')
+            *p = '\'';
+        if (*p > 0 && *p < 0x1f)
+            *p = ' ';
+        p++;
+    }
+    if (p - 1 >= str && *(p - 1) == '\\') {
+        *(p - 1) = '\0';
+    }
+}
+
+// get next CSV token based on the assumption eot points to the previous delimiter
+static inline int nextToken(char delim, char **sot, char **eot, char **eol) {
+    *sot = *eot + 1;
+    if (*sot >= *eol)
+        return 0;
+    *eot = memchr(*sot, delim, *eol - *sot);
+
+    if (!*eot)
+        return 0;
+
+    **eot = '\0';
+    return 1;
+}
+
+
+// parse aircraft.csv (addr;registration;typeCode;dbFlags;typeLong) into a hash table
+int dbParseCsv(struct aircraftDb *db, char *buf, size_t len) {
+    char *eob = buf + len;
+    char *sol;
+    char *eol;
+
+    // count lines so the entries can be allocated in one go
+    int lines = 0;
+    for (sol = buf; eob > sol && (eol = memchr(sol, '\n', eob - sol)); sol = eol + 1)
+        lines++;
+
+    db->entries = malloc(max(lines, 1) * sizeof(dbEntry));
+    db->index = calloc(DB_BUCKETS, sizeof(void*));
+
+    if (!db->entries || !db->index) {
+        fprintf(stderr, "db update error: malloc failure!\n");
+        return -1;
+    }
+
+    int i = 0;
+    for (sol = buf; eob > sol && (eol = memchr(sol, '\n', eob - sol)); sol = eol + 1) {
+
+        char *sot;
+        char *eot = sol - 1; // this pointer must not be dereferenced, nextToken will increment it.
+
+        dbEntry *curr = &db->entries[i];
+        memset(curr, 0, sizeof(dbEntry));
+
+        if (!nextToken(';', &sot, &eot, &eol)) continue;
+        curr->addr = strtol(sot, NULL, 16);
+        if (curr->addr == 0)
+            continue;
+
+        if (!nextToken(';', &sot, &eot, &eol)) continue;
+        memcpy(curr->registration, sot, min(sizeof(curr->registration), eot - sot));
+        sanitize(curr->registration, sizeof(curr->registration));
+
+        if (!nextToken(';', &sot, &eot, &eol)) continue;
+        memcpy(curr->typeCode, sot, min(sizeof(curr->typeCode), eot - sot));
+        sanitize(curr->typeCode, sizeof(curr->typeCode));
+
+        if (!nextToken(';', &sot, &eot, &eol)) continue;
+        for (int j = 0; j < 16 && sot < eot; j++, sot++)
+            curr->dbFlags |= ((*sot == '1') << j);
+
+
+        // nextToken wouldn't work as there is no trailing ;, set sot / eot by hand
+        sot = eot + 1;
+        eot = eol;
+        memcpy(curr->typeLong, sot, min(sizeof(curr->typeLong), eot - sot));
+        sanitize(curr->typeLong, sizeof(curr->typeLong));
+
+        if (false) // debugging output
+            fprintf(stdout, "%06X;%.12s;%.4s;%c%c;%.54s\n",
+                    curr->addr,
+                    curr->registration,
+                    curr->typeCode,
+                    curr->dbFlags & 1 ? '1' : '0',
+                    curr->dbFlags & 2 ? '1' : '0',
+                    curr->typeLong);
+
+        i++; // increment db array index
+        // add to hashtable
+        dbPut(curr->addr, db->index, curr);
+    }
+    db->count = i;
+
+    return 0;
+}
+
+int dbIsBinary(int fd) {
+    char magic[8];
+    // pread doesn't move the file offset, the csv reader can use fd afterwards
+    if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic))
+        return 0;
+    return !memcmp(magic, DB_BIN_MAGIC, sizeof(magic));
+}
+
+int dbMapBinary(struct aircraftDb *db, int fd, const char *filename) {
+    struct stat fileinfo = {0};
+    if (fstat(fd, &fileinfo)) {
+        perror(filename);
+        return -1;
+    }
+    uint64_t size = fileinfo.st_size;
+    if (size < sizeof(struct dbBinHeader)) {
+        fprintf(stderr, "%s: binary db too small\n", filename);
+        return -1;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror(filename);
+        return -1;
+    }
+
+    const struct dbBinHeader *h = map;
+    uint64_t count = h->count;
+    if (memcmp(h->magic, DB_BIN_MAGIC, sizeof(h->magic))
+            || h->version != DB_BIN_VERSION
+            || h->fileSize != size
+            || h->addrOffset % sizeof(uint32_t) || h->recordOffset % sizeof(uint32_t)
+            || h->addrOffset + count * sizeof(uint32_t) > size
+            || h->recordOffset + count * sizeof(struct dbBinRecord) > size
+            || (uint64_t) h->poolOffset + h->poolSize > size
+            || h->poolSize == 0
+            || ((const char *) map)[h->poolOffset + h->poolSize - 1] != '\0') {
+        fprintf(stderr, "%s: invalid binary db (version %u, expected %u)\n",
+                filename, h->version, DB_BIN_VERSION);
+        munmap(map, size);
+        return -1;
+    }
+
+    db->map = map;
+    db->mapSize = size;
+    db->count = count;
+    db->addrs = (const uint32_t *) ((const char *) map + h->addrOffset);
+    db->records = (const struct dbBinRecord *) ((const char *) map + h->recordOffset);
+    db->pool = (const char *) map + h->poolOffset;
+    db->poolSize = h->poolSize;
+
+    return 0;
+}
+
+// interpolation search on the sorted addresses
+// icao addresses are spread fairly evenly within the country blocks, a few
+// interpolation steps get close, binary search takes over to bound the worst case
+static int dbBinFind(const uint32_t *addrs, int count, uint32_t addr) {
+    int lo = 0;
+    int hi = count - 1;
+
+    for (int step = 0; step < 4 && lo <= hi; step++) {
+        uint32_t first = addrs[lo];
+        uint32_t last = addrs[hi];
+        if (addr < first || addr > last)
+            return -1;
+        if (first == last)
+            return (first == addr) ? lo : -1;
+        int mid = lo + (int) ((uint64_t) (addr - first) * (hi - lo) / (last - first));
+        if (addrs[mid] == addr)
+            return mid;
+        if (addrs[mid] < addr)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (addrs[mid] == addr)
+            return mid;
+        if (addrs[mid] < addr)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+static void dbBinEntry(struct aircraftDb *db, int i, dbEntry *out) {
+    const struct dbBinRecord *r = &db->records[i];
+    memset(out, 0, sizeof(dbEntry));
+    out->addr = db->addrs[i];
+    memcpy(out->registration, r->registration, sizeof(out->registration));
+    memcpy(out->typeCode, r->typeCode, sizeof(out->typeCode));
+    if (r->typeLong < db->poolSize) {
+        const char *typeLong = db->pool + r->typeLong;
+        memcpy(out->typeLong, typeLong, strnlen(typeLong, sizeof(out->typeLong)));
+    }
+    out->dbFlags = r->dbFlags;
+}
+
+int dbLookup(struct aircraftDb *db, uint32_t addr, dbEntry *out) {
+    if (!db)
+        return 0;
+
+    if (db->index) {
+        dbEntry *d = dbGet(addr, db->index);
+        if (!d)
+            return 0;
+        *out = *d;
+        return 1;
+    }
+
+    int i = dbBinFind(db->addrs, db->count, addr);
+    if (i < 0)
+        return 0;
+    dbBinEntry(db, i, out);
+    return 1;
+}
+
+void dbEntryAt(struct aircraftDb *db, int i, dbEntry *out) {
+    if (db->entries)
+        *out = db->entries[i];
+    else
+        dbBinEntry(db, i, out);
+}
+
+void dbFree(struct aircraftDb *db) {
+    if (!db)
+        return;
+    if (db->map)
+        munmap(db->map, db->mapSize);
+    free(db->entries);
+    free(db->index);
+    free(db);
+}
+
+static int dbCompareIndex(const void *p1, const void *p2, void *arg) {
+    const dbEntry *entries = arg;
+    int i1 = *(const int *) p1;
+    int i2 = *(const int *) p2;
+    uint32_t a1 = entries[i1].addr;
+    uint32_t a2 = entries[i2].addr;
+    if (a1 != a2)
+        return (a1 > a2) - (a1 < a2);
+    return (i1 > i2) - (i1 < i2);
+}
+
+static uint32_t stringHash(const char *str, size_t len) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (uint8_t) str[i]) * 16777619u;
+    return h;
+}
+
+// write a csv db in the binary format
+// the file is written to filename.tmp and renamed, a running readsb keeps
+// its mapping of the old file intact
+int dbWriteBinary(struct aircraftDb *db, const char *filename) {
+    int n = db->count;
+    int *order = malloc(max(n, 1) * sizeof(int));
+    uint32_t *addrs = malloc(max(n, 1) * sizeof(uint32_t));
+    struct dbBinRecord *records = calloc(max(n, 1), sizeof(struct dbBinRecord));
+    // type descriptions repeat a lot, intern them with an open addressing hash table
+    uint32_t tableSize = 1;
+    while (tableSize < 2 * (uint32_t) n)
+        tableSize *= 2;
+    uint32_t *table = calloc(tableSize, sizeof(uint32_t));
+    size_t poolAlloc = 64 * 1024;
+    size_t poolSize = 1; // offset 0 is the empty string
+    char *pool = calloc(1, poolAlloc);
+    FILE *out = NULL;
+    int res = -1;
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+
+    if (!order || !addrs || !records || !table || !pool) {
+        fprintf(stderr, "dbWriteBinary: malloc failure!\n");
+        goto out;
+    }
+
+    for (int i = 0; i < n; i++)
+        order[i] = i;
+    // sort by address, the csv index position breaks ties
+    qsort_r(order, n, sizeof(int), dbCompareIndex, db->entries);
+
+    int count = 0;
+    for (int k = 0; k < n; k++) {
+        dbEntry *d = &db->entries[order[k]];
+        // duplicate addresses: the hash table returns the last csv line, do the same
+        if (k + 1 < n && db->entries[order[k + 1]].addr == d->addr)
+            continue;
+
+        struct dbBinRecord *r = &records[count];
+        addrs[count] = d->addr;
+        memcpy(r->registration, d->registration, sizeof(r->registration));
+        memcpy(r->typeCode, d->typeCode, sizeof(r->typeCode));
+        r->dbFlags = d->dbFlags;
+
+        size_t len = strnlen(d->typeLong, sizeof(d->typeLong));
+        if (len) {
+            uint32_t slot = stringHash(d->typeLong, len) & (tableSize - 1);
+            while (table[slot] && (strlen(pool + table[slot]) != len || memcmp(pool + table[slot], d->typeLong, len)))
+                slot = (slot + 1) & (tableSize - 1);
+            if (!table[slot]) {
+                if (poolSize + len + 1 > poolAlloc) {
+                    poolAlloc *= 2;
+                    char *p = realloc(pool, poolAlloc);
+                    if (!p) {
+                        fprintf(stderr, "dbWriteBinary: malloc failure!\n");
+                        goto out;
+                    }
+                    pool = p;
+                }
+                table[slot] = poolSize;
+                memcpy(pool + poolSize, d->typeLong, len);
+                pool[poolSize + len] = '\0';
+                poolSize += len + 1;
+            }
+            r->typeLong = table[slot];
+        }
+        count++;
+    }
+
+    struct dbBinHeader h = {0};
+    memcpy(h.magic, DB_BIN_MAGIC, sizeof(h.magic));
+    h.version = DB_BIN_VERSION;
+    h.count = count;
+    h.addrOffset = sizeof(h);
+    h.recordOffset = h.addrOffset + count * sizeof(uint32_t);
+    h.poolOffset = h.recordOffset + count * sizeof(struct dbBinRecord);
+    h.poolSize = poolSize;
+    h.fileSize = h.poolOffset + poolSize;
+
+    out = fopen(tmp, "w");
+    if (!out) {
+        perror(tmp);
+        goto out;
+    }
+    if (fwrite(&h, sizeof(h), 1, out) != 1
+            || fwrite(addrs, sizeof(uint32_t), count, out) != (size_t) count
+            || fwrite(records, sizeof(struct dbBinRecord), count, out) != (size_t) count
+            || fwrite(pool, 1, poolSize, out) != poolSize) {
+        perror(tmp);
+        goto out;
+    }
+    int err = fclose(out);
+    out = NULL;
+    if (err) {
+        perror(tmp);
+        goto out;
+    }
+    if (rename(tmp, filename)) {
+        perror(filename);
+        goto out;
+    }
+
+    fprintf(stderr, "%s: %d aircraft, %zu bytes of type descriptions, %"PRIu64" bytes total\n",
+            filename, count, poolSize, h.fileSize);
+    res = 0;
+out:
+    if (out)
+        fclose(out);
+    if (res)
+        unlink(tmp);
+    free(order);
+    free(addrs);
+    free(records);
+    free(table);
+    free(pool);
+    return res;
+}
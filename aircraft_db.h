@@ -0,0 +1,73 @@
+#ifndef AIRCRAFT_DB_H
+#define AIRCRAFT_DB_H
+
+typedef struct dbEntry {
+    struct dbEntry *next;
+    uint32_t addr;
+    char typeCode[4];
+    char registration[12];
+    char typeLong[63];
+    uint8_t dbFlags;
+} dbEntry;
+
+// binary db file as written by oneoff/dbconvert, mapped read only by readsb
+// values are in host byte order, the magic and version must match
+//
+// header | uint32_t addr[count] (sorted) | struct dbBinRecord[count] | string pool
+//
+// addr[i] belongs to record[i], typeLong is an offset into the pool
+// of deduplicated NUL terminated strings.
+#define DB_BIN_MAGIC "readsbdb"
+#define DB_BIN_VERSION 1
+
+struct dbBinHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint32_t addrOffset;
+    uint32_t recordOffset;
+    uint32_t poolOffset;
+    uint32_t poolSize;
+    uint64_t fileSize;
+};
+
+struct dbBinRecord {
+    char registration[12];
+    char typeCode[4];
+    uint32_t typeLong;
+    uint8_t dbFlags;
+    uint8_t reserved[3];
+};
+
+// a loaded db, either parsed from csv into a hash table (entries / index)
+// or a mapping of the binary format (map / addrs / records / pool)
+struct aircraftDb {
+    int count;
+
+    dbEntry *entries;
+    dbEntry **index;
+
+    void *map;
+    size_t mapSize;
+    const uint32_t *addrs;
+    const struct dbBinRecord *records;
+    const char *pool;
+    uint32_t poolSize;
+};
+
+uint32_t dbHash(uint32_t addr);
+dbEntry *dbGet(uint32_t addr, dbEntry **index);
+void dbPut(uint32_t addr, dbEntry **index, dbEntry *d);
+
+int dbIsBinary(int fd);
+int dbParseCsv(struct aircraftDb *db, char *buf, size_t len);
+int dbMapBinary(struct aircraftDb *db, int fd, const char *filename);
+int dbWriteBinary(struct aircraftDb *db, const char *filename);
+void dbFree(struct aircraftDb *db);
+
+// copy the entry for addr to out, returns 0 if addr is not in the db
+int dbLookup(struct aircraftDb *db, uint32_t addr, dbEntry *out);
+// copy entry number i (0 .. count - 1) to out
+void dbEntryAt(struct aircraftDb *db, int i, dbEntry *out);
+
+#endif
@@ -0,0 +1,180 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// arena.c: reusable per-thread output buffers
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+struct arenaSlot {
+    char *buf;
+    size_t alloc;
+    size_t high; // largest size asked of the slot since the last trim
+    int8_t used;
+};
+
+struct arena {
+    struct arenaSlot slots[ARENA_SLOTS];
+    uint64_t next_trim;
+};
+
+static pthread_key_t arenaKey;
+static pthread_once_t arenaOnce = PTHREAD_ONCE_INIT;
+
+// thread exit
+static void arenaDestroy(void *arg) {
+    struct arena *arena = arg;
+    for (int k = 0; k < ARENA_SLOTS; k++)
+        free(arena->slots[k].buf);
+    free(arena);
+}
+
+static void arenaKeyCreate() {
+    if (pthread_key_create(&arenaKey, arenaDestroy))
+        fprintf(stderr, "arena: pthread_key_create failed, using malloc\n");
+}
+
+// create: make one for this thread if there is none yet
+static struct arena *getArena(int create) {
+    pthread_once(&arenaOnce, arenaKeyCreate);
+    struct arena *arena = pthread_getspecific(arenaKey);
+    if (!arena && create) {
+        arena = calloc(1, sizeof(struct arena));
+        if (arena && pthread_setspecific(arenaKey, arena)) {
+            free(arena);
+            arena = NULL;
+        }
+    }
+    return arena;
+}
+
+static struct arenaSlot *findSlot(struct arena *arena, const void *p) {
+    if (!arena || !p)
+        return NULL;
+    for (int k = 0; k < ARENA_SLOTS; k++) {
+        struct arenaSlot *s = &arena->slots[k];
+        if (s->used && s->buf == p)
+            return s;
+    }
+    return NULL;
+}
+
+static uint64_t arenaClock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// shrink the free slots to what they were used for since the last trim
+static void arenaTrim(struct arena *arena) {
+    uint64_t now = arenaClock();
+    if (now < arena->next_trim)
+        return;
+    arena->next_trim = now + ARENA_TRIM_INTERVAL;
+
+    for (int k = 0; k < ARENA_SLOTS; k++) {
+        struct arenaSlot *s = &arena->slots[k];
+        if (s->used)
+            continue;
+        if (!s->high) {
+            free(s->buf);
+            s->buf = NULL;
+            s->alloc = 0;
+        } else if (s->alloc > s->high + s->high / 4) {
+            char *buf = realloc(s->buf, s->high);
+            if (buf) {
+                s->buf = buf;
+                s->alloc = s->high;
+            }
+        }
+        s->high = 0;
+    }
+}
+
+void *arenaMalloc(size_t len) {
+    if (!len)
+        len = 1;
+    struct arena *arena = getArena(1);
+    if (!arena)
+        return malloc(len);
+
+    arenaTrim(arena);
+
+    // the smallest free slot that fits, otherwise the largest free one grows
+    struct arenaSlot *best = NULL;
+    for (int k = 0; k < ARENA_SLOTS; k++) {
+        struct arenaSlot *s = &arena->slots[k];
+        if (s->used)
+            continue;
+        if (!best
+                || (s->alloc >= len && (best->alloc < len || s->alloc < best->alloc))
+                || (best->alloc < len && s->alloc > best->alloc)) {
+            best = s;
+        }
+    }
+    if (!best)
+        return malloc(len);
+
+    if (best->alloc < len) {
+        // nothing to keep, no need for realloc to copy the old content
+        free(best->buf);
+        best->buf = malloc(len);
+        best->alloc = best->buf ? len : 0;
+        if (!best->buf)
+            return NULL;
+    }
+    best->used = 1;
+    if (len > best->high)
+        best->high = len;
+    return best->buf;
+}
+
+void *arenaRealloc(void *p, size_t len) {
+    if (!p)
+        return arenaMalloc(len);
+    struct arenaSlot *s = findSlot(getArena(0), p);
+    if (!s)
+        return realloc(p, len);
+
+    if (len > s->alloc) {
+        char *buf = realloc(s->buf, len);
+        if (!buf)
+            return NULL;
+        s->buf = buf;
+        s->alloc = len;
+    }
+    if (len > s->high)
+        s->high = len;
+    return s->buf;
+}
+
+void arenaFree(void *p) {
+    struct arenaSlot *s = findSlot(getArena(0), p);
+    if (s)
+        s->used = 0;
+    else
+        free(p);
+}
+
+void *arenaDetach(void *p, size_t len) {
+    struct arenaSlot *s = findSlot(getArena(0), p);
+    if (!s)
+        return p;
+    // a copy of the size needed, the slot keeps its buffer for the next use
+    char *copy = malloc(len ? len : 1);
+    if (copy)
+        memcpy(copy, p, len);
+    s->used = 0;
+    return copy;
+}
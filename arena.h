@@ -0,0 +1,42 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// arena.h: reusable per-thread output buffers
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+// The generate* functions and the state writer build their output in
+// buffers that only live until the file is written.  Instead of a malloc /
+// free of several MB each time, every thread keeps ARENA_SLOTS buffers that
+// are handed out again and again.  A slot never shrinks while in use, the
+// free ones are trimmed to the largest size asked of them every
+// ARENA_TRIM_INTERVAL (freed if they weren't used at all).
+//
+// Same calling convention as malloc / realloc / free.  arenaRealloc() and
+// arenaFree() take any malloc()ed pointer as well, a buffer of the arena
+// must not be passed to free() or to another thread: arenaDetach() takes it
+// out of the arena for code that keeps it (HTTP server).
+
+#define ARENA_SLOTS 8 // buffers per thread, beyond that it's plain malloc
+#define ARENA_TRIM_INTERVAL (60 * SECONDS)
+
+void *arenaMalloc(size_t len);
+void *arenaRealloc(void *p, size_t len);
+void arenaFree(void *p);
+// p as a plain malloc()ed buffer, shrunk to len, p is invalid afterwards
+void *arenaDetach(void *p, size_t len);
+
+#endif
@@ -0,0 +1,116 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// geodesy.c - distance and bearing calculations
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <math.h>
+
+#include "geodesy.h"
+
+#define DEG2RAD (M_PI / 180.0)
+
+// Distance between points on a spherical earth.
+// This has up to 0.5% error because the earth isn't actually spherical
+// (but we don't use it in situations where that matters)
+
+double greatcircle(double lat0, double lon0, double lat1, double lon1) {
+    double dlat, dlon;
+
+    lat0 = lat0 * M_PI / 180.0;
+    lon0 = lon0 * M_PI / 180.0;
+    lat1 = lat1 * M_PI / 180.0;
+    lon1 = lon1 * M_PI / 180.0;
+
+    dlat = fabs(lat1 - lat0);
+    dlon = fabs(lon1 - lon0);
+
+    // use haversine for small distances for better numerical stability
+    if (dlat < 0.001 && dlon < 0.001) {
+        double a = sin(dlat / 2) * sin(dlat / 2) + cos(lat0) * cos(lat1) * sin(dlon / 2) * sin(dlon / 2);
+        return GEO_EARTH_RADIUS * 2 * atan2(sqrt(a), sqrt(1.0 - a));
+    }
+
+    // spherical law of cosines
+    return GEO_EARTH_RADIUS * acos(sin(lat0) * sin(lat1) + cos(lat0) * cos(lat1) * cos(dlon));
+}
+
+float bearing(double lat0, double lon0, double lat1, double lon1) {
+    lat0 = lat0 * M_PI / 180.0;
+    lon0 = lon0 * M_PI / 180.0;
+    lat1 = lat1 * M_PI / 180.0;
+    lon1 = lon1 * M_PI / 180.0;
+
+    double y = sin(lon1-lon0)*cos(lat1);
+    double x = cos(lat0)*sin(lat1) - sin(lat0)*cos(lat1)*cos(lon1-lon0);
+    double res = (atan2(y, x) * 180 / M_PI + 360);
+    while (res > 360)
+        res -= 360;
+    return (float) res;
+}
+
+// longitude difference wrapped to -180 .. 180
+static inline double lon_diff(double lon0, double lon1) {
+    double dlon = lon1 - lon0;
+    if (dlon > 180)
+        dlon -= 360;
+    else if (dlon < -180)
+        dlon += 360;
+    return dlon;
+}
+
+static inline int fast_region(double lat0, double lat1, double dlat, double dlon) {
+    return (fabs(dlat) <= GEO_FAST_MAX_DELTA && fabs(dlon) <= GEO_FAST_MAX_DELTA
+            && fabs(lat0) <= GEO_FAST_MAX_LAT && fabs(lat1) <= GEO_FAST_MAX_LAT);
+}
+
+// equirectangular projection around the mean latitude
+static inline double equirect(double lat0, double lat1, double dlat, double dlon) {
+    double x = dlon * cos((lat0 + lat1) * (DEG2RAD / 2));
+    return GEO_EARTH_RADIUS * DEG2RAD * sqrt(dlat * dlat + x * x);
+}
+
+double greatcircle_fast(double lat0, double lon0, double lat1, double lon1) {
+    double dlat = lat1 - lat0;
+    double dlon = lon_diff(lon0, lon1);
+
+    if (!fast_region(lat0, lat1, dlat, dlon))
+        return greatcircle(lat0, lon0, lat1, lon1);
+
+    return equirect(lat0, lat1, dlat, dlon);
+}
+
+static inline int exact_cmp(double lat0, double lon0, double lat1, double lon1, double limit) {
+    double distance = greatcircle(lat0, lon0, lat1, lon1);
+    return (distance > limit) - (distance < limit);
+}
+
+int greatcircle_cmp(double lat0, double lon0, double lat1, double lon1, double limit) {
+    double dlat = lat1 - lat0;
+    double dlon = lon_diff(lon0, lon1);
+
+    if (!fast_region(lat0, lat1, dlat, dlon))
+        return exact_cmp(lat0, lon0, lat1, lon1, limit);
+
+    double distance = equirect(lat0, lat1, dlat, dlon);
+    double error = distance * GEO_FAST_REL_ERROR + GEO_FAST_ABS_ERROR;
+
+    if (distance + error < limit)
+        return -1;
+    if (distance - error > limit)
+        return 1;
+
+    // too close to call
+    return exact_cmp(lat0, lon0, lat1, lon1, limit);
+}
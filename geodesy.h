@@ -0,0 +1,52 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// geodesy.h - distance and bearing calculations
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef GEODESY_H
+#define GEODESY_H
+
+// mean earth radius in meters, same sphere for exact and fast functions
+#define GEO_EARTH_RADIUS 6371e3
+
+// the fast equirectangular approximation is only used when both points are
+// within GEO_FAST_MAX_DELTA degrees of each other in lat and lon
+// and neither point is closer to a pole than GEO_FAST_MAX_LAT
+#define GEO_FAST_MAX_DELTA 1.0
+#define GEO_FAST_MAX_LAT 80.0
+
+// guaranteed error bound of greatcircle_fast() compared to greatcircle():
+// |fast - exact| <= GEO_FAST_REL_ERROR * fast + GEO_FAST_ABS_ERROR
+// (measured worst case in the fast region is below 5e-5 relative, see geodesytests.c)
+#define GEO_FAST_REL_ERROR 5e-4
+#define GEO_FAST_ABS_ERROR 1e-3
+
+// calculate great circle distance in meters
+double greatcircle(double lat0, double lon0, double lat1, double lon1);
+
+// bearing from point 0 to point 1 in degrees (0 to 360)
+float bearing(double lat0, double lon0, double lat1, double lon1);
+
+// great circle distance in meters, equirectangular approximation for nearby
+// points, falls back to greatcircle() outside the fast region
+double greatcircle_fast(double lat0, double lon0, double lat1, double lon1);
+
+// compare the great circle distance against limit (meters)
+// returns -1 if the distance is smaller, 1 if it's larger, 0 if equal
+// the result is identical to comparing greatcircle() against limit,
+// the exact formula is only evaluated when the approximation is too close to call
+int greatcircle_cmp(double lat0, double lon0, double lat1, double lon1, double limit);
+
+#endif
@@ -0,0 +1,163 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// geodesytests.c - accuracy tests and benchmark for the geodesy functions
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "geodesy.h"
+
+#define SAMPLES (1000 * 1000)
+
+// deterministic pseudo random numbers so failures are reproducible
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+static double rnd(double min, double max) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    uint64_t r = rng_state * 0x2545F4914F6CDD1DULL;
+    return min + (max - min) * ((r >> 11) * (1.0 / 9007199254740992.0));
+}
+
+static double elapsed(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static double *lat0, *lon0, *lat1, *lon1;
+
+// pairs of points mostly within the fast region, some outside of it
+static void fill_samples(double maxDelta) {
+    for (int i = 0; i < SAMPLES; i++) {
+        lat0[i] = rnd(-85, 85);
+        lon0[i] = rnd(-180, 180);
+        lat1[i] = fmin(90, fmax(-90, lat0[i] + rnd(-maxDelta, maxDelta)));
+        lon1[i] = lon0[i] + rnd(-maxDelta, maxDelta);
+        if (lon1[i] > 180)
+            lon1[i] -= 360;
+        if (lon1[i] < -180)
+            lon1[i] += 360;
+    }
+}
+
+static int testFastAccuracy() {
+    int ok = 1;
+    double worst = 0;
+    fill_samples(GEO_FAST_MAX_DELTA * 1.2);
+    for (int i = 0; i < SAMPLES; i++) {
+        double exact = greatcircle(lat0[i], lon0[i], lat1[i], lon1[i]);
+        double fast = greatcircle_fast(lat0[i], lon0[i], lat1[i], lon1[i]);
+        double error = fabs(fast - exact);
+        if (exact > 1000)
+            worst = fmax(worst, error / exact);
+        if (error > fast * GEO_FAST_REL_ERROR + GEO_FAST_ABS_ERROR) {
+            if (ok)
+                fprintf(stderr, "testFastAccuracy: FAIL: %.6f,%.6f -> %.6f,%.6f exact %.3f fast %.3f\n",
+                        lat0[i], lon0[i], lat1[i], lon1[i], exact, fast);
+            ok = 0;
+        }
+    }
+    fprintf(stderr, "testFastAccuracy:   %s (worst relative error %.2e, bound %.2e)\n",
+            ok ? "PASS" : "FAIL", worst, GEO_FAST_REL_ERROR);
+    return ok;
+}
+
+static int testCompare() {
+    int ok = 1;
+    fill_samples(GEO_FAST_MAX_DELTA);
+    for (int i = 0; i < SAMPLES; i++) {
+        double exact = greatcircle(lat0[i], lon0[i], lat1[i], lon1[i]);
+        // limits both far from and very close to the actual distance
+        double limit;
+        switch (i % 3) {
+            case 0: limit = rnd(0, 150e3); break;
+            case 1: limit = exact * (1 + rnd(-1e-3, 1e-3)); break;
+            default: limit = exact; break;
+        }
+        int expected = (exact > limit) - (exact < limit);
+        int res = greatcircle_cmp(lat0[i], lon0[i], lat1[i], lon1[i], limit);
+        if (res != expected) {
+            if (ok)
+                fprintf(stderr, "testCompare: FAIL: %.6f,%.6f -> %.6f,%.6f exact %.3f limit %.3f: %d (expected %d)\n",
+                        lat0[i], lon0[i], lat1[i], lon1[i], exact, limit, res, expected);
+            ok = 0;
+        }
+    }
+    fprintf(stderr, "testCompare:        %s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+static void benchmark() {
+    struct timespec start;
+    double sum = 0;
+
+    // typical distances between consecutive positions of an aircraft
+    fill_samples(0.05);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < SAMPLES; i++)
+        sum += greatcircle(lat0[i], lon0[i], lat1[i], lon1[i]);
+    double t_exact = elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < SAMPLES; i++)
+        sum += greatcircle_fast(lat0[i], lon0[i], lat1[i], lon1[i]);
+    double t_fast = elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < SAMPLES; i++)
+        sum += greatcircle_cmp(lat0[i], lon0[i], lat1[i], lon1[i], 2000);
+    double t_cmp = elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < SAMPLES; i++)
+        sum += bearing(lat0[i], lon0[i], lat1[i], lon1[i]);
+    double t_bearing = elapsed(&start);
+
+    double ns = 1e9 / SAMPLES;
+    fprintf(stderr, "benchmark: greatcircle %.1f ns, greatcircle_fast %.1f ns, greatcircle_cmp %.1f ns, "
+            "bearing %.1f ns (checksum %.0f)\n",
+            t_exact * ns, t_fast * ns, t_cmp * ns, t_bearing * ns, sum);
+}
+
+int main(int __attribute__ ((unused)) argc, char __attribute__ ((unused)) **argv) {
+    int ok = 1;
+    lat0 = malloc(SAMPLES * sizeof(double));
+    lon0 = malloc(SAMPLES * sizeof(double));
+    lat1 = malloc(SAMPLES * sizeof(double));
+    lon1 = malloc(SAMPLES * sizeof(double));
+    if (!lat0 || !lon0 || !lat1 || !lon1) {
+        fprintf(stderr, "geodesytests: out of memory\n");
+        return 1;
+    }
+
+    ok = testFastAccuracy() && ok;
+    ok = testCompare() && ok;
+
+    if (argc > 1)
+        benchmark();
+
+    free(lat0);
+    free(lon0);
+    free(lat1);
+    free(lon1);
+    return ok ? 0 : 1;
+}
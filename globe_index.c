@@ -1,9 +1,7 @@
 #include "readsb.h"
 
-#define LEG_FOCUS 0x0
-
-static void mark_legs(struct aircraft *a);
 static void load_blob(int blob);
+static void write_pending_snapshot(int thread);
 
 ssize_t check_write(int fd, const void *buf, size_t count, const char *error_context) {
     ssize_t res = write(fd, buf, count);
@@ -188,12 +186,72 @@ int globe_index_index(int index) {
 }
 
 
-static void write_trace(struct aircraft *a, uint64_t now, int init) {
+// restoreScratch() on the decode thread keeps a->legs under traceBundleMutex
+static void attach_legs(struct aircraft *a) {
+    if (a->legs)
+        return;
+    struct legState *ls = legsNew(a);
+    pthread_mutex_lock(&Modes.traceBundleMutex);
+    a->legs = ls;
+    pthread_mutex_unlock(&Modes.traceBundleMutex);
+}
+
+// set the leg markers in the view, take a complete view if the partial one isn't enough
+static int mark_legs(struct aircraft *a, struct traceView *tv) {
+    if (legsMark(a, tv) == 0)
+        return 0;
+
+    traceViewFree(tv);
+    if (traceViewGet(a, tv))
+        return -1;
+    legsMark(a, tv);
+    return 0;
+}
+
+// gzip the recent trace, it replaces the previous one of the aircraft,
+// the globe thread copies it into the bundle of its tile
+static void bundle_recent(struct aircraft *a, struct char_buffer recent) {
+    size_t gzLen;
+    char *gz = gzOut(recent.buffer, recent.len, 1, &gzLen);
+    if (!gz)
+        return;
+    // kept until the next trace write, don't hold on to the bound
+    struct traceBlob *blob = malloc(sizeof(struct traceBlob) + gzLen);
+    if (blob) {
+        blob->len = gzLen;
+        memcpy(blob->data, gz, gzLen);
+    }
+    arenaFree(gz);
+    if (!blob)
+        return;
+
+    pthread_mutex_lock(&Modes.traceBundleMutex);
+    struct traceBlob *old = a->trace_recent;
+    a->trace_recent = blob;
+    pthread_mutex_unlock(&Modes.traceBundleMutex);
+
+    free(old);
+}
+
+// with the trace bundles and the HTTP server the full traces are only made
+// when they are requested, see traceFullOnDemand()
+static int full_on_demand() {
+    return Modes.json_trace_bundles && httpEnabled();
+}
+
+static void full_trace_name(char *filename, size_t len, uint32_t addr, const char *ext) {
+    snprintf(filename, len, "traces/%02x/trace_full_%s%06x.%s", addr % 256, (addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", addr & 0xFFFFFF, ext);
+}
+
+static int write_trace(struct aircraft *a, uint64_t now, int init) {
     struct char_buffer recent;
     struct char_buffer full;
     struct char_buffer hist;
+    struct char_buffer recent_bin = { NULL, 0 };
+    struct char_buffer full_bin = { NULL, 0 };
     char filename[PATH_MAX];
     static uint32_t count2, count3, count4;
+    int files = 0;
 
     // nineteen_ago changes day 19 min after midnight: stop writing the previous days traces
     // twenty_ago changes day 20 min after midnight: allow webserver to read the previous days traces
@@ -210,36 +268,65 @@ static void write_trace(struct aircraft *a, uint64_t now, int init) {
     a->trace_write = 0;
 
     if (!a->trace_alloc)
-        return;
+        return 0;
 
+    // the recent trace and the leg detection only need the end of the trace,
+    // decode everything only when the full trace is written
+    int recent_points = init ? 42 : 142;
+    int from = traceLen(a) - recent_points;
     if (!init) {
-        mark_legs(a);
+        attach_legs(a);
+        from = min(from, legsPrepare(a));
     }
 
-    int start24 = 0;
-    for (int i = 0; i < a->trace_len; i++) {
-        if (a->trace[i].timestamp > now - (24 * HOURS + 15 * MINUTES)) {
-            start24 = i;
-            break;
-        }
+    struct traceView tv;
+    if (traceViewGetFrom(a, &tv, from))
+        return 0;
+
+    if (!init && mark_legs(a, &tv))
+        return 0;
+
+    int full_write = (now > a->trace_next_mw || a->trace_full_write > 35 || now > a->trace_next_fw);
+    if (full_write && tv.first > 0) {
+        traceViewFree(&tv);
+        if (traceViewGet(a, &tv))
+            return 0;
+        if (!init && mark_legs(a, &tv))
+            return 0;
     }
 
-    int recent_points = init ? 42 : 142;
-    int start_recent = a->trace_len - recent_points;
+    // indexes from here on are relative to the view
+    int start24 = traceViewFindTimestamp(&tv, now - (24 * HOURS + 15 * MINUTES) + 1);
+    if (start24 == tv.len)
+        start24 = 0; // nothing that recent, write everything
+
+    int start_recent = tv.len - recent_points;
     if (start_recent < start24)
         start_recent = start24;
 
     // write recent trace to /run
-    recent = generateTraceJson(a, start_recent, -1);
+    recent = generateTraceJson(a, &tv, start_recent, -1);
+    if (Modes.json_trace_bin && !Modes.json_trace_bundles)
+        recent_bin = generateTraceBin(a, &tv, start_recent, -1);
 
-    if (now > a->trace_next_mw || a->trace_full_write > 35 || now > a->trace_next_fw) {
+    if (full_write) {
         int write_perm = 0;
 
         if (Modes.debug_traceCount && ++count3 % 1000 == 0)
             fprintf(stderr, "memory trace writes: %u\n", count3);
 
-        // write full trace to /run
-        full = generateTraceJson(a, start24, -1);
+        if (full_on_demand()) {
+            // the next request makes a new one
+            full_trace_name(filename, sizeof(filename), a->addr, "json");
+            httpRemove(filename);
+            full_trace_name(filename, sizeof(filename), a->addr, "bin");
+            httpRemove(filename);
+        } else {
+            // write full trace to /run
+            full = generateTraceJson(a, &tv, start24, -1);
+            if (Modes.json_trace_bin)
+                full_bin = generateTraceBin(a, &tv, start24, -1);
+        }
 
         if (a->trace_full_write == 0xc0ffee)
             a->trace_next_mw = now + random() % (20 * MINUTES);
@@ -260,7 +347,7 @@ static void write_trace(struct aircraft *a, uint64_t now, int init) {
         //fprintf(stderr, "%06x\n", a->addr);
 
         // prepare writing the permanent history
-        if (write_perm && a->trace_len > 0 &&
+        if (write_perm && tv.len > 0 &&
                 Modes.globe_history_dir && !(a->addr & MODES_NON_ICAO_ADDRESS)) {
 
             struct tm utc;
@@ -271,36 +358,50 @@ static void write_trace(struct aircraft *a, uint64_t now, int init) {
             uint64_t start_of_day = 1000 * (uint64_t) (timegm(&utc));
             uint64_t end_of_day = 1000 * (uint64_t) (timegm(&utc) + 86400);
 
-            int start = -1;
-            int end = -1;
-            for (int i = 0; i < a->trace_len; i++) {
-                if (start == -1 && a->trace[i].timestamp > start_of_day) {
-                    start = i;
-                }
-                if (a->trace[i].timestamp < end_of_day) {
-                    end = i;
-                }
-            }
-            if (start >= 0 && end >= 0 && end >= start)
-                hist = generateTraceJson(a, start, end);
+            int start;
+            int count = traceViewFindRange(&tv, start_of_day + 1, end_of_day, &start);
+            if (count > 0)
+                hist = generateTraceJson(a, &tv, start, start + count - 1);
         }
     }
 
+    traceViewFree(&tv);
+
 
 
     if (recent.len > 0) {
-        snprintf(filename, 256, "traces/%02x/trace_recent_%s%06x.json", a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
+        if (Modes.json_trace_bundles) {
+            bundle_recent(a, recent);
+        } else {
+            snprintf(filename, 256, "traces/%02x/trace_recent_%s%06x.json", a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
 
-        writeJsonToGzip(Modes.json_dir, filename, recent, 1);
-        free(recent.buffer);
+            writeJsonToGzip(Modes.json_dir, filename, recent, 1);
+            files++;
+        }
+        arenaFree(recent.buffer);
     }
 
     if (full.len > 0) {
-        snprintf(filename, 256, "traces/%02x/trace_full_%s%06x.json", a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
+        full_trace_name(filename, sizeof(filename), a->addr, "json");
 
         writeJsonToGzip(Modes.json_dir, filename, full, 7);
-        free(full.buffer);
+        arenaFree(full.buffer);
+        files++;
+    }
+
+    if (recent_bin.len > 0) {
+        snprintf(filename, 256, "traces/%02x/trace_recent_%s%06x.bin", a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
+        writeJsonToGzip(Modes.json_dir, filename, recent_bin, 1);
+        files++;
+    }
+    arenaFree(recent_bin.buffer);
+
+    if (full_bin.len > 0) {
+        full_trace_name(filename, sizeof(filename), a->addr, "bin");
+        writeJsonToGzip(Modes.json_dir, filename, full_bin, 7);
+        files++;
     }
+    arenaFree(full_bin.buffer);
 
     if (hist.len > 0) {
         char tstring[100];
@@ -308,109 +409,78 @@ static void write_trace(struct aircraft *a, uint64_t now, int init) {
         gmtime_r(&nineteen_ago, &utc);
         strftime (tstring, 100, "%Y-%m-%d", &utc);
 
-        snprintf(filename, PATH_MAX, "%s/traces/%02x/trace_full_%s%06x.json", tstring, a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
-        filename[PATH_MAX - 101] = 0;
+        if (Modes.globe_history_pack) {
+            historyPackAppend(tstring, a->addr, now, hist);
+        } else {
+            snprintf(filename, PATH_MAX, "%s/traces/%02x/trace_full_%s%06x.json", tstring, a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
+            filename[PATH_MAX - 101] = 0;
 
-        writeJsonToGzip(Modes.globe_history_dir, filename, hist, 9);
-        free(hist.buffer);
+            writeJsonToGzip(Modes.globe_history_dir, filename, hist, 9);
+        }
+        arenaFree(hist.buffer);
 
         if (Modes.debug_traceCount && ++count4 % 100 == 0)
             fprintf(stderr, "perm trace writes: %u\n", count4);
     }
+    return files;
 }
 
-void *save_state(void *arg) {
-    int thread_number = *((int *) arg);
-    for (int j = 0; j < STATE_BLOBS; j++) {
-        if (j % IO_THREADS != thread_number)
-            continue;
-
-        //fprintf(stderr, "save_blob(%d)\n", j);
-        save_blob(j);
-    }
-    return NULL;
-}
-
-static int load_aircraft(char **p, char *end, uint64_t now) {
-
-    if (end - *p < (long) sizeof(struct aircraft))
-        return -1;
-
-    struct aircraft *a = malloc(sizeof(struct aircraft));
-    memcpy(a, *p, sizeof(struct aircraft));
-    *p += sizeof(struct aircraft);
-
-    if (a->size_struct_aircraft != sizeof(struct aircraft)) {
-            fprintf(stderr, "sizeof(struct aircraft) has changed, unable to read state!\n");
-        free(a);
-        return -1;
-    }
-
-    a->trace = NULL;
-    a->trace_all = NULL;
-
-    if (!Modes.keep_traces) {
-        a->trace_alloc = 0;
-        a->trace_len = 0;
+int traceFullOnDemand(const char *name) {
+    if (!full_on_demand() || strncmp(name, "traces/", 7))
+        return 0;
+    const char *p = strstr(name, "/trace_full_");
+    if (!p)
+        return 0;
+    p += strlen("/trace_full_");
+    uint32_t addr = 0;
+    if (*p == '~') {
+        addr = MODES_NON_ICAO_ADDRESS;
+        p++;
     }
+    char *end;
+    addr |= strtoul(p, &end, 16);
+    int bin = !strcmp(end, ".bin");
+    if (end != p + 6 || (!bin && strcmp(end, ".json")) || (bin && !Modes.json_trace_bin))
+        return 0;
+    // only the name write_trace() would have used
+    char filename[PATH_MAX];
+    full_trace_name(filename, sizeof(filename), addr, bin ? "bin" : "json");
+    if (strcmp(filename, name))
+        return 0;
 
-    // just in case we have bogus values saved, make sure they time out
-    if (a->seen_pos > now + 26 * HOURS)
-        a->seen_pos = 0;
-    if (a->seen > now + 26 * HOURS)
-        a->seen = now;
-
-    // read trace
-    if (a->trace_len > 0
-            && a->trace_len < 1024 * 1024
-            && a->trace_alloc > a->trace_len + 4
-            && a->trace_alloc < 2 * 1024 * 1024
-       ) {
-
-        int size_state = a->trace_len * sizeof(struct state);
-        int size_all = (a->trace_len + 3) / 4 * sizeof(struct state_all);
-
+    // the trace thread of the bucket writes the traces and the leg state,
+    // the request waits for it to finish its current part
+    int thread = aircraftHash(addr) / (AIRCRAFT_BUCKETS / TRACE_THREADS);
+    pthread_mutex_lock(&Modes.jsonTraceThreadMutex[thread]);
 
-        if (end - *p < (long) (size_state + size_all)) {
-            // TRACE FAIL
-            fprintf(stderr, "read trace fail\n");
-            a->trace = NULL;
-            a->trace_all = NULL;
-            a->trace_alloc = 0;
-            a->trace_len = 0;
-        } else {
-            // TRACE SUCCESS
-            a->trace = malloc(a->trace_alloc * sizeof(struct state));
-            a->trace_all = malloc((1 + a->trace_alloc / 4) * sizeof(struct state_all));
-
-            memcpy(a->trace, *p, size_state);
-            *p += size_state;
-            memcpy(a->trace_all, *p, size_all);
-            *p += size_all;
-
-            if (a->addr == LEG_FOCUS) {
-                a->trace_next_fw = now;
-                fprintf(stderr, "%06x trace len: %d\n", a->addr, a->trace_len);
-            }
+    struct char_buffer full = { NULL, 0 };
+    struct aircraft *a = aircraftGet(addr);
+    struct traceView tv;
+    if (a && a->trace_alloc && traceLen(a) > 0 && !traceViewGet(a, &tv)) {
+        attach_legs(a);
+        uint64_t now = mstime();
+        if (mark_legs(a, &tv) == 0) {
+            int start24 = traceViewFindTimestamp(&tv, now - (24 * HOURS + 15 * MINUTES) + 1);
+            if (start24 == tv.len)
+                start24 = 0;
+            full = bin ? generateTraceBin(a, &tv, start24, -1) : generateTraceJson(a, &tv, start24, -1);
         }
-    } else {
-        // no or bad trace
-        if (a->trace_len > 0)
-            fprintf(stderr, "read trace fail\n");
-        a->trace = NULL;
-        a->trace_all = NULL;
-        a->trace_len = 0;
-        a->trace_alloc = 0;
+        traceViewFree(&tv);
     }
 
-    if (a->globe_index > GLOBE_MAX_INDEX)
-        a->globe_index = -5;
-
-    a->first_message = NULL;
-    if (a->seen > now)
-        a->seen = 0;
+    size_t gzLen = 0;
+    char *gz = full.len ? gzOut(full.buffer, full.len, 7, &gzLen) : NULL;
+    arenaFree(full.buffer);
+    // still under the lock: a trace write drops the file again after this
+    if (gz)
+        httpPublish(name, NULL, 0, arenaDetach(gz, gzLen), gzLen);
 
+    pthread_mutex_unlock(&Modes.jsonTraceThreadMutex[thread]);
+    return gz != NULL;
+}
 
+// insert a loaded aircraft into the aircraft table, replacing a previous version
+static void insert_aircraft(struct aircraft *a) {
     struct aircraft *old = aircraftGet(a->addr);
     uint32_t hash = aircraftHash(a->addr);
     if (old) {
@@ -430,15 +500,40 @@ static int load_aircraft(char **p, char *end, uint64_t now) {
         a->next = Modes.aircraft[hash];
         Modes.aircraft[hash] = a;
     }
+}
 
+// the recent trace of aircraft seen shortly before the restart is written by
+// the trace threads once they are running, loading doesn't wait for it
+static void write_startup_trace(struct aircraft *a, uint64_t now) {
     if (a->trace_alloc && Modes.json_dir && Modes.json_globe_index && now < a->seen_pos + 2 * MINUTES) {
         // the value below is again overwritten in track.c when a fullWrite is done on startup
         a->trace_next_mw = a->trace_next_fw = now + 1 * MINUTES + random() % (2 * MINUTES);
         // setting mw and fw ensures only the recent trace is written, full trace would take too long
-        write_trace(a, now, 1);
+        a->trace_write = 1;
+    }
+}
+
+// an aircraft removed according to the log
+static void remove_aircraft(uint32_t addr) {
+    struct aircraft **c = (struct aircraft **) &Modes.aircraft[aircraftHash(addr)];
+    while (*c && (*c)->addr != addr)
+        c = &((*c)->next);
+    if (*c) {
+        struct aircraft *a = *c;
+        *c = a->next;
+        freeAircraft(a);
     }
+}
 
-    return 0;
+// loading goes straight into the aircraft table, the IO threads load
+// disjoint parts of it so no locking is needed
+static void state_load_init(struct stateLoad *ld, uint64_t now) {
+    memset(ld, 0, sizeof(*ld));
+    ld->now = now;
+    ld->traces = Modes.keep_traces;
+    ld->get = aircraftGet;
+    ld->insert = insert_aircraft;
+    ld->remove = remove_aircraft;
 }
 
 void *load_state(void *arg) {
@@ -449,6 +544,8 @@ void *load_state(void *arg) {
     //off_t len = fileinfo.st_size;
     int thread_number = *((int *) arg);
     srandom(get_seed());
+    struct stateLoad ld;
+    state_load_init(&ld, now);
     for (int i = 0; i < 256; i++) {
         if (i % IO_THREADS != thread_number)
             continue;
@@ -476,7 +573,10 @@ void *load_state(void *arg) {
             char *p = cb.buffer;
             char *end = p + cb.len;
 
-            load_aircraft(&p, end, now);
+            // state format 1 without the magic
+            struct aircraft *a = stateLoadV1(&p, end, &ld);
+            if (a)
+                write_startup_trace(a, now);
 
             free(cb.buffer);
             close(fd);
@@ -537,13 +637,16 @@ void *jsonTraceThreadEntryPoint(void *arg) {
         for (int j = start; j < end; j++) {
             for (a = Modes.aircraft[j]; a; a = a->next) {
                 if (a->trace_write)
-                    write_trace(a, now, 0);
+                    Modes.stats_current.trace_json_files[thread] += write_trace(a, now, 0);
             }
         }
 
         part++;
         part %= n_parts;
 
+        if (Modes.state_dir)
+            write_pending_snapshot(thread);
+
         end_cpu_timing(&start_time, &Modes.stats_current.trace_json_cpu[thread]);
     }
 
@@ -556,299 +659,6 @@ void *jsonTraceThreadEntryPoint(void *arg) {
 #endif
 }
 
-static void mark_legs(struct aircraft *a) {
-    if (a->trace_len < 20)
-        return;
-
-    int high = 0;
-    int low = 100000;
-
-    int last_five[5] = { 0 };
-    uint32_t five_pos = 0;
-
-    double sum = 0;
-
-    struct state *last_leg = NULL;
-    struct state *new_leg = NULL;
-
-    for (int i = 0; i < a->trace_len; i++) {
-        int32_t altitude = a->trace[i].altitude * 25;
-        int on_ground = a->trace[i].flags.on_ground;
-        int altitude_valid = a->trace[i].flags.altitude_valid;
-
-        if (a->trace[i].flags.leg_marker) {
-            a->trace[i].flags.leg_marker = 0;
-            // reset leg marker
-            last_leg = &a->trace[i];
-        }
-
-        if (!altitude_valid)
-            continue;
-
-        if (on_ground) {
-            int avg = 0;
-            for (int i = 0; i < 5; i++) avg += last_five[i];
-            avg /= 5;
-            altitude = avg;
-        } else {
-            if (five_pos == 0) {
-                for (int i = 0; i < 5; i++)
-                    last_five[i] = altitude;
-            } else {
-                last_five[five_pos % 5] = altitude;
-            }
-            five_pos++;
-        }
-
-        sum += altitude;
-    }
-
-    int threshold = (int) (sum / (double) (a->trace_len * 3));
-
-    if (a->addr == LEG_FOCUS) {
-        fprintf(stderr, "threshold: %d\n", threshold);
-        fprintf(stderr, "trace_len: %d\n", a->trace_len);
-    }
-
-
-    if (threshold > 10000)
-        threshold = 10000;
-    if (threshold < 200)
-        threshold = 200;
-
-    high = 0;
-    low = 100000;
-
-    uint64_t major_climb = 0;
-    uint64_t major_descent = 0;
-    int major_climb_index = 0;
-    int major_descent_index = 0;
-    uint64_t last_high = 0;
-    uint64_t last_low = 0;
-
-    int last_low_index = 0;
-
-    uint64_t last_airborne = 0;
-    uint64_t last_ground = 0;
-
-    int was_ground = 0;
-
-    for (int i = 0; i < 5; i++)
-        last_five[i] = 0;
-    five_pos = 0;
-
-    int prev_tmp = 0;
-    for (int i = 1; i < a->trace_len; i++) {
-        struct state *state = &a->trace[i];
-        int prev_index = prev_tmp;
-        struct state *prev = &a->trace[prev_index];
-
-        uint64_t elapsed = state->timestamp - prev->timestamp;
-
-        int32_t altitude = state->altitude * 25;
-        //int32_t geom_rate = state->geom_rate * 32;
-        //int geom_rate_valid = state->flags.geom_rate_valid;
-        //int stale = state->flags.stale;
-        int on_ground = state->flags.on_ground;
-        int altitude_valid = state->flags.altitude_valid;
-        //int gs_valid = state->flags.gs_valid;
-        //int track_valid = state->flags.track_valid;
-        //int leg_marker = state->flags.leg_marker;
-        //
-        if (!on_ground && !altitude_valid)
-            continue;
-
-        prev_tmp = i;
-
-        if (on_ground) {
-            int avg = 0;
-            for (int i = 0; i < 5; i++)
-                avg += last_five[i];
-            avg /= 5;
-            altitude = avg - threshold / 2;
-        } else {
-            if (five_pos == 0) {
-                for (int i = 0; i < 5; i++)
-                    last_five[i] = altitude;
-            } else {
-                last_five[five_pos % 5] = altitude;
-            }
-            five_pos++;
-        }
-
-        if (!on_ground)
-            last_airborne = state->timestamp;
-        else
-            last_ground = state->timestamp;
-
-        if (altitude >= high) {
-            high = altitude;
-        }
-        if (altitude <= low) {
-            low = altitude;
-        }
-
-        /*
-        if (state->timestamp > a->trace[i-1].timestamp + 45 * 60 * 1000) {
-            high = low = altitude;
-        }
-        */
-
-        if (abs(low - altitude) < threshold * 1 / 3 && elapsed < 30 * MINUTES) {
-            last_low = state->timestamp;
-            last_low_index = i;
-        }
-        if (abs(high - altitude) < threshold * 1 / 3)
-            last_high = state->timestamp;
-
-        if (high - low > threshold) {
-            if (last_high > last_low) {
-                // only set new major climb time if this is after a major descent.
-                // then keep that time associated with the climb
-                // still report continuation of thta climb
-                if (major_climb <= major_descent) {
-                    int bla = min(a->trace_len - 1, last_low_index + 3);
-                    major_climb = a->trace[bla].timestamp;
-                    major_climb_index = bla;
-                }
-                if (a->addr == LEG_FOCUS) {
-                    time_t nowish = major_climb/1000;
-                    struct tm utc;
-                    gmtime_r(&nowish, &utc);
-                    char tstring[100];
-                    strftime (tstring, 100, "%H:%M:%S", &utc);
-                    fprintf(stderr, "climb: %d %s\n", altitude, tstring);
-                }
-                low = high - threshold * 9/10;
-            } else if (last_high < last_low) {
-                int bla = max(0, last_low_index - 3);
-                major_descent = a->trace[bla].timestamp;
-                major_descent_index = bla;
-                if (a->addr == LEG_FOCUS) {
-                    time_t nowish = major_descent/1000;
-                    struct tm utc;
-                    gmtime_r(&nowish, &utc);
-                    char tstring[100];
-                    strftime (tstring, 100, "%H:%M:%S", &utc);
-                    fprintf(stderr, "desc: %d %s\n", altitude, tstring);
-                }
-                high = low + threshold * 9/10;
-            }
-        }
-        int leg_now = 0;
-        if ( (major_descent && (on_ground || was_ground) && elapsed > 25 * 60 * 1000) ||
-                (major_descent && (on_ground || was_ground) && state->timestamp > last_airborne + 45 * 60 * 1000)
-           )
-        {
-            if (a->addr == LEG_FOCUS)
-                fprintf(stderr, "ground leg\n");
-            leg_now = 1;
-        }
-        double distance = greatcircle(
-                (double) a->trace[i].lat / 1E6,
-                (double) a->trace[i].lon / 1E6,
-                (double) a->trace[i-1].lat / 1E6,
-                (double) a->trace[i-1].lon / 1E6
-                );
-
-        if ( elapsed > 30 * 60 * 1000 && distance < 10E3 * (elapsed / (30 * 60 * 1000.0)) && distance > 1) {
-            leg_now = 1;
-            if (a->addr == LEG_FOCUS)
-                fprintf(stderr, "time/distance leg, elapsed: %0.fmin, distance: %0.f\n", elapsed / (60 * 1000.0), distance / 1000.0);
-        }
-
-        int leg_float = 0;
-        if (major_climb && major_descent &&
-                (major_climb > major_descent + 8 * MINUTES || last_ground > major_descent - 2 * MINUTES)
-           ) {
-            for (int i = major_descent_index + 1; i < major_climb_index; i++) {
-                if (a->trace[i].timestamp > a->trace[i - 1].timestamp + 5 * MINUTES) {
-                    leg_float = 1;
-                    if (a->addr == LEG_FOCUS)
-                        fprintf(stderr, "float leg\n");
-                }
-            }
-        }
-
-
-        if (leg_float || leg_now)
-        {
-            uint64_t leg_ts = 0;
-
-            if (leg_now) {
-                new_leg = &a->trace[prev_index + 1];
-                for (int k = prev_index + 1; k < i; k++) {
-                    struct state *state = &a->trace[i];
-                    struct state *last = &a->trace[i - 1];
-
-                    if (state->timestamp > last->timestamp + 5 * 60 * 1000) {
-                        new_leg = state;
-                        break;
-                    }
-                }
-            } else if (major_descent_index + 1 == major_climb_index) {
-                new_leg = &a->trace[major_climb_index];
-            } else {
-                for (int i = major_climb_index; i > major_descent_index; i--) {
-                    struct state *state = &a->trace[i];
-                    struct state *last = &a->trace[i - 1];
-
-                    if (state->timestamp > last->timestamp + 5 * 60 * 1000) {
-                        new_leg = state;
-                        break;
-                    }
-                }
-                uint64_t half = major_descent + (major_climb - major_descent) / 2;
-                for (int i = major_descent_index + 1; i < major_climb_index; i++) {
-                    struct state *state = &a->trace[i];
-
-                    if (state->timestamp > half) {
-                        new_leg = state;
-                        break;
-                    }
-                }
-            }
-
-            if (new_leg) {
-                leg_ts = new_leg->timestamp;
-                new_leg->flags.leg_marker = 1;
-                // set leg marker
-            }
-
-            major_climb = 0;
-            major_climb_index = 0;
-            major_descent = 0;
-            major_descent_index = 0;
-            low += threshold;
-            high -= threshold;
-
-            if (a->addr == LEG_FOCUS) {
-                if (new_leg) {
-                    time_t nowish = leg_ts/1000;
-                    struct tm utc;
-                    gmtime_r(&nowish, &utc);
-                    char tstring[100];
-                    strftime (tstring, 100, "%H:%M:%S", &utc);
-                    fprintf(stderr, "leg: %s\n", tstring);
-                } else {
-                    time_t nowish = state->timestamp/1000;
-                    struct tm utc;
-                    gmtime_r(&nowish, &utc);
-                    char tstring[100];
-                    strftime (tstring, 100, "%H:%M:%S", &utc);
-                    fprintf(stderr, "resetting major_c/d without leg: %s\n", tstring);
-                }
-            }
-        }
-
-        was_ground = on_ground;
-    }
-    if (last_leg != new_leg) {
-        a->trace_full_write = 9999;
-        //fprintf(stderr, "%06x\n", a->addr);
-    }
-}
-
 void ca_init (struct craftArray *ca) {
     *ca = (struct craftArray) {0};
 }
@@ -859,7 +669,7 @@ void ca_destroy (struct craftArray *ca) {
     *ca = (struct craftArray) {0};
 }
 
-void ca_add (struct craftArray *ca, struct aircraft *a) {
+static void ca_grow (struct craftArray *ca) {
     if (ca->alloc == 0) {
         ca->alloc = 64;
         ca->list = realloc(ca->list, ca->alloc * sizeof(struct aircraft *));
@@ -872,6 +682,10 @@ void ca_add (struct craftArray *ca, struct aircraft *a) {
         fprintf(stderr, "ca_add(): out of memory!\n");
         exit(1);
     }
+}
+
+void ca_add (struct craftArray *ca, struct aircraft *a) {
+    ca_grow(ca);
     for (int i = 0; i < ca->len; i++) {
         if (a == ca->list[i]) {
             fprintf(stderr, "ca_add(): double add!\n");
@@ -889,6 +703,14 @@ void ca_add (struct craftArray *ca, struct aircraft *a) {
     return;
 }
 
+// append without looking for duplicates or free slots, for filling empty
+// lists when loading the state (ca_add is O(len), quadratic for big lists)
+void ca_append (struct craftArray *ca, struct aircraft *a) {
+    ca_grow(ca);
+    ca->list[ca->len] = a;
+    ca->len++;
+}
+
 void ca_remove (struct craftArray *ca, struct aircraft *a) {
     if (!ca->list)
         return;
@@ -925,153 +747,407 @@ void set_globe_index (struct aircraft *a, int new_index) {
 }
 
 
-// blobs 00 to ff (0 to 255)
-void save_blob(int blob) {
-    if (!Modes.state_dir)
+// State checkpoints
+//
+// blob_XX.state is a full snapshot of one shard (1/256th of the aircraft table),
+// blob_XX.log collects the changes since that snapshot: each checkpoint
+// appends compressed segments with the aircraft that changed since the
+// previous checkpoint, containing only the trace points added since then.
+// Once the log has grown larger than the snapshot, the next periodic
+// checkpoint of that shard writes a new snapshot instead (compaction).
+// The record format is in state_store.h.
+//
+// Snapshot and log carry the same random id, a log left over from an older
+// snapshot (crash during compaction) is ignored.  A segment cut short by a
+// crash is dropped on loading and the log truncated to the last complete one.
+//
+// Aircraft removed from the table are remembered per shard and written as
+// removal records with the next checkpoint.
+//
+// With the trace threads running, the snapshots are written by the trace
+// thread covering the shard: save_blob() only flags the shard.  The trace
+// thread holds its jsonTraceThreadMutex while writing, so aircraft can't be
+// removed or their traces resized meanwhile (see lockThreads()).  Until the
+// snapshot is done, save_blob() leaves the shard alone.
+//
+// Format 1 (blob_XX.gz / blob_XX, a raw copy of the struct aircraft of that
+// time) is converted on loading, the first checkpoint after that writes a
+// snapshot in the current format and removes the old file.
+
+_Static_assert(STATE_BLOBS % TRACE_THREADS == 0, "a shard must belong to one trace thread");
+
+struct stateShard {
+    uint64_t id; // id of the current snapshot, 0: no usable snapshot
+    int64_t snapshotBytes;
+    int64_t logBytes;
+    // removed since the last checkpoint, added to under lockThreads()
+    uint32_t *removed;
+    int removedLen;
+    int removedAlloc;
+    int snapshotPending; // to be written by the trace thread, protected by its mutex
+};
+static struct stateShard stateShards[STATE_BLOBS];
+static int64_t saveStateBytes[IO_THREADS];
+// snapshots written by each trace thread, protected by its mutex, collected by save_blob()
+static int64_t snapshotBytes[TRACE_THREADS];
+static int snapshotCount[TRACE_THREADS];
+
+static int state_shard(uint32_t addr) {
+    return aircraftHash(addr) / (AIRCRAFT_BUCKETS / STATE_BLOBS);
+}
+
+static int state_thread(int blob) {
+    return blob / (STATE_BLOBS / TRACE_THREADS);
+}
+
+// called under lockThreads() for each aircraft removed from the table
+void save_removed(struct aircraft *a) {
+    if (!Modes.state_dir || (!a->chk_seen && !stateInclude(a)))
         return;
-    //static int count;
-    //fprintf(stderr, "Save blob: %02x, count: %d\n", blob, ++count);
-    if (blob < 0 || blob > 255)
-        fprintf(stderr, "save_blob: invalid argument: %d", blob);
+    struct stateShard *shard = &stateShards[state_shard(a->addr)];
+    if (!shard->id)
+        return; // the next checkpoint is a snapshot anyhow
+    if (shard->removedLen == shard->removedAlloc) {
+        int alloc = max(2 * shard->removedAlloc, 64);
+        uint32_t *removed = realloc(shard->removed, alloc * sizeof(uint32_t));
+        if (!removed) {
+            fprintf(stderr, "save_removed: realloc failure, writing a snapshot next time\n");
+            shard->id = 0;
+            return;
+        }
+        shard->removed = removed;
+        shard->removedAlloc = alloc;
+    }
+    shard->removed[shard->removedLen++] = a->addr;
+}
 
-    int gzip = 1;
+static int needs_snapshot(struct stateShard *shard) {
+    return !shard->id || shard->logBytes > shard->snapshotBytes;
+}
 
+static int write_log_header(int blob, uint64_t id) {
     char filename[PATH_MAX];
     char tmppath[PATH_MAX];
-    if (gzip) {
-        snprintf(filename, 1024, "%s/blob_%02x", Modes.state_dir, blob);
-        unlink(filename);
-        snprintf(filename, 1024, "%s/blob_%02x.gz", Modes.state_dir, blob);
-    } else {
-        snprintf(filename, 1024, "%s/blob_%02x.gz", Modes.state_dir, blob);
-        unlink(filename);
-        snprintf(filename, 1024, "%s/blob_%02x", Modes.state_dir, blob);
-    }
+    snprintf(filename, PATH_MAX, "%s/blob_%02x.log", Modes.state_dir, blob);
     snprintf(tmppath, PATH_MAX, "%s/tmp.%lx_%lx", Modes.state_dir, random(), random());
 
     int fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
     if (fd < 0) {
         fprintf(stderr, "open failed:");
         perror(tmppath);
-        return;
+        return -1;
     }
-    gzFile gzfp = NULL;
-    if (gzip) {
-        int res;
-        gzfp = gzdopen(fd, "wb");
-        if (!gzfp) {
-            fprintf(stderr, "gzdopen failed:");
-            perror(tmppath);
-            close(fd);
-            return;
-        }
-        if (gzbuffer(gzfp, GZBUFFER_BIG) < 0)
-            fprintf(stderr, "gzbuffer fail");
-        res = gzsetparams(gzfp, 1, Z_DEFAULT_STRATEGY);
-        if (res < 0)
-            fprintf(stderr, "gzsetparams fail: %d", res);
+    struct stateHeader header;
+    stateHeaderInit(&header, STATE_LOG_MAGIC2, id);
+    ssize_t res = check_write(fd, &header, sizeof(header), tmppath);
+    close(fd);
+    if (res != sizeof(header) || rename(tmppath, filename) == -1) {
+        perror(filename);
+        unlink(tmppath);
+        return -1;
     }
+    return sizeof(header);
+}
 
-    int stride = AIRCRAFT_BUCKETS / STATE_BLOBS;
-    int start = stride * blob;
-    int end = start + stride;
-
-    uint64_t magic = 0x7ba09e63757913eeULL;
-
-    int alloc = 32 * 1024 * 1024;
-    unsigned char *buf = malloc(alloc);
-    unsigned char *p = buf;
+// write a full snapshot of the shard and start a new log, returns bytes written
+static int64_t write_snapshot(int blob) {
+    struct stateShard *shard = &stateShards[blob];
+    char filename[PATH_MAX];
+    char tmppath[PATH_MAX];
 
+    snprintf(filename, PATH_MAX, "%s/blob_%02x.state", Modes.state_dir, blob);
+    snprintf(tmppath, PATH_MAX, "%s/tmp.%lx_%lx", Modes.state_dir, random(), random());
 
-    for (int j = start; j < end; j++) {
-        for (struct aircraft *a = Modes.aircraft[j]; a; a = a->next) {
-            if (!a->seen_pos && a->trace_len == 0)
-                continue;
-            if (a->addr & MODES_NON_ICAO_ADDRESS)
-                continue;
-            if (a->messages < 2)
-                continue;
+    // the current log won't match the new snapshot, until a new log is written
+    // nothing must be appended
+    shard->id = 0;
+    // the snapshot only has the aircraft still in the table
+    shard->removedLen = 0;
 
-            memcpy(p, &magic, sizeof(magic));
-            p += sizeof(magic);
+    int fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "open failed:");
+        perror(tmppath);
+        return 0;
+    }
 
+    uint64_t id;
+    do {
+        id = ((uint64_t) random() << 32) ^ random() ^ mstime();
+    } while (id == 0);
 
-            int size_state = a->trace_len * sizeof(struct state);
-            int size_all = (a->trace_len + 3) / 4 * sizeof(struct state_all);
+    struct stateHeader header;
+    stateHeaderInit(&header, STATE_SNAPSHOT_MAGIC2, id);
+    int ok = (check_write(fd, &header, sizeof(header), tmppath) == sizeof(header));
 
-            if (p + size_state + size_all + sizeof(struct aircraft) < buf + alloc) {
+    struct stateBuffer sb = { 0 };
+    int stride = AIRCRAFT_BUCKETS / STATE_BLOBS;
+    int start = stride * blob;
+    int end = start + stride;
 
-                memcpy(p, a, sizeof(struct aircraft));
-                p += sizeof(struct aircraft);
-                if (a->trace_len > 0) {
-                    memcpy(p, a->trace, size_state);
-                    p += size_state;
-                    memcpy(p, a->trace_all, size_all);
-                    p += size_all;
-                }
-            } else {
-                fprintf(stderr, "%06x: too big for save_blob!\n", a->addr);
-            }
+    for (int j = start; ok && j < end; j++) {
+        for (struct aircraft *a = Modes.aircraft[j]; ok && a; a = a->next) {
+            if (!stateInclude(a))
+                continue;
 
-            if (p - buf > alloc - 4 * 1024 * 1024) {
-                fprintf(stderr, "buffer almost full: loop_write %d KB\n", (int) ((p - buf) / 1024));
-                if (gzip) {
-                    writeGz(gzfp, buf, p - buf, tmppath);
-                } else {
-                    check_write(fd, buf, p - buf, tmppath);
-                }
+            stateRecord(&sb, a, 0);
 
-                p = buf;
-            }
+            if (sb.len > STATE_FLUSH_SIZE && stateWriteSegment(fd, &sb, tmppath) < 0)
+                ok = 0;
         }
     }
-    magic--;
-    memcpy(p, &magic, sizeof(magic));
-    p += sizeof(magic);
+    if (ok && sb.len > 0 && stateWriteSegment(fd, &sb, tmppath) < 0)
+        ok = 0;
+    arenaFree(sb.buf);
 
-    //fprintf(stderr, "end_write %d KB\n", (int) ((p - buf) / 1024));
-    if (gzip) {
-        writeGz(gzfp, buf, p - buf, tmppath);
-    } else {
-        check_write(fd, buf, p - buf, tmppath);
-    }
-    p = buf;
+    if (close(fd) != 0)
+        ok = 0;
 
-    if (gzfp)
-        gzclose(gzfp);
-    else if (fd != -1)
-        close(fd);
+    if (!ok) {
+        fprintf(stderr, "save_blob: writing %s failed\n", tmppath);
+        unlink(tmppath);
+        return 0;
+    }
 
     if (rename(tmppath, filename) == -1) {
         fprintf(stderr, "save_blob rename(): %s -> %s", tmppath, filename);
         perror("");
+        unlink(tmppath);
+        return 0;
     }
 
-    free(buf);
-}
-void *load_blobs(void *arg) {
-    int thread_number = *((int *) arg);
-    srandom(get_seed());
-    for (int j = 0; j < STATE_BLOBS; j++) {
-        if (j % IO_THREADS != thread_number)
-           continue;
-        load_blob(j);
+    // state format 1, replaced by the snapshot
+    snprintf(tmppath, PATH_MAX, "%s/blob_%02x.gz", Modes.state_dir, blob);
+    unlink(tmppath);
+    snprintf(tmppath, PATH_MAX, "%s/blob_%02x", Modes.state_dir, blob);
+    unlink(tmppath);
+
+    struct stat fileinfo = {0};
+    stat(filename, &fileinfo);
+    shard->snapshotBytes = fileinfo.st_size;
+
+    int logBytes = write_log_header(blob, id);
+    if (logBytes > 0) {
+        shard->id = id;
+        shard->logBytes = logBytes;
     }
-    return NULL;
+
+    return shard->snapshotBytes + max(logBytes, 0);
 }
 
-// blobs 00 to ff (0 to 255)
-static void load_blob(int blob) {
-    //fprintf(stderr, "load blob %d\n", blob);
-    if (blob < 0 || blob >= STATE_BLOBS)
-        fprintf(stderr, "load_blob: invalid argument: %d", blob);
-    uint64_t magic = 0x7ba09e63757913eeULL;
-    char filename[1024];
-    uint64_t now = mstime();
+// append the changes since the last checkpoint to the log, returns bytes written
+static int64_t append_checkpoint(int blob) {
+    struct stateShard *shard = &stateShards[blob];
+    char filename[PATH_MAX];
+    snprintf(filename, PATH_MAX, "%s/blob_%02x.log", Modes.state_dir, blob);
+
+    struct stateBuffer sb = { 0 };
     int fd = -1;
+    int ok = 1;
+    int64_t written = 0;
+
+    // removals first: an aircraft that was removed and came back has its record after that
+    for (int k = 0; k < shard->removedLen; k++) {
+        if (stateRemoval(&sb, shard->removed[k]))
+            ok = 0;
+    }
+    shard->removedLen = 0;
+
+    int stride = AIRCRAFT_BUCKETS / STATE_BLOBS;
+    int start = stride * blob;
+    int end = start + stride;
+
+    for (int j = start; j < end; j++) {
+        for (struct aircraft *a = Modes.aircraft[j]; a; a = a->next) {
+            if (!stateInclude(a) || !stateRecord(&sb, a, 1))
+                continue;
+            if (sb.len <= STATE_FLUSH_SIZE || !ok)
+                continue;
+            if (fd < 0 && (fd = open(filename, O_WRONLY | O_APPEND)) < 0) {
+                perror(filename);
+                ok = 0;
+                continue;
+            }
+            int64_t res = stateWriteSegment(fd, &sb, filename);
+            if (res < 0)
+                ok = 0;
+            else
+                written += res;
+        }
+    }
+
+    if (ok && sb.len > 0) {
+        if (fd < 0 && (fd = open(filename, O_WRONLY | O_APPEND)) < 0) {
+            perror(filename);
+            ok = 0;
+        } else {
+            int64_t res = stateWriteSegment(fd, &sb, filename);
+            if (res < 0)
+                ok = 0;
+            else
+                written += res;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+    arenaFree(sb.buf);
+
+    shard->logBytes += written;
+
+    if (!ok) {
+        // the aircraft were marked as saved, only a new snapshot is safe now
+        fprintf(stderr, "save_blob: appending to %s failed, writing a snapshot next time\n", filename);
+        shard->id = 0;
+    }
+
+    return written;
+}
+
+// blobs 00 to ff (0 to 255)
+static int64_t checkpoint_blob(int blob, int compact, int *compacted) {
+    if (!Modes.state_dir)
+        return 0;
+    if (blob < 0 || blob >= STATE_BLOBS) {
+        fprintf(stderr, "save_blob: invalid argument: %d", blob);
+        return 0;
+    }
+
+    struct stateShard *shard = &stateShards[blob];
+    if (!shard->id || (compact && needs_snapshot(shard))) {
+        if (compacted)
+            *compacted = 1;
+        return write_snapshot(blob);
+    }
+    return append_checkpoint(blob);
+}
+
+// periodic checkpoint of one shard, only called from the main thread
+void save_blob(int blob) {
+    if (!Modes.state_dir || blob < 0 || blob >= STATE_BLOBS)
+        return;
+
+    if (Modes.json_globe_index) {
+        // the trace thread writes the snapshot, collect what it has done since the last call
+        int thread = state_thread(blob);
+        struct stateShard *shard = &stateShards[blob];
+        pthread_mutex_lock(&Modes.jsonTraceThreadMutex[thread]);
+        Modes.stats_current.state_bytes_written += snapshotBytes[thread];
+        Modes.stats_current.state_compactions += snapshotCount[thread];
+        snapshotBytes[thread] = 0;
+        snapshotCount[thread] = 0;
+        if (!shard->snapshotPending && needs_snapshot(shard))
+            shard->snapshotPending = 1;
+        int pending = shard->snapshotPending;
+        pthread_mutex_unlock(&Modes.jsonTraceThreadMutex[thread]);
+        if (pending)
+            return;
+    }
+
+    int compacted = 0;
+    int64_t bytes = checkpoint_blob(blob, 1, &compacted);
+
+    Modes.stats_current.state_bytes_written += bytes;
+    if (compacted)
+        Modes.stats_current.state_compactions++;
+    else if (bytes)
+        Modes.stats_current.state_checkpoints++;
+}
+
+// called by the trace threads with their mutex locked, one snapshot per call
+// to keep the time the trace writes wait short
+static void write_pending_snapshot(int thread) {
+    int per_thread = STATE_BLOBS / TRACE_THREADS;
+    for (int blob = thread * per_thread; blob < (thread + 1) * per_thread; blob++) {
+        struct stateShard *shard = &stateShards[blob];
+        if (!shard->snapshotPending)
+            continue;
+        int64_t bytes = write_snapshot(blob);
+        snapshotBytes[thread] += bytes;
+        if (bytes)
+            snapshotCount[thread]++;
+        shard->snapshotPending = 0;
+        return;
+    }
+}
+
+// on exit: append the latest changes of all shards, no compaction
+void *save_state(void *arg) {
+    int thread_number = *((int *) arg);
+    for (int j = 0; j < STATE_BLOBS; j++) {
+        if (j % IO_THREADS != thread_number)
+            continue;
+
+        //fprintf(stderr, "save_blob(%d)\n", j);
+        saveStateBytes[thread_number] += checkpoint_blob(j, 0, NULL);
+    }
+    return NULL;
+}
+
+int64_t saved_state_bytes() {
+    int64_t sum = 0;
+    for (int i = 0; i < IO_THREADS; i++)
+        sum += saveStateBytes[i];
+    return sum;
+}
+
+// each thread loads every IO_THREADS'th shard, the shards cover disjoint
+// parts of the aircraft table so no locking is needed
+void *load_blobs(void *arg) {
+    int thread_number = *((int *) arg);
+    srandom(get_seed());
+    for (int j = 0; j < STATE_BLOBS; j++) {
+        if (j % IO_THREADS != thread_number)
+           continue;
+        load_blob(j);
+    }
+    return NULL;
+}
+
+// replay the log belonging to the snapshot with the given id
+static void load_log(int blob, uint64_t id, struct stateLoad *snapshot) {
+    struct stateShard *shard = &stateShards[blob];
+    char filename[PATH_MAX];
+    snprintf(filename, PATH_MAX, "%s/blob_%02x.log", Modes.state_dir, blob);
+
+    int fd = open(filename, O_RDWR);
+    if (fd == -1)
+        return;
+
+    struct stat fileinfo = {0};
+    fstat(fd, &fileinfo);
+
+    struct stateLoad ld = *snapshot;
+    struct stateHeader header = { 0 };
+
+    if (!id || stateReadAt(fd, &header, sizeof(header), 0) != 0
+            || header.magic != STATE_LOG_MAGIC2 || header.version != STATE_VERSION || header.id != id) {
+        // log of an older snapshot
+        close(fd);
+        unlink(filename);
+        return;
+    }
+    ld.size_state = header.size_state;
+    ld.size_state_all = header.size_state_all;
+    ld.traces = Modes.keep_traces && ld.size_state == sizeof(struct state) && ld.size_state_all == sizeof(struct state_all);
+
+    off_t off = stateLoadSegments(fd, sizeof(header), &ld, filename);
+
+    if (off != fileinfo.st_size) {
+        fprintf(stderr, "%s: dropping %jd bytes of an incomplete checkpoint\n", filename, (intmax_t) (fileinfo.st_size - off));
+        if (ftruncate(fd, off))
+            perror(filename);
+    }
+
+    shard->id = id;
+    shard->logBytes = off;
+
+    close(fd);
+}
+
+// format 1: blob_XX.gz or blob_XX
+static void load_blob_v1(int blob, struct stateLoad *ld) {
+    char filename[1024];
     struct char_buffer cb;
-    char *p;
-    char *end;
 
     snprintf(filename, 1024, "%s/blob_%02x.gz", Modes.state_dir, blob);
     gzFile gzfp = gzopen(filename, "r");
@@ -1080,7 +1156,7 @@ static void load_blob(int blob) {
         gzclose(gzfp);
     } else {
         snprintf(filename, 1024, "%s/blob_%02x", Modes.state_dir, blob);
-        fd = open(filename, O_RDONLY);
+        int fd = open(filename, O_RDONLY);
         if (fd == -1) {
             fprintf(stderr, "missing state blob:");
             perror(filename);
@@ -1091,24 +1167,237 @@ static void load_blob(int blob) {
     }
     if (!cb.buffer)
         return;
-    p = cb.buffer;
-    end = p + cb.len;
-
-    while (end - p > 0) {
-        uint64_t value = 0;
-        if (end - p >= (long) sizeof(value)) {
-            memcpy(&value, p, sizeof(value));
-            p += sizeof(value);
+
+    if (stateLoadV1Blob(cb.buffer, cb.buffer + cb.len, ld))
+        fprintf(stderr, "Incomplete state file: %s\n", filename);
+    free(cb.buffer);
+}
+
+// blobs 00 to ff (0 to 255)
+static void load_blob(int blob) {
+    //fprintf(stderr, "load blob %d\n", blob);
+    if (blob < 0 || blob >= STATE_BLOBS)
+        fprintf(stderr, "load_blob: invalid argument: %d", blob);
+    char filename[PATH_MAX];
+    uint64_t now = mstime();
+
+    struct stateLoad ld;
+    state_load_init(&ld, now);
+    struct stateHeader header;
+
+    snprintf(filename, PATH_MAX, "%s/blob_%02x.state", Modes.state_dir, blob);
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0 && stateReadAt(fd, &header, sizeof(header), 0) == 0
+            && header.magic == STATE_SNAPSHOT_MAGIC2 && header.version == STATE_VERSION) {
+        ld.size_state = header.size_state;
+        ld.size_state_all = header.size_state_all;
+        ld.traces = (ld.size_state == sizeof(struct state) && ld.size_state_all == sizeof(struct state_all));
+        if (!ld.traces)
+            fprintf(stderr, "%s: trace format has changed, loading the aircraft without traces\n", filename);
+        ld.traces = ld.traces && Modes.keep_traces;
+
+        off_t off = stateLoadSegments(fd, sizeof(header), &ld, filename);
+        struct stat fileinfo = {0};
+        fstat(fd, &fileinfo);
+        if (off != fileinfo.st_size)
+            fprintf(stderr, "Incomplete state file: %s\n", filename);
+        stateShards[blob].snapshotBytes = fileinfo.st_size;
+
+        load_log(blob, header.id, &ld);
+    } else {
+        if (fd >= 0)
+            fprintf(stderr, "%s: unknown state format, ignoring it\n", filename);
+        load_blob_v1(blob, &ld);
+        // the next checkpoint writes a snapshot in the current format
+        stateShards[blob].id = 0;
+    }
+    if (fd >= 0)
+        close(fd);
+
+    // the recent traces are written once the shard is complete
+    int stride = AIRCRAFT_BUCKETS / STATE_BLOBS;
+    for (int j = stride * blob; j < stride * (blob + 1); j++) {
+        for (struct aircraft *a = Modes.aircraft[j]; a; a = a->next) {
+            write_startup_trace(a, now);
         }
+    }
+}
 
-        if (value != magic) {
-            if (value != magic - 1)
-                fprintf(stderr, "Incomplete state file: %s\n", filename);
-            break;
+// positions and squawk / callsign changes of one half hour, collected by handleHeatmap()
+// and written by the heatmap thread
+struct heatmapJob {
+    struct heatmapJob *next;
+    struct heatEntry *buffer;
+    int *slices; // slice of each buffer entry
+    int len;
+    int alloc;
+    int num_slices;
+    uint64_t start;
+    uint32_t interval;
+    int half_hour;
+    char tstring[100];
+};
+
+static struct heatmapJob *heatmapQueue; // protected by heatmapThreadMutex
+
+static int heatmap_grow(struct heatmapJob *job, int limit) {
+    int alloc = min(limit, max(64 * 1024, 2 * job->alloc));
+    struct heatEntry *buffer = realloc(job->buffer, alloc * sizeof(struct heatEntry));
+    if (buffer)
+        job->buffer = buffer;
+    int *slices = realloc(job->slices, alloc * sizeof(int));
+    if (slices)
+        job->slices = slices;
+    if (!buffer || !slices) {
+        fprintf(stderr, "heatmap: realloc failure!\n");
+        return -1;
+    }
+    job->alloc = alloc;
+    return 0;
+}
+
+static void heatmap_free(struct heatmapJob *job) {
+    free(job->buffer);
+    free(job->slices);
+    free(job);
+}
+
+static void heatmap_write(struct heatmapJob *job) {
+    int num_slices = job->num_slices;
+    int len = job->len;
+    int len2 = len + num_slices;
+    struct heatEntry *buffer2 = malloc(max(len2, 1) * sizeof(struct heatEntry));
+    int *pos = malloc(num_slices * sizeof(int));
+    struct heatEntry index[num_slices];
+
+    if (!buffer2 || !pos) {
+        fprintf(stderr, "heatmap: malloc failure!\n");
+        free(buffer2);
+        free(pos);
+        return;
+    }
+
+    // counting sort by slice, stable: each slice keeps the collection order
+    // entries past the last slice are dropped
+    for (int i = 0; i < num_slices; i++)
+        pos[i] = 0;
+    for (int k = 0; k < len; k++) {
+        if (job->slices[k] < num_slices)
+            pos[job->slices[k]]++;
+        else
+            len2--;
+    }
+    int next = 0;
+    for (int i = 0; i < num_slices; i++) {
+        int count = pos[i];
+
+        struct heatEntry specialSauce = (struct heatEntry) {0};
+        uint64_t slice_stamp = job->start + i * job->interval;
+        specialSauce.hex = 0xe7f7c9d;
+        specialSauce.lat = slice_stamp >> 32;
+        specialSauce.lon = slice_stamp & ((1ULL << 32) - 1);
+        specialSauce.alt = job->interval;
+
+        index[i] = (struct heatEntry) {0};
+        index[i].hex = next + num_slices;
+        buffer2[next++] = specialSauce;
+
+        pos[i] = next;
+        next += count;
+    }
+    for (int k = 0; k < len; k++) {
+        int slice = job->slices[k];
+        if (slice < num_slices)
+            buffer2[pos[slice]++] = job->buffer[k];
+    }
+    free(pos);
+
+    char pathbuf[PATH_MAX];
+    char tmppath[PATH_MAX];
+    char *tstring = job->tstring;
+    int half_hour = job->half_hour;
+
+    char *base_dir = Modes.globe_history_dir;
+    if (Modes.heatmap_dir) {
+        base_dir = Modes.heatmap_dir;
+    }
+
+    if (mkdir(base_dir, 0755) && errno != EEXIST)
+        perror(base_dir);
+
+    snprintf(pathbuf, PATH_MAX, "%s/%s", base_dir, tstring);
+    if (mkdir(pathbuf, 0755) && errno != EEXIST)
+        perror(pathbuf);
+
+    snprintf(pathbuf, PATH_MAX, "%s/%s/heatmap", base_dir, tstring);
+    if (mkdir(pathbuf, 0755) && errno != EEXIST)
+        perror(pathbuf);
+
+    snprintf(pathbuf, PATH_MAX, "%s/%s/heatmap/%02d.bin.ttf", base_dir, tstring, half_hour);
+    snprintf(tmppath, PATH_MAX, "%s/%s/heatmap/temp_%lx_%lx", base_dir, tstring, random(), random());
+
+    //fprintf(stderr, "%s using %d positions\n", pathbuf, len);
+
+    int fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(tmppath);
+    } else {
+        int res;
+        gzFile gzfp = gzdopen(fd, "wb");
+        if (!gzfp)
+            fprintf(stderr, "heatmap: gzdopen fail");
+        if (gzbuffer(gzfp, GZBUFFER_BIG) < 0)
+            fprintf(stderr, "gzbuffer fail");
+        res = gzsetparams(gzfp, 9, Z_DEFAULT_STRATEGY);
+        if (res < 0)
+            fprintf(stderr, "gzsetparams fail: %d", res);
+        ssize_t toWrite = sizeof(index);
+        writeGz(gzfp, index, toWrite, tmppath);
+
+        toWrite = len2 * sizeof(struct heatEntry);
+        writeGz(gzfp, buffer2, toWrite, tmppath);
+
+        gzclose(gzfp);
+    }
+    if (rename(tmppath, pathbuf) == -1) {
+        fprintf(stderr, "heatmap rename(): %s -> %s", tmppath, pathbuf);
+        perror("");
+    }
+
+    free(buffer2);
+}
+
+// sorting and compressing the heatmap takes a while, do it in the background
+void *heatmapThreadEntryPoint(void *arg) {
+    MODES_NOTUSED(arg);
+
+    pthread_mutex_lock(&Modes.heatmapThreadMutex);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    while (1) {
+        // the exit signal is sent without holding the mutex, don't wait forever
+        while (!heatmapQueue && !Modes.exit) {
+            incTimedwait(&ts, 1 * SECONDS);
+            pthread_cond_timedwait(&Modes.heatmapThreadCond, &Modes.heatmapThreadMutex, &ts);
         }
-        load_aircraft(&p, end, now);
+
+        // write what was collected before exiting
+        struct heatmapJob *job = heatmapQueue;
+        if (!job)
+            break;
+        heatmapQueue = job->next;
+
+        pthread_mutex_unlock(&Modes.heatmapThreadMutex);
+        heatmap_write(job);
+        heatmap_free(job);
+        pthread_mutex_lock(&Modes.heatmapThreadMutex);
     }
-    free(cb.buffer);
+
+    pthread_mutex_unlock(&Modes.heatmapThreadMutex);
+
+    return NULL;
 }
 
 void handleHeatmap() {
@@ -1135,34 +1424,53 @@ void handleHeatmap() {
 
     Modes.heatmap_current_interval = half_hour;
 
-    char pathbuf[PATH_MAX];
-    char tmppath[PATH_MAX];
+    // the heatmap never had more than this many entries,
+    // one more can be added by the last point (callsign + position)
+    int max_len = 1 * 1024 * 1024;
+
+    struct heatmapJob *job = calloc(1, sizeof(struct heatmapJob));
+    if (!job || heatmap_grow(job, max_len + 1)) {
+        fprintf(stderr, "heatmap: malloc failure!\n");
+        if (job)
+            heatmap_free(job);
+        return;
+    }
+    job->num_slices = num_slices;
+    job->start = start;
+    job->interval = Modes.heatmap_interval;
+    job->half_hour = half_hour;
+    strftime (job->tstring, 100, "%Y-%m-%d", &utc);
+
     int len = 0;
-    int len2 = 0;
-    int alloc = 1 * 1024 * 1024;
-    struct heatEntry *buffer = malloc(alloc * sizeof(struct heatEntry));
-    struct heatEntry *buffer2 = malloc(alloc * sizeof(struct heatEntry));
-    int *slices = malloc(alloc * sizeof(int));
-    struct heatEntry index[num_slices];
+    struct traceIter it;
 
+    // this runs on the main thread like resize_trace(), the traces don't change
+    // apart from points being appended: the entries collected here are a consistent snapshot
     for (int j = 0; j < AIRCRAFT_BUCKETS; j++) {
         for (struct aircraft *a = Modes.aircraft[j]; a; a = a->next) {
             if (a->addr & MODES_NON_ICAO_ADDRESS) continue;
-            if (a->trace_len == 0) continue;
+            if (traceLen(a) == 0) continue;
 
-            struct state *trace = a->trace;
+            struct state *trace;
+            struct state_all *all;
+            // nothing before start is used
+            traceIterInit(&it, a, traceFindTimestamp(a, start));
             uint64_t next = start;
             int slice = 0;
             uint32_t squawk = 8888; // impossible squawk
             uint64_t callsign = 0; // quackery
 
-            for (int i = 0; i < a->trace_len; i++) {
-                if (len >= alloc)
+            while ((trace = traceIterNext(&it, &all))) {
+                // room for the 2 entries this point can add
+                if (len + 2 > job->alloc && job->alloc <= max_len && heatmap_grow(job, max_len + 1))
                     break;
-                if (trace[i].timestamp > end)
+                if (len >= max_len)
                     break;
-                if (trace[i].timestamp > start && i % 4 == 0) {
-                    struct state_all *all = &(a->trace_all[i/4]);
+                if (trace->timestamp > end)
+                    break;
+                struct heatEntry *buffer = job->buffer;
+                int *slices = job->slices;
+                if (trace->timestamp > start && all) {
                     uint64_t *cs = (uint64_t *) &(all->callsign);
                     if (*cs != callsign || squawk != all->squawk) {
 
@@ -1184,27 +1492,27 @@ void handleHeatmap() {
                         len++;
                     }
                 }
-                if (trace[i].timestamp < next)
+                if (trace->timestamp < next)
                     continue;
-                if (!trace[i].flags.altitude_valid)
+                if (!trace->flags.altitude_valid)
                     continue;
 
-                while (trace[i].timestamp > next + Modes.heatmap_interval) {
+                while (trace->timestamp > next + Modes.heatmap_interval) {
                     next += Modes.heatmap_interval;
                     slice++;
                 }
 
                 buffer[len].hex = a->addr;
-                buffer[len].lat = trace[i].lat;
-                buffer[len].lon = trace[i].lon;
+                buffer[len].lat = trace->lat;
+                buffer[len].lon = trace->lon;
 
-                if (!trace[i].flags.on_ground)
-                    buffer[len].alt = trace[i].altitude;
+                if (!trace->flags.on_ground)
+                    buffer[len].alt = trace->altitude;
                 else
                     buffer[len].alt = -123; // on ground
 
-                if (trace[i].flags.gs_valid)
-                    buffer[len].gs = trace[i].gs;
+                if (trace->flags.gs_valid)
+                    buffer[len].gs = trace->gs;
                 else
                     buffer[len].gs = -1; // invalid
 
@@ -1217,78 +1525,22 @@ void handleHeatmap() {
             }
         }
     }
+    job->len = len;
 
-    for (int i = 0; i < num_slices; i++) {
-        struct heatEntry specialSauce = (struct heatEntry) {0};
-        uint64_t slice_stamp = start + i * Modes.heatmap_interval;
-        specialSauce.hex = 0xe7f7c9d;
-        specialSauce.lat = slice_stamp >> 32;
-        specialSauce.lon = slice_stamp & ((1ULL << 32) - 1);
-        specialSauce.alt = Modes.heatmap_interval;
-
-        index[i] = (struct heatEntry) {0};
-        index[i].hex = len2 + num_slices;
-        buffer2[len2++] = specialSauce;
-
-        for (int k = 0; k < len; k++) {
-            if (slices[k] == i)
-                buffer2[len2++] = buffer[k];
-        }
-    }
-
-    char tstring[100];
-    strftime (tstring, 100, "%Y-%m-%d", &utc);
-
-    char *base_dir = Modes.globe_history_dir;
-    if (Modes.heatmap_dir) {
-        base_dir = Modes.heatmap_dir;
-    }
-
-    if (mkdir(base_dir, 0755) && errno != EEXIST)
-        perror(base_dir);
-
-    snprintf(pathbuf, PATH_MAX, "%s/%s", base_dir, tstring);
-    if (mkdir(pathbuf, 0755) && errno != EEXIST)
-        perror(pathbuf);
-
-    snprintf(pathbuf, PATH_MAX, "%s/%s/heatmap", base_dir, tstring);
-    if (mkdir(pathbuf, 0755) && errno != EEXIST)
-        perror(pathbuf);
-
-    snprintf(pathbuf, PATH_MAX, "%s/%s/heatmap/%02d.bin.ttf", base_dir, tstring, half_hour);
-    snprintf(tmppath, PATH_MAX, "%s/%s/heatmap/temp_%lx_%lx", base_dir, tstring, random(), random());
-
-    //fprintf(stderr, "%s using %d positions\n", pathbuf, len);
-
-    int fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0) {
-        perror(tmppath);
-    } else {
-        int res;
-        gzFile gzfp = gzdopen(fd, "wb");
-        if (!gzfp)
-            fprintf(stderr, "heatmap: gzdopen fail");
-        if (gzbuffer(gzfp, GZBUFFER_BIG) < 0)
-            fprintf(stderr, "gzbuffer fail");
-        res = gzsetparams(gzfp, 9, Z_DEFAULT_STRATEGY);
-        if (res < 0)
-            fprintf(stderr, "gzsetparams fail: %d", res);
-        ssize_t toWrite = sizeof(index);
-        writeGz(gzfp, index, toWrite, tmppath);
-
-        toWrite = len2 * sizeof(struct heatEntry);
-        writeGz(gzfp, buffer2, toWrite, tmppath);
-
-        gzclose(gzfp);
-    }
-    if (rename(tmppath, pathbuf) == -1) {
-        fprintf(stderr, "heatmap rename(): %s -> %s", tmppath, pathbuf);
-        perror("");
+    if (!Modes.heatmapThread) {
+        // no heatmap thread (viewadsb), write it right here
+        heatmap_write(job);
+        heatmap_free(job);
+        return;
     }
 
-    free(buffer);
-    free(buffer2);
-    free(slices);
+    pthread_mutex_lock(&Modes.heatmapThreadMutex);
+    struct heatmapJob **tail = &heatmapQueue;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = job;
+    pthread_cond_signal(&Modes.heatmapThreadCond);
+    pthread_mutex_unlock(&Modes.heatmapThreadMutex);
 }
 
 
@@ -1315,6 +1567,10 @@ void checkNewDay() {
 
         strftime (tstring, 100, "%Y-%m-%d", &utc);
 
+        // no more writes for yesterday, index the packs before making them readable
+        if (Modes.globe_history_pack)
+            historyPacksSeal(tstring);
+
         snprintf(filename, PATH_MAX, "%s/%s/traces", Modes.globe_history_dir, tstring);
         chmod(filename, 0755);
     }
@@ -1346,7 +1602,7 @@ void checkNewDay() {
         if (mkdir(filename, 0700) && errno != EEXIST)
             perror(filename);
 
-        for (int i = 0; i < 256; i++) {
+        for (int i = 0; i < 256 && !Modes.globe_history_pack; i++) {
             snprintf(filename, PATH_MAX, "%s/%s/traces/%02x", Modes.globe_history_dir, tstring, i);
             if (mkdir(filename, 0755) && errno != EEXIST)
                 perror(filename);
@@ -1361,11 +1617,102 @@ void unlink_trace(struct aircraft *a) {
     if (!Modes.json_globe_index || !Modes.json_dir)
         return;
 
+    pthread_mutex_lock(&Modes.traceBundleMutex);
+    free(a->trace_recent);
+    a->trace_recent = NULL;
+    pthread_mutex_unlock(&Modes.traceBundleMutex);
+
     snprintf(filename, 1024, "%s/traces/%02x/trace_recent_%s%06x.json", Modes.json_dir, a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
     unlink(filename);
+    httpRemove(filename + strlen(Modes.json_dir) + 1);
 
     snprintf(filename, 1024, "%s/traces/%02x/trace_full_%s%06x.json", Modes.json_dir, a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
     unlink(filename);
+    httpRemove(filename + strlen(Modes.json_dir) + 1);
+
+    if (Modes.json_trace_bin) {
+        snprintf(filename, 1024, "%s/traces/%02x/trace_recent_%s%06x.bin", Modes.json_dir, a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
+        unlink(filename);
+        httpRemove(filename + strlen(Modes.json_dir) + 1);
+
+        snprintf(filename, 1024, "%s/traces/%02x/trace_full_%s%06x.bin", Modes.json_dir, a->addr % 256, (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
+        unlink(filename);
+        httpRemove(filename + strlen(Modes.json_dir) + 1);
+    }
 
     //fprintf(stderr, "unlink %06x: %s\n", a->addr, filename);
 }
+
+void writeTraceBundle(int globe_index) {
+    static int8_t written[GLOBE_MAX_INDEX + 1];
+    char filename[32];
+    snprintf(filename, sizeof(filename), "traces/bundle_%04d.bin", globe_index);
+
+    struct craftArray *ca = &Modes.globeLists[globe_index];
+    int ca_len = ca->len;
+    int count = 0;
+    struct traceBundleEntry *entries = arenaMalloc((ca_len + 1) * sizeof(struct traceBundleEntry));
+    size_t alloc = 64 * 1024;
+    size_t len = 0;
+    unsigned char *data = arenaMalloc(alloc);
+    if (!entries || !data) {
+        arenaFree(entries);
+        arenaFree(data);
+        return;
+    }
+
+    // only copy under the lock, everything else happens after
+    pthread_mutex_lock(&Modes.traceBundleMutex);
+    for (int i = 0; i < ca_len; i++) {
+        struct aircraft *a = ca->list[i];
+        if (!a || !a->trace_recent)
+            continue;
+        struct traceBlob *blob = a->trace_recent;
+        if (len + blob->len > alloc) {
+            size_t newAlloc = 2 * (len + blob->len);
+            unsigned char *tmp = arenaRealloc(data, newAlloc);
+            if (!tmp)
+                break;
+            data = tmp;
+            alloc = newAlloc;
+        }
+        entries[count++] = (struct traceBundleEntry) { .addr = a->addr, .offset = len, .size = blob->len };
+        memcpy(data + len, blob->data, blob->len);
+        len += blob->len;
+    }
+    pthread_mutex_unlock(&Modes.traceBundleMutex);
+
+    if (count == 0) {
+        // don't leave a stale bundle behind, skip tiles that never had one
+        if (written[globe_index]) {
+            char pathbuf[PATH_MAX];
+            snprintf(pathbuf, PATH_MAX, "%s/%s", Modes.json_dir, filename);
+            unlink(pathbuf);
+            httpRemove(filename);
+            written[globe_index] = 0;
+        }
+        arenaFree(entries);
+        arenaFree(data);
+        return;
+    }
+
+    size_t headerSize = sizeof(struct traceBundleHeader) + count * sizeof(struct traceBundleEntry);
+    struct char_buffer cb;
+    cb.len = headerSize + len;
+    cb.buffer = arenaMalloc(cb.len);
+    if (cb.buffer) {
+        struct traceBundleHeader hdr = { .now = mstime(), .count = count, .globe_index = globe_index };
+        memcpy(hdr.magic, TRACE_BUNDLE_MAGIC, sizeof(hdr.magic));
+        for (int k = 0; k < count; k++)
+            entries[k].offset += headerSize;
+        memcpy(cb.buffer, &hdr, sizeof(hdr));
+        memcpy(cb.buffer + sizeof(hdr), entries, count * sizeof(struct traceBundleEntry));
+        memcpy(cb.buffer + headerSize, data, len);
+        // frees cb.buffer
+        writeJsonToFile(Modes.json_dir, filename, cb);
+        written[globe_index] = 1;
+        Modes.stats_current.trace_bundle_files++;
+    }
+    arenaFree(entries);
+    arenaFree(data);
+}
@@ -25,13 +25,52 @@ void init_globe_index(struct tile *s_tiles);
 void *load_state(void *arg);
 void *load_blobs(void *arg);
 void *save_state(void *arg);
+int64_t saved_state_bytes();
 void save_blob(int blob);
+void save_removed(struct aircraft *a);
 void *jsonTraceThreadEntryPoint(void *arg);
 
 void handleHeatmap();
+void *heatmapThreadEntryPoint(void *arg);
 
 void unlink_trace(struct aircraft *a);
 
+// --write-json-trace-bundles: instead of traces/xx/trace_recent_xxxxxx.json the
+// recent traces of all aircraft in a globe tile are written to traces/bundle_xxxx.bin
+// (xxxx: globe index), every tile is rewritten every 10 seconds.
+//
+// struct traceBundleHeader | struct traceBundleEntry[count] | gzip data
+//
+// Each entry points to the gzipped recent trace of one aircraft, the same
+// content trace_recent_xxxxxx.json would have.  Offsets are from the start of
+// the file, host byte order like the binCraft files.
+#define TRACE_BUNDLE_MAGIC "rsbtrbnd"
+
+struct traceBundleHeader {
+    char magic[8];
+    uint64_t now;
+    uint32_t count;
+    uint32_t globe_index;
+};
+
+struct traceBundleEntry {
+    uint32_t addr; // MODES_NON_ICAO_ADDRESS set: trace_recent_~xxxxxx
+    uint32_t offset;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+// a->trace_recent, set by the trace threads, copied into the bundle by the globe thread
+struct traceBlob {
+    uint32_t len;
+    unsigned char data[];
+};
+
+void writeTraceBundle(int globe_index);
+// --write-json-trace-bundles with the HTTP server: make the requested
+// traces/xx/trace_full_xxxxxx.json (or .bin) and publish it, returns 1 if it was
+int traceFullOnDemand(const char *name);
+
 struct craftArray {
     struct aircraft **list;
     int len; // index of highest entry + 1
@@ -43,6 +82,7 @@ void ca_init (struct craftArray *ca);
 void ca_destroy (struct craftArray *ca);
 void ca_remove (struct craftArray *ca, struct aircraft *a);
 void ca_add (struct craftArray *ca, struct aircraft *a);
+void ca_append (struct craftArray *ca, struct aircraft *a);
 void set_globe_index (struct aircraft *a, int new_index);
 
 // this format is fixed, don't change.
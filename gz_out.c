@@ -0,0 +1,129 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// gz_out.c: gzip output from a reused per-thread deflate stream
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+// no references to Modes in here, oneoff/tracepack links this file
+
+#define GZ_HEADER 10
+#define GZ_TRAILER 8
+
+struct gzStream {
+    z_stream strm;
+    int level;
+};
+
+static pthread_key_t gzKey;
+static pthread_once_t gzOnce = PTHREAD_ONCE_INIT;
+
+// thread exit
+static void gzDestroy(void *arg) {
+    struct gzStream *s = arg;
+    deflateEnd(&s->strm);
+    free(s);
+}
+
+static void gzInit() {
+    if (pthread_key_create(&gzKey, gzDestroy))
+        fprintf(stderr, "gz_out: pthread_key_create failed\n");
+}
+
+static struct gzStream *getStream(int level) {
+    pthread_once(&gzOnce, gzInit);
+    struct gzStream *s = pthread_getspecific(gzKey);
+    if (!s) {
+        s = calloc(1, sizeof(struct gzStream));
+        if (!s)
+            return NULL;
+        if (deflateInit2(&s->strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(s);
+            return NULL;
+        }
+        s->level = level;
+        if (pthread_setspecific(gzKey, s)) {
+            gzDestroy(s);
+            return NULL;
+        }
+        return s;
+    }
+    if (deflateReset(&s->strm) != Z_OK)
+        return NULL;
+    // nothing was compressed since the reset, this only switches the parameters
+    if (s->level != level) {
+        if (deflateParams(&s->strm, level, Z_DEFAULT_STRATEGY) != Z_OK)
+            return NULL;
+        s->level = level;
+    }
+    return s;
+}
+
+static inline void put32(unsigned char *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+size_t gzOutBound(size_t len) {
+    // deflateBound() for the default parameters, the stream isn't needed for it
+    return GZ_HEADER + compressBound(len) + GZ_TRAILER;
+}
+
+size_t gzOutTo(char *out, size_t out_alloc, const char *in, size_t len, int level) {
+    struct gzStream *s = getStream(level);
+    if (!s || out_alloc < GZ_HEADER + GZ_TRAILER)
+        return 0;
+
+    unsigned char *o = (unsigned char *) out;
+    unsigned char *p = o;
+
+    // magic, deflate, flags, mtime (not set), extra flags, os (unix)
+    *p++ = 0x1f;
+    *p++ = 0x8b;
+    *p++ = 8;
+    *p++ = 0;
+    put32(p, 0);
+    p += 4;
+    *p++ = 0;
+    *p++ = 3;
+
+    s->strm.next_in = (unsigned char *) in;
+    s->strm.avail_in = len;
+    s->strm.next_out = p;
+    s->strm.avail_out = out_alloc - (p - o) - GZ_TRAILER;
+    if (deflate(&s->strm, Z_FINISH) != Z_STREAM_END)
+        return 0;
+    p = s->strm.next_out;
+
+    put32(p, crc32(0, (const unsigned char *) in, len));
+    put32(p + 4, len);
+    p += GZ_TRAILER;
+    return p - o;
+}
+
+char *gzOut(const char *in, size_t len, int level, size_t *out_len) {
+    size_t bound = gzOutBound(len);
+    char *out = arenaMalloc(bound);
+    if (!out)
+        return NULL;
+    *out_len = gzOutTo(out, bound, in, len, level);
+    if (!*out_len) {
+        arenaFree(out);
+        return NULL;
+    }
+    return out;
+}
@@ -0,0 +1,32 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// gz_out.h: gzip output from a reused per-thread deflate stream
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef GZ_OUT_H
+#define GZ_OUT_H
+
+// Every thread keeps one raw deflate stream, it's reset for each file and
+// the gzip header and trailer are written here.  That saves the setup of
+// a z_stream (about 270 kB of state) or a gzFile for every file written.
+
+// output bytes gzOutTo() needs at most for len bytes of input
+size_t gzOutBound(size_t len);
+// gzip member of in, returns its size or 0 on failure
+size_t gzOutTo(char *out, size_t out_alloc, const char *in, size_t len, int level);
+// the same into a buffer from arenaMalloc(), returns NULL on failure
+char *gzOut(const char *in, size_t len, int level, size_t *out_len);
+
+#endif
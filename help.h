@@ -68,18 +68,24 @@ static struct argp_option options[] =
     {"write-json", OptJsonDir, "<dir>", 0, "Periodically write json output to <dir>", 1},
     {"write-prom", OptPromFile, "<filepath>", 0, "Periodically write prometheus output to <filepath>", 1},
     {"write-globe-history", OptGlobeHistoryDir, "<dir>", 0, "Extended Globe History", 1},
+    {"write-globe-history-pack", OptGlobeHistoryPack, 0, 0, "Append the globe history traces to a few pack files per day instead of one file per aircraft (read them with oneoff/tracepack)", 1},
     {"write-state", OptStateDir, "<dir>", 0, "Write state to disk to have traces after a restart", 1},
     {"heatmap-dir", OptHeatmapDir, "<dir>", 0, "Change the directory where heatmaps are saved (default is in globe history dir)", 1},
     {"heatmap", OptHeatmap, "<interval in seconds>", 0, "Make Heatmap, each aircraft at most every interval seconds (creates historydir/heatmap.bin and exit after that)", 1},
     {"write-json-every", OptJsonTime, "<t>", 0, "Write json output every t seconds (default 1)", 1},
     {"json-location-accuracy", OptJsonLocAcc , "<n>", 0, "Accuracy of receiver location in json metadata: 0=no location, 1=approximate, 2=exact", 1},
     {"write-json-globe-index", OptJsonGlobeIndex, 0, 0, "Write specially indexed globe_xxxx.json files (for tar1090)", 1},
+    {"write-json-globe-threads", OptJsonGlobeThreads, "<n>", 0, "Threads generating and compressing the globe_xxxx files (default: 1, max: 16)", 1},
+    {"write-json-globe-deltas", OptJsonGlobeDeltas, "<n>", 0, "Write globeDelta_xxxx.binCraft with the changes since the previous version of the tile every time, globe_xxxx.binCraft only for every n-th version (default: off)", 1},
+    {"write-json-trace-bin", OptJsonTraceBin, 0, 0, "Also write the traces as traces/xx/trace_full_xxxxxx.bin and trace_recent_xxxxxx.bin, a compact binary format described in net_io.h", 1},
+    {"write-json-trace-bundles", OptJsonTraceBundles, 0, 0, "Write the recent traces as one traces/bundle_xxxx.bin per globe tile every 10 seconds instead of a trace_recent file per aircraft, with --net-http-port the full traces are only made when requested", 1},
     {"write-receiver-id-json", OptNetReceiverIdJson, 0, 0, "Write receivers.json", 1},
+    {"trace-compact-age", OptTraceCompactAge, "<hours>", 0, "Thin out the trace points older than this, positions stay within 100 m and altitudes within 200 ft, leg changes and ground transitions are kept (default: off)", 1},
     {"json-trace-interval", OptJsonTraceInt, "<seconds>", 0, "Interval after which a new position will guaranteed to be written to the trace and the json position output (default: 30)", 1},
     {"write-json-gzip", OptJsonGzip, 0, 0, "Write aircraft.json also as aircraft.json.gz", 1},
     {"write-json-binCraft-only", OptJsonBinCraft, "<n>", 0, "Use only binary binCraft format for globe files (1), for aircraft.json as well (2)", 1},
     {"json-reliable", OptJsonReliable,"<n>", 0, "Minimum position reliability to put it into json (default: 1, globe options will default set this to 2, disable speed filter: -1, max: 4)", 1},
-    {"db-file", OptDbFile, "<file.csv.gz>", 0, "disable db loading: --db-file none Default: /usr/local/share/tar1090/git-db/aircraft.csv.gz", 1},
+    {"db-file", OptDbFile, "<file.csv.gz>", 0, "csv.gz or binary db (oneoff/dbconvert), disable db loading: --db-file none Default: /usr/local/share/tar1090/git-db/aircraft.csv.gz", 1},
 #endif
     {0,0,0,0, "Network options:", 2},
 #if defined(READSB) || defined(VIEWADSB)
@@ -98,6 +104,9 @@ static struct argp_option options[] =
     {"net-vrs-interval", OptNetVRSInterval, "<seconds>", 0, "TCP VRS json output interval (default: 5)", 2},
     {"net-json-port", OptNetJsonPorts, "<ports>", 0, "TCP json position output listen ports (requires --write-json-globe-index) (default: 0)", 2},
     {"net-api-port", OptNetApiPorts, "<ports>", 0, "TCP API listen port (only for exactly one client, needs an external wrapper program communicating via this port) (work in progress) (default: 0)", 2},
+    {"net-http-port", OptNetHttpPorts, "<ports>", 0, "HTTP listen ports serving the --write-json output from memory, /aircraft.json or /data/aircraft.json (default: 0)", 2},
+    {"net-http-threads", OptNetHttpThreads, "<n>", 0, "HTTP server worker threads (default: 1, max: 16)", 2},
+    {"net-http-no-files", OptNetHttpNoFiles, 0, 0, "Don't write the --write-json files, only serve them with --net-http-port", 2},
     {"net-beast-reduce-out-port", OptNetBeastReducePorts, "<ports>", 0, "TCP BeastReduce output listen ports (default: 0)", 2},
     {"net-beast-reduce-interval", OptNetBeastReduceInterval, "<seconds>", 0, "BeastReduce position update interval, longer means less data (default: 0.125, valid range: 0.000 - 14.999)", 2},
     {"net-receiver-id", OptNetReceiverId, 0, 0, "forward receiver ID", 2},
@@ -0,0 +1,518 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// history_pack.c: per day pack files for the globe history traces
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+// no references to Modes in here, oneoff/tracepack links this file
+
+struct historyPack {
+    pthread_mutex_t mutex;
+    int fd; // -1: closed
+    char day[16];
+    uint64_t size; // bytes of complete records
+    struct historyIndexEntry *entries; // in the order they were appended
+    int len;
+    int alloc;
+};
+
+static struct historyPack packs[HISTORY_PACKS];
+static char *history_dir;
+
+// historyPacksSeal compacts the packs in the background
+static pthread_t seal_thread;
+static int seal_running;
+
+static void seal_join() {
+    if (!seal_running)
+        return;
+    pthread_join(seal_thread, NULL);
+    seal_running = 0;
+}
+
+static int entries_add(struct historyIndexEntry **entries, int *len, int *alloc, uint32_t addr, uint32_t size, uint64_t offset) {
+    if (*len == *alloc) {
+        int newAlloc = *alloc ? 2 * *alloc : 1024;
+        struct historyIndexEntry *tmp = realloc(*entries, newAlloc * sizeof(struct historyIndexEntry));
+        if (!tmp)
+            return -1;
+        *entries = tmp;
+        *alloc = newAlloc;
+    }
+    (*entries)[(*len)++] = (struct historyIndexEntry) { .addr = addr, .size = size, .offset = offset };
+    return 0;
+}
+
+static int entry_cmp(const void *p1, const void *p2) {
+    const struct historyIndexEntry *e1 = p1;
+    const struct historyIndexEntry *e2 = p2;
+    if (e1->addr != e2->addr)
+        return (e1->addr > e2->addr) - (e1->addr < e2->addr);
+    return (e1->offset > e2->offset) - (e1->offset < e2->offset);
+}
+
+// sort by addr and keep the newest record of each addr, returns the new length
+static int entries_compact(struct historyIndexEntry *entries, int len) {
+    qsort(entries, len, sizeof(struct historyIndexEntry), entry_cmp);
+    int out = 0;
+    for (int i = 0; i < len; i++) {
+        if (out > 0 && entries[out - 1].addr == entries[i].addr)
+            out--;
+        entries[out++] = entries[i];
+    }
+    return out;
+}
+
+// add the records from offset from to the end of the file, stops at the first
+// incomplete or damaged record header, returns the offset after the last good record
+static uint64_t scan_records(int fd, uint64_t from, struct historyIndexEntry **entries, int *len, int *alloc, const char *path) {
+    struct stat st;
+    if (fstat(fd, &st))
+        return from;
+    uint64_t fileSize = st.st_size;
+    uint64_t pos = from;
+    struct historyRecord rec;
+    while (pos + sizeof(rec) <= fileSize) {
+        if (pread(fd, &rec, sizeof(rec), pos) != sizeof(rec))
+            break;
+        if (rec.magic != HISTORY_RECORD_MAGIC || pos + sizeof(rec) + rec.size > fileSize)
+            break;
+        if (entries_add(entries, len, alloc, rec.addr, rec.size, pos + sizeof(rec)))
+            break;
+        pos += sizeof(rec) + rec.size;
+    }
+    if (pos != fileSize)
+        fprintf(stderr, "%s: ignoring %"PRIu64" bytes of incomplete records at the end\n", path, fileSize - pos);
+    return pos;
+}
+
+// read the index if it's there and matches the pack, returns packSize (0 without index)
+static uint64_t load_index(const char *idxPath, uint64_t fileSize, struct historyIndexEntry **entries, int *len, int *alloc) {
+    int fd = open(idxPath, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    uint64_t packSize = 0;
+    struct historyIndexHeader hdr;
+    if (read(fd, &hdr, sizeof(hdr)) == sizeof(hdr)
+            && memcmp(hdr.magic, HISTORY_INDEX_MAGIC, sizeof(hdr.magic)) == 0
+            && hdr.version == HISTORY_INDEX_VERSION
+            && hdr.packSize <= fileSize) {
+        size_t bytes = hdr.count * sizeof(struct historyIndexEntry);
+        struct historyIndexEntry *tmp = malloc(bytes + 1);
+        if (tmp && read(fd, tmp, bytes) == (ssize_t) bytes) {
+            free(*entries);
+            *entries = tmp;
+            *len = *alloc = hdr.count;
+            packSize = hdr.packSize;
+        } else {
+            free(tmp);
+            fprintf(stderr, "%s: index incomplete, scanning the pack\n", idxPath);
+        }
+    }
+    close(fd);
+    return packSize;
+}
+
+static int pack_paths(const char *dayDir, int pack, char *binPath, char *idxPath) {
+    if (snprintf(binPath, PATH_MAX, "%s/traces/pack_%02d.bin", dayDir, pack) >= PATH_MAX
+            || snprintf(idxPath, PATH_MAX, "%s/traces/pack_%02d.idx", dayDir, pack) >= PATH_MAX) {
+        fprintf(stderr, "%s: path too long\n", dayDir);
+        return -1;
+    }
+    return 0;
+}
+
+// entries of an open pack file, returns the offset after the last good record
+static uint64_t load_entries(int fd, const char *binPath, const char *idxPath, struct historyIndexEntry **entries, int *len, int *alloc) {
+    struct stat st;
+    if (fstat(fd, &st))
+        return 0;
+    uint64_t packSize = load_index(idxPath, st.st_size, entries, len, alloc);
+    return scan_records(fd, packSize, entries, len, alloc, binPath);
+}
+
+// check_write() is in globe_index.c which the reader doesn't link
+static int write_all(int fd, const void *buf, size_t count, const char *path) {
+    ssize_t res = write(fd, buf, count);
+    if (res == (ssize_t) count)
+        return 0;
+    if (res < 0)
+        perror(path);
+    else
+        fprintf(stderr, "%s: Only %zd of %zu bytes written!\n", path, res, count);
+    return -1;
+}
+
+// write the index through a temporary file so readers never see half of it
+static int write_index_file(const char *idxPath, const struct historyIndexEntry *entries, int len, uint64_t packSize) {
+    char tmpPath[PATH_MAX];
+    if (snprintf(tmpPath, PATH_MAX, "%s.tmp", idxPath) >= PATH_MAX)
+        return -1;
+
+    struct historyIndexHeader hdr = { .version = HISTORY_INDEX_VERSION, .count = len, .packSize = packSize };
+    memcpy(hdr.magic, HISTORY_INDEX_MAGIC, sizeof(hdr.magic));
+
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(tmpPath);
+        return -1;
+    }
+    size_t bytes = len * sizeof(struct historyIndexEntry);
+    if (write_all(fd, &hdr, sizeof(hdr), tmpPath) || write_all(fd, entries, bytes, tmpPath)) {
+        close(fd);
+        unlink(tmpPath);
+        return -1;
+    }
+    close(fd);
+    if (rename(tmpPath, idxPath)) {
+        perror(idxPath);
+        unlink(tmpPath);
+        return -1;
+    }
+    return 0;
+}
+
+static int write_index(struct historyPack *p, int pack) {
+    char dayDir[PATH_MAX];
+    char binPath[PATH_MAX];
+    char idxPath[PATH_MAX];
+    snprintf(dayDir, PATH_MAX, "%s/%s", history_dir, p->day);
+    if (pack_paths(dayDir, pack, binPath, idxPath))
+        return -1;
+
+    p->len = entries_compact(p->entries, p->len);
+
+    return write_index_file(idxPath, p->entries, p->len, p->size);
+}
+
+// rewrite a pack with only the newest record of each addr, every permanent
+// write appends a complete trace so most of a days pack is superseded records
+static int pack_compact(const char *dayDir, int pack) {
+    char binPath[PATH_MAX];
+    char idxPath[PATH_MAX];
+    char tmpPath[PATH_MAX];
+    if (pack_paths(dayDir, pack, binPath, idxPath)
+            || snprintf(tmpPath, PATH_MAX, "%s.tmp", binPath) >= PATH_MAX)
+        return -1;
+
+    int fd = open(binPath, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            perror(binPath);
+        return -1;
+    }
+
+    struct historyIndexEntry *entries = NULL;
+    int len = 0;
+    int alloc = 0;
+    uint64_t goodSize = load_entries(fd, binPath, idxPath, &entries, &len, &alloc);
+    len = entries_compact(entries, len);
+
+    uint64_t keep = 0;
+    for (int i = 0; i < len; i++)
+        keep += sizeof(struct historyRecord) + entries[i].size;
+
+    struct stat st;
+    int err = -1;
+    if (fstat(fd, &st)) {
+        perror(binPath);
+        goto out;
+    }
+
+    if (keep == goodSize && (uint64_t) st.st_size == goodSize) {
+        // nothing superseded, the index is all that might be missing
+        err = write_index_file(idxPath, entries, len, goodSize);
+        goto out;
+    }
+
+    int tmp = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (tmp < 0) {
+        perror(tmpPath);
+        goto out;
+    }
+
+    uint64_t pos = 0;
+    char *buf = NULL;
+    uint32_t bufSize = 0;
+    for (int i = 0; i < len; i++) {
+        struct historyIndexEntry *e = &entries[i];
+        size_t bytes = sizeof(struct historyRecord) + e->size;
+        if (e->size > bufSize) {
+            free(buf);
+            bufSize = e->size;
+            buf = malloc(bytes);
+            if (!buf) {
+                fprintf(stderr, "%s: malloc failed\n", tmpPath);
+                break;
+            }
+        }
+        // copy header and gzip data as they are, readers check the crc
+        struct historyRecord *rec = (struct historyRecord *) buf;
+        if (pread(fd, buf, bytes, e->offset - sizeof(struct historyRecord)) != (ssize_t) bytes
+                || rec->magic != HISTORY_RECORD_MAGIC || rec->addr != e->addr || rec->size != e->size) {
+            fprintf(stderr, "%s: record for %06x at offset %"PRIu64" is damaged\n", binPath, e->addr, e->offset);
+            break;
+        }
+        if (write_all(tmp, buf, bytes, tmpPath))
+            break;
+        e->offset = pos + sizeof(struct historyRecord);
+        pos += bytes;
+    }
+    free(buf);
+    close(tmp);
+
+    if (pos != keep) {
+        // keep the pack as it was, it's still readable
+        unlink(tmpPath);
+        goto out;
+    }
+
+    // without an index readers scan the pack, that works for the old and the new one
+    unlink(idxPath);
+    if (rename(tmpPath, binPath)) {
+        perror(binPath);
+        unlink(tmpPath);
+        goto out;
+    }
+    err = write_index_file(idxPath, entries, len, pos);
+
+out:
+    free(entries);
+    close(fd);
+    return err;
+}
+
+static void pack_close(struct historyPack *p, int pack) {
+    if (p->fd < 0)
+        return;
+    write_index(p, pack);
+    close(p->fd);
+    p->fd = -1;
+    p->len = 0;
+}
+
+static int pack_open(struct historyPack *p, int pack, const char *day) {
+    char dayDir[PATH_MAX];
+    char binPath[PATH_MAX];
+    char idxPath[PATH_MAX];
+    snprintf(dayDir, PATH_MAX, "%s/%s", history_dir, day);
+    if (pack_paths(dayDir, pack, binPath, idxPath))
+        return -1;
+
+    int fd = open(binPath, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        perror(binPath);
+        return -1;
+    }
+
+    p->len = 0;
+    p->size = load_entries(fd, binPath, idxPath, &p->entries, &p->len, &p->alloc);
+
+    // the index is written again on close, until then readers scan the pack:
+    // a stale one could cover bytes cut off below and overwritten by appending
+    if (unlink(idxPath) && errno != ENOENT)
+        perror(idxPath);
+
+    // cut off what a crash left behind, appending continues after the last good record
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (uint64_t) st.st_size > p->size && ftruncate(fd, p->size))
+        perror(binPath);
+
+    p->fd = fd;
+    snprintf(p->day, sizeof(p->day), "%s", day);
+    return 0;
+}
+
+void historyPacksInit(const char *dir) {
+    history_dir = strdup(dir);
+    for (int i = 0; i < HISTORY_PACKS; i++) {
+        pthread_mutex_init(&packs[i].mutex, NULL);
+        packs[i].fd = -1;
+    }
+}
+
+int historyPackAppend(const char *day, uint32_t addr, uint64_t timestamp, struct char_buffer cb) {
+    // compress without holding the lock, header and data go out in one write
+    size_t bound = gzOutBound(cb.len);
+    unsigned char *buf = arenaMalloc(sizeof(struct historyRecord) + bound);
+    if (!buf)
+        return -1;
+    uint32_t size = gzOutTo((char *) buf + sizeof(struct historyRecord), bound, cb.buffer, cb.len, 9);
+    if (!size) {
+        arenaFree(buf);
+        return -1;
+    }
+
+    struct historyRecord rec = {
+        .magic = HISTORY_RECORD_MAGIC,
+        .addr = addr,
+        .size = size,
+        .crc = crc32(0, buf + sizeof(rec), size),
+        .timestamp = timestamp,
+    };
+    memcpy(buf, &rec, sizeof(rec));
+
+    int pack = addr % HISTORY_PACKS;
+    struct historyPack *p = &packs[pack];
+    size_t bytes = sizeof(rec) + size;
+
+    pthread_mutex_lock(&p->mutex);
+
+    if (p->fd >= 0 && strcmp(p->day, day) != 0)
+        pack_close(p, pack);
+
+    int err = -1;
+    if (p->fd >= 0 || pack_open(p, pack, day) == 0) {
+        char context[64];
+        snprintf(context, sizeof(context), "%s/pack_%02d.bin", day, pack);
+        if (write_all(p->fd, buf, bytes, context) == 0) {
+            if (entries_add(&p->entries, &p->len, &p->alloc, addr, size, p->size + sizeof(rec)) == 0)
+                err = 0;
+            p->size += bytes;
+        } else if (ftruncate(p->fd, p->size)) {
+            // don't leave a partial record in front of the next one
+            perror(context);
+        }
+    }
+
+    pthread_mutex_unlock(&p->mutex);
+
+    arenaFree(buf);
+    return err;
+}
+
+static void *seal_entry(void *arg) {
+    char *dayDir = arg;
+    for (int i = 0; i < HISTORY_PACKS; i++)
+        pack_compact(dayDir, i);
+    free(dayDir);
+    return NULL;
+}
+
+void historyPacksSeal(const char *day) {
+    for (int i = 0; i < HISTORY_PACKS; i++) {
+        struct historyPack *p = &packs[i];
+        pthread_mutex_lock(&p->mutex);
+        if (p->fd >= 0 && strcmp(p->day, day) == 0)
+            pack_close(p, i);
+        pthread_mutex_unlock(&p->mutex);
+    }
+
+    seal_join();
+
+    char dayDir[PATH_MAX];
+    snprintf(dayDir, PATH_MAX, "%s/%s", history_dir, day);
+    char *arg = strdup(dayDir);
+    if (!arg)
+        return;
+    // rewriting the packs takes a while, don't hold up the caller
+    if (pthread_create(&seal_thread, NULL, seal_entry, arg)) {
+        fprintf(stderr, "%s: couldn't start the seal thread, compacting the packs in place\n", dayDir);
+        seal_entry(arg);
+        return;
+    }
+    seal_running = 1;
+}
+
+void historyPacksClose() {
+    seal_join();
+
+    for (int i = 0; i < HISTORY_PACKS; i++) {
+        struct historyPack *p = &packs[i];
+        pthread_mutex_lock(&p->mutex);
+        pack_close(p, i);
+        free(p->entries);
+        p->entries = NULL;
+        p->alloc = 0;
+        pthread_mutex_unlock(&p->mutex);
+    }
+}
+
+int historyPackLoadIndex(const char *dayDir, int pack, struct historyIndexEntry **entries) {
+    char binPath[PATH_MAX];
+    char idxPath[PATH_MAX];
+    if (pack_paths(dayDir, pack, binPath, idxPath))
+        return -1;
+
+    int fd = open(binPath, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    int len = 0;
+    int alloc = 0;
+    *entries = NULL;
+    load_entries(fd, binPath, idxPath, entries, &len, &alloc);
+    close(fd);
+
+    return entries_compact(*entries, len);
+}
+
+int historyPackReadEntry(const char *dayDir, const struct historyIndexEntry *e, struct char_buffer *out) {
+    char binPath[PATH_MAX];
+    char idxPath[PATH_MAX];
+    if (pack_paths(dayDir, e->addr % HISTORY_PACKS, binPath, idxPath))
+        return -1;
+
+    int fd = open(binPath, O_RDONLY);
+    if (fd < 0) {
+        perror(binPath);
+        return -1;
+    }
+
+    int err = -1;
+    struct historyRecord rec;
+    char *buf = malloc(e->size + 1);
+    if (buf
+            && pread(fd, &rec, sizeof(rec), e->offset - sizeof(rec)) == sizeof(rec)
+            && pread(fd, buf, e->size, e->offset) == (ssize_t) e->size) {
+        if (rec.magic == HISTORY_RECORD_MAGIC && rec.addr == e->addr && rec.size == e->size
+                && rec.crc == crc32(0, (unsigned char *) buf, e->size)) {
+            out->buffer = buf;
+            out->len = e->size;
+            buf = NULL;
+            err = 0;
+        } else {
+            fprintf(stderr, "%s: record for %06x at offset %"PRIu64" is damaged\n", binPath, e->addr, e->offset);
+        }
+    }
+    free(buf);
+    close(fd);
+    return err;
+}
+
+int historyPackRead(const char *dayDir, uint32_t addr, struct char_buffer *out) {
+    struct historyIndexEntry *entries;
+    int len = historyPackLoadIndex(dayDir, addr % HISTORY_PACKS, &entries);
+    if (len < 0)
+        return -1;
+
+    // after compacting there is at most one entry per addr
+    int lo = 0, hi = len;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (entries[mid].addr < addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int err = -1;
+    if (lo < len && entries[lo].addr == addr)
+        err = historyPackReadEntry(dayDir, &entries[lo], out);
+
+    free(entries);
+    return err;
+}
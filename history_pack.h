@@ -0,0 +1,90 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// history_pack.h: per day pack files for the globe history traces
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HISTORY_PACK_H
+#define HISTORY_PACK_H
+
+// With --write-globe-history-pack the daily traces are not written as one
+// file per aircraft but appended to HISTORY_PACKS pack files per day:
+//
+// <history dir>/<day>/traces/pack_XX.bin (XX = addr % HISTORY_PACKS)
+//
+// pack file: struct historyRecord | gzip data | struct historyRecord | gzip data ...
+//
+// Each record is the complete trace_full json of one aircraft for that day,
+// the gzip data is what trace_full_xxxxxx.json used to contain.  An aircraft
+// gets a new record on every permanent write, the last record wins.
+//
+// When the day is sealed (20 min after midnight) each pack is rewritten with
+// only the newest record of each aircraft and pack_XX.idx is written:
+//
+// struct historyIndexHeader | struct historyIndexEntry[count] (sorted by addr)
+//
+// Records appended after the index was written (packSize) are found by
+// scanning the pack from packSize, the index is optional for readers.
+// Values are in host byte order.
+
+#define HISTORY_PACKS 16
+#define HISTORY_RECORD_MAGIC 0x6b706873 // "shpk"
+#define HISTORY_INDEX_MAGIC "readsbix"
+#define HISTORY_INDEX_VERSION 1
+
+struct historyRecord {
+    uint32_t magic;
+    uint32_t addr;
+    uint32_t size; // bytes of gzip data following this header
+    uint32_t crc; // crc32 of the gzip data
+    uint64_t timestamp; // time of the write in ms
+};
+
+struct historyIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t packSize; // bytes of the pack covered by this index
+};
+
+struct historyIndexEntry {
+    uint32_t addr;
+    uint32_t size;
+    uint64_t offset; // of the gzip data (after the record header)
+};
+
+// directory the day directories are in, call before anything else
+void historyPacksInit(const char *dir);
+// gzip cb and append it as the newest record for addr to the pack of that day
+// (YYYY-MM-DD), returns -1 on error
+int historyPackAppend(const char *day, uint32_t addr, uint64_t timestamp, struct char_buffer cb);
+// close the packs of that day, then drop the superseded records and write the
+// index in a background thread, nothing may be appended to that day afterwards
+void historyPacksSeal(const char *day);
+// wait for a running seal, write the index of all open packs and close them,
+// appending reopens them
+void historyPacksClose();
+
+// reading, dayDir is <history dir>/<day>
+
+// entries of pack number pack, sorted by addr, only the newest record of each addr
+// uses the index and scans the part of the pack not covered by it
+// returns the number of entries or -1 if the pack can't be read, *entries must be freed
+int historyPackLoadIndex(const char *dayDir, int pack, struct historyIndexEntry **entries);
+// gzip data of the record an entry points to, returns -1 if it's damaged
+int historyPackReadEntry(const char *dayDir, const struct historyIndexEntry *e, struct char_buffer *out);
+// gzip data of the newest record for addr, returns -1 if not found or damaged
+int historyPackRead(const char *dayDir, uint32_t addr, struct char_buffer *out);
+
+#endif
@@ -0,0 +1,265 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// historytests.c - round trip tests for the history pack files
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+#define ADDRS 40
+#define VERSIONS 5
+#define NOW 1600000000000ULL
+// day directories, keeps the paths built from them well below PATH_MAX
+#define DIR_LEN 256
+
+// deterministic pseudo random numbers so failures are reproducible
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+static uint32_t rnd(uint32_t n) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t) ((rng_state * 0x2545F4914F6CDD1DULL) >> 32) % n;
+}
+
+static char history_dir[64];
+
+// something shaped like a trace_full json, longer for later versions like a growing trace
+static void fill_json(char *buf, size_t size, uint32_t addr, int version) {
+    int len = snprintf(buf, size, "{\"icao\":\"%06x\",\"version\":%d,\"trace\":[", addr, version);
+    int points = 20 + version * 10 + rnd(10);
+    for (int i = 0; i < points && (size_t) len + 64 < size; i++)
+        len += snprintf(buf + len, size - len, "%s[%d,%.5f,%.5f,%d]", i ? "," : "", i * 4 + (int) rnd(4),
+                50.0 + rnd(100000) / 1e5, 8.0 + rnd(100000) / 1e5, 1000 + (int) rnd(30000));
+    snprintf(buf + len, size - len, "]}");
+}
+
+static int append(const char *name, const char *day, uint32_t addr, uint64_t timestamp, char *json) {
+    struct char_buffer cb = { .buffer = json, .len = strlen(json) };
+    if (historyPackAppend(day, addr, timestamp, cb)) {
+        fprintf(stderr, "%s: FAIL: append for %06x failed\n", name, addr);
+        return 0;
+    }
+    return 1;
+}
+
+static int make_day(const char *day, char *dayDir) {
+    char path[PATH_MAX];
+    snprintf(dayDir, DIR_LEN, "%s/%.15s", history_dir, day);
+    snprintf(path, PATH_MAX, "%s/traces", dayDir);
+    return mkdir(dayDir, 0755) == 0 && mkdir(path, 0755) == 0;
+}
+
+static uint64_t pack_size(const char *dayDir, int pack) {
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/traces/pack_%02d.bin", dayDir, pack);
+    struct stat st;
+    return stat(path, &st) ? 0 : (uint64_t) st.st_size;
+}
+
+// the newest record for addr must inflate to expected
+static int check_read(const char *name, const char *dayDir, uint32_t addr, const char *expected) {
+    struct char_buffer cb;
+    if (historyPackRead(dayDir, addr, &cb)) {
+        fprintf(stderr, "%s: FAIL: no record for %06x\n", name, addr);
+        return 0;
+    }
+    size_t len = strlen(expected);
+    char *plain = malloc(len + 1);
+    z_stream strm = { 0 };
+    int ok = (inflateInit2(&strm, 16 + MAX_WBITS) == Z_OK);
+    if (ok) {
+        strm.next_in = (unsigned char *) cb.buffer;
+        strm.avail_in = cb.len;
+        strm.next_out = (unsigned char *) plain;
+        strm.avail_out = len + 1;
+        ok = (inflate(&strm, Z_FINISH) == Z_STREAM_END && strm.total_out == len && memcmp(plain, expected, len) == 0);
+        inflateEnd(&strm);
+    }
+    if (!ok)
+        fprintf(stderr, "%s: FAIL: record for %06x doesn't match what was appended\n", name, addr);
+    free(plain);
+    free(cb.buffer);
+    return ok;
+}
+
+// the index must cover the whole pack and every record in it must be one that is read
+static int check_sealed(const char *name, const char *dayDir, int pack) {
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/traces/pack_%02d.idx", dayDir, pack);
+    struct historyIndexHeader hdr;
+    int fd = open(path, O_RDONLY);
+    int ok = (fd >= 0 && read(fd, &hdr, sizeof(hdr)) == sizeof(hdr));
+    if (fd >= 0)
+        close(fd);
+
+    struct historyIndexEntry *entries;
+    int len = historyPackLoadIndex(dayDir, pack, &entries);
+    uint64_t bytes = 0;
+    for (int i = 0; i < len; i++)
+        bytes += sizeof(struct historyRecord) + entries[i].size;
+    if (len >= 0)
+        free(entries);
+
+    uint64_t size = pack_size(dayDir, pack);
+    if (!ok || hdr.packSize != size || (int) hdr.count != len || bytes != size) {
+        fprintf(stderr, "%s: FAIL: pack %02d: %"PRIu64" bytes, %"PRIu64" bytes in %d newest records, index covers %"PRIu64"\n",
+                name, pack, size, bytes, len, ok ? hdr.packSize : 0);
+        return 0;
+    }
+    return 1;
+}
+
+// every aircraft written several times, sealing keeps only the newest record of each
+static int testRoundTrip() {
+    const char *name = "testRoundTrip";
+    const char *day = "2020-09-13";
+    char dayDir[DIR_LEN];
+    int ok = make_day(day, dayDir);
+
+    uint32_t addrs[ADDRS];
+    char *newest[ADDRS];
+    for (int k = 0; k < ADDRS; k++) {
+        addrs[k] = 0x3c0000 + k * 7 + rnd(5);
+        newest[k] = malloc(16384);
+    }
+
+    uint64_t timestamp = NOW;
+    for (int v = 0; v < VERSIONS; v++) {
+        for (int k = 0; k < ADDRS; k++) {
+            fill_json(newest[k], 16384, addrs[k], v);
+            ok &= append(name, day, addrs[k], timestamp += 1000, newest[k]);
+        }
+        // reopening continues after the records already there
+        if (v == 1)
+            historyPacksClose();
+    }
+    // readable before the seal, the index covers only part of the packs
+    for (int k = 0; k < ADDRS; k++)
+        ok &= check_read(name, dayDir, addrs[k], newest[k]);
+
+    uint64_t before = 0;
+    for (int i = 0; i < HISTORY_PACKS; i++)
+        before += pack_size(dayDir, i);
+
+    historyPacksSeal(day);
+    // waits for the seal
+    historyPacksClose();
+
+    uint64_t after = 0;
+    for (int i = 0; i < HISTORY_PACKS; i++) {
+        after += pack_size(dayDir, i);
+        // not every pack got an aircraft
+        if (pack_size(dayDir, i))
+            ok &= check_sealed(name, dayDir, i);
+    }
+    for (int k = 0; k < ADDRS; k++)
+        ok &= check_read(name, dayDir, addrs[k], newest[k]);
+
+    // the newest version is the largest, still the others are most of the data
+    if (after * 2 > before) {
+        fprintf(stderr, "%s: FAIL: sealed packs are %"PRIu64" bytes, %"PRIu64" before\n", name, after, before);
+        ok = 0;
+    }
+
+    for (int k = 0; k < ADDRS; k++)
+        free(newest[k]);
+    fprintf(stderr, "%s:%*s%s\n", name, (int) (19 - strlen(name)), "", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// a pack cut short within its last record: the records before it are still read,
+// appending continues after them and the seal drops the partial record
+static int testTruncatedTail() {
+    const char *name = "testTruncatedTail";
+    const char *day = "2020-09-14";
+    char dayDir[DIR_LEN];
+    int ok = make_day(day, dayDir);
+
+    uint32_t a = 0x4b1810;
+    uint32_t b = a + HISTORY_PACKS;
+    int pack = a % HISTORY_PACKS;
+    char a0[4096], a1[4096], a2[4096], b0[4096];
+    fill_json(a0, sizeof(a0), a, 0);
+    fill_json(a1, sizeof(a1), a, 1);
+    fill_json(a2, sizeof(a2), a, 2);
+    fill_json(b0, sizeof(b0), b, 0);
+
+    ok &= append(name, day, a, NOW, a0);
+    ok &= append(name, day, b, NOW + 1000, b0);
+    ok &= append(name, day, a, NOW + 2000, a1);
+    historyPacksClose();
+
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/traces/pack_%02d.bin", dayDir, pack);
+    uint64_t full = pack_size(dayDir, pack);
+    if (truncate(path, full - 10)) {
+        perror(path);
+        ok = 0;
+    }
+
+    // the index covers more than is left of the pack, it's ignored and the pack scanned
+    ok &= check_read(name, dayDir, a, a0);
+    ok &= check_read(name, dayDir, b, b0);
+
+    ok &= append(name, day, a, NOW + 3000, a2);
+    ok &= check_read(name, dayDir, a, a2);
+    ok &= check_read(name, dayDir, b, b0);
+
+    historyPacksSeal(day);
+    historyPacksClose();
+
+    ok &= check_sealed(name, dayDir, pack);
+    ok &= check_read(name, dayDir, a, a2);
+    ok &= check_read(name, dayDir, b, b0);
+
+    fprintf(stderr, "%s:%*s%s\n", name, (int) (19 - strlen(name)), "", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+static void remove_dir(const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir)
+        return;
+    struct dirent *ent;
+    while ((ent = readdir(dir))) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        char sub[PATH_MAX];
+        snprintf(sub, PATH_MAX, "%s/%s", path, ent->d_name);
+        if (unlink(sub))
+            remove_dir(sub);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+int main(int argc, char **argv) {
+    MODES_NOTUSED(argc);
+    MODES_NOTUSED(argv);
+
+    snprintf(history_dir, sizeof(history_dir), "/tmp/historytests.XXXXXX");
+    if (!mkdtemp(history_dir)) {
+        perror(history_dir);
+        return 1;
+    }
+    historyPacksInit(history_dir);
+
+    int ok = 1;
+    ok &= testRoundTrip();
+    ok &= testTruncatedTail();
+
+    remove_dir(history_dir);
+    return ok ? 0 : 1;
+}
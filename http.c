@@ -0,0 +1,1057 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// http.c: built-in HTTP/1.1 server for the --write-json output
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define HTTP_BUCKETS (1 << 16) // files hash table, one entry per trace file
+#define HTTP_LOCKS 64
+#define HTTP_REQUEST_MAX 8192 // request line and headers
+#define HTTP_IDLE_TIMEOUT (60 * 1000) // ms without progress before a connection is closed
+#define HTTP_MAX_CONNECTIONS 4096 // per worker
+#define WS_SNDBUF (32 * 1024) // socket send buffer of a websocket, the kernel doubles it
+
+struct httpFile {
+    struct httpFile *next;
+    uint64_t hash; // of the name
+    int refs; // the table and every connection sending it, protected by the lock of the bucket
+    char *plain;
+    size_t plain_len;
+    char *gz;
+    size_t gz_len;
+    char etag[20];
+    char name[];
+};
+
+struct httpConn {
+    int fd;
+    int in_len;
+    int eof; // the client shut down its side
+    int close; // close after the response
+    int sending;
+    int head_len;
+    uint64_t last_active;
+    struct httpFile *file; // referenced while its content is sent
+    char *inflated; // body for clients not accepting gzip
+    const char *body;
+    size_t body_len;
+    size_t sent; // bytes of head and body
+    struct wsState *ws; // after the upgrade to a websocket
+    char head[512];
+    char in[HTTP_REQUEST_MAX];
+};
+
+// tiles a websocket client subscribed to
+struct wsState {
+    int *tiles;
+    uint32_t *sent; // version of the tile the client has, 0: none
+    int len;
+    int next; // round robin over the tiles
+};
+
+struct httpWorker {
+    pthread_t thread;
+    int wake[2]; // pipe, new tile versions for the websockets
+    struct httpConn **conns;
+    int len;
+    int alloc;
+    struct pollfd *pfds;
+};
+
+static struct httpFile **buckets;
+static pthread_mutex_t locks[HTTP_LOCKS];
+static int enabled;
+static int *listen_fds;
+static int listen_count;
+static struct httpWorker workers[HTTP_THREADS];
+static int worker_count;
+static uint32_t tileVersion[GLOBE_MAX_INDEX + 1]; // newest ws/delta_xxxx version, __atomic: set by the globe workers
+
+static inline pthread_mutex_t *bucketLock(uint64_t hash) {
+    return &locks[(hash & (HTTP_BUCKETS - 1)) % HTTP_LOCKS];
+}
+
+static void fileFree(struct httpFile *f) {
+    free(f->plain);
+    free(f->gz);
+    free(f);
+}
+
+static void fileRelease(struct httpFile *f) {
+    pthread_mutex_t *lock = bucketLock(f->hash);
+    pthread_mutex_lock(lock);
+    int last = (--f->refs == 0);
+    pthread_mutex_unlock(lock);
+    if (last)
+        fileFree(f);
+}
+
+// returns a reference, release it with fileRelease()
+static struct httpFile *fileGet(const char *name) {
+    uint64_t hash = fasthash64(name, strlen(name), 0x5bd1e995);
+    pthread_mutex_t *lock = bucketLock(hash);
+    pthread_mutex_lock(lock);
+    struct httpFile *f = buckets[hash & (HTTP_BUCKETS - 1)];
+    while (f && (f->hash != hash || strcmp(f->name, name)))
+        f = f->next;
+    if (f)
+        f->refs++;
+    pthread_mutex_unlock(lock);
+    return f;
+}
+
+// put f in place of the file with the same name (f NULL: remove it)
+static void fileReplace(const char *name, uint64_t hash, struct httpFile *f) {
+    pthread_mutex_t *lock = bucketLock(hash);
+    pthread_mutex_lock(lock);
+    struct httpFile **pp = &buckets[hash & (HTTP_BUCKETS - 1)];
+    while (*pp && ((*pp)->hash != hash || strcmp((*pp)->name, name)))
+        pp = &(*pp)->next;
+    struct httpFile *old = *pp;
+    if (f) {
+        f->next = old ? old->next : *pp;
+        *pp = f;
+    } else if (old) {
+        *pp = old->next;
+    }
+    int last = old && (--old->refs == 0);
+    pthread_mutex_unlock(lock);
+    if (last)
+        fileFree(old);
+}
+
+int httpEnabled() {
+    return enabled;
+}
+
+void httpPublish(const char *file, char *plain, size_t plain_len, char *gz, size_t gz_len) {
+    if (!plain && !gz)
+        return;
+    size_t nameLen = strlen(file);
+    struct httpFile *f = malloc(sizeof(struct httpFile) + nameLen + 1);
+    if (!f) {
+        free(plain);
+        free(gz);
+        return;
+    }
+    f->next = NULL;
+    f->hash = fasthash64(file, nameLen, 0x5bd1e995);
+    f->refs = 1;
+    f->plain = plain;
+    f->plain_len = plain_len;
+    f->gz = gz;
+    f->gz_len = gz_len;
+    uint64_t etag = plain ? fasthash64(plain, plain_len, 0) : fasthash64(gz, gz_len, 0);
+    snprintf(f->etag, sizeof(f->etag), "\"%016"PRIx64"\"", etag);
+    memcpy(f->name, file, nameLen + 1);
+
+    fileReplace(f->name, f->hash, f);
+}
+
+void httpRemove(const char *file) {
+    if (!enabled)
+        return;
+    fileReplace(file, fasthash64(file, strlen(file), 0x5bd1e995), NULL);
+}
+
+static const char *contentType(const char *name) {
+    const char *ext = strrchr(name, '.');
+    if (!ext)
+        return "application/octet-stream";
+    if (!strcmp(ext, ".json"))
+        return "application/json";
+    if (!strcmp(ext, ".gz"))
+        return "application/gzip";
+    if (!strcmp(ext, ".csv"))
+        return "text/csv";
+    return "application/octet-stream";
+}
+
+static int endsWith(const char *s, const char *suffix) {
+    size_t len = strlen(s);
+    size_t slen = strlen(suffix);
+    return len >= slen && !strcmp(s + len - slen, suffix);
+}
+
+// the gzip trailer has the uncompressed size
+static char *gunzip(const char *gz, size_t gz_len, size_t *len) {
+    if (gz_len < 18)
+        return NULL;
+    const unsigned char *t = (const unsigned char *) gz + gz_len - 4;
+    uint32_t isize = t[0] | t[1] << 8 | t[2] << 16 | (uint32_t) t[3] << 24;
+    char *out = malloc(isize + 1);
+    if (!out)
+        return NULL;
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK) {
+        free(out);
+        return NULL;
+    }
+    strm.next_in = (unsigned char *) gz;
+    strm.avail_in = gz_len;
+    strm.next_out = (unsigned char *) out;
+    strm.avail_out = isize + 1;
+    int res = inflate(&strm, Z_FINISH);
+    *len = strm.total_out;
+    inflateEnd(&strm);
+    if (res != Z_STREAM_END || *len != isize) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+static const char *statusText(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 431: return "Request Header Fields Too Large";
+        default: return "Internal Server Error";
+    }
+}
+
+// queue the response, c->file and c->inflated are already set if they are the body
+static void respond(struct httpConn *c, int status, const char *type, const char *encoding,
+        const char *etag, int vary, const char *body, size_t body_len, int head_only) {
+    char *p = c->head;
+    char *end = c->head + sizeof(c->head);
+    p = safe_snprintf(p, end, "HTTP/1.1 %d %s\r\nServer: readsb\r\n", status, statusText(status));
+    if (status != 304) {
+        if (type)
+            p = safe_snprintf(p, end, "Content-Type: %s\r\n", type);
+        p = safe_snprintf(p, end, "Content-Length: %zu\r\n", body_len);
+    }
+    if (status == 405)
+        p = safe_snprintf(p, end, "Allow: GET, HEAD\r\n");
+    if (encoding)
+        p = safe_snprintf(p, end, "Content-Encoding: %s\r\n", encoding);
+    if (vary)
+        p = safe_snprintf(p, end, "Vary: Accept-Encoding\r\n");
+    if (etag)
+        p = safe_snprintf(p, end, "ETag: %s\r\nCache-Control: no-cache\r\n", etag);
+    p = safe_snprintf(p, end, "Connection: %s\r\n\r\n", c->close ? "close" : "keep-alive");
+
+    c->head_len = p - c->head;
+    c->body = (head_only || status == 304) ? NULL : body;
+    c->body_len = c->body ? body_len : 0;
+    c->sent = 0;
+    c->sending = 1;
+}
+
+static void respondError(struct httpConn *c, int status) {
+    static const char *text[] = { "not found\n", "error\n" };
+    const char *body = (status == 404) ? text[0] : text[1];
+    if (status == 400 || status == 431)
+        c->close = 1;
+    respond(c, status, "text/plain", NULL, NULL, 0, body, strlen(body), 0);
+}
+
+// SHA-1 and base64 for the websocket handshake (RFC 6455)
+static uint32_t rol32(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1(const unsigned char *data, size_t len, unsigned char out[20]) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    size_t total = ((len + 8) / 64 + 1) * 64;
+    for (size_t off = 0; off < total; off += 64) {
+        unsigned char block[64];
+        for (int i = 0; i < 64; i++) {
+            size_t k = off + i;
+            if (k < len)
+                block[i] = data[k];
+            else if (k == len)
+                block[i] = 0x80;
+            else if (k >= total - 8)
+                block[i] = (uint64_t) len * 8 >> (8 * (total - 1 - k));
+            else
+                block[i] = 0;
+        }
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t) block[4 * i] << 24 | block[4 * i + 1] << 16 | block[4 * i + 2] << 8 | block[4 * i + 3];
+        for (int i = 16; i < 80; i++)
+            w[i] = rol32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t t = rol32(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rol32(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    for (int i = 0; i < 20; i++)
+        out[i] = h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+static char *base64(char *p, const unsigned char *data, size_t len) {
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = data[i] << 16 | (i + 1 < len ? data[i + 1] << 8 : 0) | (i + 2 < len ? data[i + 2] : 0);
+        *p++ = digits[v >> 18 & 63];
+        *p++ = digits[v >> 12 & 63];
+        *p++ = (i + 1 < len) ? digits[v >> 6 & 63] : '=';
+        *p++ = (i + 2 < len) ? digits[v & 63] : '=';
+    }
+    *p = 0;
+    return p;
+}
+
+static void wsFree(struct wsState *ws) {
+    if (!ws)
+        return;
+    free(ws->tiles);
+    free(ws->sent);
+    free(ws);
+}
+
+static void wsHandshake(struct httpConn *c, const char *key) {
+    static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    char buf[128];
+    unsigned char digest[20];
+    char accept[32];
+    snprintf(buf, sizeof(buf), "%s%s", key, guid);
+    sha1((unsigned char *) buf, strlen(buf), digest);
+    base64(accept, digest, sizeof(digest));
+
+    c->ws = calloc(1, sizeof(struct wsState));
+    if (!c->ws) {
+        respondError(c, 500);
+        return;
+    }
+    c->close = 0;
+    // keep the queue in the kernel short: a slow client gets a full tile
+    // with the newest version instead of every delta it couldn't keep up with
+    char err[ANET_ERR_LEN];
+    anetSetSendBuffer(err, c->fd, WS_SNDBUF);
+    char *p = c->head;
+    char *end = c->head + sizeof(c->head);
+    p = safe_snprintf(p, end, "HTTP/1.1 101 Switching Protocols\r\nServer: readsb\r\n"
+            "Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+    c->head_len = p - c->head;
+    c->body = NULL;
+    c->body_len = 0;
+    c->sent = 0;
+    c->sending = 1;
+}
+
+// frame header of a server frame (not masked), returns its length
+static int wsFrameHeader(char *p, int opcode, uint64_t len) {
+    unsigned char *b = (unsigned char *) p;
+    b[0] = 0x80 | opcode;
+    if (len < 126) {
+        b[1] = len;
+        return 2;
+    }
+    if (len < 65536) {
+        b[1] = 126;
+        b[2] = len >> 8;
+        b[3] = len;
+        return 4;
+    }
+    b[1] = 127;
+    for (int i = 0; i < 8; i++)
+        b[2 + i] = len >> (56 - 8 * i);
+    return 10;
+}
+
+// control frame with the payload in the head, len <= 125
+static void wsQueueControl(struct httpConn *c, int opcode, const char *payload, int len) {
+    int n = wsFrameHeader(c->head, opcode, len);
+    memcpy(c->head + n, payload, len);
+    c->head_len = n + len;
+    c->body = NULL;
+    c->body_len = 0;
+    c->sent = 0;
+    c->sending = 1;
+}
+
+// the message holds a reference to f until it's sent
+static void wsQueueTile(struct httpConn *c, struct httpFile *f, uint32_t type) {
+    int n = wsFrameHeader(c->head, 2, sizeof(type) + f->plain_len);
+    memcpy(c->head + n, &type, sizeof(type));
+    c->head_len = n + sizeof(type);
+    c->file = f;
+    c->body = f->plain;
+    c->body_len = f->plain_len;
+    c->sent = 0;
+    c->sending = 1;
+}
+
+// the version of a full tile or a delta is at byte 20 of the header
+static uint32_t wsVersion(const struct httpFile *f) {
+    uint32_t version = 0;
+    if (f->plain && f->plain_len >= 24)
+        memcpy(&version, f->plain + 20, sizeof(version));
+    return version;
+}
+
+static void wsSubscribe(struct httpConn *c, const int *tiles, int len) {
+    struct wsState *ws = c->ws;
+    int *newTiles = malloc((len + 1) * sizeof(int));
+    uint32_t *newSent = malloc((len + 1) * sizeof(uint32_t));
+    if (!newTiles || !newSent) {
+        free(newTiles);
+        free(newSent);
+        return;
+    }
+    int n = 0;
+    for (int i = 0; i < len; i++) {
+        int dup = 0;
+        for (int k = 0; k < n && !dup; k++)
+            dup = (newTiles[k] == tiles[i]);
+        if (dup)
+            continue;
+        newTiles[n] = tiles[i];
+        // the client keeps the tiles it had
+        newSent[n] = 0;
+        for (int k = 0; k < ws->len; k++) {
+            if (ws->tiles[k] == tiles[i])
+                newSent[n] = ws->sent[k];
+        }
+        n++;
+    }
+    free(ws->tiles);
+    free(ws->sent);
+    ws->tiles = newTiles;
+    ws->sent = newSent;
+    ws->len = n;
+    ws->next = 0;
+}
+
+// the globe tiles overlapping the box, special tiles are on the same grid
+static int boxTiles(double south, double west, double north, double east, int *tiles) {
+    int grid = GLOBE_INDEX_GRID;
+    if (!(south <= north) || south < -90 || north > 90 || west < -180 || west > 180 || east < -180 || east > 180)
+        return 0;
+    if (east < west)
+        east += 360; // crosses the date line
+    int n = 0;
+    for (double lat = floor(south / grid) * grid; lat <= north && lat < 90; lat += grid) {
+        for (double lon = floor(west / grid) * grid; lon <= east; lon += grid) {
+            double l = lon >= 180 ? lon - 360 : lon;
+            int index = globe_index(lat + grid / 2.0, l + grid / 2.0);
+            if (index >= 0 && index <= GLOBE_MAX_INDEX && n <= GLOBE_MAX_INDEX)
+                tiles[n++] = index;
+        }
+    }
+    return n;
+}
+
+// "tiles <index>,<index>,..." or "box <south> <west> <north> <east>"
+static void wsCommand(struct httpConn *c, char *msg) {
+    int *tiles = malloc((GLOBE_MAX_INDEX + 2) * sizeof(int));
+    if (!tiles)
+        return;
+    int n = 0;
+    if (!strncmp(msg, "tiles", 5)) {
+        char *p = msg + 5;
+        while (*p && n <= GLOBE_MAX_INDEX) {
+            char *end;
+            long index = strtol(p, &end, 10);
+            if (end == p) {
+                p++;
+                continue;
+            }
+            if (index >= 0 && index <= GLOBE_MAX_INDEX)
+                tiles[n++] = index;
+            p = end;
+        }
+        wsSubscribe(c, tiles, n);
+    } else if (!strncmp(msg, "box", 3)) {
+        double south, west, north, east;
+        if (sscanf(msg + 3, "%lf %lf %lf %lf", &south, &west, &north, &east) == 4) {
+            n = boxTiles(south, west, north, east, tiles);
+            wsSubscribe(c, tiles, n);
+        }
+    }
+    free(tiles);
+}
+
+// frames from the client, they are masked, messages in one frame only
+// returns -1 if the connection is to be closed
+static int wsRead(struct httpConn *c) {
+    while (!c->sending && c->in_len >= 2) {
+        unsigned char *b = (unsigned char *) c->in;
+        int fin = b[0] & 0x80;
+        int opcode = b[0] & 0x0f;
+        size_t len = b[1] & 0x7f;
+        int hdr = 2;
+        if (!(b[1] & 0x80) || len == 127)
+            return -1;
+        if (len == 126) {
+            if (c->in_len < 4)
+                return 0;
+            len = b[2] << 8 | b[3];
+            hdr = 4;
+        }
+        size_t frameLen = hdr + 4 + len;
+        if (frameLen > HTTP_REQUEST_MAX)
+            return -1;
+        if ((size_t) c->in_len < frameLen)
+            return 0;
+        char *payload = c->in + hdr + 4;
+        for (size_t i = 0; i < len; i++)
+            payload[i] ^= b[hdr + i % 4];
+
+        switch (opcode) {
+            case 1: // text
+                if (fin) {
+                    char *msg = malloc(len + 1);
+                    if (msg) {
+                        memcpy(msg, payload, len);
+                        msg[len] = 0;
+                        wsCommand(c, msg);
+                        free(msg);
+                    }
+                }
+                break;
+            case 8: // close
+                c->close = 1;
+                wsQueueControl(c, 8, payload, min(len, 2));
+                break;
+            case 9: // ping
+                wsQueueControl(c, 10, payload, min(len, 125));
+                break;
+            default:
+                break;
+        }
+        memmove(c->in, c->in + frameLen, c->in_len - frameLen);
+        c->in_len -= frameLen;
+    }
+    return 0;
+}
+
+// queue the next tile the client doesn't have the newest version of: the delta
+// if the client has the version before it, otherwise the full tile.  While a
+// slow client is still busy with a message the versions it misses coalesce
+// into the full tile.  Returns 1 if something was queued.
+static int wsNext(struct httpConn *c) {
+    struct wsState *ws = c->ws;
+    char name[32];
+    for (int n = 0; n < ws->len; n++) {
+        int k = ws->next;
+        ws->next = (ws->next + 1) % ws->len;
+        int tile = ws->tiles[k];
+        if (ws->sent[k] == __atomic_load_n(&tileVersion[tile], __ATOMIC_ACQUIRE))
+            continue;
+
+        snprintf(name, sizeof(name), "ws/delta_%04d", tile);
+        struct httpFile *f = fileGet(name);
+        if (f && ws->sent[k] && wsVersion(f) == ws->sent[k] + 1) {
+            ws->sent[k] = wsVersion(f);
+            wsQueueTile(c, f, WS_TILE_DELTA);
+            return 1;
+        }
+        if (f)
+            fileRelease(f);
+
+        snprintf(name, sizeof(name), "ws/globe_%04d", tile);
+        f = fileGet(name);
+        if (!f)
+            continue;
+        if (wsVersion(f) == ws->sent[k]) {
+            fileRelease(f);
+            continue;
+        }
+        ws->sent[k] = wsVersion(f);
+        wsQueueTile(c, f, WS_TILE_FULL);
+        return 1;
+    }
+    return 0;
+}
+
+void httpPublishTile(int globe_index, struct char_buffer full, struct char_buffer delta) {
+    if (!enabled || globe_index < 0 || globe_index > GLOBE_MAX_INDEX) {
+        free(full.buffer);
+        free(delta.buffer);
+        return;
+    }
+    char name[32];
+    uint32_t version = 0;
+    if (delta.len >= 24)
+        memcpy(&version, delta.buffer + 20, sizeof(version));
+    snprintf(name, sizeof(name), "ws/globe_%04d", globe_index);
+    httpPublish(name, full.buffer, full.len, NULL, 0);
+    snprintf(name, sizeof(name), "ws/delta_%04d", globe_index);
+    httpPublish(name, delta.buffer, delta.len, NULL, 0);
+    __atomic_store_n(&tileVersion[globe_index], version, __ATOMIC_RELEASE);
+}
+
+void httpWakeWebsockets() {
+    if (!enabled)
+        return;
+    // a full pipe means the worker is about to wake up anyway
+    for (int i = 0; i < worker_count; i++) {
+        if (write(workers[i].wake[1], "", 1) < 0) {
+            // EAGAIN
+        }
+    }
+}
+
+// req: request line and headers, each line ends with \r\n, 0 terminated
+static void handleRequest(struct httpConn *c, char *req) {
+    char *method = req;
+    char *target = strchr(method, ' ');
+    char *version = target ? strchr(target + 1, ' ') : NULL;
+    char *eol = version ? strstr(version + 1, "\r\n") : NULL;
+    if (!eol) {
+        respondError(c, 400);
+        return;
+    }
+    *target++ = 0;
+    *version++ = 0;
+    *eol = 0;
+    if (strncmp(version, "HTTP/1.", 7)) {
+        respondError(c, 400);
+        return;
+    }
+    c->close = !!strcmp(version, "HTTP/1.1");
+
+    int gzip_ok = 0;
+    int upgrade = 0;
+    const char *if_none_match = NULL;
+    const char *ws_key = NULL;
+    char *h = eol + 2;
+    while ((eol = strstr(h, "\r\n"))) {
+        *eol = 0;
+        char *value = strchr(h, ':');
+        if (value) {
+            *value++ = 0;
+            while (*value == ' ' || *value == '\t')
+                value++;
+            if (!strcasecmp(h, "Accept-Encoding")) {
+                gzip_ok = !!strcasestr(value, "gzip");
+            } else if (!strcasecmp(h, "If-None-Match")) {
+                if_none_match = value;
+            } else if (!strcasecmp(h, "Upgrade")) {
+                upgrade = !!strcasestr(value, "websocket");
+            } else if (!strcasecmp(h, "Sec-WebSocket-Key")) {
+                ws_key = value;
+            } else if (!strcasecmp(h, "Connection")) {
+                if (strcasestr(value, "close"))
+                    c->close = 1;
+                else if (strcasestr(value, "keep-alive"))
+                    c->close = 0;
+            }
+        }
+        h = eol + 2;
+    }
+
+    int head_only = !strcmp(method, "HEAD");
+    if (!head_only && strcmp(method, "GET")) {
+        respondError(c, 405);
+        return;
+    }
+
+    char *query = strpbrk(target, "?#");
+    if (query)
+        *query = 0;
+    if (target[0] != '/') {
+        respondError(c, 400);
+        return;
+    }
+    const char *name = target + 1;
+    if (!strncmp(name, "data/", 5))
+        name += 5;
+
+    if (!strcmp(name, "ws") && !head_only) {
+        if (!upgrade || !ws_key || strlen(ws_key) > 64)
+            respondError(c, 400);
+        else if (!Modes.json_globe_index)
+            respondError(c, 404);
+        else
+            wsHandshake(c, ws_key);
+        return;
+    }
+
+    struct httpFile *f = *name ? fileGet(name) : NULL;
+    if (!f && traceFullOnDemand(name))
+        f = fileGet(name);
+    if (!f) {
+        respondError(c, 404);
+        return;
+    }
+
+    if (if_none_match && (strstr(if_none_match, f->etag) || !strcmp(if_none_match, "*"))) {
+        respond(c, 304, NULL, NULL, f->etag, f->gz && f->plain, NULL, 0, 1);
+        fileRelease(f);
+        return;
+    }
+
+    const char *type = contentType(name);
+    int vary = (f->gz != NULL);
+    c->file = f;
+    if (endsWith(name, ".gz") && f->gz) {
+        respond(c, 200, type, NULL, f->etag, 0, f->gz, f->gz_len, head_only);
+    } else if (gzip_ok && f->gz) {
+        respond(c, 200, type, "gzip", f->etag, vary, f->gz, f->gz_len, head_only);
+    } else if (f->plain) {
+        respond(c, 200, type, NULL, f->etag, vary, f->plain, f->plain_len, head_only);
+    } else {
+        size_t len;
+        c->inflated = gunzip(f->gz, f->gz_len, &len);
+        if (!c->inflated) {
+            c->file = NULL;
+            fileRelease(f);
+            respondError(c, 500);
+            return;
+        }
+        respond(c, 200, type, NULL, f->etag, vary, c->inflated, len, head_only);
+    }
+}
+
+static void responseDone(struct httpConn *c) {
+    if (c->file)
+        fileRelease(c->file);
+    c->file = NULL;
+    free(c->inflated);
+    c->inflated = NULL;
+    c->body = NULL;
+    c->sending = 0;
+}
+
+// returns 1 when the response is sent, 0 if the socket is full, -1 on error
+static int sendResponse(struct httpConn *c, uint64_t now) {
+    size_t total = c->head_len + c->body_len;
+    while (c->sent < total) {
+        struct iovec iov[2];
+        int n = 0;
+        if (c->sent < (size_t) c->head_len) {
+            iov[n++] = (struct iovec) { c->head + c->sent, c->head_len - c->sent };
+            if (c->body_len)
+                iov[n++] = (struct iovec) { (void *) c->body, c->body_len };
+        } else {
+            size_t off = c->sent - c->head_len;
+            iov[n++] = (struct iovec) { (void *) (c->body + off), c->body_len - off };
+        }
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = n };
+        ssize_t res = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        c->sent += res;
+        c->last_active = now;
+    }
+    responseDone(c);
+    return 1;
+}
+
+// read what's there, returns -1 on error
+static int readRequests(struct httpConn *c, uint64_t now) {
+    while (!c->eof && c->in_len < HTTP_REQUEST_MAX) {
+        ssize_t res = recv(c->fd, c->in + c->in_len, HTTP_REQUEST_MAX - c->in_len, 0);
+        if (res == 0) {
+            c->eof = 1;
+        } else if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        } else {
+            c->in_len += res;
+            c->last_active = now;
+        }
+    }
+    return 0;
+}
+
+// answer the buffered requests one after the other, a pipelined request waits
+// until the response before it is sent
+// returns -1 if the connection is to be closed
+static int serviceConn(struct httpConn *c, uint64_t now) {
+    while (1) {
+        if (c->sending) {
+            int res = sendResponse(c, now);
+            if (res <= 0)
+                return res;
+            if (c->close)
+                return -1;
+        }
+        if (c->ws) {
+            if (wsRead(c) < 0)
+                return -1;
+            if (c->sending || wsNext(c))
+                continue;
+            return c->eof ? -1 : 0;
+        }
+        char *eoh = memmem(c->in, c->in_len, "\r\n\r\n", 4);
+        if (!eoh) {
+            if (c->in_len == HTTP_REQUEST_MAX) {
+                c->in_len = 0;
+                respondError(c, 431);
+                continue;
+            }
+            return c->eof ? -1 : 0;
+        }
+        int reqLen = eoh + 4 - c->in;
+        char save = c->in[reqLen - 2];
+        c->in[reqLen - 2] = 0;
+        handleRequest(c, c->in);
+        c->in[reqLen - 2] = save;
+        memmove(c->in, c->in + reqLen, c->in_len - reqLen);
+        c->in_len -= reqLen;
+    }
+}
+
+static void closeConn(struct httpConn *c) {
+    responseDone(c);
+    wsFree(c->ws);
+    anetCloseSocket(c->fd);
+    free(c);
+}
+
+static void acceptConns(struct httpWorker *w, int listen_fd, uint64_t now) {
+    char err[ANET_ERR_LEN];
+    for (int k = 0; k < 64; k++) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            return; // EAGAIN, another worker got it or a real error, try again next time
+        if (w->len >= HTTP_MAX_CONNECTIONS) {
+            anetCloseSocket(fd);
+            continue;
+        }
+        struct httpConn *c = malloc(sizeof(struct httpConn));
+        if (w->len == w->alloc) {
+            int newAlloc = w->alloc ? 2 * w->alloc : 64;
+            struct httpConn **conns = realloc(w->conns, newAlloc * sizeof(struct httpConn *));
+            struct pollfd *pfds = realloc(w->pfds, (listen_count + 1 + newAlloc) * sizeof(struct pollfd));
+            if (conns)
+                w->conns = conns;
+            if (pfds)
+                w->pfds = pfds;
+            if (conns && pfds)
+                w->alloc = newAlloc;
+        }
+        if (!c || w->len == w->alloc) {
+            free(c);
+            anetCloseSocket(fd);
+            continue;
+        }
+        memset(c, 0, offsetof(struct httpConn, head));
+        c->fd = fd;
+        c->last_active = now;
+        anetNonBlock(err, fd);
+        // a response is sent with one sendmsg, don't hold back its last segment
+        anetTcpNoDelay(err, fd);
+        w->conns[w->len++] = c;
+    }
+}
+
+static void *httpWorkerEntryPoint(void *arg) {
+    struct httpWorker *w = arg;
+    w->pfds = malloc((listen_count + 1) * sizeof(struct pollfd));
+    if (!w->pfds) {
+        fprintf(stderr, "<3> http: out of memory\n");
+        return NULL;
+    }
+
+    while (!Modes.exit) {
+        int n = 0;
+        for (int i = 0; i < listen_count; i++)
+            w->pfds[n++] = (struct pollfd) { listen_fds[i], POLLIN, 0 };
+        w->pfds[n++] = (struct pollfd) { w->wake[0], POLLIN, 0 };
+        for (int i = 0; i < w->len; i++)
+            w->pfds[n++] = (struct pollfd) { w->conns[i]->fd, w->conns[i]->sending ? POLLOUT : POLLIN, 0 };
+
+        // the timeout only matters for noticing Modes.exit and idle connections
+        int res = poll(w->pfds, n, 500);
+        if (res < 0 && errno != EINTR) {
+            fprintf(stderr, "<3> http: poll(): %s\n", strerror(errno));
+            struct timespec slp = {0, 100 * 1000 * 1000};
+            nanosleep(&slp, NULL);
+            continue;
+        }
+        uint64_t now = mstime();
+
+        int woken = 0;
+        if (res > 0 && (w->pfds[listen_count].revents & POLLIN)) {
+            char buf[256];
+            while (read(w->wake[0], buf, sizeof(buf)) > 0);
+            woken = 1;
+        }
+
+        int kept = 0;
+        for (int i = 0; i < w->len; i++) {
+            struct httpConn *c = w->conns[i];
+            short revents = (res > 0) ? w->pfds[listen_count + 1 + i].revents : 0;
+            int result = 0;
+            if (revents & POLLNVAL) {
+                result = -1;
+            } else if (revents || (woken && c->ws && !c->sending)) {
+                if (revents && !c->sending)
+                    result = readRequests(c, now);
+                if (result == 0)
+                    result = serviceConn(c, now);
+            } else if (now - c->last_active > HTTP_IDLE_TIMEOUT) {
+                result = -1;
+            }
+            if (result < 0)
+                closeConn(c);
+            else
+                w->conns[kept++] = c;
+        }
+        w->len = kept;
+
+        for (int i = 0; i < listen_count && res > 0; i++) {
+            if (w->pfds[i].revents & POLLIN)
+                acceptConns(w, listen_fds[i], now);
+        }
+    }
+
+    for (int i = 0; i < w->len; i++)
+        closeConn(w->conns[i]);
+    free(w->conns);
+    free(w->pfds);
+    w->conns = NULL;
+    w->pfds = NULL;
+    w->len = w->alloc = 0;
+    return NULL;
+}
+
+// same port list syntax as the other listeners
+static void httpListen(char *bind_addr, char *bind_ports) {
+    char *p = bind_ports;
+    char buf[128];
+    char err[ANET_ERR_LEN];
+    while (p && *p) {
+        int newfds[16];
+        char *end = strpbrk(p, ", ");
+        size_t len = end ? (size_t) (end - p) : strlen(p);
+        if (len >= sizeof(buf))
+            len = sizeof(buf) - 1;
+        memcpy(buf, p, len);
+        buf[len] = 0;
+        p = end ? end + 1 : NULL;
+
+        int nfds = anetTcpServer(err, buf, bind_addr, newfds, sizeof(newfds));
+        if (nfds == ANET_ERR) {
+            fprintf(stderr, "Error opening the listening port %s (HTTP): %s\n", buf, err);
+            exit(1);
+        }
+        int *fds = realloc(listen_fds, (listen_count + nfds) * sizeof(int));
+        if (!fds) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        listen_fds = fds;
+        for (int i = 0; i < nfds; i++) {
+            anetNonBlock(err, newfds[i]);
+            listen_fds[listen_count++] = newfds[i];
+        }
+    }
+}
+
+void httpInit() {
+    if (!Modes.net_output_http_ports || !strcmp(Modes.net_output_http_ports, "0"))
+        return;
+    if (!Modes.json_dir) {
+        fprintf(stderr, "--net-http-port needs --write-json, not starting the HTTP server\n");
+        return;
+    }
+
+    buckets = calloc(HTTP_BUCKETS, sizeof(struct httpFile *));
+    if (!buckets) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < HTTP_LOCKS; i++)
+        pthread_mutex_init(&locks[i], NULL);
+
+    httpListen(Modes.net_bind_address, Modes.net_output_http_ports);
+    if (!listen_count)
+        return;
+
+    enabled = 1;
+    worker_count = Modes.net_http_threads;
+    for (int i = 0; i < worker_count; i++) {
+        if (pipe(workers[i].wake)) {
+            fprintf(stderr, "http: pipe(): %s\n", strerror(errno));
+            exit(1);
+        }
+        char err[ANET_ERR_LEN];
+        anetNonBlock(err, workers[i].wake[0]);
+        anetNonBlock(err, workers[i].wake[1]);
+    }
+    for (int i = 0; i < worker_count; i++)
+        pthread_create(&workers[i].thread, NULL, httpWorkerEntryPoint, &workers[i]);
+}
+
+void httpCleanup() {
+    if (!buckets)
+        return;
+    // the workers exit on Modes.exit
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        close(workers[i].wake[0]);
+        close(workers[i].wake[1]);
+    }
+    worker_count = 0;
+    enabled = 0;
+
+    for (int i = 0; i < listen_count; i++)
+        anetCloseSocket(listen_fds[i]);
+    free(listen_fds);
+    listen_fds = NULL;
+    listen_count = 0;
+
+    for (int i = 0; i < HTTP_BUCKETS; i++) {
+        struct httpFile *f = buckets[i];
+        while (f) {
+            struct httpFile *next = f->next;
+            fileFree(f);
+            f = next;
+        }
+    }
+    free(buckets);
+    buckets = NULL;
+    for (int i = 0; i < HTTP_LOCKS; i++)
+        pthread_mutex_destroy(&locks[i]);
+}
@@ -0,0 +1,73 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// http.h: built-in HTTP/1.1 server for the --write-json output
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef HTTP_H
+#define HTTP_H
+
+// With --net-http-port every file written to the --write-json directory is
+// also published here and served from memory, the newest version wins:
+//
+// GET / HEAD /<file> or /data/<file>, <file> relative to the json directory
+// (aircraft.json, globe_0000.binCraft, traces/ab/trace_full_xxxxxx.json ...)
+//
+// - files written gzipped (globe tiles, traces) are only kept gzipped, they are
+//   sent with Content-Encoding: gzip and inflated for clients not accepting it
+// - files written plain get a gzip variant if they have HTTP_GZIP_MIN bytes or more
+// - *.gz files are sent as they are
+// - the ETag is a hash of the content, If-None-Match is answered with 304
+// - HTTP/1.1 connections are kept alive unless the client sends Connection: close
+//
+// Each worker thread polls the listening sockets and its own connections,
+// the files are reference counted so a publish never waits for a slow client.
+//
+// Websocket /ws (or /data/ws, needs --write-json-globe-index): the client sends
+// text messages to subscribe, each replaces the previous subscription:
+//
+// "tiles <index>,<index>,..."            globe tiles by index
+// "box <south> <west> <north> <east>"    the globe tiles overlapping the box
+//
+// The server sends a binary message per tile update: uint32_t WS_TILE_FULL
+// followed by the globe_xxxx.binCraft records or WS_TILE_DELTA followed by a
+// globeDelta_xxxx.binCraft (see generateGlobeDelta() for the format).  Deltas
+// are sent right after the globe thread made them if the client has the
+// version before it, everything else gets the full tile: the first message of
+// a tile and a client that was still busy receiving (coalesced, a slow client
+// never has more than one message per tile queued).
+
+#define HTTP_THREADS 16
+#define HTTP_GZIP_MIN 512 // bytes
+
+#define WS_TILE_FULL 1
+#define WS_TILE_DELTA 2
+
+// open the listening sockets and start the workers, exits on failure
+void httpInit();
+// stop the workers, close all connections and free the files
+void httpCleanup();
+// is the server running, writeJsonTo() publishes only then
+int httpEnabled();
+// replace the file, the server takes ownership of plain and gz (either can be NULL)
+void httpPublish(const char *file, char *plain, size_t plain_len, char *gz, size_t gz_len);
+// the file was deleted from the json directory
+void httpRemove(const char *file);
+// new version of a globe tile for the websockets, takes ownership of the
+// full tile (version set by generateGlobeDelta()) and the delta
+void httpPublishTile(int globe_index, struct char_buffer full, struct char_buffer delta);
+// once per globe refresh: the workers send the new tile versions to the websockets
+void httpWakeWebsockets();
+
+#endif
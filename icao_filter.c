@@ -23,115 +23,236 @@
 
 #include "readsb.h"
 
-// Millis between filter expiry flips:
+// Millis per filter generation:
+// an address stays in the filter for the generation it was last added in
+// and the following one (60 to 120 seconds, same as the old two table flip)
 #define MODES_ICAO_FILTER_TTL 60000
 
 // Open-addressed hash table with linear probing.
-// We store each address twice to handle Data/Parity
-// which need to match on a partial address (top 16 bits only).
+// Each entry is tagged with the generation it was last added in.
+// Lookups ignore expired entries and icaoFilterExpire removes them
+// incrementally using backward shift deletion, so probe chains stay
+// intact without tombstones and there is no periodic clearing of the table.
 
-// Maintain two tables and switch between them to age out entries.
+#define ICAO_FILTER_SIZE AIRCRAFT_BUCKETS
+#define ICAO_FILTER_MASK (ICAO_FILTER_SIZE - 1)
 
-static uint32_t icao_filter_a[AIRCRAFT_BUCKETS];
-static uint32_t icao_filter_b[AIRCRAFT_BUCKETS];
-static uint32_t *icao_filter_active;
+// lookups compare this many consecutive slots at once, the table has
+// this many extra slots at the end mirroring the first ones so a group never wraps
+#define ICAO_FILTER_LANES 4
+
+// slots checked for expired entries per icaoFilterExpire call
+#define ICAO_FILTER_SWEEP 1024
+
+typedef uint32_t icao_vec __attribute__ ((vector_size (ICAO_FILTER_LANES * sizeof(uint32_t))));
+
+static uint32_t icao_filter[ICAO_FILTER_SIZE + ICAO_FILTER_LANES] __attribute__ ((aligned (16)));
+static uint16_t icao_filter_gen[ICAO_FILTER_SIZE];
+static uint16_t current_gen;
+static uint32_t sweep_pos;
+
+// Blocked bloom filter in front of the table so most misses don't have to probe:
+// one 64 bit word per address with 2 bits set.
+// One filter per generation, a third one is cleared in small steps
+// while the other two are in use.
+#define ICAO_BLOOM_BITS 14
+#define ICAO_BLOOM_WORDS (1 << ICAO_BLOOM_BITS)
+#define ICAO_BLOOM_CLEAR_STEP 256
+
+static uint64_t icao_bloom[3][ICAO_BLOOM_WORDS];
+static int bloom_current;
+static uint32_t bloom_clear_pos;
+
+// Secondary index on the low 16 bits of the address for icaoFilterTestFuzzy,
+// direct mapped, holds the most recently added address with those bits.
+static uint32_t fuzzy_addr[1 << 16];
+static uint16_t fuzzy_gen[1 << 16];
+
+static inline int expired(uint16_t gen) {
+    return (uint16_t) (current_gen - gen) > 1;
+}
+
+static inline void set_slot(uint32_t i, uint32_t addr, uint16_t gen) {
+    icao_filter[i] = addr;
+    icao_filter_gen[i] = gen;
+    if (i < ICAO_FILTER_LANES)
+        icao_filter[ICAO_FILTER_SIZE + i] = addr;
+}
+
+static inline uint64_t bloom_hash(uint32_t addr) {
+    return addr * 0x9E3779B97F4A7C15ULL;
+}
+
+static inline uint32_t bloom_word(uint64_t h) {
+    return h >> (64 - ICAO_BLOOM_BITS);
+}
+
+static inline uint64_t bloom_mask(uint64_t h) {
+    return (1ULL << ((h >> 20) & 63)) | (1ULL << ((h >> 26) & 63));
+}
+
+static inline int bloom_test(uint32_t addr) {
+    uint64_t h = bloom_hash(addr);
+    uint32_t word = bloom_word(h);
+    uint64_t mask = bloom_mask(h);
+    int previous = (bloom_current + 2) % 3;
+    return ((icao_bloom[bloom_current][word] & mask) == mask
+            || (icao_bloom[previous][word] & mask) == mask);
+}
+
+// returns the slot containing addr or -1, probes is set to the number of groups looked at
+static inline int32_t lookup(uint32_t addr, int *probes) {
+    uint32_t h = aircraftHash(addr);
+    icao_vec key = { addr, addr, addr, addr };
+    icao_vec zero = { 0, 0, 0, 0 };
+
+    for (int n = 1; n <= ICAO_FILTER_SIZE / ICAO_FILTER_LANES; n++) {
+        icao_vec v;
+        memcpy(&v, &icao_filter[h], sizeof(v));
+
+        // an address is only stored once, if it's in this group it's our entry
+        icao_vec eq = (icao_vec) (v == key);
+        if (eq[0] | eq[1] | eq[2] | eq[3]) {
+            *probes = n;
+            for (int l = 0; l < ICAO_FILTER_LANES; l++) {
+                if (icao_filter[h + l] == addr)
+                    return (h + l) & ICAO_FILTER_MASK;
+            }
+        }
+        // an empty slot ends the probe chain
+        icao_vec empty = (icao_vec) (v == zero);
+        if (empty[0] | empty[1] | empty[2] | empty[3]) {
+            *probes = n;
+            return -1;
+        }
+
+        h = (h + ICAO_FILTER_LANES) & ICAO_FILTER_MASK;
+    }
+    *probes = ICAO_FILTER_SIZE / ICAO_FILTER_LANES;
+    return -1;
+}
+
+// backward shift deletion: move following entries of the probe chain up
+// unless that would put them in front of their home slot
+static void remove_slot(uint32_t i) {
+    uint32_t j = i;
+    while (1) {
+        j = (j + 1) & ICAO_FILTER_MASK;
+        uint32_t addr = icao_filter[j];
+        if (!addr)
+            break;
+        uint32_t home = aircraftHash(addr);
+        // the entry stays where it is if its home is cyclically in (i, j]
+        if (((j - home) & ICAO_FILTER_MASK) >= ((j - i) & ICAO_FILTER_MASK)) {
+            set_slot(i, addr, icao_filter_gen[j]);
+            i = j;
+        }
+    }
+    set_slot(i, 0, 0);
+}
 
 void icaoFilterInit() {
-    memset(icao_filter_a, 0, sizeof (icao_filter_a));
-    memset(icao_filter_b, 0, sizeof (icao_filter_b));
-    icao_filter_active = icao_filter_a;
+    memset(icao_filter, 0, sizeof (icao_filter));
+    memset(icao_filter_gen, 0, sizeof (icao_filter_gen));
+    memset(icao_bloom, 0, sizeof (icao_bloom));
+    memset(fuzzy_addr, 0, sizeof (fuzzy_addr));
+    memset(fuzzy_gen, 0, sizeof (fuzzy_gen));
+    current_gen = mstime() / MODES_ICAO_FILTER_TTL;
+    bloom_current = 0;
+    bloom_clear_pos = 0;
+    sweep_pos = 0;
 }
 
 void icaoFilterAdd(uint32_t addr) {
+    // 0 marks empty slots
+    if (!addr)
+        return;
+
+    uint64_t bh = bloom_hash(addr);
+    icao_bloom[bloom_current][bloom_word(bh)] |= bloom_mask(bh);
+
+    fuzzy_addr[addr & 0xffff] = addr;
+    fuzzy_gen[addr & 0xffff] = current_gen;
+
+    int probes;
+    int32_t found = lookup(addr, &probes);
+    if (found >= 0) {
+        icao_filter_gen[found] = current_gen;
+        return;
+    }
+
+    // use the first empty or expired slot
     uint32_t h, h0;
     h0 = h = aircraftHash(addr);
-    while (icao_filter_active[h] && icao_filter_active[h] != addr) {
-        h = (h + 1) & (AIRCRAFT_BUCKETS - 1);
+    while (icao_filter[h] && !expired(icao_filter_gen[h])) {
+        h = (h + 1) & ICAO_FILTER_MASK;
         if (h == h0) {
             fprintf(stderr, "ICAO hash table full, increase AIRCRAFT_HASH_BITS\n");
             return;
         }
     }
-    if (!icao_filter_active[h])
-        icao_filter_active[h] = addr;
-
-    /* disable as it's not being used
-    // also add with a zeroed top byte, for handling DF20/21 with Data Parity
-    h0 = h = aircraftHash(addr & 0x00ffff);
-    while (icao_filter_active[h] && (icao_filter_active[h] & 0x00ffff) != (addr & 0x00ffff)) {
-        h = (h + 1) & (AIRCRAFT_BUCKETS - 1);
-        if (h == h0) {
-            fprintf(stderr, "ICAO hash table full, increase AIRCRAFT_BUCKETS\n");
-            return;
-        }
-    }
-    if (!icao_filter_active[h])
-        icao_filter_active[h] = addr;
-    */
+    set_slot(h, addr, current_gen);
 }
 
 int icaoFilterTest(uint32_t addr) {
-    uint32_t h, h0;
+    struct stats *st = &Modes.stats_current;
 
-    h0 = h = aircraftHash(addr);
-    while (icao_filter_a[h] && icao_filter_a[h] != addr) {
-        h = (h + 1) & (AIRCRAFT_BUCKETS - 1);
-        if (h == h0)
-            break;
+    if (!addr || !bloom_test(addr)) {
+        st->icao_filter_misses++;
+        st->icao_filter_bloom_rejects++;
+        return 0;
     }
-    if (icao_filter_a[h] == addr)
-        return 1;
 
-    h = h0;
-    while (icao_filter_b[h] && icao_filter_b[h] != addr) {
-        h = (h + 1) & (AIRCRAFT_BUCKETS - 1);
-        if (h == h0)
-            break;
-    }
-    if (icao_filter_b[h] == addr)
+    int probes;
+    int32_t found = lookup(addr, &probes);
+    st->icao_filter_probes[min(probes, ICAO_FILTER_PROBE_BUCKETS) - 1]++;
+
+    if (found >= 0 && !expired(icao_filter_gen[found])) {
+        st->icao_filter_hits++;
         return 1;
+    }
 
+    st->icao_filter_misses++;
     return 0;
 }
 
 uint32_t icaoFilterTestFuzzy(uint32_t partial) {
-    uint32_t h, h0;
-
     partial &= 0x00ffff;
-    h0 = h = aircraftHash(partial);
-    while (icao_filter_a[h] && (icao_filter_a[h] & 0x00ffff) != partial) {
-        h = (h + 1) & (AIRCRAFT_BUCKETS - 1);
-        if (h == h0)
-            break;
-    }
-    if ((icao_filter_a[h] & 0x00ffff) == partial)
-        return icao_filter_a[h];
-
-    h = h0;
-    while (icao_filter_b[h] && (icao_filter_b[h] & 0x00ffff) != partial) {
-        h = (h + 1) & (AIRCRAFT_BUCKETS - 1);
-        if (h == h0)
-            break;
-    }
-    if ((icao_filter_b[h] & 0x00ffff) == partial)
-        return icao_filter_b[h];
-
+    if (fuzzy_addr[partial] && !expired(fuzzy_gen[partial]))
+        return fuzzy_addr[partial];
     return 0;
 }
 
 // call this periodically:
 void icaoFilterExpire() {
-    static uint64_t next_flip = 0;
     uint64_t now = mstime();
+    uint16_t gen = now / MODES_ICAO_FILTER_TTL;
 
-    if (now >= next_flip) {
-        if (icao_filter_active == icao_filter_a) {
-            memset(icao_filter_b, 0, sizeof (icao_filter_b));
-            icao_filter_active = icao_filter_b;
-        } else {
-            memset(icao_filter_a, 0, sizeof (icao_filter_a));
-            icao_filter_active = icao_filter_a;
+    int next = (bloom_current + 1) % 3;
+
+    if (gen != current_gen) {
+        // the bloom filter for the new generation must be clear,
+        // usually this is already done by the incremental clearing below
+        if (bloom_clear_pos < ICAO_BLOOM_WORDS) {
+            memset(&icao_bloom[next][bloom_clear_pos], 0,
+                    (ICAO_BLOOM_WORDS - bloom_clear_pos) * sizeof(uint64_t));
         }
-        next_flip = now + MODES_ICAO_FILTER_TTL;
+        current_gen = gen;
+        bloom_current = next;
+        bloom_clear_pos = 0;
+        next = (bloom_current + 1) % 3;
+    }
+
+    // the filter two generations back isn't needed anymore, clear it step by step
+    if (bloom_clear_pos < ICAO_BLOOM_WORDS) {
+        memset(&icao_bloom[next][bloom_clear_pos], 0, ICAO_BLOOM_CLEAR_STEP * sizeof(uint64_t));
+        bloom_clear_pos += ICAO_BLOOM_CLEAR_STEP;
+    }
+
+    // remove expired entries
+    for (int n = 0; n < ICAO_FILTER_SWEEP; n++) {
+        while (icao_filter[sweep_pos] && expired(icao_filter_gen[sweep_pos]))
+            remove_slot(sweep_pos);
+        sweep_pos = (sweep_pos + 1) & ICAO_FILTER_MASK;
     }
 }
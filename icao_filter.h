@@ -33,8 +33,8 @@ void icaoFilterAdd (uint32_t addr);
 // Test if the given address matches the filter
 int icaoFilterTest (uint32_t addr);
 
-// Test if the top 16 bits match any previously added address.
-// If they do, returns an arbitrary one of the matched
+// Test if the low 16 bits match any previously added address.
+// If they do, returns the most recently added one of the matched
 // addresses. Returns 0 on failure.
 uint32_t icaoFilterTestFuzzy (uint32_t partial);
 
@@ -0,0 +1,184 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// json_out.h: printf free json output
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef JSON_OUT_H
+#define JSON_OUT_H
+
+// Replacements for the safe_snprintf() calls in the json output, same calling
+// convention: append to p, never write past end, return the new p (end if the
+// output didn't fit).  The output is the same as the printf format noted
+// with each function.
+
+static inline char *json_mem(char *p, char *end, const char *s, size_t len) {
+    if (p + len > end) {
+        // like snprintf: as much as fits
+        while (p < end)
+            *p++ = *s++;
+        return end;
+    }
+    memcpy(p, s, len);
+    return p + len;
+}
+
+// string literal, the length is known at compile time
+#define json_lit(p, end, s) json_mem((p), (end), "" s, sizeof(s) - 1)
+
+// "%s"
+static inline char *json_str(char *p, char *end, const char *s) {
+    return json_mem(p, end, s, strlen(s));
+}
+
+// "%.*s": at most len chars, stops at a 0 byte
+static inline char *json_strn(char *p, char *end, const char *s, size_t len) {
+    return json_mem(p, end, s, strnlen(s, len));
+}
+
+// "%u"
+static inline char *json_uint(char *p, char *end, uint64_t v) {
+    char tmp[24];
+    char *t = tmp + sizeof(tmp);
+    do {
+        *--t = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    return json_mem(p, end, t, tmp + sizeof(tmp) - t);
+}
+
+// "%d"
+static inline char *json_int(char *p, char *end, int64_t v) {
+    if (v < 0) {
+        p = json_lit(p, end, "-");
+        return json_uint(p, end, -(uint64_t) v);
+    }
+    return json_uint(p, end, v);
+}
+
+// "%0<width>x" or "%0<width>X"
+static inline char *json_hex(char *p, char *end, uint64_t v, int width, int upper) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[24];
+    char *t = tmp + sizeof(tmp);
+    do {
+        *--t = digits[v & 0xf];
+        v >>= 4;
+    } while (v || tmp + sizeof(tmp) - t < width);
+    return json_mem(p, end, t, tmp + sizeof(tmp) - t);
+}
+
+// "%.<decimals>f", decimals <= 6
+//
+// The value is scaled to an integer and rounded.  printf rounds the exact
+// binary value: the result is the same unless the scaled value is very
+// close to a tie where the rounding error of the scaling could matter,
+// those rare values, large ones and NaN / inf are left to printf.
+static inline char *json_fixed(char *p, char *end, double v, int decimals) {
+    static const double scale[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6 };
+    double r = fabs(v) * scale[decimals];
+    // the error of r is below 1e11 * 2^-53, far below the 1e-4 margin
+    if (!(r < 1e11) || fabs(r - floor(r) - 0.5) < 1e-4)
+        return safe_snprintf(p, end, "%.*f", decimals, v);
+
+    uint64_t n = (uint64_t) (r + 0.5);
+    char tmp[32];
+    char *t = tmp + sizeof(tmp);
+    for (int k = 0; k < decimals; k++) {
+        *--t = '0' + n % 10;
+        n /= 10;
+    }
+    if (decimals)
+        *--t = '.';
+    do {
+        *--t = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    // printf keeps the sign of values rounding to zero and of -0.0
+    if (signbit(v))
+        *--t = '-';
+    return json_mem(p, end, t, tmp + sizeof(tmp) - t);
+}
+
+// 0: as is, 1: \u00xx, 2: backslash
+static const unsigned char json_escape_class[256] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+};
+
+// "%s" of jsonEscapeString(): " and \ get a backslash, other characters
+// outside of 32 - 126 become \u00xx, at most len characters
+static inline char *json_escape(char *p, char *end, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < len && s[i]; i++) {
+        unsigned char ch = s[i];
+        switch (json_escape_class[ch]) {
+            case 0:
+                if (p >= end)
+                    return end;
+                *p++ = ch;
+                break;
+            case 1:
+                {
+                    char u[6] = { '\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 0xf] };
+                    p = json_mem(p, end, u, sizeof(u));
+                    break;
+                }
+            default:
+                {
+                    char b[2] = { '\\', ch };
+                    p = json_mem(p, end, b, sizeof(b));
+                    break;
+                }
+        }
+    }
+    return p;
+}
+
+// make room for need more bytes after p, the buffer is doubled as often as needed,
+// *buf, *end and the returned p move with it, *buf can be from arenaMalloc()
+// if the allocation fails the output is truncated at end
+static inline char *json_reserve(char **buf, size_t *buflen, char **end, char *p, size_t need) {
+    if (p + need < *end)
+        return p;
+    size_t used = p - *buf;
+    size_t len = *buflen;
+    while (used + need >= len)
+        len *= 2;
+    char *grown = arenaRealloc(*buf, len);
+    if (!grown) {
+        fprintf(stderr, "json_reserve: realloc failure!\n");
+        return p;
+    }
+    *buf = grown;
+    *buflen = len;
+    *end = grown + len;
+    return grown + used;
+}
+
+#endif
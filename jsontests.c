@@ -0,0 +1,184 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// jsontests.c - the json_out.h functions against the printf formats they replace
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+// deterministic pseudo random numbers so failures are reproducible
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+static uint64_t rnd64() {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double elapsed(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// values like the ones in aircraft.json: coordinates, speeds, angles, small
+// numbers, exact ties in binary (x.5, x.25, x.125), values close to ties
+static double test_value(int k) {
+    double u = (rnd64() >> 11) * 0x1.0p-53;
+    double sign = (rnd64() & 1) ? -1 : 1;
+    switch (k % 8) {
+        case 0: return sign * u * 180;
+        case 1: return sign * u * 1000;
+        case 2: return sign * u;
+        case 3: return sign * (rnd64() % 100000) / 8.0;
+        case 4: return sign * ((rnd64() % 100000) + 0.5) / 1000.0;
+        case 5: return sign * ((rnd64() % 100000) + 0.5) / 10.0 + sign * 1e-12;
+        case 6: return (float) (sign * u * 500);
+        default: return sign * u * 1e-3;
+    }
+}
+
+static int check(const char *what, const char *expected, const char *p, const char *got) {
+    if ((size_t) (p - got) != strlen(expected) || memcmp(expected, got, p - got)) {
+        fprintf(stderr, "testJson: FAIL: %s: expected \"%s\", got \"%.*s\"\n", what, expected, (int) (p - got), got);
+        return 0;
+    }
+    return 1;
+}
+
+static int testFixed() {
+    char expected[512], got[512];
+    int ok = 1;
+    double special[] = { 0, -0.0, 0.5, -0.5, 1.5, 2.5, 0.125, 0.375, 1.005, 2.675, -0.04, -0.0000001,
+        1e10, 123456789.123456, 1e15, 1e300, -1e300, INFINITY, -INFINITY, NAN, 1703074587.123 };
+    for (int decimals = 0; decimals <= 6 && ok; decimals++) {
+        for (size_t k = 0; k < sizeof(special) / sizeof(special[0]) + 200000 && ok; k++) {
+            double v = k < sizeof(special) / sizeof(special[0]) ? special[k] : test_value(k);
+            snprintf(expected, sizeof(expected), "%.*f", decimals, v);
+            char *p = json_fixed(got, got + sizeof(got), v, decimals);
+            ok = check("json_fixed", expected, p, got);
+        }
+    }
+    fprintf(stderr, "testFixed:          %s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+static int testIntHex() {
+    char expected[64], got[64];
+    int ok = 1;
+    for (int k = 0; k < 200000 && ok; k++) {
+        int64_t v = (int64_t) rnd64() >> (rnd64() % 64);
+        int32_t i = (int32_t) v;
+        uint32_t u = (uint32_t) v;
+
+        snprintf(expected, sizeof(expected), "%d", i);
+        ok &= check("json_int", expected, json_int(got, got + sizeof(got), i), got);
+        snprintf(expected, sizeof(expected), "%u", u);
+        ok &= check("json_uint", expected, json_uint(got, got + sizeof(got), u), got);
+        snprintf(expected, sizeof(expected), "%06x", u & 0xffffff);
+        ok &= check("json_hex", expected, json_hex(got, got + sizeof(got), u & 0xffffff, 6, 0), got);
+        snprintf(expected, sizeof(expected), "%02X", u & 0xff);
+        ok &= check("json_hex", expected, json_hex(got, got + sizeof(got), u & 0xff, 2, 1), got);
+        snprintf(expected, sizeof(expected), "%016"PRIx64, (uint64_t) v);
+        ok &= check("json_hex", expected, json_hex(got, got + sizeof(got), v, 16, 0), got);
+    }
+    fprintf(stderr, "testIntHex:         %s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+static int testEscape() {
+    char got[64];
+    int ok = 1;
+    ok &= check("json_escape", "DLH123  ", json_escape(got, got + sizeof(got), "DLH123  ", 8), got);
+    ok &= check("json_escape", "A\\\"B\\\\C", json_escape(got, got + sizeof(got), "A\"B\\C", 8), got);
+    ok &= check("json_escape", "\\u0001\\u007f\\u00ff@", json_escape(got, got + sizeof(got), "\x01\x7f\xff@", 8), got);
+    ok &= check("json_escape", "ABCD", json_escape(got, got + sizeof(got), "ABCDEFGH", 4), got);
+    ok &= check("json_strn", "ABC", json_strn(got, got + sizeof(got), "ABC\0DEF", 7), got);
+    // truncated at end like snprintf
+    char *p = json_lit(got, got + 4, "abcdefgh");
+    ok &= (p == got + 4 && !memcmp(got, "abcd", 4));
+    p = json_fixed(got, got + 3, 123.456, 2);
+    ok &= (p == got + 3 && !memcmp(got, "123", 3));
+    fprintf(stderr, "testEscape:         %s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// one aircraft.json line worth of fields, printf against json_out.h
+static void benchmark() {
+    int n = 200000;
+    double *values = malloc(n * 4 * sizeof(double));
+    for (int i = 0; i < n * 4; i++)
+        values[i] = test_value(i % 3);
+    size_t buflen = 256;
+    char *buf = malloc(buflen), *end = buf + buflen;
+    volatile size_t sink = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++) {
+        double *v = values + 4 * i;
+        char *p = buf;
+        p = safe_snprintf(p, end, "\n{\"hex\":\"%06x\",\"alt_baro\":%d,\"gs\":%.1f,\"track\":%.2f",
+                i & 0xffffff, i % 40000, v[0], v[1]);
+        p = safe_snprintf(p, end, ",\"lat\":%f,\"lon\":%f,\"nic\":%u,\"rc\":%u,\"seen_pos\":%.1f",
+                v[2], v[3], 8, 186, v[0] / 100);
+        sink += p - buf;
+    }
+    double printf_time = elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++) {
+        double *v = values + 4 * i;
+        char *p = buf;
+        p = json_lit(p, end, "\n{\"hex\":\"");
+        p = json_hex(p, end, i & 0xffffff, 6, 0);
+        p = json_lit(p, end, "\",\"alt_baro\":");
+        p = json_int(p, end, i % 40000);
+        p = json_lit(p, end, ",\"gs\":");
+        p = json_fixed(p, end, v[0], 1);
+        p = json_lit(p, end, ",\"track\":");
+        p = json_fixed(p, end, v[1], 2);
+        p = json_lit(p, end, ",\"lat\":");
+        p = json_fixed(p, end, v[2], 6);
+        p = json_lit(p, end, ",\"lon\":");
+        p = json_fixed(p, end, v[3], 6);
+        p = json_lit(p, end, ",\"nic\":");
+        p = json_uint(p, end, 8);
+        p = json_lit(p, end, ",\"rc\":");
+        p = json_uint(p, end, 186);
+        p = json_lit(p, end, ",\"seen_pos\":");
+        p = json_fixed(p, end, v[0] / 100, 1);
+        sink += p - buf;
+    }
+    double json_time = elapsed(&start);
+
+    fprintf(stderr, "snprintf: %.0f ns per object, json_out: %.0f ns per object (%.1fx)\n",
+            printf_time / n * 1e9, json_time / n * 1e9, printf_time / json_time);
+    free(buf);
+    free(values);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && !strcmp(argv[1], "benchmark")) {
+        benchmark();
+        return 0;
+    }
+
+    int ok = 1;
+    ok &= testFixed();
+    ok &= testIntHex();
+    ok &= testEscape();
+    return ok ? 0 : 1;
+}
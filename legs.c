@@ -0,0 +1,410 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// legs.c: incremental leg detection for the trace json
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+// point i of the trace, only valid for i >= tv->first
+static inline struct state *at(struct traceView *tv, int i) {
+    return &tv->trace[i - tv->first];
+}
+
+static void focus_time(const char *what, uint64_t timestamp) {
+    time_t nowish = timestamp / 1000;
+    struct tm utc;
+    gmtime_r(&nowish, &utc);
+    char tstring[100];
+    strftime (tstring, 100, "%H:%M:%S", &utc);
+    fprintf(stderr, "%s%s\n", what, tstring);
+}
+
+static void legs_reset(struct legState *ls, uint64_t first_ts) {
+    int *markers = ls->markers;
+    int markers_alloc = ls->markers_alloc;
+    memset(ls, 0, sizeof(struct legState));
+    ls->markers = markers;
+    ls->markers_alloc = markers_alloc;
+    ls->first_ts = first_ts;
+}
+
+// first pass: ground points count as the average of the last 5 airborne altitudes
+static void sum_point(struct legState *ls, struct state *state) {
+    ls->n++;
+
+    if (!state->flags.altitude_valid)
+        return;
+
+    int32_t altitude = state->altitude * 25;
+    if (state->flags.on_ground) {
+        int avg = 0;
+        for (int i = 0; i < 5; i++) avg += ls->last_five[i];
+        avg /= 5;
+        altitude = avg;
+    } else {
+        if (ls->five_pos == 0) {
+            for (int i = 0; i < 5; i++)
+                ls->last_five[i] = altitude;
+        } else {
+            ls->last_five[ls->five_pos % 5] = altitude;
+        }
+        ls->five_pos++;
+    }
+
+    ls->sum += altitude;
+}
+
+static int leg_threshold(struct legState *ls) {
+    int threshold = (int) (ls->sum / (double) (ls->n * 3));
+
+    if (threshold > 10000)
+        threshold = 10000;
+    if (threshold < 200)
+        threshold = 200;
+
+    return threshold;
+}
+
+static void scan_start(struct legScan *s, int threshold) {
+    memset(s, 0, sizeof(struct legScan));
+    s->next = 1;
+    s->threshold = threshold;
+    s->low = 100000;
+    s->new_leg = -1;
+}
+
+static void add_marker(struct legState *ls, int index) {
+    if (ls->markers_len && ls->markers[ls->markers_len - 1] == index)
+        return;
+    if (ls->markers_len == ls->markers_alloc) {
+        int alloc = max(16, 2 * ls->markers_alloc);
+        int *markers = realloc(ls->markers, alloc * sizeof(int));
+        if (!markers) {
+            fprintf(stderr, "add_marker: realloc failure!\n");
+            return;
+        }
+        ls->markers = markers;
+        ls->markers_alloc = alloc;
+    }
+    ls->markers[ls->markers_len++] = index;
+}
+
+// second pass, look at point i of a trace with trace_len points
+// markers are set in the view and added to ls->markers if ls is not NULL
+static void scan_point(struct aircraft *a, struct legScan *s, struct traceView *tv, int trace_len, struct legState *ls) {
+    int i = s->next++;
+    int threshold = s->threshold;
+
+    struct state *state = at(tv, i);
+    int prev_index = s->prev_tmp;
+    struct state *prev = at(tv, prev_index);
+
+    uint64_t elapsed = state->timestamp - prev->timestamp;
+
+    int32_t altitude = state->altitude * 25;
+    int on_ground = state->flags.on_ground;
+    int altitude_valid = state->flags.altitude_valid;
+
+    if (!on_ground && !altitude_valid)
+        return;
+
+    s->prev_tmp = i;
+
+    if (on_ground) {
+        int avg = 0;
+        for (int i = 0; i < 5; i++)
+            avg += s->last_five[i];
+        avg /= 5;
+        altitude = avg - threshold / 2;
+    } else {
+        if (s->five_pos == 0) {
+            for (int i = 0; i < 5; i++)
+                s->last_five[i] = altitude;
+        } else {
+            s->last_five[s->five_pos % 5] = altitude;
+        }
+        s->five_pos++;
+    }
+
+    if (!on_ground)
+        s->last_airborne = state->timestamp;
+    else
+        s->last_ground = state->timestamp;
+
+    if (altitude >= s->high) {
+        s->high = altitude;
+    }
+    if (altitude <= s->low) {
+        s->low = altitude;
+    }
+
+    if (abs(s->low - altitude) < threshold * 1 / 3 && elapsed < 30 * MINUTES) {
+        s->last_low = state->timestamp;
+        s->last_low_index = i;
+    }
+    if (abs(s->high - altitude) < threshold * 1 / 3)
+        s->last_high = state->timestamp;
+
+    if (s->high - s->low > threshold) {
+        if (s->last_high > s->last_low) {
+            // only set new major climb time if this is after a major descent.
+            // then keep that time associated with the climb
+            // still report continuation of thta climb
+            if (s->major_climb <= s->major_descent) {
+                int bla = min(trace_len - 1, s->last_low_index + 3);
+                s->major_climb = at(tv, bla)->timestamp;
+                s->major_climb_index = bla;
+            }
+            if (a->addr == LEG_FOCUS) {
+                fprintf(stderr, "climb: %d ", altitude);
+                focus_time("", s->major_climb);
+            }
+            s->low = s->high - threshold * 9/10;
+        } else if (s->last_high < s->last_low) {
+            int bla = max(0, s->last_low_index - 3);
+            s->major_descent = at(tv, bla)->timestamp;
+            s->major_descent_index = bla;
+            if (a->addr == LEG_FOCUS) {
+                fprintf(stderr, "desc: %d ", altitude);
+                focus_time("", s->major_descent);
+            }
+            s->high = s->low + threshold * 9/10;
+        }
+    }
+    int leg_now = 0;
+    if ( (s->major_descent && (on_ground || s->was_ground) && elapsed > 25 * 60 * 1000) ||
+            (s->major_descent && (on_ground || s->was_ground) && state->timestamp > s->last_airborne + 45 * 60 * 1000)
+       )
+    {
+        if (a->addr == LEG_FOCUS)
+            fprintf(stderr, "ground leg\n");
+        leg_now = 1;
+    }
+    double distance = greatcircle_fast(
+            (double) at(tv, i)->lat / 1E6,
+            (double) at(tv, i)->lon / 1E6,
+            (double) at(tv, i - 1)->lat / 1E6,
+            (double) at(tv, i - 1)->lon / 1E6
+            );
+
+    if ( elapsed > 30 * 60 * 1000 && distance < 10E3 * (elapsed / (30 * 60 * 1000.0)) && distance > 1) {
+        leg_now = 1;
+        if (a->addr == LEG_FOCUS)
+            fprintf(stderr, "time/distance leg, elapsed: %0.fmin, distance: %0.f\n", elapsed / (60 * 1000.0), distance / 1000.0);
+    }
+
+    int leg_float = 0;
+    if (s->major_climb && s->major_descent &&
+            (s->major_climb > s->major_descent + 8 * MINUTES || s->last_ground > s->major_descent - 2 * MINUTES)
+       ) {
+        for (int i = s->major_descent_index + 1; i < s->major_climb_index; i++) {
+            if (at(tv, i)->timestamp > at(tv, i - 1)->timestamp + 5 * MINUTES) {
+                leg_float = 1;
+                if (a->addr == LEG_FOCUS)
+                    fprintf(stderr, "float leg\n");
+            }
+        }
+    }
+
+    if (leg_float || leg_now)
+    {
+        // new_leg keeps pointing at the previous leg if no better point is found
+        int new_leg = s->new_leg;
+        uint64_t leg_ts = s->new_leg_ts;
+
+        if (leg_now) {
+            new_leg = prev_index + 1;
+            if (state->timestamp > at(tv, i - 1)->timestamp + 5 * 60 * 1000 && prev_index + 1 < i)
+                new_leg = i;
+        } else if (s->major_descent_index + 1 == s->major_climb_index) {
+            new_leg = s->major_climb_index;
+        } else {
+            for (int i = s->major_climb_index; i > s->major_descent_index; i--) {
+                if (at(tv, i)->timestamp > at(tv, i - 1)->timestamp + 5 * 60 * 1000) {
+                    new_leg = i;
+                    break;
+                }
+            }
+            uint64_t half = s->major_descent + (s->major_climb - s->major_descent) / 2;
+            for (int i = s->major_descent_index + 1; i < s->major_climb_index; i++) {
+                if (at(tv, i)->timestamp > half) {
+                    new_leg = i;
+                    break;
+                }
+            }
+        }
+
+        if (new_leg != s->new_leg)
+            leg_ts = at(tv, new_leg)->timestamp;
+
+        if (new_leg >= 0) {
+            // set leg marker
+            if (new_leg >= tv->first)
+                at(tv, new_leg)->flags.leg_marker = 1;
+            if (ls)
+                add_marker(ls, new_leg);
+        }
+        s->new_leg = new_leg;
+        s->new_leg_ts = leg_ts;
+
+        s->major_climb = 0;
+        s->major_climb_index = 0;
+        s->major_descent = 0;
+        s->major_descent_index = 0;
+        s->low += threshold;
+        s->high -= threshold;
+
+        if (a->addr == LEG_FOCUS) {
+            if (new_leg >= 0)
+                focus_time("leg: ", leg_ts);
+            else
+                focus_time("resetting major_c/d without leg: ", state->timestamp);
+        }
+    }
+
+    s->was_ground = on_ground;
+}
+
+// lowest trace index scan_point() will look at when continuing from s
+static int scan_first_needed(struct legScan *s) {
+    if (s->next == 0)
+        return 0;
+    int first = min(s->next - 1, s->prev_tmp);
+    first = min(first, max(0, s->last_low_index - 3));
+    if (s->major_descent)
+        first = min(first, s->major_descent_index);
+    if (s->major_climb)
+        first = min(first, s->major_climb_index);
+    return first;
+}
+
+struct legState *legsNew(struct aircraft *a) {
+    struct legState *ls = calloc(1, sizeof(struct legState));
+    if (ls)
+        legs_reset(ls, traceFirstTimestamp(a));
+    return ls;
+}
+
+int legsPrepare(struct aircraft *a) {
+    int len = traceLen(a);
+    uint64_t first_ts = traceFirstTimestamp(a);
+
+    if (!a->legs) {
+        a->legs = legsNew(a);
+        if (!a->legs)
+            return 0;
+    }
+    struct legState *ls = a->legs;
+
+    if (ls->first_ts != first_ts || ls->n > len) {
+        // the front of the trace was dropped, all indexes changed
+        legs_reset(ls, first_ts);
+        return 0;
+    }
+
+    // the first pass doesn't care about the trace length, continue it right here
+    if (ls->n < len) {
+        struct traceIter it;
+        struct state *state;
+        struct state_all *all;
+        traceIterInit(&it, a, ls->n);
+        while (ls->n < len && (state = traceIterNext(&it, &all)))
+            sum_point(ls, state);
+    }
+
+    if (len < 20 || ls->scan.next == 0 || ls->scan.threshold != leg_threshold(ls)) {
+        ls->scan.next = 0;
+        return 0;
+    }
+
+    return min(ls->n, scan_first_needed(&ls->scan));
+}
+
+int legsMark(struct aircraft *a, struct traceView *tv) {
+    int trace_len = tv->first + tv->len;
+
+    if (trace_len < 20)
+        return 0;
+
+    if (!a->legs)
+        legsPrepare(a);
+    struct legState *ls = a->legs;
+    if (!ls)
+        return -1;
+
+    if (tv->first == 0 && tv->trace[0].timestamp != ls->first_ts)
+        legs_reset(ls, tv->trace[0].timestamp);
+    if (ls->n > trace_len)
+        legs_reset(ls, ls->first_ts);
+    if (ls->n < tv->first)
+        return -1;
+
+    // points added after legsPrepare()
+    for (int i = ls->n; i < trace_len; i++)
+        sum_point(ls, at(tv, i));
+
+    int threshold = leg_threshold(ls);
+
+    if (a->addr == LEG_FOCUS) {
+        fprintf(stderr, "threshold: %d\n", (int) (ls->sum / (double) (trace_len * 3)));
+        fprintf(stderr, "trace_len: %d\n", trace_len);
+    }
+
+    if (ls->scan.next == 0 || ls->scan.threshold != threshold || ls->scan.next > trace_len) {
+        if (tv->first > 0)
+            return -1;
+        scan_start(&ls->scan, threshold);
+        ls->markers_len = 0;
+    }
+
+    if (scan_first_needed(&ls->scan) < tv->first)
+        return -1;
+
+    // reset leg markers
+    for (int i = 0; i < tv->len; i++)
+        tv->trace[i].flags.leg_marker = 0;
+
+    for (int k = 0; k < ls->markers_len; k++) {
+        if (ls->markers[k] >= tv->first)
+            at(tv, ls->markers[k])->flags.leg_marker = 1;
+    }
+
+    // what happens at point i only depends on trace_len for i > trace_len - 4:
+    // scan up to there keeping the state, the rest of the points with a copy
+    int checkpoint = trace_len - 3;
+    while (ls->scan.next < checkpoint)
+        scan_point(a, &ls->scan, tv, trace_len, ls);
+
+    struct legScan s = ls->scan;
+    while (s.next < trace_len)
+        scan_point(a, &s, tv, trace_len, NULL);
+
+    // the markers in the packed part of the trace are only set in the view,
+    // remember the last leg in the aircraft to notice changes
+    uint64_t last_leg = s.new_leg_ts;
+    if (last_leg != a->trace_last_leg) {
+        a->trace_last_leg = last_leg;
+        a->trace_full_write = 9999;
+    }
+    return 0;
+}
+
+void legsFree(struct aircraft *a) {
+    if (!a->legs)
+        return;
+    free(a->legs->markers);
+    free(a->legs);
+    a->legs = NULL;
+}
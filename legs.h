@@ -0,0 +1,85 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// legs.h: incremental leg detection for the trace json
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LEGS_H
+#define LEGS_H
+
+// print the leg detection of this address to stderr
+#define LEG_FOCUS 0x0
+
+// Leg detection runs in two passes over the trace: the first pass averages
+// the altitude to get a threshold, the second pass looks for climbs and
+// descents of at least that threshold and places the leg markers.
+//
+// Both passes only ever look at points before the current one, so their
+// state after point i depends on nothing but the points up to i and the
+// threshold.  legState keeps that state between trace writes: the first
+// pass is continued with the new points, the second pass is resumed from
+// a checkpoint a few points before the end of the trace as long as the
+// threshold stays the same.  If it changes or the front of the trace was
+// dropped, the second pass starts over.
+
+// second pass state, see scan_point() in legs.c
+struct legScan {
+    int next; // index of the next point to look at, 0: not started
+    int threshold;
+    int high;
+    int low;
+    int last_five[5];
+    uint32_t five_pos;
+    uint64_t major_climb;
+    uint64_t major_descent;
+    int major_climb_index;
+    int major_descent_index;
+    uint64_t last_high;
+    uint64_t last_low;
+    int last_low_index;
+    uint64_t last_airborne;
+    uint64_t last_ground;
+    int was_ground;
+    int prev_tmp;
+    int new_leg; // index of the last leg marker, -1: none
+    uint64_t new_leg_ts;
+};
+
+struct legState {
+    // first pass
+    int n; // number of points summed
+    uint64_t first_ts; // timestamp of point 0, changes when the front of the trace is dropped
+    double sum;
+    int last_five[5];
+    uint32_t five_pos;
+
+    struct legScan scan;
+
+    // leg markers set by the second pass up to scan.next
+    int *markers;
+    int markers_len;
+    int markers_alloc;
+};
+
+// leg state for the trace of a, not attached to the aircraft yet
+struct legState *legsNew(struct aircraft *a);
+// catch up with the points added since the last call, returns the first trace index
+// mark_legs() will need in the view, 0 if the second pass has to start over
+int legsPrepare(struct aircraft *a);
+// set the leg markers in the view and update a->trace_last_leg, returns -1 if the view
+// does not start early enough (the threshold changed after legsPrepare())
+int legsMark(struct aircraft *a, struct traceView *tv);
+void legsFree(struct aircraft *a);
+
+#endif
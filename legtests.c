@@ -0,0 +1,569 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// legtests.c - incremental leg detection compared to the complete rescan
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// usage: legtests [benchmark] [trace_full_xxxxxx.json ...]
+// without files a number of synthetic flights are used,
+// trace json files as written by readsb (gzipped or not) are replayed point by point
+
+#include "readsb.h"
+
+#define MAX_POINTS (64 * 1024)
+
+// deterministic pseudo random numbers so failures are reproducible
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+static uint32_t rnd(uint32_t n) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t) ((rng_state * 0x2545F4914F6CDD1DULL) >> 32) % n;
+}
+
+static double elapsed(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// mark_legs() as it was before legs.c, rescanning the complete trace every time
+static void reference_legs(struct state *trace, int trace_len, uint64_t *last_leg) {
+    if (trace_len < 20)
+        return;
+
+    int high = 0;
+    int low = 100000;
+
+    int last_five[5] = { 0 };
+    uint32_t five_pos = 0;
+
+    double sum = 0;
+
+    struct state *new_leg = NULL;
+
+    for (int i = 0; i < trace_len; i++) {
+        int32_t altitude = trace[i].altitude * 25;
+        int on_ground = trace[i].flags.on_ground;
+        int altitude_valid = trace[i].flags.altitude_valid;
+
+        trace[i].flags.leg_marker = 0;
+
+        if (!altitude_valid)
+            continue;
+
+        if (on_ground) {
+            int avg = 0;
+            for (int i = 0; i < 5; i++) avg += last_five[i];
+            avg /= 5;
+            altitude = avg;
+        } else {
+            if (five_pos == 0) {
+                for (int i = 0; i < 5; i++)
+                    last_five[i] = altitude;
+            } else {
+                last_five[five_pos % 5] = altitude;
+            }
+            five_pos++;
+        }
+
+        sum += altitude;
+    }
+
+    int threshold = (int) (sum / (double) (trace_len * 3));
+
+    if (threshold > 10000)
+        threshold = 10000;
+    if (threshold < 200)
+        threshold = 200;
+
+    high = 0;
+    low = 100000;
+
+    uint64_t major_climb = 0;
+    uint64_t major_descent = 0;
+    int major_climb_index = 0;
+    int major_descent_index = 0;
+    uint64_t last_high = 0;
+    uint64_t last_low = 0;
+
+    int last_low_index = 0;
+
+    uint64_t last_airborne = 0;
+    uint64_t last_ground = 0;
+
+    int was_ground = 0;
+
+    for (int i = 0; i < 5; i++)
+        last_five[i] = 0;
+    five_pos = 0;
+
+    int prev_tmp = 0;
+    for (int i = 1; i < trace_len; i++) {
+        struct state *state = &trace[i];
+        int prev_index = prev_tmp;
+        struct state *prev = &trace[prev_index];
+
+        uint64_t elapsed = state->timestamp - prev->timestamp;
+
+        int32_t altitude = state->altitude * 25;
+        int on_ground = state->flags.on_ground;
+        int altitude_valid = state->flags.altitude_valid;
+
+        if (!on_ground && !altitude_valid)
+            continue;
+
+        prev_tmp = i;
+
+        if (on_ground) {
+            int avg = 0;
+            for (int i = 0; i < 5; i++)
+                avg += last_five[i];
+            avg /= 5;
+            altitude = avg - threshold / 2;
+        } else {
+            if (five_pos == 0) {
+                for (int i = 0; i < 5; i++)
+                    last_five[i] = altitude;
+            } else {
+                last_five[five_pos % 5] = altitude;
+            }
+            five_pos++;
+        }
+
+        if (!on_ground)
+            last_airborne = state->timestamp;
+        else
+            last_ground = state->timestamp;
+
+        if (altitude >= high) {
+            high = altitude;
+        }
+        if (altitude <= low) {
+            low = altitude;
+        }
+
+        if (abs(low - altitude) < threshold * 1 / 3 && elapsed < 30 * MINUTES) {
+            last_low = state->timestamp;
+            last_low_index = i;
+        }
+        if (abs(high - altitude) < threshold * 1 / 3)
+            last_high = state->timestamp;
+
+        if (high - low > threshold) {
+            if (last_high > last_low) {
+                if (major_climb <= major_descent) {
+                    int bla = min(trace_len - 1, last_low_index + 3);
+                    major_climb = trace[bla].timestamp;
+                    major_climb_index = bla;
+                }
+                low = high - threshold * 9/10;
+            } else if (last_high < last_low) {
+                int bla = max(0, last_low_index - 3);
+                major_descent = trace[bla].timestamp;
+                major_descent_index = bla;
+                high = low + threshold * 9/10;
+            }
+        }
+        int leg_now = 0;
+        if ( (major_descent && (on_ground || was_ground) && elapsed > 25 * 60 * 1000) ||
+                (major_descent && (on_ground || was_ground) && state->timestamp > last_airborne + 45 * 60 * 1000)
+           )
+        {
+            leg_now = 1;
+        }
+        double distance = greatcircle_fast(
+                (double) trace[i].lat / 1E6,
+                (double) trace[i].lon / 1E6,
+                (double) trace[i-1].lat / 1E6,
+                (double) trace[i-1].lon / 1E6
+                );
+
+        if ( elapsed > 30 * 60 * 1000 && distance < 10E3 * (elapsed / (30 * 60 * 1000.0)) && distance > 1) {
+            leg_now = 1;
+        }
+
+        int leg_float = 0;
+        if (major_climb && major_descent &&
+                (major_climb > major_descent + 8 * MINUTES || last_ground > major_descent - 2 * MINUTES)
+           ) {
+            for (int i = major_descent_index + 1; i < major_climb_index; i++) {
+                if (trace[i].timestamp > trace[i - 1].timestamp + 5 * MINUTES) {
+                    leg_float = 1;
+                }
+            }
+        }
+
+        if (leg_float || leg_now)
+        {
+            if (leg_now) {
+                new_leg = &trace[prev_index + 1];
+                for (int k = prev_index + 1; k < i; k++) {
+                    struct state *state = &trace[i];
+                    struct state *last = &trace[i - 1];
+
+                    if (state->timestamp > last->timestamp + 5 * 60 * 1000) {
+                        new_leg = state;
+                        break;
+                    }
+                }
+            } else if (major_descent_index + 1 == major_climb_index) {
+                new_leg = &trace[major_climb_index];
+            } else {
+                for (int i = major_climb_index; i > major_descent_index; i--) {
+                    struct state *state = &trace[i];
+                    struct state *last = &trace[i - 1];
+
+                    if (state->timestamp > last->timestamp + 5 * 60 * 1000) {
+                        new_leg = state;
+                        break;
+                    }
+                }
+                uint64_t half = major_descent + (major_climb - major_descent) / 2;
+                for (int i = major_descent_index + 1; i < major_climb_index; i++) {
+                    struct state *state = &trace[i];
+
+                    if (state->timestamp > half) {
+                        new_leg = state;
+                        break;
+                    }
+                }
+            }
+
+            if (new_leg) {
+                new_leg->flags.leg_marker = 1;
+            }
+
+            major_climb = 0;
+            major_climb_index = 0;
+            major_descent = 0;
+            major_descent_index = 0;
+            low += threshold;
+            high -= threshold;
+        }
+
+        was_ground = on_ground;
+    }
+    *last_leg = new_leg ? new_leg->timestamp : 0;
+}
+
+static void add_point(struct state *trace, int *len, uint64_t ts, double lat, double lon, int alt, int ground) {
+    if (*len >= MAX_POINTS)
+        return;
+    struct state *s = &trace[(*len)++];
+    memset(s, 0, sizeof(struct state));
+    s->timestamp = ts;
+    s->lat = (int32_t) (lat * 1E6);
+    s->lon = (int32_t) (lon * 1E6);
+    s->altitude = alt / 25;
+    s->flags.on_ground = ground;
+    s->flags.altitude_valid = !ground && rnd(50);
+}
+
+enum { HELICOPTER, REGIONAL, LONG_HAUL };
+
+// a day of a plane or helicopter: taxi, climb, cruise, descent, land, turnaround, repeat
+// with reception gaps now and then
+static int synthetic_flights(struct state *trace, int max_len, int type) {
+    int len = 0;
+    uint64_t ts = 1600000000000ULL;
+    double lat = 40 + rnd(2000) / 100.0, lon = rnd(3000) / 100.0;
+    int heli = (type == HELICOPTER);
+    int legs = 1 + rnd(type == HELICOPTER ? 12 : (type == REGIONAL ? 6 : 2));
+
+    for (int leg = 0; leg < legs && len < max_len; leg++) {
+        int cruise, cruise_time;
+        if (type == HELICOPTER) {
+            cruise = 500 + rnd(2000);
+            cruise_time = 300 + rnd(3600);
+        } else if (type == REGIONAL) {
+            cruise = 3000 + rnd(35000);
+            cruise_time = 1200 + rnd(3 * 3600);
+        } else {
+            cruise = 33000 + rnd(8000);
+            cruise_time = 6 * 3600 + rnd(6 * 3600);
+        }
+        double dir = rnd(360) * M_PI / 180;
+        double speed = (heli ? 60 : 220) / 111e3; // degrees per second, roughly
+        int alt = 0;
+
+        // taxi
+        for (int t = 0; t < 300; t += 5 + rnd(20)) {
+            ts += 5000 + rnd(20000);
+            add_point(trace, &len, ts, lat, lon, 0, 1);
+        }
+        int climb = 1, descent = 0, time = 0;
+        while (len < max_len) {
+            int step = 4 + rnd(30);
+            ts += step * 1000;
+            time += step;
+            if (climb) {
+                alt += step * (heli ? 10 : 30);
+                if (alt >= cruise) {
+                    alt = cruise;
+                    climb = 0;
+                }
+            } else if (descent) {
+                alt -= step * (heli ? 10 : 25);
+                if (alt <= 0)
+                    break;
+            } else if (time > cruise_time) {
+                descent = 1;
+            } else {
+                alt += (int) rnd(200) - 100;
+            }
+            lat += speed * step * cos(dir);
+            lon += speed * step * sin(dir);
+            if (!rnd(400)) {
+                // reception gap while airborne
+                int gap = 60 + rnd(3600);
+                ts += gap * 1000;
+                time += gap;
+                lat += speed * gap * cos(dir);
+                lon += speed * gap * sin(dir);
+            }
+            add_point(trace, &len, ts, lat, lon, max(alt, 0), 0);
+        }
+        // landing, turnaround on the ground, sometimes without any positions
+        for (int t = 0; t < 200; t += 5 + rnd(20)) {
+            ts += 5000 + rnd(20000);
+            add_point(trace, &len, ts, lat, lon, 0, 1);
+        }
+        ts += (10 + rnd(120)) * 60 * 1000;
+    }
+    return len;
+}
+
+// trace json as written by generateTraceJson, only what leg detection uses
+static int read_trace_json(const char *filename, struct state *trace, int max_len) {
+    gzFile gzfp = gzopen(filename, "r");
+    if (!gzfp) {
+        perror(filename);
+        return -1;
+    }
+    struct char_buffer cb = { 0 };
+    size_t alloc = 0;
+    int res;
+    do {
+        if (alloc - cb.len < 65536) {
+            alloc = 2 * alloc + 65536;
+            cb.buffer = realloc(cb.buffer, alloc + 1);
+        }
+        res = gzread(gzfp, cb.buffer + cb.len, alloc - cb.len);
+        if (res > 0)
+            cb.len += res;
+    } while (res > 0);
+    gzclose(gzfp);
+    if (res < 0) {
+        fprintf(stderr, "%s: gzread failed\n", filename);
+        free(cb.buffer);
+        return -1;
+    }
+    cb.buffer[cb.len] = 0;
+
+    int len = 0;
+    double base = 0;
+    char *p = strstr(cb.buffer, "\"timestamp\":");
+    if (p)
+        base = strtod(p + strlen("\"timestamp\":"), NULL);
+    p = strstr(cb.buffer, "\"trace\":[");
+    while (p && len < max_len && (p = strstr(p, "\n[")) != NULL) {
+        p += 2;
+        char *end;
+        double offset = strtod(p, &end);
+        double lat = strtod(end + 1, &end);
+        double lon = strtod(end + 1, &end);
+        int ground = !strncmp(end + 1, "\"ground\"", 8);
+        int valid = !ground && strncmp(end + 1, "null", 4);
+        int alt = valid ? (int) strtol(end + 1, NULL, 10) : 0;
+
+        struct state *s = &trace[len++];
+        memset(s, 0, sizeof(struct state));
+        s->timestamp = (uint64_t) ((base + offset) * 1000 + 0.5);
+        s->lat = (int32_t) nearbyint(lat * 1E6);
+        s->lon = (int32_t) nearbyint(lon * 1E6);
+        s->altitude = alt / 25;
+        s->flags.on_ground = ground;
+        s->flags.altitude_valid = valid;
+    }
+    free(cb.buffer);
+    return len;
+}
+
+// one trace write like write_trace(): partial view, full view if that isn't enough
+static int incremental_write(struct aircraft *a, struct traceView *tv) {
+    int from = min(traceLen(a) - 142, legsPrepare(a));
+    if (traceViewGetFrom(a, tv, from))
+        return -1;
+    if (legsMark(a, tv) == 0)
+        return 0;
+    traceViewFree(tv);
+    if (traceViewGet(a, tv))
+        return -1;
+    return legsMark(a, tv);
+}
+
+// append the points a few at a time like the decode thread, resize the trace like
+// resize_trace() and compare the markers after every write
+static int replay(const char *name, struct state *trace, int len, int drop_every) {
+    struct state_all *trace_all = calloc(len / 4 + 1, sizeof(struct state_all));
+    struct state *ref = malloc(len * sizeof(struct state));
+    struct aircraft *a = calloc(1, sizeof(struct aircraft));
+    a->addr = 0x4b1234; // not LEG_FOCUS
+    uint64_t ref_last_leg = 0;
+    int first = 0; // index of the first point still in the trace
+    int ok = 1;
+
+    for (int i = 0; i < len && ok; ) {
+        int n = min(1 + rnd(40), len - i);
+        for (int k = 0; k < n; k++, i++) {
+            if (a->trace_len + GLOBE_STEP / 2 >= a->trace_alloc) {
+                if (drop_every && i % drop_every < 100)
+                    first += traceDropOldest(a);
+                traceSeal(a);
+                traceReserve(a, a->trace_len + GLOBE_STEP);
+            }
+            *traceAt(a, a->trace_len) = trace[i];
+            if (a->trace_len % 4 == 0)
+                *traceAllAt(a, a->trace_len) = trace_all[i / 4];
+            a->trace_len++;
+        }
+
+        struct traceView tv = { 0 };
+        if (incremental_write(a, &tv)) {
+            fprintf(stderr, "%s: FAIL: no view\n", name);
+            ok = 0;
+            break;
+        }
+        int ref_len = i - first;
+        memcpy(ref, trace + first, ref_len * sizeof(struct state));
+        reference_legs(ref, ref_len, &ref_last_leg);
+
+        if (ref_len >= 20) {
+            for (int k = 0; k < tv.len; k++) {
+                if (tv.trace[k].flags.leg_marker != ref[tv.first + k].flags.leg_marker) {
+                    fprintf(stderr, "%s: FAIL: leg marker at %d of %d differs (view from %d)\n",
+                            name, tv.first + k, ref_len, tv.first);
+                    ok = 0;
+                    break;
+                }
+            }
+            if (ok && a->trace_last_leg != ref_last_leg) {
+                fprintf(stderr, "%s: FAIL: last leg differs at %d points\n", name, ref_len);
+                ok = 0;
+            }
+        }
+        traceViewFree(&tv);
+    }
+    legsFree(a);
+    traceFree(a);
+    free(a);
+    free(ref);
+    free(trace_all);
+    return ok;
+}
+
+static int testSynthetic(struct state *trace) {
+    int ok = 1;
+    for (int round = 0; round < 40 && ok; round++) {
+        int len = synthetic_flights(trace, MAX_POINTS, round % 3);
+        ok &= replay("testSynthetic", trace, len, round % 2 ? 3000 : 0);
+    }
+    fprintf(stderr, "testSynthetic:      %s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+static int testFiles(struct state *trace, int argc, char **argv) {
+    int ok = 1;
+    for (int i = 0; i < argc; i++) {
+        int len = read_trace_json(argv[i], trace, MAX_POINTS);
+        if (len < 0) {
+            ok = 0;
+            continue;
+        }
+        ok &= replay(argv[i], trace, len, 0);
+    }
+    fprintf(stderr, "testFiles:          %s (%d traces)\n", ok ? "PASS" : "FAIL", argc);
+    return ok;
+}
+
+// cost of the leg detection per trace write, view included:
+// rescanning the complete trace vs. continuing from the last write
+static void benchmark(struct state *trace) {
+    const char *names[] = { "helicopter", "regional", "long haul" };
+    for (int type = HELICOPTER; type <= LONG_HAUL; type++) {
+        int len = synthetic_flights(trace, MAX_POINTS, type);
+
+        struct aircraft *a = calloc(1, sizeof(struct aircraft));
+        a->addr = 0x4b1234; // not LEG_FOCUS
+        struct state_all *trace_all = calloc(len / 4 + 1, sizeof(struct state_all));
+        double full = 0, incremental = 0;
+        int writes = 0, partial = 0;
+
+        for (int i = 0; i < len; ) {
+            for (int k = 0; k < 2 && i < len; k++, i++) {
+                if (a->trace_len + GLOBE_STEP / 2 >= a->trace_alloc) {
+                    traceSeal(a);
+                    traceReserve(a, a->trace_len + GLOBE_STEP);
+                }
+                *traceAt(a, a->trace_len) = trace[i];
+                if (a->trace_len % 4 == 0)
+                    *traceAllAt(a, a->trace_len) = trace_all[i / 4];
+                a->trace_len++;
+            }
+            struct timespec start;
+            struct traceView tv;
+            uint64_t last_leg = 0;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            traceViewGet(a, &tv);
+            reference_legs(tv.trace, tv.len, &last_leg);
+            traceViewFree(&tv);
+            full += elapsed(&start);
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            incremental_write(a, &tv);
+            partial += (tv.first > 0);
+            traceViewFree(&tv);
+            incremental += elapsed(&start);
+
+            writes++;
+        }
+        fprintf(stderr, "%-10s %5d points, %4d writes (%3.0f%% partial): full %6.1f us, incremental %6.1f us per write\n",
+                names[type], len, writes, 100.0 * partial / writes, full / writes * 1e6, incremental / writes * 1e6);
+
+        legsFree(a);
+        traceFree(a);
+        free(a);
+        free(trace_all);
+    }
+}
+
+int main(int argc, char **argv) {
+    struct state *trace = malloc(MAX_POINTS * sizeof(struct state));
+
+    if (argc > 1 && !strcmp(argv[1], "benchmark")) {
+        benchmark(trace);
+        free(trace);
+        return 0;
+    }
+
+    int ok = 1;
+    ok &= testSynthetic(trace);
+    if (argc > 1)
+        ok &= testFiles(trace, argc - 1, argv + 1);
+    free(trace);
+    return ok ? 0 : 1;
+}
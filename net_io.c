@@ -103,6 +103,7 @@ static int hexDigitVal(int c);
 static void *pthreadGetaddrinfo(void *param);
 
 static char *sprintAircraftObject(char *p, char *end, struct aircraft *a, uint64_t now, int printMode);
+static char *sprintAircraftCached(char *p, char *end, struct aircraft *a, uint64_t now);
 static void flushClient(struct client *c, uint64_t now);
 static void read_uuid(struct client *c, char *p, char *eod);
 
@@ -2012,26 +2013,6 @@ static const char *trimSpace(const char *in, char *out, int len) {
 //
 // Return a description of planes in json. No metric conversion
 //
-static const char *jsonEscapeString(const char *str, char *buf, int len) {
-    const char *in = str;
-    char *out = buf, *end = buf + len - 10;
-
-    for (; *in && out < end; ++in) {
-        unsigned char ch = *in;
-        if (ch == '"' || ch == '\\') {
-            *out++ = '\\';
-            *out++ = ch;
-        } else if (ch < 32 || ch > 126) {
-            out = safe_snprintf(out, end, "\\u%04x", ch);
-        } else {
-            *out++ = ch;
-        }
-    }
-
-    *out++ = 0;
-    return buf;
-}
-
 static const char *hexEscapeString(const char *str, char *buf, int len) {
     const char *in = str;
     char *out = buf, *end = buf + len - 10;
@@ -2053,68 +2034,68 @@ static const char *hexEscapeString(const char *str, char *buf, int len) {
 }
 
 static char *append_flags(char *p, char *end, struct aircraft *a, datasource_t source) {
-    p = safe_snprintf(p, end, "[");
+    p = json_lit(p, end, "[");
 
     char *start = p;
     if (a->callsign_valid.source == source)
-        p = safe_snprintf(p, end, "\"callsign\",");
+        p = json_lit(p, end, "\"callsign\",");
     if (a->altitude_baro_valid.source == source)
-        p = safe_snprintf(p, end, "\"altitude\",");
+        p = json_lit(p, end, "\"altitude\",");
     if (a->altitude_geom_valid.source == source)
-        p = safe_snprintf(p, end, "\"alt_geom\",");
+        p = json_lit(p, end, "\"alt_geom\",");
     if (a->gs_valid.source == source)
-        p = safe_snprintf(p, end, "\"gs\",");
+        p = json_lit(p, end, "\"gs\",");
     if (a->ias_valid.source == source)
-        p = safe_snprintf(p, end, "\"ias\",");
+        p = json_lit(p, end, "\"ias\",");
     if (a->tas_valid.source == source)
-        p = safe_snprintf(p, end, "\"tas\",");
+        p = json_lit(p, end, "\"tas\",");
     if (a->mach_valid.source == source)
-        p = safe_snprintf(p, end, "\"mach\",");
+        p = json_lit(p, end, "\"mach\",");
     if (a->track_valid.source == source)
-        p = safe_snprintf(p, end, "\"track\",");
+        p = json_lit(p, end, "\"track\",");
     if (a->track_rate_valid.source == source)
-        p = safe_snprintf(p, end, "\"track_rate\",");
+        p = json_lit(p, end, "\"track_rate\",");
     if (a->roll_valid.source == source)
-        p = safe_snprintf(p, end, "\"roll\",");
+        p = json_lit(p, end, "\"roll\",");
     if (a->mag_heading_valid.source == source)
-        p = safe_snprintf(p, end, "\"mag_heading\",");
+        p = json_lit(p, end, "\"mag_heading\",");
     if (a->true_heading_valid.source == source)
-        p = safe_snprintf(p, end, "\"true_heading\",");
+        p = json_lit(p, end, "\"true_heading\",");
     if (a->baro_rate_valid.source == source)
-        p = safe_snprintf(p, end, "\"baro_rate\",");
+        p = json_lit(p, end, "\"baro_rate\",");
     if (a->geom_rate_valid.source == source)
-        p = safe_snprintf(p, end, "\"geom_rate\",");
+        p = json_lit(p, end, "\"geom_rate\",");
     if (a->squawk_valid.source == source)
-        p = safe_snprintf(p, end, "\"squawk\",");
+        p = json_lit(p, end, "\"squawk\",");
     if (a->emergency_valid.source == source)
-        p = safe_snprintf(p, end, "\"emergency\",");
+        p = json_lit(p, end, "\"emergency\",");
     if (a->nav_qnh_valid.source == source)
-        p = safe_snprintf(p, end, "\"nav_qnh\",");
+        p = json_lit(p, end, "\"nav_qnh\",");
     if (a->nav_altitude_mcp_valid.source == source)
-        p = safe_snprintf(p, end, "\"nav_altitude_mcp\",");
+        p = json_lit(p, end, "\"nav_altitude_mcp\",");
     if (a->nav_altitude_fms_valid.source == source)
-        p = safe_snprintf(p, end, "\"nav_altitude_fms\",");
+        p = json_lit(p, end, "\"nav_altitude_fms\",");
     if (a->nav_heading_valid.source == source)
-        p = safe_snprintf(p, end, "\"nav_heading\",");
+        p = json_lit(p, end, "\"nav_heading\",");
     if (a->nav_modes_valid.source == source)
-        p = safe_snprintf(p, end, "\"nav_modes\",");
+        p = json_lit(p, end, "\"nav_modes\",");
     if (a->position_valid.source == source)
-        p = safe_snprintf(p, end, "\"lat\",\"lon\",\"nic\",\"rc\",");
+        p = json_lit(p, end, "\"lat\",\"lon\",\"nic\",\"rc\",");
     if (a->nic_baro_valid.source == source)
-        p = safe_snprintf(p, end, "\"nic_baro\",");
+        p = json_lit(p, end, "\"nic_baro\",");
     if (a->nac_p_valid.source == source)
-        p = safe_snprintf(p, end, "\"nac_p\",");
+        p = json_lit(p, end, "\"nac_p\",");
     if (a->nac_v_valid.source == source)
-        p = safe_snprintf(p, end, "\"nac_v\",");
+        p = json_lit(p, end, "\"nac_v\",");
     if (a->sil_valid.source == source)
-        p = safe_snprintf(p, end, "\"sil\",\"sil_type\",");
+        p = json_lit(p, end, "\"sil\",\"sil_type\",");
     if (a->gva_valid.source == source)
-        p = safe_snprintf(p, end, "\"gva\",");
+        p = json_lit(p, end, "\"gva\",");
     if (a->sda_valid.source == source)
-        p = safe_snprintf(p, end, "\"sda\",");
+        p = json_lit(p, end, "\"sda\",");
     if (p != start)
         --p;
-    p = safe_snprintf(p, end, "]");
+    p = json_lit(p, end, "]");
     return p;
 }
 
@@ -2139,11 +2120,13 @@ static char *append_nav_modes(char *p, char *end, nav_modes_t flags, const char
         }
 
         if (!first) {
-            p = safe_snprintf(p, end, "%s", sep);
+            p = json_str(p, end, sep);
         }
 
         first = 0;
-        p = safe_snprintf(p, end, "%s%s%s", quote, nav_modes_names[i].name, quote);
+        p = json_str(p, end, quote);
+        p = json_str(p, end, nav_modes_names[i].name);
+        p = json_str(p, end, quote);
     }
 
     return p;
@@ -2151,8 +2134,8 @@ static char *append_nav_modes(char *p, char *end, nav_modes_t flags, const char
 
 const char *nav_modes_flags_string(nav_modes_t flags) {
     static char buf[256];
-    buf[0] = 0;
-    append_nav_modes(buf, buf + sizeof (buf), flags, "", " ");
+    char *p = append_nav_modes(buf, buf + sizeof (buf) - 1, flags, "", " ");
+    *p = 0;
     return buf;
 }
 
@@ -2265,14 +2248,11 @@ static void check_state_all(struct aircraft *test, uint64_t now) {
     }
 }
 */
-struct char_buffer generateGlobeBin(int globe_index, int mil) {
-    struct char_buffer cb;
-    uint64_t now = mstime();
-    struct aircraft *a;
-    size_t buflen = 1*1024*1024; // The initial buffer is resized as needed
-    char *buf = (char *) malloc(buflen), *p = buf, *end = buf + buflen;
 
+// header of a binCraft tile, one record long
+static char *globeBinHeader(char *p, int globe_index, uint64_t now) {
     uint32_t elementSize = sizeof(struct binCraft);
+    char *start = p;
     memset(p, 0, elementSize);
 
 #define memWrite(p, var) do { memcpy(p, &var, sizeof(var)); p += sizeof(var); } while(0)
@@ -2287,71 +2267,237 @@ struct char_buffer generateGlobeBin(int globe_index, int mil) {
     uint32_t index = globe_index;
     memWrite(p, index);
 
-    if (p - buf > (int) elementSize)
+    // tile version for --write-json-globe-deltas, set by generateGlobeDelta()
+    uint32_t version = 0;
+    memWrite(p, version);
+
+#undef memWrite
+
+    if (p - start > (int) elementSize)
         fprintf(stderr, "buffer overrun globeBin\n");
 
-    p = buf + elementSize;
+    return start + elementSize;
+}
 
-    struct craftArray *ca = NULL;
-    int good;
-    if (globe_index <= GLOBE_MAX_INDEX) {
-        ca = &Modes.globeLists[globe_index];
-        good = 1;
-    } else {
+// append a record, the buffer is doubled as needed
+static void globeBinAppend(struct char_buffer *cb, size_t *buflen, const struct binCraft *bin) {
+    if (cb->len + sizeof(struct binCraft) > *buflen) {
+        size_t len = *buflen * 2;
+        char *grown = arenaRealloc(cb->buffer, len);
+        if (!grown) {
+            fprintf(stderr, "globeBinAppend: realloc failure!\n");
+            return;
+        }
+        cb->buffer = grown;
+        *buflen = len;
+    }
+    memcpy(cb->buffer + cb->len, bin, sizeof(struct binCraft));
+    cb->len += sizeof(struct binCraft);
+}
+
+// globe_xxxx.binCraft and globeMil_xxxx.binCraft in one pass over the tile,
+// each record is converted once for both.  The record is built locally: an
+// aircraft that moves to another tile during the refresh is converted by two
+// globe workers at the same time.
+void generateGlobeBins(int globe_index, uint64_t now, struct char_buffer *all, struct char_buffer *mil) {
+    size_t alllen = 1*1024*1024; // The initial buffers are resized as needed
+    size_t millen = 64*1024;
+    all->buffer = arenaMalloc(alllen);
+    mil->buffer = arenaMalloc(millen);
+    all->len = globeBinHeader(all->buffer, globe_index, now) - all->buffer;
+    mil->len = globeBinHeader(mil->buffer, globe_index, now) - mil->buffer;
+
+    if (globe_index > GLOBE_MAX_INDEX) {
         fprintf(stderr, "generateAircraftJson: bad globe_index: %d\n", globe_index);
-        good = 0;
+        return;
     }
-    if (good && ca->list) {
-        for (int i = 0; i < ca->len; i++) {
-            a = ca->list[i];
+    struct craftArray *ca = &Modes.globeLists[globe_index];
+    if (!ca->list)
+        return;
 
-            if (a == NULL)
-                continue;
-            if (mil && !(a->dbFlags & 1))
-                continue;
+    for (int i = 0; i < ca->len; i++) {
+        struct aircraft *a = ca->list[i];
 
-            int use = 0;
+        if (a == NULL)
+            continue;
 
-            if (a->position_valid.source == SOURCE_JAERO)
-                use = 1;
-            if (now < a->seen_pos + 5 * MINUTES)
-                use = 1;
+        if (a->position_valid.source != SOURCE_JAERO && now >= a->seen_pos + 5 * MINUTES)
+            continue;
 
-            if (!use)
-                continue;
+        struct binCraft bin;
+        toBinCraft(a, &bin, now);
 
-            // check if we have enough space
-            if ((p + 1000) >= end) {
-                int used = p - buf;
-                buflen *= 2;
-                buf = (char *) realloc(buf, buflen);
-                p = buf + used;
-                end = buf + buflen;
-            }
+        globeBinAppend(all, &alllen, &bin);
+        if (a->dbFlags & 1)
+            globeBinAppend(mil, &millen, &bin);
+    }
+}
 
-            struct binCraft bin;
-            toBinCraft(a, &bin, now);
+// Delta tiles (--write-json-globe-deltas): globeDelta_xxxx.binCraft brings the
+// records of globe_xxxx.binCraft from one version of the tile to the next.
+// The full tile carries its version as uint32_t at byte 20 of the header.
+//
+// Header, 32 bytes: uint64_t now, uint32_t elementSize (the record size),
+// uint32_t ac_count_pos, uint32_t globe index, uint32_t version,
+// uint32_t removed, uint32_t changed.
+// Then removed times uint32_t hex: records gone from the tile.
+// Then changed times: uint32_t hex, uint64_t mask, one uint16_t word of the
+// record for each bit set in the mask (bit i: bytes 2i and 2i + 1).  The
+// record is the previous one with those words replaced, a new record starts
+// out as zeros and the hex.  seen_pos and seen are always part of a changed record.
+// Records not mentioned are unchanged except for seen and seen_pos: they advance
+// by (now - previous now) / 100 capped at 65535, seen_pos only if lat or lon
+// isn't 0.  They stay within 0.1 of the full tile, else the record is sent.
+
+#define BIN_WORDS (sizeof(struct binCraft) / 2)
+// one bit of the uint64_t change mask per word
+_Static_assert(sizeof(struct binCraft) <= 128 && sizeof(struct binCraft) % 2 == 0, "struct binCraft doesn't fit the change mask of the delta format");
+#define BIN_SEEN_WORDS ((1ULL << 2) | (1ULL << 3)) // seen_pos, seen
+
+struct globeDeltaState {
+    struct binCraft *recs; // the records of the last version as the client has them, sorted by hex
+    int len;
+    uint32_t version;
+    uint64_t now;
+};
 
-            memWrite(p, bin);
+// each tile is written by one thread at a time
+static struct globeDeltaState globeDeltas[GLOBE_MAX_INDEX + 1];
 
-            if (p >= end)
-                fprintf(stderr, "buffer overrun globeBin\n");
+static int compareBinHex(const void *x, const void *y) {
+    uint32_t a = ((const struct binCraft *) x)->hex;
+    uint32_t b = ((const struct binCraft *) y)->hex;
+    return (a > b) - (a < b);
+}
+
+// words of b that differ from a, seen_pos and seen are not compared
+static uint64_t binDiff(const struct binCraft *a, const struct binCraft *b) {
+    uint16_t wa[BIN_WORDS], wb[BIN_WORDS];
+    memcpy(wa, a, sizeof(wa));
+    memcpy(wb, b, sizeof(wb));
+    uint64_t mask = 0;
+    for (unsigned i = 2; i < BIN_WORDS; i++) {
+        if (wa[i] != wb[i])
+            mask |= 1ULL << i;
+    }
+    return mask & ~BIN_SEEN_WORDS;
+}
+
+// what the client makes of a record not mentioned in the delta
+static void binAge(struct binCraft *r, uint64_t elapsed) {
+    uint64_t tenths = elapsed / 100;
+    r->seen = min(65535, r->seen + tenths);
+    if (r->lat || r->lon)
+        r->seen_pos = min(65535, r->seen_pos + tenths);
+}
+
+static char *binDeltaRecord(char *p, const struct binCraft *base, const struct binCraft *rec) {
+    uint64_t mask = binDiff(base, rec) | BIN_SEEN_WORDS;
+    uint16_t words[BIN_WORDS];
+    memcpy(words, rec, sizeof(words));
+    memcpy(p, &rec->hex, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+    memcpy(p, &mask, sizeof(mask));
+    p += sizeof(mask);
+    for (unsigned i = 2; i < BIN_WORDS; i++) {
+        if (mask & (1ULL << i)) {
+            memcpy(p, &words[i], sizeof(uint16_t));
+            p += sizeof(uint16_t);
         }
     }
+    return p;
+}
+
+// the delta from the previous version of the tile to the records of the full
+// tile all (made by generateGlobeBins()), the version is written into all
+struct char_buffer generateGlobeDelta(int globe_index, struct char_buffer *all, uint64_t now) {
+    struct char_buffer cb = { NULL, 0 };
+    struct globeDeltaState *st = &globeDeltas[globe_index];
+    int elementSize = sizeof(struct binCraft);
+    int len = all->len / elementSize - 1;
+
+    // the new records sorted by hex, an aircraft listed twice counts once
+    struct binCraft *recs = malloc((len + 1) * sizeof(struct binCraft));
+    // worst case: everything removed and everything new with all words
+    char *buf = arenaMalloc(32 + st->len * sizeof(uint32_t) + len * (sizeof(uint32_t) + sizeof(uint64_t) + elementSize));
+    if (!recs || !buf) {
+        fprintf(stderr, "generateGlobeDelta: malloc failure!\n");
+        free(recs);
+        arenaFree(buf);
+        return cb;
+    }
+    memcpy(recs, all->buffer + elementSize, len * elementSize);
+    qsort(recs, len, elementSize, compareBinHex);
+    int unique = 0;
+    for (int i = 0; i < len; i++) {
+        if (unique == 0 || recs[i].hex != recs[unique - 1].hex)
+            recs[unique++] = recs[i];
+    }
+    len = unique;
+
+    uint32_t version = ++st->version;
+    memcpy(all->buffer + 20, &version, sizeof(version));
+
+    char *p = buf + 32;
+    uint32_t removed = 0;
+    for (int i = 0, k = 0; i < st->len; i++) {
+        while (k < len && recs[k].hex < st->recs[i].hex)
+            k++;
+        if (k < len && recs[k].hex == st->recs[i].hex)
+            continue;
+        memcpy(p, &st->recs[i].hex, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+        removed++;
+    }
+
+    uint32_t changed = 0;
+    for (int k = 0, i = 0; k < len; k++) {
+        while (i < st->len && st->recs[i].hex < recs[k].hex)
+            i++;
+        struct binCraft base;
+        if (i < st->len && st->recs[i].hex == recs[k].hex) {
+            base = st->recs[i];
+            binAge(&base, now - st->now);
+            if (!binDiff(&base, &recs[k]) && abs(base.seen - recs[k].seen) <= 1 && abs(base.seen_pos - recs[k].seen_pos) <= 1) {
+                // keep the client's version of the record
+                recs[k] = base;
+                continue;
+            }
+        } else {
+            memset(&base, 0, sizeof(base));
+        }
+        p = binDeltaRecord(p, &base, &recs[k]);
+        changed++;
+    }
+
+    char *h = buf;
+    uint32_t header[6] = { elementSize, Modes.json_ac_count_pos, globe_index, version, removed, changed };
+    memcpy(h, &now, sizeof(now));
+    memcpy(h + sizeof(now), header, sizeof(header));
+
+    free(st->recs);
+    st->recs = recs;
+    st->len = len;
+    st->now = now;
 
-    cb.len = p - buf;
     cb.buffer = buf;
+    cb.len = p - buf;
     return cb;
+}
 
-#undef memWrite
+void globeDeltasFree() {
+    for (int i = 0; i <= GLOBE_MAX_INDEX; i++) {
+        free(globeDeltas[i].recs);
+        globeDeltas[i].recs = NULL;
+        globeDeltas[i].len = 0;
+    }
 }
 
-struct char_buffer generateGlobeJson(int globe_index){
+struct char_buffer generateGlobeJson(int globe_index, uint64_t now){
     struct char_buffer cb;
-    uint64_t now = mstime();
     struct aircraft *a;
     size_t buflen = 1*1024*1024; // The initial buffer is resized as needed
-    char *buf = (char *) malloc(buflen), *p = buf, *end = buf + buflen;
+    char *buf = (char *) arenaMalloc(buflen), *p = buf, *end = buf + buflen;
 
     p = safe_snprintf(p, end,
             "{ \"now\" : %.1f,\n"
@@ -2421,13 +2567,7 @@ struct char_buffer generateGlobeJson(int globe_index){
                 continue;
 
             // check if we have enough space
-            if ((p + 1000) >= end) {
-                int used = p - buf;
-                buflen *= 2;
-                buf = (char *) realloc(buf, buflen);
-                p = buf + used;
-                end = buf + buflen;
-            }
+            p = json_reserve(&buf, &buflen, &end, p, 1000);
 
             p = sprintAircraftObject(p, end, a, now, 3);
 
@@ -2452,7 +2592,7 @@ struct char_buffer generateAircraftJson(){
     uint64_t now = mstime();
     struct aircraft *a;
     size_t buflen = 6*1024*1024; // The initial buffer is resized as needed
-    char *buf = (char *) malloc(buflen), *p = buf, *end = buf + buflen;
+    char *buf = (char *) arenaMalloc(buflen), *p = buf, *end = buf + buflen;
 
     p = safe_snprintf(p, end,
             "{ \"now\" : %.1f,\n"
@@ -2473,15 +2613,9 @@ struct char_buffer generateAircraftJson(){
                 continue;
 
             // check if we have enough space
-            if ((p + 1000) >= end) {
-                int used = p - buf;
-                buflen *= 2;
-                buf = (char *) realloc(buf, buflen);
-                p = buf + used;
-                end = buf + buflen;
-            }
+            p = json_reserve(&buf, &buflen, &end, p, 1000);
 
-            p = sprintAircraftObject(p, end, a, now, 0);
+            p = sprintAircraftCached(p, end, a, now);
 
             *p++ = ',';
 
@@ -2501,12 +2635,12 @@ struct char_buffer generateAircraftJson(){
     return cb;
 }
 
-struct char_buffer generateTraceJson(struct aircraft *a, int start, int last) {
+struct char_buffer generateTraceJson(struct aircraft *a, struct traceView *tv, int start, int last) {
     struct char_buffer cb;
-    size_t buflen = a->trace_len * 300 + 1024;
+    size_t buflen = tv->len * 300 + 1024;
 
     if (last < 0)
-        last = a->trace_len - 1;
+        last = tv->len - 1;
 
     if (!Modes.json_globe_index) {
         cb.len = 0;
@@ -2514,7 +2648,7 @@ struct char_buffer generateTraceJson(struct aircraft *a, int start, int last) {
         return cb;
     }
 
-    char *buf = (char *) malloc(buflen), *p = buf, *end = buf + buflen;
+    char *buf = (char *) arenaMalloc(buflen), *p = buf, *end = buf + buflen;
 
     p = safe_snprintf(p, end, "{\"icao\":\"%s%06x\"", (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
 
@@ -2532,13 +2666,13 @@ struct char_buffer generateTraceJson(struct aircraft *a, int start, int last) {
             p = safe_snprintf(p, end, ",\n\"noRegData\":true");
     }
 
-    if (start <= last && last < a->trace_len) {
-        p = safe_snprintf(p, end, ",\n\"timestamp\": %.3f", (a->trace + start)->timestamp / 1000.0);
+    if (start <= last && last < tv->len) {
+        p = safe_snprintf(p, end, ",\n\"timestamp\": %.3f", (tv->trace + start)->timestamp / 1000.0);
 
         p = safe_snprintf(p, end, ",\n\"trace\":[ ");
 
         for (int i = start; i <= last; i++) {
-            struct state *trace = &a->trace[i];
+            struct state *trace = &tv->trace[i];
 
             int32_t altitude = trace->altitude * 25;
             int32_t rate = trace->rate * 32;
@@ -2553,48 +2687,61 @@ struct char_buffer generateTraceJson(struct aircraft *a, int start, int last) {
             int altitude_geom = trace->flags.altitude_geom;
 
                 // in the air
-                p = safe_snprintf(p, end, "\n[%.1f,%f,%f",
-                        (trace->timestamp - (a->trace + start)->timestamp) / 1000.0, trace->lat / 1E6, trace->lon / 1E6);
-
-                if (on_ground)
-                    p = safe_snprintf(p, end, ",\"ground\"");
-                else if (altitude_valid)
-                    p = safe_snprintf(p, end, ",%d", altitude);
-                else
-                    p = safe_snprintf(p, end, ",null");
+                p = json_lit(p, end, "\n[");
+                p = json_fixed(p, end, (trace->timestamp - (tv->trace + start)->timestamp) / 1000.0, 1);
+                p = json_lit(p, end, ",");
+                p = json_fixed(p, end, trace->lat / 1E6, 6);
+                p = json_lit(p, end, ",");
+                p = json_fixed(p, end, trace->lon / 1E6, 6);
+
+                if (on_ground) {
+                    p = json_lit(p, end, ",\"ground\"");
+                } else if (altitude_valid) {
+                    p = json_lit(p, end, ",");
+                    p = json_int(p, end, altitude);
+                } else {
+                    p = json_lit(p, end, ",null");
+                }
 
-                if (gs_valid)
-                    p = safe_snprintf(p, end, ",%.1f", trace->gs / 10.0);
-                else
-                    p = safe_snprintf(p, end, ",null");
+                if (gs_valid) {
+                    p = json_lit(p, end, ",");
+                    p = json_fixed(p, end, trace->gs / 10.0, 1);
+                } else {
+                    p = json_lit(p, end, ",null");
+                }
 
-                if (track_valid)
-                    p = safe_snprintf(p, end, ",%.1f", trace->track / 10.0);
-                else
-                    p = safe_snprintf(p, end, ",null");
+                if (track_valid) {
+                    p = json_lit(p, end, ",");
+                    p = json_fixed(p, end, trace->track / 10.0, 1);
+                } else {
+                    p = json_lit(p, end, ",null");
+                }
 
                 int bitfield = (altitude_geom << 3) | (rate_geom << 2) | (leg_marker << 1) | (stale << 0);
-                p = safe_snprintf(p, end, ",%d", bitfield);
+                p = json_lit(p, end, ",");
+                p = json_int(p, end, bitfield);
 
-                if (rate_valid)
-                    p = safe_snprintf(p, end, ",%d", rate);
-                else
-                    p = safe_snprintf(p, end, ",null");
+                if (rate_valid) {
+                    p = json_lit(p, end, ",");
+                    p = json_int(p, end, rate);
+                } else {
+                    p = json_lit(p, end, ",null");
+                }
 
                 if (i % 4 == 0) {
                     uint64_t now = trace->timestamp;
-                    struct state_all *all = &(a->trace_all[i/4]);
+                    struct state_all *all = &(tv->trace_all[i/4]);
                     struct aircraft b;
                     memset(&b, 0, sizeof(struct aircraft));
                     struct aircraft *ac = &b;
                     from_state_all(all, ac, now);
 
-                    p = safe_snprintf(p, end, ",");
+                    p = json_lit(p, end, ",");
                     p = sprintAircraftObject(p, end, ac, now, 1);
                 } else {
-                    p = safe_snprintf(p, end, ",null");
+                    p = json_lit(p, end, ",null");
                 }
-                p = safe_snprintf(p, end, "],");
+                p = json_lit(p, end, "],");
         }
 
         p--; // remove last comma
@@ -2618,10 +2765,50 @@ struct char_buffer generateTraceJson(struct aircraft *a, int start, int last) {
 //
 // Return a description of the receiver in json.
 //
+// the points start to last (-1: the end) of the view, see struct traceBinHeader
+struct char_buffer generateTraceBin(struct aircraft *a, struct traceView *tv, int start, int last) {
+    struct char_buffer cb = { NULL, 0 };
+
+    if (last < 0)
+        last = tv->len - 1;
+    int count = (start <= last && last < tv->len) ? last - start + 1 : 0;
+
+    size_t buflen = sizeof(struct traceBinHeader) + traceEncodeBound(count);
+    char *buf = arenaMalloc(buflen);
+    if (!buf) {
+        fprintf(stderr, "generateTraceBin: malloc failure!\n");
+        return cb;
+    }
+
+    struct traceBinHeader *h = (struct traceBinHeader *) buf;
+    memset(h, 0, sizeof(*h));
+    h->magic = TRACE_BIN_MAGIC;
+    h->header_size = sizeof(struct traceBinHeader);
+    h->state_all_size = sizeof(struct state_all);
+    // the state_all are with the view indexes divisible by 4, like in the json
+    h->first_all = (4 - start % 4) % 4;
+    h->addr = a->addr;
+    h->count = count;
+    h->dbFlags = a->dbFlags;
+    memcpy(h->typeCode, a->typeCode, sizeof(h->typeCode));
+    memcpy(h->registration, a->registration, sizeof(h->registration));
+    memcpy(h->typeLong, a->typeLong, sizeof(h->typeLong));
+
+    unsigned char *data = (unsigned char *) buf + sizeof(struct traceBinHeader);
+    unsigned char *p = data;
+    if (count > 0)
+        p = traceEncode(data, tv->trace, tv->trace_all, start, count);
+    h->size = p - data;
+
+    cb.buffer = buf;
+    cb.len = (char *) p - buf;
+    return cb;
+}
+
 struct char_buffer generateReceiverJson() {
     struct char_buffer cb;
     size_t buflen = 8192;
-    char *buf = (char *) malloc(buflen), *p = buf, *end = buf + buflen;
+    char *buf = (char *) arenaMalloc(buflen), *p = buf, *end = buf + buflen;
 
     p = safe_snprintf(p, end, "{ "
             "\"refresh\": %.0f, "
@@ -2674,15 +2861,14 @@ struct char_buffer generateReceiverJson() {
     return cb;
 }
 
-// Write JSON to file
-static inline void writeJsonTo (const char* dir, const char *file, struct char_buffer cb, int gzip) {
+// Write data to dir/file via a tmp file and rename, gzipped with level gzip if gzip > 0
+// returns -1 on failure
+static int writeFileAtomic(const char* dir, const char *file, const char *content, int len, int gzip) {
 #ifndef _WIN32
 
     char pathbuf[PATH_MAX];
     char tmppath[PATH_MAX];
     int fd;
-    int len = cb.len;
-    char *content = cb.buffer;
 
     if (!dir)
         snprintf(tmppath, PATH_MAX, "%s.%lx", file, random());
@@ -2694,9 +2880,7 @@ static inline void writeJsonTo (const char* dir, const char *file, struct char_b
     if (fd < 0) {
         fprintf(stderr, "writeJsonTo open(): ");
         perror(tmppath);
-        if (!gzip)
-            free(content);
-        return;
+        return -1;
     }
 
     if (!dir)
@@ -2728,20 +2912,22 @@ static inline void writeJsonTo (const char* dir, const char *file, struct char_b
             goto error_2;
         */
     } else if (gzip > 0) {
-        gzFile gzfp = gzdopen(fd, "wb");
-        if (!gzfp)
+        size_t gzLen;
+        char *gz = gzOut(content, len, gzip, &gzLen);
+        if (!gz) {
+            fprintf(stderr, "%s: gzip of length %d failed\n", pathbuf, len);
             goto error_1;
+        }
 
-        gzbuffer(gzfp, 1024 * 1024);
-        gzsetparams(gzfp, gzip, Z_DEFAULT_STRATEGY);
-
-        int res = gzwrite(gzfp, content, len);
-        if (res != len) {
-            int error;
-            fprintf(stderr, "%s: gzwrite of length %d failed: %s (res == %d)\n", pathbuf, len, gzerror(gzfp, &error), res);
+        ssize_t res = write(fd, gz, gzLen);
+        arenaFree(gz);
+        if (res != (ssize_t) gzLen) {
+            fprintf(stderr, "writeJsonTo write(): ");
+            perror(tmppath);
+            goto error_1;
         }
 
-        if (gzclose(gzfp) < 0)
+        if (close(fd) < 0)
             goto error_2;
     } else {
         if (write(fd, content, len) != len) {
@@ -2759,20 +2945,61 @@ static inline void writeJsonTo (const char* dir, const char *file, struct char_b
         perror("");
         goto error_2;
     }
-    if (!gzip)
-        free(content);
-    return;
+    return 0;
 
 error_1:
     close(fd);
 error_2:
     unlink(tmppath);
-    if (!gzip)
-        free(content);
-    return;
+    return -1;
+#else
+    return -1;
 #endif
 }
 
+// Files in json_dir are handed to the HTTP server as well: it gets the gzip
+// data of gzipped files and the buffer of plain ones, plain files of some
+// size are compressed once here so the server can send them gzipped.
+static int publishJson(const char *file, struct char_buffer cb, int gzip) {
+    size_t gzLen = 0;
+    char *gz = NULL;
+    if (gzip > 0 || cb.len >= HTTP_GZIP_MIN) {
+        gz = gzOut(cb.buffer, cb.len, gzip > 0 ? gzip : 1, &gzLen);
+        // kept until the next version of the file
+        if (gz)
+            gz = arenaDetach(gz, gzLen);
+        if (!gz)
+            gzLen = 0;
+    }
+    if (gzip > 0 && !gz)
+        return -1;
+
+    if (!Modes.net_http_no_files) {
+        if (gzip > 0)
+            writeFileAtomic(Modes.json_dir, file, gz, gzLen, 0);
+        else
+            writeFileAtomic(Modes.json_dir, file, cb.buffer, cb.len, 0);
+    }
+
+    if (gzip > 0)
+        httpPublish(file, NULL, 0, gz, gzLen); // the caller frees cb
+    else
+        httpPublish(file, arenaDetach(cb.buffer, cb.len), cb.len, gz, gzLen);
+    return 0;
+}
+
+// Write JSON to file
+// gzip == 0: frees cb.buffer, otherwise it stays with the caller
+static inline void writeJsonTo (const char* dir, const char *file, struct char_buffer cb, int gzip) {
+    if (dir && dir == Modes.json_dir && gzip >= 0 && httpEnabled() && publishJson(file, cb, gzip) == 0)
+        return;
+
+    if (!(dir && dir == Modes.json_dir && Modes.net_http_no_files))
+        writeFileAtomic(dir, file, cb.buffer, cb.len, gzip);
+    if (!gzip)
+        arenaFree(cb.buffer);
+}
+
 void writeJsonToFile (const char* dir, const char *file, struct char_buffer cb) {
     writeJsonTo(dir, file, cb, 0);
 }
@@ -3367,7 +3594,7 @@ void writeJsonToNet(struct net_writer *writer, struct char_buffer cb) {
 
     char *p = prepareWrite(writer, bytes);
     if (!p) {
-        free(content);
+        arenaFree(content);
         return;
     }
 
@@ -3387,7 +3614,7 @@ void writeJsonToNet(struct net_writer *writer, struct char_buffer cb) {
     }
 
     flushWrites(writer);
-    free(content);
+    arenaFree(content);
 }
 
 struct char_buffer generateVRS(int part, int n_parts, int reduced_data) {
@@ -3395,7 +3622,7 @@ struct char_buffer generateVRS(int part, int n_parts, int reduced_data) {
     uint64_t now = mstime();
     struct aircraft *a;
     size_t buflen = 256*1024; // The initial buffer is resized as needed
-    char *buf = (char *) malloc(buflen), *p = buf, *end = buf + buflen;
+    char *buf = (char *) arenaMalloc(buflen), *p = buf, *end = buf + buflen;
     char *line_start;
     int first = 1;
     int part_len = AIRCRAFT_BUCKETS / n_parts;
@@ -3426,64 +3653,88 @@ struct char_buffer generateVRS(int part, int n_parts, int reduced_data) {
 retry:
             line_start = p;
 
-            p = safe_snprintf(p, end, "{\"Icao\":\"%s%06X\"", (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
+            p = json_lit(p, end, "{\"Icao\":\"");
+            if (a->addr & MODES_NON_ICAO_ADDRESS)
+                p = json_lit(p, end, "~");
+            p = json_hex(p, end, a->addr & 0xFFFFFF, 6, 1);
+            p = json_lit(p, end, "\"");
 
 
             if (trackDataValid(&a->position_valid)) {
-                p = safe_snprintf(p, end, ",\"Lat\":%f,\"Long\":%f", a->lat, a->lon);
+                p = json_lit(p, end, ",\"Lat\":");
+                p = json_fixed(p, end, a->lat, 6);
+                p = json_lit(p, end, ",\"Long\":");
+                p = json_fixed(p, end, a->lon, 6);
                 //p = safe_snprintf(p, end, ",\"PosTime\":%"PRIu64, a->position_valid.updated);
             }
 
             if (trackDataValid(&a->altitude_baro_valid)
-                    && (a->alt_reliable >= Modes.json_reliable + 1 || a->position_valid.source <= SOURCE_JAERO ))
-                p = safe_snprintf(p, end, ",\"Alt\":%d", a->altitude_baro);
+                    && (a->alt_reliable >= Modes.json_reliable + 1 || a->position_valid.source <= SOURCE_JAERO )) {
+                p = json_lit(p, end, ",\"Alt\":");
+                p = json_int(p, end, a->altitude_baro);
+            }
 
             if (trackDataValid(&a->geom_rate_valid)) {
-                p = safe_snprintf(p, end, ",\"Vsi\":%d", a->geom_rate);
+                p = json_lit(p, end, ",\"Vsi\":");
+                p = json_int(p, end, a->geom_rate);
             } else if (trackDataValid(&a->baro_rate_valid)) {
-                p = safe_snprintf(p, end, ",\"Vsi\":%d", a->baro_rate);
+                p = json_lit(p, end, ",\"Vsi\":");
+                p = json_int(p, end, a->baro_rate);
             }
 
             if (trackDataValid(&a->track_valid)) {
-                p = safe_snprintf(p, end, ",\"Trak\":%.1f", a->track);
+                p = json_lit(p, end, ",\"Trak\":");
+                p = json_fixed(p, end, a->track, 1);
             } else if (trackDataValid(&a->mag_heading_valid)) {
-                p = safe_snprintf(p, end, ",\"Trak\":%.1f", a->mag_heading);
+                p = json_lit(p, end, ",\"Trak\":");
+                p = json_fixed(p, end, a->mag_heading, 1);
             } else if (trackDataValid(&a->true_heading_valid)) {
-                p = safe_snprintf(p, end, ",\"Trak\":%.1f", a->true_heading);
+                p = json_lit(p, end, ",\"Trak\":");
+                p = json_fixed(p, end, a->true_heading, 1);
             }
 
             if (trackDataValid(&a->gs_valid)) {
-                p = safe_snprintf(p, end, ",\"Spd\":%.1f", a->gs);
+                p = json_lit(p, end, ",\"Spd\":");
+                p = json_fixed(p, end, a->gs, 1);
             } else if (trackDataValid(&a->ias_valid)) {
-                p = safe_snprintf(p, end, ",\"Spd\":%u", a->ias);
+                p = json_lit(p, end, ",\"Spd\":");
+                p = json_uint(p, end, a->ias);
             } else if (trackDataValid(&a->tas_valid)) {
-                p = safe_snprintf(p, end, ",\"Spd\":%u", a->tas);
+                p = json_lit(p, end, ",\"Spd\":");
+                p = json_uint(p, end, a->tas);
             }
 
-            if (trackDataValid(&a->altitude_geom_valid))
-                p = safe_snprintf(p, end, ",\"GAlt\":%d", a->altitude_geom);
+            if (trackDataValid(&a->altitude_geom_valid)) {
+                p = json_lit(p, end, ",\"GAlt\":");
+                p = json_int(p, end, a->altitude_geom);
+            }
 
             if (trackDataValid(&a->airground_valid) && a->airground == AG_GROUND)
-                p = safe_snprintf(p, end, ",\"Gnd\":true");
+                p = json_lit(p, end, ",\"Gnd\":true");
             else
-                p = safe_snprintf(p, end, ",\"Gnd\":false");
+                p = json_lit(p, end, ",\"Gnd\":false");
 
-            if (trackDataValid(&a->squawk_valid))
-                p = safe_snprintf(p, end, ",\"Sqk\":\"%04x\"", a->squawk);
+            if (trackDataValid(&a->squawk_valid)) {
+                p = json_lit(p, end, ",\"Sqk\":\"");
+                p = json_hex(p, end, a->squawk, 4, 0);
+                p = json_lit(p, end, "\"");
+            }
 
             if (trackDataValid(&a->nav_altitude_mcp_valid)) {
-                p = safe_snprintf(p, end, ",\"TAlt\":%d", a->nav_altitude_mcp);
+                p = json_lit(p, end, ",\"TAlt\":");
+                p = json_int(p, end, (int) a->nav_altitude_mcp);
             } else if (trackDataValid(&a->nav_altitude_fms_valid)) {
-                p = safe_snprintf(p, end, ",\"TAlt\":%d", a->nav_altitude_fms);
+                p = json_lit(p, end, ",\"TAlt\":");
+                p = json_int(p, end, (int) a->nav_altitude_fms);
             }
 
             if (a->position_valid.source != SOURCE_INVALID) {
                 if (a->position_valid.source == SOURCE_MLAT)
-                    p = safe_snprintf(p, end, ",\"Mlat\":true");
+                    p = json_lit(p, end, ",\"Mlat\":true");
                 else if (a->position_valid.source == SOURCE_TISB)
-                    p = safe_snprintf(p, end, ",\"Tisb\":true");
+                    p = json_lit(p, end, ",\"Tisb\":true");
                 else if (a->position_valid.source == SOURCE_JAERO)
-                    p = safe_snprintf(p, end, ",\"Sat\":true");
+                    p = json_lit(p, end, ",\"Sat\":true");
             }
 
             if (reduced_data && a->addrtype != ADDR_JAERO && a->position_valid.source != SOURCE_JAERO)
@@ -3492,64 +3743,67 @@ retry:
             if (trackDataAge(now, &a->callsign_valid) < 5 * MINUTES
                     || (a->position_valid.source == SOURCE_JAERO && trackDataAge(now, &a->callsign_valid) < 8 * HOURS)
                ) {
-                char buf[128];
                 char buf2[16];
                 const char *trimmed = trimSpace(a->callsign, buf2, 8);
                 if (trimmed[0] != 0) {
-                    p = safe_snprintf(p, end, ",\"Call\":\"%s\"", jsonEscapeString(trimmed, buf, sizeof(buf)));
-                    p = safe_snprintf(p, end, ",\"CallSus\":false");
+                    p = json_lit(p, end, ",\"Call\":\"");
+                    p = json_escape(p, end, trimmed, sizeof(buf2));
+                    p = json_lit(p, end, "\",\"CallSus\":false");
                 }
             }
 
-            if (trackDataValid(&a->nav_heading_valid))
-                p = safe_snprintf(p, end, ",\"TTrk\":%.1f", a->nav_heading);
+            if (trackDataValid(&a->nav_heading_valid)) {
+                p = json_lit(p, end, ",\"TTrk\":");
+                p = json_fixed(p, end, a->nav_heading, 1);
+            }
 
 
             if (trackDataValid(&a->geom_rate_valid)) {
-                p = safe_snprintf(p, end, ",\"VsiT\":1");
+                p = json_lit(p, end, ",\"VsiT\":1");
             } else if (trackDataValid(&a->baro_rate_valid)) {
-                p = safe_snprintf(p, end, ",\"VsiT\":0");
+                p = json_lit(p, end, ",\"VsiT\":0");
             }
 
 
             if (trackDataValid(&a->track_valid)) {
-                p = safe_snprintf(p, end, ",\"TrkH\":false");
+                p = json_lit(p, end, ",\"TrkH\":false");
             } else if (trackDataValid(&a->mag_heading_valid)) {
-                p = safe_snprintf(p, end, ",\"TrkH\":true");
+                p = json_lit(p, end, ",\"TrkH\":true");
             } else if (trackDataValid(&a->true_heading_valid)) {
-                p = safe_snprintf(p, end, ",\"TrkH\":true");
+                p = json_lit(p, end, ",\"TrkH\":true");
             }
 
-            p = safe_snprintf(p, end, ",\"Sig\":%d", get8bitSignal(a));
+            p = json_lit(p, end, ",\"Sig\":");
+            p = json_int(p, end, get8bitSignal(a));
 
-            if (trackDataValid(&a->nav_qnh_valid))
-                p = safe_snprintf(p, end, ",\"InHg\":%.2f", a->nav_qnh * 0.02952998307);
+            if (trackDataValid(&a->nav_qnh_valid)) {
+                p = json_lit(p, end, ",\"InHg\":");
+                p = json_fixed(p, end, a->nav_qnh * 0.02952998307, 2);
+            }
 
-            p = safe_snprintf(p, end, ",\"AltT\":%d", 0);
+            p = json_lit(p, end, ",\"AltT\":0");
 
 
             if (a->position_valid.source != SOURCE_INVALID) {
                 if (a->position_valid.source != SOURCE_MLAT)
-                    p = safe_snprintf(p, end, ",\"Mlat\":false");
+                    p = json_lit(p, end, ",\"Mlat\":false");
                 if (a->position_valid.source != SOURCE_TISB)
-                    p = safe_snprintf(p, end, ",\"Tisb\":false");
+                    p = json_lit(p, end, ",\"Tisb\":false");
                 if (a->position_valid.source != SOURCE_JAERO)
-                    p = safe_snprintf(p, end, ",\"Sat\":true");
+                    p = json_lit(p, end, ",\"Sat\":true");
             }
 
 
             if (trackDataValid(&a->gs_valid)) {
-                p = safe_snprintf(p, end, ",\"SpdTyp\":0");
+                p = json_lit(p, end, ",\"SpdTyp\":0");
             } else if (trackDataValid(&a->ias_valid)) {
-                p = safe_snprintf(p, end, ",\"SpdTyp\":2");
+                p = json_lit(p, end, ",\"SpdTyp\":2");
             } else if (trackDataValid(&a->tas_valid)) {
-                p = safe_snprintf(p, end, ",\"SpdTyp\":3");
+                p = json_lit(p, end, ",\"SpdTyp\":3");
             }
 
-            if (a->adsb_version >= 0)
-                p = safe_snprintf(p, end, ",\"Trt\":%d", a->adsb_version + 3);
-            else
-                p = safe_snprintf(p, end, ",\"Trt\":%d", 1);
+            p = json_lit(p, end, ",\"Trt\":");
+            p = json_int(p, end, a->adsb_version >= 0 ? a->adsb_version + 3 : 1);
 
 
             //p = safe_snprintf(p, end, ",\"Cmsgs\":%ld", a->messages);
@@ -3557,13 +3811,13 @@ retry:
 
 skip_fields:
 
-            p = safe_snprintf(p, end, "}");
+            p = json_lit(p, end, "}");
 
             if ((p + 10) >= end) { // +10 to leave some space for the final line
                 // overran the buffer
                 int used = line_start - buf;
                 buflen *= 2;
-                buf = (char *) realloc(buf, buflen);
+                buf = (char *) arenaRealloc(buf, buflen);
                 p = buf + used;
                 end = buf + buflen;
                 goto retry;
@@ -3615,142 +3869,250 @@ static void *pthreadGetaddrinfo(void *param) {
     return NULL;
 }
 
-static char *sprintAircraftObject(char *p, char *end, struct aircraft *a, uint64_t now, int printMode) {
+// the object up to the live fields, without the closing brace
+// seen_pos: if not NULL, the seen_pos value is left out and *seen_pos points to where it goes
+static char *sprintAircraftFields(char *p, char *end, struct aircraft *a, uint64_t now, int printMode, char **seen_pos) {
 
     // printMode == 0: aircraft.json
     // printMode == 1: trace.json
     // printMode == 2: jsonPositionOutput
     // printMode == 3: globe.json
 
-    p = safe_snprintf(p, end, "\n{");
-    if (printMode == 2)
-        p = safe_snprintf(p, end, "\"now\" : %.1f,", now / 1000.0);
-    if (printMode != 1)
-        p = safe_snprintf(p, end, "\"hex\":\"%s%06x\",", (a->addr & MODES_NON_ICAO_ADDRESS) ? "~" : "", a->addr & 0xFFFFFF);
-    p = safe_snprintf(p, end, "\"type\":\"%s\"", addrtype_enum_string(a->addrtype));
+    p = json_lit(p, end, "\n{");
+    if (printMode == 2) {
+        p = json_lit(p, end, "\"now\" : ");
+        p = json_fixed(p, end, now / 1000.0, 1);
+        p = json_lit(p, end, ",");
+    }
+    if (printMode != 1) {
+        p = json_lit(p, end, "\"hex\":\"");
+        if (a->addr & MODES_NON_ICAO_ADDRESS)
+            p = json_lit(p, end, "~");
+        p = json_hex(p, end, a->addr & 0xFFFFFF, 6, 0);
+        p = json_lit(p, end, "\",");
+    }
+    p = json_lit(p, end, "\"type\":\"");
+    p = json_str(p, end, addrtype_enum_string(a->addrtype));
+    p = json_lit(p, end, "\"");
     if (trackDataValid(&a->callsign_valid)) {
-        char buf[128];
-        p = safe_snprintf(p, end, ",\"flight\":\"%s\"", jsonEscapeString(a->callsign, buf, sizeof(buf)));
+        p = json_lit(p, end, ",\"flight\":\"");
+        p = json_escape(p, end, a->callsign, sizeof(a->callsign));
+        p = json_lit(p, end, "\"");
     }
     if (Modes.db) {
         if (printMode != 1) {
-            if (a->registration[0])
-                p = safe_snprintf(p, end, ",\"r\":\"%.*s\"", (int) sizeof(a->registration), a->registration);
-            if (a->typeCode[0])
-                p = safe_snprintf(p, end, ",\"t\":\"%.*s\"", (int) sizeof(a->typeCode), a->typeCode);
-            if (a->dbFlags)
-                p = safe_snprintf(p, end, ",\"dbFlags\":%u", a->dbFlags);
+            if (a->registration[0]) {
+                p = json_lit(p, end, ",\"r\":\"");
+                p = json_strn(p, end, a->registration, sizeof(a->registration));
+                p = json_lit(p, end, "\"");
+            }
+            if (a->typeCode[0]) {
+                p = json_lit(p, end, ",\"t\":\"");
+                p = json_strn(p, end, a->typeCode, sizeof(a->typeCode));
+                p = json_lit(p, end, "\"");
+            }
+            if (a->dbFlags) {
+                p = json_lit(p, end, ",\"dbFlags\":");
+                p = json_uint(p, end, a->dbFlags);
+            }
         }
         if ((printMode == 0 || printMode == 2)&& !Modes.dbExchange) {
-            if (a->typeLong[0])
-                p = safe_snprintf(p, end, ",\"desc\":\"%.*s\"", (int) sizeof(a->typeLong), a->typeLong);
+            if (a->typeLong[0]) {
+                p = json_lit(p, end, ",\"desc\":\"");
+                p = json_strn(p, end, a->typeLong, sizeof(a->typeLong));
+                p = json_lit(p, end, "\"");
+            }
         }
     }
     if (printMode != 1) {
         if (trackDataValid(&a->airground_valid) && a->airground == AG_GROUND)
             if (printMode == 2)
-                p = safe_snprintf(p, end, ",\"ground\":true");
+                p = json_lit(p, end, ",\"ground\":true");
             else
-                p = safe_snprintf(p, end, ",\"alt_baro\":\"ground\"");
+                p = json_lit(p, end, ",\"alt_baro\":\"ground\"");
         else {
             if (trackDataValid(&a->altitude_baro_valid)
-                    && (a->alt_reliable >= Modes.json_reliable + 1 || a->position_valid.source <= SOURCE_JAERO ))
-                p = safe_snprintf(p, end, ",\"alt_baro\":%d", a->altitude_baro);
+                    && (a->alt_reliable >= Modes.json_reliable + 1 || a->position_valid.source <= SOURCE_JAERO )) {
+                p = json_lit(p, end, ",\"alt_baro\":");
+                p = json_int(p, end, a->altitude_baro);
+            }
             if (printMode == 2)
-                p = safe_snprintf(p, end, ",\"ground\":false");
-        }
-    }
-    if (trackDataValid(&a->altitude_geom_valid))
-        p = safe_snprintf(p, end, ",\"alt_geom\":%d", a->altitude_geom);
-    if (printMode != 1 && trackDataValid(&a->gs_valid))
-        p = safe_snprintf(p, end, ",\"gs\":%.1f", a->gs);
-    if (trackDataValid(&a->ias_valid))
-        p = safe_snprintf(p, end, ",\"ias\":%u", a->ias);
-    if (trackDataValid(&a->tas_valid))
-        p = safe_snprintf(p, end, ",\"tas\":%u", a->tas);
-    if (trackDataValid(&a->mach_valid))
-        p = safe_snprintf(p, end, ",\"mach\":%.3f", a->mach);
+                p = json_lit(p, end, ",\"ground\":false");
+        }
+    }
+    if (trackDataValid(&a->altitude_geom_valid)) {
+        p = json_lit(p, end, ",\"alt_geom\":");
+        p = json_int(p, end, a->altitude_geom);
+    }
+    if (printMode != 1 && trackDataValid(&a->gs_valid)) {
+        p = json_lit(p, end, ",\"gs\":");
+        p = json_fixed(p, end, a->gs, 1);
+    }
+    if (trackDataValid(&a->ias_valid)) {
+        p = json_lit(p, end, ",\"ias\":");
+        p = json_uint(p, end, a->ias);
+    }
+    if (trackDataValid(&a->tas_valid)) {
+        p = json_lit(p, end, ",\"tas\":");
+        p = json_uint(p, end, a->tas);
+    }
+    if (trackDataValid(&a->mach_valid)) {
+        p = json_lit(p, end, ",\"mach\":");
+        p = json_fixed(p, end, a->mach, 3);
+    }
     if (now < a->wind_updated + TRACK_EXPIRE && abs(a->wind_altitude - a->altitude_baro) < 500) {
-        p = safe_snprintf(p, end, ",\"wd\":%.0f", a->wind_direction);
-        p = safe_snprintf(p, end, ",\"ws\":%.0f", a->wind_speed);
+        p = json_lit(p, end, ",\"wd\":");
+        p = json_fixed(p, end, a->wind_direction, 0);
+        p = json_lit(p, end, ",\"ws\":");
+        p = json_fixed(p, end, a->wind_speed, 0);
     }
     if (now < a->oat_updated + TRACK_EXPIRE) {
-        p = safe_snprintf(p, end, ",\"oat\":%.0f", a->oat);
-        p = safe_snprintf(p, end, ",\"tat\":%.0f", a->tat);
-    }
-
-    if (trackDataValid(&a->track_valid))
-        p = safe_snprintf(p, end, ",\"track\":%.2f", a->track);
-    else if (printMode != 1 && trackDataValid(&a->position_valid) &&
-        !(trackDataValid(&a->airground_valid) && a->airground == AG_GROUND))
-        p = safe_snprintf(p, end, ",\"calc_track\":%.0f", a->calc_track);
-
-    if (trackDataValid(&a->track_rate_valid))
-        p = safe_snprintf(p, end, ",\"track_rate\":%.2f", a->track_rate);
-    if (trackDataValid(&a->roll_valid))
-        p = safe_snprintf(p, end, ",\"roll\":%.2f", a->roll);
-    if (trackDataValid(&a->mag_heading_valid))
-        p = safe_snprintf(p, end, ",\"mag_heading\":%.2f", a->mag_heading);
-    if (trackDataValid(&a->true_heading_valid))
-        p = safe_snprintf(p, end, ",\"true_heading\":%.2f", a->true_heading);
-    if (trackDataValid(&a->baro_rate_valid))
-        p = safe_snprintf(p, end, ",\"baro_rate\":%d", a->baro_rate);
-    if (trackDataValid(&a->geom_rate_valid))
-        p = safe_snprintf(p, end, ",\"geom_rate\":%d", a->geom_rate);
-    if (trackDataValid(&a->squawk_valid))
-        p = safe_snprintf(p, end, ",\"squawk\":\"%04x\"", a->squawk);
-    if (trackDataValid(&a->emergency_valid))
-        p = safe_snprintf(p, end, ",\"emergency\":\"%s\"", emergency_enum_string(a->emergency));
-    if (a->category != 0)
-        p = safe_snprintf(p, end, ",\"category\":\"%02X\"", a->category);
-    if (trackDataValid(&a->nav_qnh_valid))
-        p = safe_snprintf(p, end, ",\"nav_qnh\":%.1f", a->nav_qnh);
-    if (trackDataValid(&a->nav_altitude_mcp_valid))
-        p = safe_snprintf(p, end, ",\"nav_altitude_mcp\":%d", a->nav_altitude_mcp);
-    if (trackDataValid(&a->nav_altitude_fms_valid))
-        p = safe_snprintf(p, end, ",\"nav_altitude_fms\":%d", a->nav_altitude_fms);
-    if (trackDataValid(&a->nav_heading_valid))
-        p = safe_snprintf(p, end, ",\"nav_heading\":%.2f", a->nav_heading);
+        p = json_lit(p, end, ",\"oat\":");
+        p = json_fixed(p, end, a->oat, 0);
+        p = json_lit(p, end, ",\"tat\":");
+        p = json_fixed(p, end, a->tat, 0);
+    }
+
+    if (trackDataValid(&a->track_valid)) {
+        p = json_lit(p, end, ",\"track\":");
+        p = json_fixed(p, end, a->track, 2);
+    } else if (printMode != 1 && trackDataValid(&a->position_valid) &&
+        !(trackDataValid(&a->airground_valid) && a->airground == AG_GROUND)) {
+        p = json_lit(p, end, ",\"calc_track\":");
+        p = json_fixed(p, end, a->calc_track, 0);
+    }
+
+    if (trackDataValid(&a->track_rate_valid)) {
+        p = json_lit(p, end, ",\"track_rate\":");
+        p = json_fixed(p, end, a->track_rate, 2);
+    }
+    if (trackDataValid(&a->roll_valid)) {
+        p = json_lit(p, end, ",\"roll\":");
+        p = json_fixed(p, end, a->roll, 2);
+    }
+    if (trackDataValid(&a->mag_heading_valid)) {
+        p = json_lit(p, end, ",\"mag_heading\":");
+        p = json_fixed(p, end, a->mag_heading, 2);
+    }
+    if (trackDataValid(&a->true_heading_valid)) {
+        p = json_lit(p, end, ",\"true_heading\":");
+        p = json_fixed(p, end, a->true_heading, 2);
+    }
+    if (trackDataValid(&a->baro_rate_valid)) {
+        p = json_lit(p, end, ",\"baro_rate\":");
+        p = json_int(p, end, a->baro_rate);
+    }
+    if (trackDataValid(&a->geom_rate_valid)) {
+        p = json_lit(p, end, ",\"geom_rate\":");
+        p = json_int(p, end, a->geom_rate);
+    }
+    if (trackDataValid(&a->squawk_valid)) {
+        p = json_lit(p, end, ",\"squawk\":\"");
+        p = json_hex(p, end, a->squawk, 4, 0);
+        p = json_lit(p, end, "\"");
+    }
+    if (trackDataValid(&a->emergency_valid)) {
+        p = json_lit(p, end, ",\"emergency\":\"");
+        p = json_str(p, end, emergency_enum_string(a->emergency));
+        p = json_lit(p, end, "\"");
+    }
+    if (a->category != 0) {
+        p = json_lit(p, end, ",\"category\":\"");
+        p = json_hex(p, end, a->category, 2, 1);
+        p = json_lit(p, end, "\"");
+    }
+    if (trackDataValid(&a->nav_qnh_valid)) {
+        p = json_lit(p, end, ",\"nav_qnh\":");
+        p = json_fixed(p, end, a->nav_qnh, 1);
+    }
+    if (trackDataValid(&a->nav_altitude_mcp_valid)) {
+        p = json_lit(p, end, ",\"nav_altitude_mcp\":");
+        p = json_int(p, end, (int) a->nav_altitude_mcp);
+    }
+    if (trackDataValid(&a->nav_altitude_fms_valid)) {
+        p = json_lit(p, end, ",\"nav_altitude_fms\":");
+        p = json_int(p, end, (int) a->nav_altitude_fms);
+    }
+    if (trackDataValid(&a->nav_heading_valid)) {
+        p = json_lit(p, end, ",\"nav_heading\":");
+        p = json_fixed(p, end, a->nav_heading, 2);
+    }
     if (trackDataValid(&a->nav_modes_valid)) {
-        p = safe_snprintf(p, end, ",\"nav_modes\":[");
+        p = json_lit(p, end, ",\"nav_modes\":[");
         p = append_nav_modes(p, end, a->nav_modes, "\"", ",");
-        p = safe_snprintf(p, end, "]");
+        p = json_lit(p, end, "]");
     }
     if (printMode != 1 && trackDataValid(&a->position_valid)
             && ( (a->pos_reliable_odd >= Modes.json_reliable && a->pos_reliable_even >= Modes.json_reliable) || a->position_valid.source <= SOURCE_JAERO ) ) {
-        p = safe_snprintf(p, end, ",\"lat\":%f,\"lon\":%f,\"nic\":%u,\"rc\":%u,\"seen_pos\":%.1f",
-                a->lat, a->lon, a->pos_nic, a->pos_rc,
-                (now < a->position_valid.updated) ? 0 : ((now - a->position_valid.updated) / 1000.0));
+        p = json_lit(p, end, ",\"lat\":");
+        p = json_fixed(p, end, a->lat, 6);
+        p = json_lit(p, end, ",\"lon\":");
+        p = json_fixed(p, end, a->lon, 6);
+        p = json_lit(p, end, ",\"nic\":");
+        p = json_uint(p, end, a->pos_nic);
+        p = json_lit(p, end, ",\"rc\":");
+        p = json_uint(p, end, a->pos_rc);
+        p = json_lit(p, end, ",\"seen_pos\":");
+        if (seen_pos)
+            *seen_pos = p;
+        else
+            p = json_fixed(p, end, (now < a->position_valid.updated) ? 0 : ((now - a->position_valid.updated) / 1000.0), 1);
     }
 
     if (now > a->seen_pos + 60 * MINUTES && now < a->rr_seen + 2 * MINUTES) {
-        p = safe_snprintf(p, end, ",\"rr_lat\":%.1f,\"rr_lon\":%.1f", a->rr_lat, a->rr_lon);
+        p = json_lit(p, end, ",\"rr_lat\":");
+        p = json_fixed(p, end, a->rr_lat, 1);
+        p = json_lit(p, end, ",\"rr_lon\":");
+        p = json_fixed(p, end, a->rr_lon, 1);
     }
 
     if (printMode == 1 && trackDataValid(&a->position_valid)) {
-        p = safe_snprintf(p, end, ",\"nic\":%u,\"rc\":%u",
-                a->pos_nic, a->pos_rc);
-    }
-    if (a->adsb_version >= 0)
-        p = safe_snprintf(p, end, ",\"version\":%d", a->adsb_version);
-    if (trackDataValid(&a->nic_baro_valid))
-        p = safe_snprintf(p, end, ",\"nic_baro\":%u", a->nic_baro);
-    if (trackDataValid(&a->nac_p_valid))
-        p = safe_snprintf(p, end, ",\"nac_p\":%u", a->nac_p);
-    if (trackDataValid(&a->nac_v_valid))
-        p = safe_snprintf(p, end, ",\"nac_v\":%u", a->nac_v);
-    if (trackDataValid(&a->sil_valid))
-        p = safe_snprintf(p, end, ",\"sil\":%u", a->sil);
-    if (a->sil_type != SIL_INVALID)
-        p = safe_snprintf(p, end, ",\"sil_type\":\"%s\"", sil_type_enum_string(a->sil_type));
-    if (trackDataValid(&a->gva_valid))
-        p = safe_snprintf(p, end, ",\"gva\":%u", a->gva);
-    if (trackDataValid(&a->sda_valid))
-        p = safe_snprintf(p, end, ",\"sda\":%u", a->sda);
-    if (trackDataValid(&a->alert_valid))
-        p = safe_snprintf(p, end, ",\"alert\":%u", a->alert);
-    if (trackDataValid(&a->spi_valid))
-        p = safe_snprintf(p, end, ",\"spi\":%u", a->spi);
+        p = json_lit(p, end, ",\"nic\":");
+        p = json_uint(p, end, a->pos_nic);
+        p = json_lit(p, end, ",\"rc\":");
+        p = json_uint(p, end, a->pos_rc);
+    }
+    if (a->adsb_version >= 0) {
+        p = json_lit(p, end, ",\"version\":");
+        p = json_int(p, end, a->adsb_version);
+    }
+    if (trackDataValid(&a->nic_baro_valid)) {
+        p = json_lit(p, end, ",\"nic_baro\":");
+        p = json_uint(p, end, a->nic_baro);
+    }
+    if (trackDataValid(&a->nac_p_valid)) {
+        p = json_lit(p, end, ",\"nac_p\":");
+        p = json_uint(p, end, a->nac_p);
+    }
+    if (trackDataValid(&a->nac_v_valid)) {
+        p = json_lit(p, end, ",\"nac_v\":");
+        p = json_uint(p, end, a->nac_v);
+    }
+    if (trackDataValid(&a->sil_valid)) {
+        p = json_lit(p, end, ",\"sil\":");
+        p = json_uint(p, end, a->sil);
+    }
+    if (a->sil_type != SIL_INVALID) {
+        p = json_lit(p, end, ",\"sil_type\":\"");
+        p = json_str(p, end, sil_type_enum_string(a->sil_type));
+        p = json_lit(p, end, "\"");
+    }
+    if (trackDataValid(&a->gva_valid)) {
+        p = json_lit(p, end, ",\"gva\":");
+        p = json_uint(p, end, a->gva);
+    }
+    if (trackDataValid(&a->sda_valid)) {
+        p = json_lit(p, end, ",\"sda\":");
+        p = json_uint(p, end, a->sda);
+    }
+    if (trackDataValid(&a->alert_valid)) {
+        p = json_lit(p, end, ",\"alert\":");
+        p = json_uint(p, end, a->alert);
+    }
+    if (trackDataValid(&a->spi_valid)) {
+        p = json_lit(p, end, ",\"spi\":");
+        p = json_uint(p, end, a->spi);
+    }
 
     /*
     if (a->position_valid.source == SOURCE_JAERO)
@@ -3759,23 +4121,105 @@ static char *sprintAircraftObject(char *p, char *end, struct aircraft *a, uint64
         p = safe_snprintf(p, end, ",\"sbs_other\": true");
     */
     if (Modes.netReceiverIdPrint) {
-        p = safe_snprintf(p, end, ",\"rId\":%016"PRIx64"", a->lastPosReceiverId);
+        p = json_lit(p, end, ",\"rId\":");
+        p = json_hex(p, end, a->lastPosReceiverId, 16, 0);
     }
 
     if (printMode != 1) {
-        p = safe_snprintf(p, end, ",\"mlat\":");
+        p = json_lit(p, end, ",\"mlat\":");
         p = append_flags(p, end, a, SOURCE_MLAT);
-        p = safe_snprintf(p, end, ",\"tisb\":");
+        p = json_lit(p, end, ",\"tisb\":");
         p = append_flags(p, end, a, SOURCE_TISB);
+    }
 
-        p = safe_snprintf(p, end, ",\"messages\":%u,\"seen\":%.1f,\"rssi\":%.1f}",
-                a->messages, (now < a->seen) ? 0 : ((now - a->seen) / 1000.0),
-                10 * log10((a->signalLevel[0] + a->signalLevel[1] + a->signalLevel[2] + a->signalLevel[3] +
-                        a->signalLevel[4] + a->signalLevel[5] + a->signalLevel[6] + a->signalLevel[7]) / 8 + 1.125e-5));
+    return p;
+}
+
+// messages, seen and rssi change with every message or as time passes
+static char *sprintAircraftLive(char *p, char *end, struct aircraft *a, uint64_t now) {
+    p = json_lit(p, end, ",\"messages\":");
+    p = json_uint(p, end, a->messages);
+    p = json_lit(p, end, ",\"seen\":");
+    p = json_fixed(p, end, (now < a->seen) ? 0 : ((now - a->seen) / 1000.0), 1);
+    p = json_lit(p, end, ",\"rssi\":");
+    p = json_fixed(p, end,
+            10 * log10((a->signalLevel[0] + a->signalLevel[1] + a->signalLevel[2] + a->signalLevel[3] +
+                    a->signalLevel[4] + a->signalLevel[5] + a->signalLevel[6] + a->signalLevel[7]) / 8 + 1.125e-5), 1);
+    return p;
+}
+
+static char *sprintAircraftObject(char *p, char *end, struct aircraft *a, uint64_t now, int printMode) {
+    p = sprintAircraftFields(p, end, a, now, printMode, NULL);
+    if (printMode != 1)
+        p = sprintAircraftLive(p, end, a, now);
+    p = json_lit(p, end, "}");
+    return p;
+}
+
+// the time dependent fields of the aircraft.json object (wd / ws, oat / tat,
+// rr_lat / rr_lon) appear or disappear at the earliest of these times after now
+static uint64_t aircraftJsonExpire(struct aircraft *a, uint64_t now) {
+    uint64_t times[] = {
+        a->wind_updated + TRACK_EXPIRE,
+        a->oat_updated + TRACK_EXPIRE,
+        a->seen_pos + 60 * MINUTES + 1,
+        a->rr_seen + 2 * MINUTES,
+    };
+    uint64_t expire = UINT64_MAX;
+    for (size_t i = 0; i < sizeof(times) / sizeof(times[0]); i++) {
+        if (times[i] > now && times[i] < expire)
+            expire = times[i];
+    }
+    return expire;
+}
+
+// aircraft.json object (printMode 0) from the fragment cached with the aircraft:
+// it is serialized again only when a->json_version moved on or a time dependent
+// field changed, seen_pos and the live fields are filled in on every call
+static char *sprintAircraftCached(char *p, char *end, struct aircraft *a, uint64_t now) {
+    // read before serializing, a message arriving meanwhile is picked up next time
+    uint32_t version = a->json_version;
+
+    Modes.stats_current.aircraft_json_objects++;
+
+    if (!a->json_frag || a->json_frag_version != version || now >= a->json_frag_expire) {
+        char buf[2048];
+        char *seen_pos = NULL;
+        char *frag_end = sprintAircraftFields(buf, buf + sizeof(buf), a, now, 0, &seen_pos);
+        size_t len = frag_end - buf;
+
+        Modes.stats_current.aircraft_json_serialized++;
+
+        // the decode thread copies these fields when it undoes a message
+        pthread_mutex_lock(&Modes.jsonFragMutex);
+        // allocated in steps of 256 bytes, the capacity follows from json_frag_len
+        size_t cap = (len + 255) & ~255;
+        if (!a->json_frag || cap != (((size_t) a->json_frag_len + 255) & ~255)) {
+            char *frag = realloc(a->json_frag, cap);
+            if (!frag) {
+                pthread_mutex_unlock(&Modes.jsonFragMutex);
+                fprintf(stderr, "sprintAircraftCached: realloc failure!\n");
+                return sprintAircraftObject(p, end, a, now, 0);
+            }
+            a->json_frag = frag;
+        }
+        memcpy(a->json_frag, buf, len);
+        a->json_frag_len = len;
+        a->json_frag_hole = seen_pos ? seen_pos - buf : 0;
+        a->json_frag_version = version;
+        a->json_frag_expire = aircraftJsonExpire(a, now);
+        pthread_mutex_unlock(&Modes.jsonFragMutex);
+    }
+
+    if (a->json_frag_hole) {
+        p = json_mem(p, end, a->json_frag, a->json_frag_hole);
+        p = json_fixed(p, end, (now < a->position_valid.updated) ? 0 : ((now - a->position_valid.updated) / 1000.0), 1);
+        p = json_mem(p, end, a->json_frag + a->json_frag_hole, a->json_frag_len - a->json_frag_hole);
     } else {
-        p = safe_snprintf(p, end, "}");
+        p = json_mem(p, end, a->json_frag, a->json_frag_len);
     }
-
+    p = sprintAircraftLive(p, end, a, now);
+    p = json_lit(p, end, "}");
     return p;
 }
 
@@ -3888,7 +4332,7 @@ struct char_buffer generateClientsJson() {
     uint64_t now = mstime();
 
     size_t buflen = 1*1024*1024; // The initial buffer is resized as needed
-    char *buf = (char *) malloc(buflen), *p = buf, *end = buf + buflen;
+    char *buf = (char *) arenaMalloc(buflen), *p = buf, *end = buf + buflen;
 
     p = safe_snprintf(p, end, "{ \"now\" : %.1f,\n", now / 1000.0);
 
@@ -3905,7 +4349,7 @@ struct char_buffer generateClientsJson() {
             if ((p + 1000) >= end) {
                 int used = p - buf;
                 buflen *= 2;
-                buf = (char *) realloc(buf, buflen);
+                buf = (char *) arenaRealloc(buf, buflen);
                 p = buf + used;
                 end = buf + buflen;
             }
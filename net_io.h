@@ -32,6 +32,7 @@ struct aircraft;
 struct modesMessage;
 struct client;
 struct net_service;
+struct traceView;
 typedef int (*read_fn)(struct client *, char *, int, uint64_t);
 typedef void (*heartbeat_fn)(struct net_service *);
 const char *addrtype_enum_string(addrtype_t type);
@@ -164,11 +165,42 @@ void modesReadSerialClient(void);
 void cleanupNetwork(void);
 void netFreeClients();
 
+// --write-json-trace-bin: traces/xx/trace_full_xxxxxx.bin and trace_recent_xxxxxx.bin
+// next to the json, gzipped the same way, little endian.  The header is followed
+// by the points in the block encoding of trace_store.h: per point zigzag varint
+// deltas of timestamp (ms, the first point relative to 0), lat / lon (1E-6
+// degrees), altitude (25 ft), gs (0.1 kt), track (0.1 degrees) and rate (32 fpm)
+// as in struct state, the struct state_flags bits xor the previous ones; for
+// point first_all and every 4th point after it the sparse state_all: a varint
+// mask of the bytes that differ from the previous state_all (all zero before
+// the first) and those bytes.  state_flags and state_all have the memory layout
+// of this build like the binCraft records, state_all_size tells them apart.
+#define TRACE_BIN_MAGIC 0x31425452 // "RTB1"
+
+struct traceBinHeader {
+    uint32_t magic;
+    uint16_t header_size; // the points start here
+    uint8_t state_all_size;
+    uint8_t first_all; // 0 - 3
+    uint32_t addr; // MODES_NON_ICAO_ADDRESS set for non icao addresses
+    uint32_t count; // number of points
+    uint32_t size; // bytes after the header
+    uint8_t dbFlags;
+    char typeCode[4];
+    char registration[12];
+    char typeLong[63];
+};
+
+_Static_assert(sizeof(struct traceBinHeader) == 100, "struct traceBinHeader is part of the file format");
+
 // TODO: move these somewhere else
 struct char_buffer generateAircraftJson();
-struct char_buffer generateGlobeBin(int globe_index, int mil);
-struct char_buffer generateGlobeJson(int globe_index);
-struct char_buffer generateTraceJson(struct aircraft *a, int start, int last);
+void generateGlobeBins(int globe_index, uint64_t now, struct char_buffer *all, struct char_buffer *mil);
+struct char_buffer generateGlobeDelta(int globe_index, struct char_buffer *all, uint64_t now);
+void globeDeltasFree();
+struct char_buffer generateGlobeJson(int globe_index, uint64_t now);
+struct char_buffer generateTraceJson(struct aircraft *a, struct traceView *tv, int start, int last);
+struct char_buffer generateTraceBin(struct aircraft *a, struct traceView *tv, int start, int last);
 struct char_buffer generateReceiverJson ();
 struct char_buffer generateHistoryJson ();
 struct char_buffer generateClientsJson();
@@ -0,0 +1,78 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// dbconvert.c: convert aircraft.csv.gz to the binary db format readsb can mmap
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// usage: dbconvert aircraft.csv.gz aircraft.bin
+// then run readsb with --db-file aircraft.bin
+
+#include "../readsb.h"
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <aircraft.csv.gz> <aircraft.bin>\n", argv[0]);
+        return 1;
+    }
+
+    gzFile gzfp = gzopen(argv[1], "r");
+    if (!gzfp) {
+        perror(argv[1]);
+        return 1;
+    }
+    struct char_buffer cb = readWholeGz(gzfp, argv[1]);
+    gzclose(gzfp);
+    if (!cb.buffer)
+        return 1;
+
+    struct aircraftDb *csv = calloc(1, sizeof(struct aircraftDb));
+    struct aircraftDb *bin = calloc(1, sizeof(struct aircraftDb));
+    if (!csv || !bin || dbParseCsv(csv, cb.buffer, cb.len) || dbWriteBinary(csv, argv[2]))
+        return 1;
+
+    // check every csv entry reads back the same as from the hash table
+    int fd = open(argv[2], O_RDONLY);
+    if (fd == -1 || dbMapBinary(bin, fd, argv[2])) {
+        perror(argv[2]);
+        return 1;
+    }
+    close(fd);
+
+    int errors = 0;
+    for (int i = 0; i < csv->count; i++) {
+        dbEntry expected, actual;
+        memset(&expected, 0, sizeof(expected));
+        memset(&actual, 0, sizeof(actual));
+        uint32_t addr = csv->entries[i].addr;
+        dbLookup(csv, addr, &expected);
+        if (!dbLookup(bin, addr, &actual)
+                || memcmp(expected.registration, actual.registration, sizeof(actual.registration))
+                || memcmp(expected.typeCode, actual.typeCode, sizeof(actual.typeCode))
+                || strncmp(expected.typeLong, actual.typeLong, sizeof(actual.typeLong))
+                || expected.dbFlags != actual.dbFlags) {
+            if (errors++ < 10)
+                fprintf(stderr, "%06x: mismatch after conversion\n", addr);
+        }
+    }
+
+    dbFree(csv);
+    dbFree(bin);
+    free(cb.buffer);
+
+    if (errors) {
+        fprintf(stderr, "%d mismatches, the binary db is broken!\n", errors);
+        return 1;
+    }
+    return 0;
+}
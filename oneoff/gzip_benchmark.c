@@ -0,0 +1,179 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// gzip_benchmark.c: size and time per file of the gzip output paths
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// usage:
+// gzip_benchmark <level> <file> [<file> ...]
+//
+// The files are json as readsb writes it (plain or gzipped).  Each is
+// compressed at level and written to a memfd, averaged over all files:
+//
+// gzFile: gzdopen / gzbuffer 1 MB / gzsetparams / gzwrite / gzclose,
+//         what writeFileAtomic() used to do for every file
+// gzOut:  the reused per-thread deflate stream of gz_out.c
+//
+// The gzOut output is decompressed again and compared to the input.
+
+#include "../readsb.h"
+#include <sys/mman.h>
+
+#define ROUNDS 20
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int read_file(const char *path, struct char_buffer *cb) {
+    gzFile gzfp = gzopen(path, "r");
+    if (!gzfp) {
+        perror(path);
+        return -1;
+    }
+    size_t alloc = 64 * 1024;
+    cb->buffer = malloc(alloc);
+    cb->len = 0;
+    int res;
+    while (cb->buffer && (res = gzread(gzfp, cb->buffer + cb->len, alloc - cb->len)) > 0) {
+        cb->len += res;
+        if (cb->len == alloc) {
+            alloc *= 2;
+            cb->buffer = realloc(cb->buffer, alloc);
+        }
+    }
+    gzclose(gzfp);
+    return cb->buffer ? 0 : -1;
+}
+
+static size_t write_gzfile(int fd, struct char_buffer cb, int level) {
+    lseek(fd, 0, SEEK_SET);
+    if (ftruncate(fd, 0))
+        return 0;
+    gzFile gzfp = gzdopen(dup(fd), "wb");
+    if (!gzfp)
+        return 0;
+    gzbuffer(gzfp, 1024 * 1024);
+    gzsetparams(gzfp, level, Z_DEFAULT_STRATEGY);
+    gzwrite(gzfp, cb.buffer, cb.len);
+    if (gzclose(gzfp) < 0)
+        return 0;
+    return lseek(fd, 0, SEEK_CUR);
+}
+
+static size_t write_gzout(int fd, struct char_buffer cb, int level) {
+    lseek(fd, 0, SEEK_SET);
+    if (ftruncate(fd, 0))
+        return 0;
+    size_t gzLen;
+    char *gz = gzOut(cb.buffer, cb.len, level, &gzLen);
+    if (!gz)
+        return 0;
+    ssize_t res = write(fd, gz, gzLen);
+    arenaFree(gz);
+    return res == (ssize_t) gzLen ? gzLen : 0;
+}
+
+// gzip member back to the input
+static int verify(struct char_buffer cb, int level) {
+    size_t gzLen;
+    char *gz = gzOut(cb.buffer, cb.len, level, &gzLen);
+    if (!gz)
+        return -1;
+
+    int ok = 0;
+    char *check = malloc(cb.len + 1);
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (check && inflateInit2(&strm, 15 + 16) == Z_OK) {
+        strm.next_in = (unsigned char *) gz;
+        strm.avail_in = gzLen;
+        strm.next_out = (unsigned char *) check;
+        strm.avail_out = cb.len + 1;
+        ok = inflate(&strm, Z_FINISH) == Z_STREAM_END
+            && strm.total_out == cb.len
+            && memcmp(check, cb.buffer, cb.len) == 0;
+        inflateEnd(&strm);
+    }
+    free(check);
+    arenaFree(gz);
+    return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <level> <file> [<file> ...]\n", argv[0]);
+        return 1;
+    }
+    int level = atoi(argv[1]);
+    int count = argc - 2;
+    struct char_buffer *files = calloc(count, sizeof(struct char_buffer));
+    size_t plain = 0;
+    for (int i = 0; i < count; i++) {
+        if (read_file(argv[i + 2], &files[i]))
+            return 1;
+        plain += files[i].len;
+    }
+
+    int fd = memfd_create("gzip_benchmark", 0);
+    if (fd < 0) {
+        perror("memfd_create");
+        return 1;
+    }
+
+    const char *names[2] = { "gzFile", "gzOut" };
+    size_t bytes[2] = { 0 };
+    double us[2] = { 0 };
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int k = 0; k < 2; k++) {
+            double start = now_us();
+            size_t total = 0;
+            for (int i = 0; i < count; i++) {
+                size_t len;
+                if (k == 0)
+                    len = write_gzfile(fd, files[i], level);
+                else
+                    len = write_gzout(fd, files[i], level);
+                if (!len) {
+                    fprintf(stderr, "%s: %s failed\n", argv[i + 2], names[k]);
+                    return 1;
+                }
+                total += len;
+            }
+            us[k] += now_us() - start;
+            bytes[k] = total;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (verify(files[i], level)) {
+            fprintf(stderr, "%s: round trip failed\n", argv[i + 2]);
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "%d files, %.0f bytes per file, level %d\n", count, (double) plain / count, level);
+    for (int k = 0; k < 2; k++) {
+        fprintf(stderr, "  %-6s %8.0f bytes %6.1f%% %8.1f us per file\n", names[k],
+                (double) bytes[k] / count, 100.0 * bytes[k] / plain, us[k] / ROUNDS / count);
+    }
+
+    for (int i = 0; i < count; i++)
+        free(files[i].buffer);
+    free(files);
+    close(fd);
+    return 0;
+}
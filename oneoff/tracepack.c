@@ -0,0 +1,113 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// tracepack.c: read the globe history pack files written with --write-globe-history-pack
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// usage:
+// tracepack <history dir>/<day> list
+//     print hex and compressed size of every trace of that day
+// tracepack <history dir>/<day> <hex> [trace_full_<hex>.json]
+//     write the gzipped trace to the file or to stdout (pipe it to zcat)
+// tracepack <history dir>/<day> extract <out dir>
+//     write all traces of the day as <out dir>/xx/trace_full_<hex>.json,
+//     the layout readsb uses without --write-globe-history-pack
+
+#include "../readsb.h"
+
+static int write_file(const char *path, struct char_buffer cb) {
+    int fd = path ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    int err = 0;
+    if (write(fd, cb.buffer, cb.len) != (ssize_t) cb.len) {
+        perror(path ? path : "stdout");
+        err = 1;
+    }
+    if (path)
+        close(fd);
+    return err;
+}
+
+static int list(const char *dayDir, const char *outDir) {
+    int total = 0;
+    for (int pack = 0; pack < HISTORY_PACKS; pack++) {
+        struct historyIndexEntry *entries;
+        int len = historyPackLoadIndex(dayDir, pack, &entries);
+        if (len < 0)
+            continue;
+        for (int i = 0; i < len; i++) {
+            uint32_t addr = entries[i].addr;
+            if (!outDir) {
+                printf("%06x %u\n", addr, entries[i].size);
+                continue;
+            }
+            char path[PATH_MAX];
+            struct char_buffer cb;
+            snprintf(path, PATH_MAX, "%s/%02x", outDir, addr % 256);
+            if (mkdir(path, 0755) && errno != EEXIST)
+                perror(path);
+            snprintf(path, PATH_MAX, "%s/%02x/trace_full_%06x.json", outDir, addr % 256, addr);
+            if (historyPackReadEntry(dayDir, &entries[i], &cb) == 0) {
+                write_file(path, cb);
+                free(cb.buffer);
+            }
+        }
+        total += len;
+        free(entries);
+    }
+    fprintf(stderr, "%d traces\n", total);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <history dir>/<day> list | <hex> [out file] | extract <out dir>\n", argv[0]);
+        return 1;
+    }
+    const char *dayDir = argv[1];
+
+    if (strcmp(argv[2], "list") == 0)
+        return list(dayDir, NULL);
+
+    if (strcmp(argv[2], "extract") == 0) {
+        if (argc < 4) {
+            fprintf(stderr, "extract needs an output directory\n");
+            return 1;
+        }
+        if (mkdir(argv[3], 0755) && errno != EEXIST) {
+            perror(argv[3]);
+            return 1;
+        }
+        return list(dayDir, argv[3]);
+    }
+
+    char *end;
+    uint32_t addr = strtol(argv[2], &end, 16);
+    if (*end || end == argv[2]) {
+        fprintf(stderr, "%s: not a hex address\n", argv[2]);
+        return 1;
+    }
+
+    struct char_buffer cb;
+    if (historyPackRead(dayDir, addr, &cb)) {
+        fprintf(stderr, "%06x: not found in %s\n", addr, dayDir);
+        return 1;
+    }
+    int err = write_file(argc > 3 ? argv[3] : NULL, cb);
+    free(cb.buffer);
+    return err;
+}
@@ -135,11 +135,22 @@ static void cond_broadcast_all() {
     if (Modes.jsonGlobeThread)
         pthread_cond_broadcast(&Modes.jsonGlobeThreadCond);
 
+    if (Modes.json_globe_threads > 1) {
+        pthread_cond_broadcast(&Modes.globeWorkCond);
+        pthread_cond_broadcast(&Modes.globeDoneCond);
+    }
+
     for (int i = 0; i < TRACE_THREADS; i++) {
         if (Modes.jsonTraceThread[i])
             pthread_cond_broadcast(&Modes.jsonTraceThreadCond[i]);
     }
 
+    if (Modes.dbThread)
+        pthread_cond_broadcast(&Modes.dbThreadCond);
+
+    if (Modes.heatmapThread)
+        pthread_cond_broadcast(&Modes.heatmapThreadCond);
+
     if (Modes.decodeThread) {
         pthread_cond_broadcast(&Modes.decodeThreadCond);
         pthread_cond_broadcast(&Modes.data_cond);
@@ -203,6 +214,8 @@ static void modesInitConfig(void) {
     Modes.net_output_vrs_interval = 5 * SECONDS;
     Modes.net_output_json_ports = strdup("0");
     Modes.net_output_api_ports = strdup("0");
+    Modes.net_output_http_ports = strdup("0");
+    Modes.net_http_threads = 1;
     Modes.net_connector_delay = 30 * 1000;
     Modes.interactive_display_ttl = MODES_INTERACTIVE_DISPLAY_TTL;
     Modes.json_interval = 1000;
@@ -219,6 +232,7 @@ static void modesInitConfig(void) {
     Modes.netIngest = 0;
     Modes.uuidFile = strdup("/boot/adsbx-uuid");
     Modes.json_trace_interval = 30 * 1000;
+    Modes.json_globe_threads = 1;
     Modes.heatmap_current_interval = -1;
     Modes.heatmap_interval = 60 * SECONDS;
     Modes.json_reliable = -13;
@@ -273,10 +287,22 @@ static void modesInit(void) {
     pthread_mutex_init(&Modes.decodeThreadMutex, NULL);
     pthread_mutex_init(&Modes.jsonThreadMutex, NULL);
     pthread_mutex_init(&Modes.jsonGlobeThreadMutex, NULL);
+    pthread_mutex_init(&Modes.globeWorkMutex, NULL);
 
     pthread_cond_init(&Modes.decodeThreadCond, NULL);
     pthread_cond_init(&Modes.jsonThreadCond, NULL);
     pthread_cond_init(&Modes.jsonGlobeThreadCond, NULL);
+    pthread_cond_init(&Modes.globeWorkCond, NULL);
+    pthread_cond_init(&Modes.globeDoneCond, NULL);
+
+    pthread_mutex_init(&Modes.dbThreadMutex, NULL);
+    pthread_cond_init(&Modes.dbThreadCond, NULL);
+    pthread_mutex_init(&Modes.dbUpdateMutex, NULL);
+
+    pthread_mutex_init(&Modes.heatmapThreadMutex, NULL);
+    pthread_cond_init(&Modes.heatmapThreadCond, NULL);
+    pthread_mutex_init(&Modes.traceBundleMutex, NULL);
+    pthread_mutex_init(&Modes.jsonFragMutex, NULL);
 
     for (int i = 0; i < TRACE_THREADS; i++) {
         pthread_mutex_init(&Modes.jsonTraceThreadMutex[i], NULL);
@@ -457,6 +483,128 @@ static void *jsonThreadEntryPoint(void *arg) {
 #endif
 }
 
+// The tiles of a globe refresh are queued here, the globe thread and the
+// workers take them one at a time until the queue is empty.
+static struct {
+    int tiles[GLOBE_MAX_INDEX + 1];
+    int len;
+    int next; // next tile to take
+    int busy; // workers still on the current refresh
+    uint64_t generation; // counts the refreshes
+    uint64_t now; // same timestamp for all tiles of a refresh
+} globeQueue;
+
+static void writeGlobeTile(int i, uint64_t now) {
+    char filename[32];
+
+    struct char_buffer cb2, cb3;
+    generateGlobeBins(i, now, &cb2, &cb3);
+
+    int full = 1;
+    // the websockets of the HTTP server stream the deltas
+    int ws = httpEnabled();
+    struct char_buffer delta = { NULL, 0 };
+    if (Modes.json_globe_deltas || ws)
+        delta = generateGlobeDelta(i, &cb2, now);
+    if (Modes.json_globe_deltas) {
+        if (delta.buffer) {
+            snprintf(filename, 31, "globeDelta_%04d.binCraft", i);
+            writeJsonToGzip(Modes.json_dir, filename, delta, 5);
+        }
+        uint32_t version;
+        memcpy(&version, cb2.buffer + 20, sizeof(version));
+        // keyframe to start from or resync
+        full = (version % Modes.json_globe_deltas == 1 % Modes.json_globe_deltas);
+    }
+
+    if (full) {
+        snprintf(filename, 31, "globe_%04d.binCraft", i);
+        writeJsonToGzip(Modes.json_dir, filename, cb2, 5);
+    }
+    if (ws && delta.buffer) {
+        cb2.buffer = arenaDetach(cb2.buffer, cb2.len);
+        delta.buffer = arenaDetach(delta.buffer, delta.len);
+        httpPublishTile(i, cb2, delta);
+    } else {
+        arenaFree(cb2.buffer);
+        arenaFree(delta.buffer);
+    }
+
+    snprintf(filename, 31, "globeMil_%04d.binCraft", i);
+    writeJsonToGzip(Modes.json_dir, filename, cb3, 5);
+    arenaFree(cb3.buffer);
+
+    if (!Modes.jsonBinCraft) {
+        snprintf(filename, 31, "globe_%04d.json", i);
+        struct char_buffer cb = generateGlobeJson(i, now);
+        writeJsonToGzip(Modes.json_dir, filename, cb, 3);
+        arenaFree(cb.buffer);
+    }
+}
+
+// work on the queued tiles until there are none left
+static void writeGlobeTiles(int thread) {
+    struct timespec start_time;
+    start_cpu_timing(&start_time);
+
+    while (1) {
+        pthread_mutex_lock(&Modes.globeWorkMutex);
+        int k = globeQueue.next++;
+        pthread_mutex_unlock(&Modes.globeWorkMutex);
+
+        if (k >= globeQueue.len)
+            break;
+
+        writeGlobeTile(globeQueue.tiles[k], globeQueue.now);
+    }
+
+    end_cpu_timing(&start_time, &Modes.stats_current.globe_json_cpu[thread]);
+}
+
+// biggest tiles first, the small ones fill the gaps at the end
+static int compareTileSize(const void *x, const void *y) {
+    int a = Modes.globeLists[*(const int *) x].len;
+    int b = Modes.globeLists[*(const int *) y].len;
+    return (a < b) - (a > b);
+}
+
+// The workers only run while the globe thread waits for them, it holds
+// jsonGlobeThreadMutex meanwhile: lockThreads() stops them as well.
+static void *globeWorkerEntryPoint(void *arg) {
+    int thread = * (int *) arg;
+    srandom(get_seed());
+
+    uint64_t generation = 0;
+
+    pthread_mutex_lock(&Modes.globeWorkMutex);
+
+    while (!Modes.exit) {
+        if (generation == globeQueue.generation) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            incTimedwait(&ts, 1000);
+            pthread_cond_timedwait(&Modes.globeWorkCond, &Modes.globeWorkMutex, &ts);
+            continue;
+        }
+        generation = globeQueue.generation;
+
+        pthread_mutex_unlock(&Modes.globeWorkMutex);
+        writeGlobeTiles(thread);
+        pthread_mutex_lock(&Modes.globeWorkMutex);
+
+        if (--globeQueue.busy == 0)
+            pthread_cond_signal(&Modes.globeDoneCond);
+    }
+
+    pthread_mutex_unlock(&Modes.globeWorkMutex);
+
+#ifndef _WIN32
+    pthread_exit(NULL);
+#else
+    return NULL;
+#endif
+}
+
 static void *jsonGlobeThreadEntryPoint(void *arg) {
     MODES_NOTUSED(arg);
     srandom(get_seed());
@@ -466,14 +614,18 @@ static void *jsonGlobeThreadEntryPoint(void *arg) {
 
     uint64_t sleep_ms = Modes.json_interval / n_parts;
 
+    // every tile gets a new trace bundle every 10 seconds, a few tiles per wakeup
+    int bundle_part = 0;
+    int bundle_parts = 10 * SECONDS / sleep_ms;
+    if (bundle_parts < 1)
+        bundle_parts = 1;
+
     pthread_mutex_lock(&Modes.jsonGlobeThreadMutex);
 
     struct timespec ts;
     clock_gettime(CLOCK_REALTIME, &ts);
 
     while (!Modes.exit) {
-        char filename[32];
-
         incTimedwait(&ts, sleep_ms);
 
         int res = 0;
@@ -484,8 +636,8 @@ static void *jsonGlobeThreadEntryPoint(void *arg) {
             break;
 
         struct timespec start_time;
-        start_cpu_timing(&start_time);
 
+        int len = 0;
         for (int i = 0; i <= GLOBE_MAX_INDEX; i++) {
             if (i == GLOBE_SPECIAL_INDEX)
                 i = GLOBE_MIN_INDEX;
@@ -496,27 +648,56 @@ static void *jsonGlobeThreadEntryPoint(void *arg) {
             if (i >= GLOBE_MIN_INDEX && globe_index_index(i) < GLOBE_MIN_INDEX)
                 continue;
 
-            snprintf(filename, 31, "globe_%04d.binCraft", i);
-            struct char_buffer cb2 = generateGlobeBin(i, 0);
-            writeJsonToGzip(Modes.json_dir, filename, cb2, 5);
-            free(cb2.buffer);
-
-            snprintf(filename, 31, "globeMil_%04d.binCraft", i);
-            struct char_buffer cb3 = generateGlobeBin(i, 1);
-            writeJsonToGzip(Modes.json_dir, filename, cb3, 5);
-            free(cb3.buffer);
-
-            if (!Modes.jsonBinCraft) {
-                snprintf(filename, 31, "globe_%04d.json", i);
-                struct char_buffer cb = generateGlobeJson(i);
-                writeJsonToGzip(Modes.json_dir, filename, cb, 3);
-                free(cb.buffer);
-            }
+            globeQueue.tiles[len++] = i;
+        }
+
+        int workers = Modes.json_globe_threads - 1;
+        if (workers > 0)
+            qsort(globeQueue.tiles, len, sizeof(int), compareTileSize);
+
+        pthread_mutex_lock(&Modes.globeWorkMutex);
+        globeQueue.len = len;
+        globeQueue.next = 0;
+        globeQueue.now = mstime();
+        globeQueue.busy = workers;
+        globeQueue.generation++;
+        pthread_cond_broadcast(&Modes.globeWorkCond);
+        pthread_mutex_unlock(&Modes.globeWorkMutex);
+
+        writeGlobeTiles(0);
+
+        pthread_mutex_lock(&Modes.globeWorkMutex);
+        while (globeQueue.busy > 0 && !Modes.exit) {
+            struct timespec done_ts;
+            clock_gettime(CLOCK_REALTIME, &done_ts);
+            incTimedwait(&done_ts, 1000);
+            pthread_cond_timedwait(&Modes.globeDoneCond, &Modes.globeWorkMutex, &done_ts);
         }
+        pthread_mutex_unlock(&Modes.globeWorkMutex);
+
+        httpWakeWebsockets();
 
         part++;
         part %= n_parts;
-        end_cpu_timing(&start_time, &Modes.stats_current.globe_json_cpu);
+
+        if (Modes.json_trace_bundles) {
+            start_cpu_timing(&start_time);
+            for (int i = 0; i <= GLOBE_MAX_INDEX; i++) {
+                if (i == GLOBE_SPECIAL_INDEX)
+                    i = GLOBE_MIN_INDEX;
+
+                if (i % bundle_parts != bundle_part)
+                    continue;
+
+                if (i >= GLOBE_MIN_INDEX && globe_index_index(i) < GLOBE_MIN_INDEX)
+                    continue;
+
+                writeTraceBundle(i);
+            }
+            bundle_part++;
+            bundle_part %= bundle_parts;
+            end_cpu_timing(&start_time, &Modes.stats_current.trace_bundle_cpu);
+        }
     }
 
     pthread_mutex_unlock(&Modes.jsonGlobeThreadMutex);
@@ -774,11 +955,13 @@ static void cleanup_and_exit(int code) {
     free(Modes.net_input_sbs_ports);
     free(Modes.net_output_json_ports);
     free(Modes.net_output_api_ports);
+    free(Modes.net_output_http_ports);
     free(Modes.beast_serial);
     free(Modes.json_globe_special_tiles);
     free(Modes.uuidFile);
-    free(Modes.dbIndex);
-    free(Modes.db);
+    dbFree(Modes.db);
+    dbFree(Modes.db2);
+    globeDeltasFree();
     /* Go through tracked aircraft chain and free up any used memory */
     for (int j = 0; j < AIRCRAFT_BUCKETS; j++) {
         struct aircraft *a = Modes.aircraft[j], *na;
@@ -788,10 +971,10 @@ static void cleanup_and_exit(int code) {
 
                 if (a->first_message)
                     free(a->first_message);
-                if (a->trace) {
-                    free(a->trace);
-                    free(a->trace_all);
-                }
+                traceFree(a);
+                legsFree(a);
+                free(a->trace_recent);
+                free(a->json_frag);
 
                 free(a);
             }
@@ -934,6 +1117,9 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
                 snprintf(Modes.state_dir, PATH_MAX, "%s/internal_state", Modes.globe_history_dir);
             }
             break;
+        case OptGlobeHistoryPack:
+            Modes.globe_history_pack = 1;
+            break;
         case OptStateDir:
             if (Modes.state_dir)
                 free(Modes.state_dir);
@@ -968,9 +1154,25 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             if (atof(arg) > 0)
                 Modes.json_trace_interval = 1000 * atof(arg);
             break;
+        case OptTraceCompactAge:
+            if (atof(arg) > 0)
+                Modes.trace_compact_age = (uint64_t) (atof(arg) * HOURS);
+            break;
         case OptJsonGlobeIndex:
             Modes.json_globe_index = 1;
             break;
+        case OptJsonTraceBundles:
+            Modes.json_trace_bundles = 1;
+            break;
+        case OptJsonTraceBin:
+            Modes.json_trace_bin = 1;
+            break;
+        case OptJsonGlobeDeltas:
+            Modes.json_globe_deltas = max(1, atoi(arg));
+            break;
+        case OptJsonGlobeThreads:
+            Modes.json_globe_threads = max(1, min(GLOBE_THREADS, atoi(arg)));
+            break;
 #endif
         case OptNetHeartbeat:
             Modes.net_heartbeat_interval = (uint64_t) (1000 * atof(arg));
@@ -1027,6 +1229,16 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             Modes.net_output_api_ports = strdup(arg);
             Modes.api = 1;
             break;
+        case OptNetHttpPorts:
+            free(Modes.net_output_http_ports);
+            Modes.net_output_http_ports = strdup(arg);
+            break;
+        case OptNetHttpThreads:
+            Modes.net_http_threads = max(1, min(HTTP_THREADS, atoi(arg)));
+            break;
+        case OptNetHttpNoFiles:
+            Modes.net_http_no_files = 1;
+            break;
         case OptNetSbsInPorts:
             free(Modes.net_input_sbs_ports);
             Modes.net_input_sbs_ports = strdup(arg);
@@ -1281,6 +1493,9 @@ int main(int argc, char **argv) {
         modesInitNet();
     }
 
+    // before anything is written to json_dir
+    httpInit();
+
     // init stats:
     Modes.stats_current.start = Modes.stats_current.end =
             Modes.stats_alltime.start = Modes.stats_alltime.end =
@@ -1301,6 +1516,15 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (Modes.globe_history_pack) {
+        if (!Modes.globe_history_dir) {
+            fprintf(stderr, "--write-globe-history-pack requires --write-globe-history, ignoring it!\n");
+            Modes.globe_history_pack = 0;
+        } else {
+            historyPacksInit(Modes.globe_history_dir);
+        }
+    }
+
     if (Modes.json_globe_index) {
         Modes.keep_traces = 24 * HOURS + 40 * MINUTES; // include 40 minutes overlap, tar1090 needs at least 30 minutes currently
     } else if (Modes.heatmap) {
@@ -1319,6 +1543,7 @@ int main(int argc, char **argv) {
 
     if (Modes.state_dir) {
         fprintf(stderr, "loading state .....\n");
+        uint64_t load_start = mstime();
         pthread_t threads[IO_THREADS];
         int numbers[IO_THREADS];
         for (int i = 0; i < IO_THREADS; i++) {
@@ -1339,14 +1564,14 @@ int main(int argc, char **argv) {
         uint64_t now = mstime();
         for (int j = 0; j < AIRCRAFT_BUCKETS; j++) {
             for (struct aircraft *a = Modes.aircraft[j]; a; a = a->next) {
-                int new_index = a->globe_index;
-                a->globe_index = -5;
-                set_globe_index(a, new_index);
+                // the globe lists are empty, no need for set_globe_index()
+                if (a->globe_index >= 0 && a->globe_index <= GLOBE_MAX_INDEX)
+                    ca_append(&Modes.globeLists[a->globe_index], a);
                 count_ac++;
                 updateValidities(a, now);
             }
         }
-        fprintf(stderr, " .......... done, loaded %u aircraft!\n", count_ac);
+        fprintf(stderr, " .......... done, loaded %u aircraft in %.1f seconds!\n", count_ac, (mstime() - load_start) / 1000.0);
         Modes.aircraftCount = count_ac;
         fprintf(stderr, "aircraft table fill: %0.1f\n", Modes.aircraftCount / (double) AIRCRAFT_BUCKETS );
 
@@ -1373,6 +1598,12 @@ int main(int argc, char **argv) {
 
     pthread_create(&Modes.decodeThread, NULL, decodeThreadEntryPoint, NULL);
 
+    // db reloads are parsed in the background, the tracker only swaps pointers
+    pthread_create(&Modes.dbThread, NULL, dbThreadEntryPoint, NULL);
+
+    if (Modes.heatmap)
+        pthread_create(&Modes.heatmapThread, NULL, heatmapThreadEntryPoint, NULL);
+
     if (Modes.json_dir) {
 
         pthread_create(&Modes.jsonThread, NULL, jsonThreadEntryPoint, NULL);
@@ -1380,6 +1611,9 @@ int main(int argc, char **argv) {
         if (Modes.json_globe_index) {
             // globe_xxxx.json
             pthread_create(&Modes.jsonGlobeThread, NULL, jsonGlobeThreadEntryPoint, NULL);
+            for (int i = 1; i < Modes.json_globe_threads; i++) {
+                pthread_create(&Modes.globeWorkerThread[i], NULL, globeWorkerEntryPoint, &Modes.threadNumber[i]);
+            }
 
             // trace_xxxxxxxxx.json
             for (int i = 0; i < TRACE_THREADS; i++) {
@@ -1417,6 +1651,9 @@ int main(int argc, char **argv) {
 
         if (Modes.json_globe_index) {
             pthread_join(Modes.jsonGlobeThread, NULL); // Wait on json writer thread exit
+            for (int i = 1; i < Modes.json_globe_threads; i++) {
+                pthread_join(Modes.globeWorkerThread[i], NULL);
+            }
 
             for (int i = 0; i < TRACE_THREADS; i++) {
                 pthread_join(Modes.jsonTraceThread[i], NULL); // Wait on json writer thread exit
@@ -1425,12 +1662,23 @@ int main(int argc, char **argv) {
     }
 
     pthread_join(Modes.decodeThread, NULL); // Wait on json writer thread exit
+    pthread_join(Modes.dbThread, NULL); // Wait on db thread exit
+    if (Modes.heatmapThread)
+        pthread_join(Modes.heatmapThread, NULL); // Wait on heatmap thread exit, it writes what's queued
+
+    // the trace threads are done, write the pack indexes
+    if (Modes.globe_history_pack)
+        historyPacksClose();
+
+    // everything writing to json_dir is done
+    httpCleanup();
 
     /* Cleanup network setup */
     cleanupNetwork();
 
     if (Modes.state_dir) {
         fprintf(stderr, "saving state .....\n");
+        uint64_t start = mstime();
 
         pthread_t threads[IO_THREADS];
         int numbers[IO_THREADS];
@@ -1441,16 +1689,27 @@ int main(int argc, char **argv) {
         for (int i = 0; i < IO_THREADS; i++) {
             pthread_join(threads[i], NULL);
         }
-        fprintf(stderr, "............. done!\n");
+        fprintf(stderr, "............. done! (%"PRIi64" KB in %.1f seconds)\n",
+                saved_state_bytes() / 1024, (mstime() - start) / 1000.0);
     }
 
 
     pthread_mutex_destroy(&Modes.decodeThreadMutex);
     pthread_mutex_destroy(&Modes.jsonThreadMutex);
     pthread_mutex_destroy(&Modes.jsonGlobeThreadMutex);
+    pthread_mutex_destroy(&Modes.globeWorkMutex);
     pthread_cond_destroy(&Modes.decodeThreadCond);
     pthread_cond_destroy(&Modes.jsonThreadCond);
     pthread_cond_destroy(&Modes.jsonGlobeThreadCond);
+    pthread_cond_destroy(&Modes.globeWorkCond);
+    pthread_cond_destroy(&Modes.globeDoneCond);
+    pthread_mutex_destroy(&Modes.dbThreadMutex);
+    pthread_cond_destroy(&Modes.dbThreadCond);
+    pthread_mutex_destroy(&Modes.dbUpdateMutex);
+    pthread_mutex_destroy(&Modes.heatmapThreadMutex);
+    pthread_cond_destroy(&Modes.heatmapThreadCond);
+    pthread_mutex_destroy(&Modes.traceBundleMutex);
+    pthread_mutex_destroy(&Modes.jsonFragMutex);
     for (int i = 0; i < TRACE_THREADS; i++) {
         pthread_mutex_destroy(&Modes.jsonTraceThreadMutex[i]);
         pthread_cond_destroy(&Modes.jsonTraceThreadCond[i]);
@@ -306,9 +306,11 @@ typedef enum {
 
 #define GLOBE_TRACE_SIZE 32768
 #define GLOBE_STEP 32
+#define TRACE_COMPACT_BLOCKS 32 // blocks thinned out per removeStale pass, about 0.1 ms each under lockThreads()
 #define STATE_BLOBS 256
 #define IO_THREADS 8
 #define TRACE_THREADS 8
+#define GLOBE_THREADS 16 // max threads writing the globe tiles, --write-json-globe-threads
 
 #define STAT_BUCKETS 90 // 90 * 10 seconds = 15 min (max interval in stats.json)
 
@@ -322,9 +324,13 @@ typedef enum {
 // Include subheaders after all the #defines are in place
 
 #include "util.h"
+#include "arena.h"
+#include "gz_out.h"
+#include "geodesy.h"
 #include "fasthash.h"
 #include "anet.h"
 #include "net_io.h"
+#include "json_out.h"
 #include "crc.h"
 #include "demod_2400.h"
 #include "stats.h"
@@ -334,7 +340,10 @@ typedef enum {
 #include "sdr.h"
 #include "globe_index.h"
 #include "receiver.h"
+#include "aircraft_db.h"
 #include "aircraft.h"
+#include "history_pack.h"
+#include "http.h"
 
 //======================== structure declarations =========================
 
@@ -384,6 +393,11 @@ struct _Modes
     pthread_mutex_t jsonTraceThreadMutex[TRACE_THREADS];
     pthread_cond_t jsonTraceThreadCond[TRACE_THREADS];
 
+    pthread_t globeWorkerThread[GLOBE_THREADS]; // help the globe thread with the tiles, [0] unused
+    pthread_mutex_t globeWorkMutex; // protects the tile queue of the globe thread
+    pthread_cond_t globeWorkCond; // new tiles queued
+    pthread_cond_t globeDoneCond; // a worker finished
+
     unsigned first_free_buffer; // Entry in mag_buffers that will next be filled with input.
     unsigned first_filled_buffer; // Entry in mag_buffers that has valid data and will be demodulated next. If equal to next_free_buffer, there is no unprocessed data.
     unsigned trailing_samples; // extra trailing samples in magnitude buffers
@@ -404,11 +418,19 @@ struct _Modes
     struct aircraft * volatile aircraft[AIRCRAFT_BUCKETS]; // pointers are volatile
     struct craftArray globeLists[GLOBE_MAX_INDEX+1];
     struct receiver *receiverTable[RECEIVER_TABLE_SIZE];
-    dbEntry *db;
-    dbEntry **dbIndex;
-    dbEntry *db2;
-    dbEntry **db2Index;
+    struct aircraftDb *db;
+    struct aircraftDb *db2; // loaded by the db thread, not yet swapped in
     uint64_t dbModificationTime;
+    uint32_t dbGeneration; // incremented whenever a new db is swapped in
+    pthread_t dbThread; // thread reloading the aircraft db
+    pthread_mutex_t dbThreadMutex;
+    pthread_cond_t dbThreadCond;
+    pthread_mutex_t dbUpdateMutex; // protects the db2 handover
+    pthread_t heatmapThread; // sorts and writes the heatmap collected by the main thread
+    pthread_mutex_t heatmapThreadMutex;
+    pthread_cond_t heatmapThreadCond;
+    pthread_mutex_t traceBundleMutex; // protects a->trace_recent and setting a->legs
+    pthread_mutex_t jsonFragMutex; // protects the a->json_frag fields
     uint64_t aircraftCount;
     uint64_t receiverCount;
     struct net_writer raw_out; // Raw output
@@ -496,6 +518,7 @@ struct _Modes
     char *net_output_beast_reduce_ports; // List of Beast output TCP ports
     char *net_output_json_ports;
     char *net_output_api_ports;
+    char *net_output_http_ports;
     char *garbage_ports;
     char *net_output_vrs_ports; // List of VRS output TCP ports
     uint64_t net_output_vrs_interval;
@@ -507,6 +530,7 @@ struct _Modes
     char *net_bind_address; // Bind address
     char *json_dir; // Path to json base directory, or NULL not to write json.
     char *globe_history_dir;
+    int8_t globe_history_pack; // append the history traces to per day pack files
     char *state_dir;
     char *prom_file;
     uint32_t heatmap_interval;
@@ -515,7 +539,14 @@ struct _Modes
     char *heatmap_dir;
     uint32_t keep_traces; // how long traces are saved in internal memory
     int json_globe_index; // Enable extra globe indexed json files.
+    int8_t json_trace_bundles; // recent traces go into one bundle per globe tile instead of a file per aircraft
+    int8_t json_trace_bin; // write the traces in the binary format next to the json
+    int json_globe_threads; // threads writing the globe tiles, including the globe thread
+    int json_globe_deltas; // write globeDelta_xxxx.binCraft, the full tile only every n-th version, 0: off
+    int net_http_threads; // workers of the built-in HTTP server
+    int8_t net_http_no_files; // serve the json output only over HTTP, don't write it to json_dir
     uint32_t json_trace_interval; // max time ignoring new positions for trace
+    uint64_t trace_compact_age; // trace points older than this are thinned out, 0: off
     int json_ac_count_pos;
     int json_ac_count_no_pos;
     struct tile *json_globe_special_tiles;
@@ -855,13 +886,19 @@ enum {
     OptDbFile,
     OptPromFile,
     OptGlobeHistoryDir,
+    OptGlobeHistoryPack,
     OptStateDir,
     OptHeatmap,
     OptHeatmapDir,
     OptJsonTime,
     OptJsonLocAcc,
     OptJsonGlobeIndex,
+    OptJsonTraceBundles,
+    OptJsonTraceBin,
+    OptJsonGlobeThreads,
+    OptJsonGlobeDeltas,
     OptJsonTraceInt,
+    OptTraceCompactAge,
     OptDcFilter,
     OptBiasTee,
     OptNet,
@@ -879,6 +916,9 @@ enum {
     OptNetVRSInterval,
     OptNetJsonPorts,
     OptNetApiPorts,
+    OptNetHttpPorts,
+    OptNetHttpThreads,
+    OptNetHttpNoFiles,
     OptNetRoSize,
     OptNetRoRate,
     OptNetRoIntervall,
@@ -913,6 +953,9 @@ enum {
 
 // This one needs modesMessage:
 #include "track.h"
+#include "trace_store.h"
+#include "legs.h"
+#include "state_store.h"
 #include "mode_s.h"
 #include "comm_b.h"
 
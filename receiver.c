@@ -117,9 +117,8 @@ void receiverPositionReceived(struct aircraft *a, uint64_t id, double lat, doubl
         double rlat = r->latMin + latDiff / 2;
         double rlon = r->lonMin + lonDiff / 2;
 
-        double distance = greatcircle(rlat, rlon, lat, lon);
-
-        if (!r->badExtent && distance > RECEIVER_MAX_RANGE) {
+        if (!r->badExtent && greatcircle_cmp(rlat, rlon, lat, lon, RECEIVER_MAX_RANGE) > 0) {
+            double distance = greatcircle(rlat, rlon, lat, lon);
             r->badExtent = now;
 
             if (Modes.debug_receiver) {
@@ -228,7 +227,7 @@ struct char_buffer generateReceiversJson() {
     uint64_t now = mstime();
 
     size_t buflen = 1*1024*1024; // The initial buffer is resized as needed
-    char *buf = (char *) malloc(buflen), *p = buf, *end = buf + buflen;
+    char *buf = (char *) arenaMalloc(buflen), *p = buf, *end = buf + buflen;
 
     p = safe_snprintf(p, end, "{ \"now\" : %.1f,\n", now / 1000.0);
 
@@ -244,7 +243,7 @@ struct char_buffer generateReceiversJson() {
             if ((p + 1000) >= end) {
                 int used = p - buf;
                 buflen *= 2;
-                buf = (char *) realloc(buf, buflen);
+                buf = (char *) arenaRealloc(buf, buflen);
                 p = buf + used;
                 end = buf + buflen;
             }
@@ -0,0 +1,654 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// state_store.c: serialization of the aircraft state (state_dir)
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+#include "state_v1.h"
+
+#define STATE_VALIDITY_SIZE 19
+
+// upper bound for the encoded fields of one aircraft
+#define COUNT_FIELD(tag, member) + 1
+#define STATE_FIELD_COUNT (0 STATE_FIELDS(COUNT_FIELD) STATE_BITFIELDS(COUNT_FIELD) STATE_VALIDITY(COUNT_FIELD))
+#define STATE_FIELDS_MAX (sizeof(struct aircraft) + STATE_FIELD_COUNT * (4 + STATE_VALIDITY_SIZE))
+
+// format 1 is converted with the same field lists
+#define V1_FIELD_SIZE(tag, member) \
+    _Static_assert(sizeof(((struct aircraft *) 0)->member) == sizeof(((struct aircraftV1 *) 0)->member), \
+            "state format 1: type of " #member " has changed");
+STATE_FIELDS_V1(V1_FIELD_SIZE)
+STATE_VALIDITY(V1_FIELD_SIZE)
+#undef V1_FIELD_SIZE
+
+static int sb_reserve(struct stateBuffer *sb, size_t bytes) {
+    if (sb->len + bytes <= sb->alloc)
+        return 0;
+    size_t alloc = max(sb->alloc * 2, sb->len + bytes + STATE_FLUSH_SIZE);
+    unsigned char *buf = arenaRealloc(sb->buf, alloc);
+    if (!buf) {
+        fprintf(stderr, "state checkpoint: malloc failure!\n");
+        return -1;
+    }
+    sb->buf = buf;
+    sb->alloc = alloc;
+    return 0;
+}
+
+static void sb_put(struct stateBuffer *sb, const void *data, size_t bytes) {
+    memcpy(sb->buf + sb->len, data, bytes);
+    sb->len += bytes;
+}
+
+static void sb_field(struct stateBuffer *sb, uint16_t tag, const void *data, uint16_t len) {
+    sb_put(sb, &tag, sizeof(tag));
+    sb_put(sb, &len, sizeof(len));
+    sb_put(sb, data, len);
+}
+
+static void sb_validity(struct stateBuffer *sb, uint16_t tag, const data_validity *v) {
+    unsigned char value[STATE_VALIDITY_SIZE];
+    memcpy(value, &v->updated, 8);
+    memcpy(value + 8, &v->next_reduce_forward, 8);
+    value[16] = v->source;
+    value[17] = v->last_source;
+    value[18] = v->stale;
+    sb_field(sb, tag, value, sizeof(value));
+}
+
+static void read_validity(data_validity *v, const unsigned char *value, int len) {
+    if (len != STATE_VALIDITY_SIZE)
+        return;
+    memcpy(&v->updated, value, 8);
+    memcpy(&v->next_reduce_forward, value + 8, 8);
+    v->source = (int8_t) value[16];
+    v->last_source = (int8_t) value[17];
+    v->stale = value[18];
+}
+
+static void write_fields(struct stateBuffer *sb, struct aircraft *a) {
+#define WRITE_FIELD(tag, member) sb_field(sb, tag, &a->member, sizeof(a->member));
+#define WRITE_BITFIELD(tag, member) { uint8_t value = a->member; sb_field(sb, tag, &value, 1); }
+#define WRITE_VALIDITY(tag, member) sb_validity(sb, tag, &a->member);
+    STATE_FIELDS(WRITE_FIELD)
+    STATE_BITFIELDS(WRITE_BITFIELD)
+    STATE_VALIDITY(WRITE_VALIDITY)
+#undef WRITE_FIELD
+#undef WRITE_BITFIELD
+#undef WRITE_VALIDITY
+}
+
+// returns -1 if the fields are cut short
+static int read_fields(struct aircraft *a, const unsigned char *p, const unsigned char *end) {
+    while (end - p >= 4) {
+        uint16_t tag, len;
+        memcpy(&tag, p, sizeof(tag));
+        memcpy(&len, p + 2, sizeof(len));
+        p += 4;
+        if (end - p < len)
+            return -1;
+        switch (tag) {
+#define READ_FIELD(t, member) case t: if (len == sizeof(a->member)) memcpy(&a->member, p, len); break;
+#define READ_BITFIELD(t, member) case t: if (len == 1) a->member = *p; break;
+#define READ_VALIDITY(t, member) case t: read_validity(&a->member, p, len); break;
+            STATE_FIELDS(READ_FIELD)
+            STATE_BITFIELDS(READ_BITFIELD)
+            STATE_VALIDITY(READ_VALIDITY)
+#undef READ_FIELD
+#undef READ_BITFIELD
+#undef READ_VALIDITY
+            default:
+                break;
+        }
+        p += len;
+    }
+    return (p == end) ? 0 : -1;
+}
+
+int stateInclude(struct aircraft *a) {
+    if (!a->seen_pos && traceLen(a) == 0)
+        return 0;
+    if (a->addr & MODES_NON_ICAO_ADDRESS)
+        return 0;
+    if (a->messages < 2)
+        return 0;
+    return 1;
+}
+
+// encode count points (state_all at every 4th) as one chunk, returns -1 on allocation failure
+static int write_chunk(struct stateBuffer *sb, const struct state *trace, const struct state_all *trace_all, int count) {
+    if (sb_reserve(sb, sizeof(struct stateChunk) + traceEncodeBound(count)))
+        return -1;
+    struct stateChunk chunk = {
+        .first = trace[0].timestamp,
+        .last = trace[count - 1].timestamp,
+        .count = count,
+    };
+    unsigned char *data = sb->buf + sb->len + sizeof(chunk);
+    chunk.size = traceEncode(data, trace, trace_all, 0, count) - data;
+    memcpy(sb->buf + sb->len, &chunk, sizeof(chunk));
+    sb->len += sizeof(chunk) + chunk.size;
+    return 0;
+}
+
+// a sealed block, copied without decoding it
+static int write_block_chunk(struct stateBuffer *sb, const struct traceBlock *block) {
+    if (sb_reserve(sb, sizeof(struct stateChunk) + block->size))
+        return -1;
+    struct stateChunk chunk = {
+        .first = block->first,
+        .last = block->last,
+        .size = block->size,
+        .count = block->count,
+        .flags = STATE_CHUNK_BLOCK | (block->compacted ? STATE_CHUNK_COMPACTED : 0),
+    };
+    sb_put(sb, &chunk, sizeof(chunk));
+    sb_put(sb, block->data, block->size);
+    return 0;
+}
+
+// the points from start (a multiple of 4) to the end of the trace as chunks
+// returns the number of chunks or -1 on allocation failure
+static int write_chunks(struct stateBuffer *sb, struct aircraft *a, int start, int len) {
+    struct state trace[TRACE_BLOCK_POINTS];
+    struct state_all trace_all[TRACE_BLOCK_POINTS / 4];
+    int chunks = 0;
+
+    int i = 0;
+    for (struct traceBlock *block = a->trace_blocks; block && i < a->trace_packed; block = block->next) {
+        int end = i + block->count;
+        if (i >= start) {
+            if (write_block_chunk(sb, block))
+                return -1;
+            chunks++;
+        } else if (end > start) {
+            // the record starts within this block, only its newer part is written
+            traceBlockUnpack(block, trace, trace_all);
+            if (write_chunk(sb, trace + start - i, trace_all + (start - i) / 4, end - start))
+                return -1;
+            chunks++;
+        }
+        i = end;
+    }
+
+    // the tail, the block encoding needs the points in flat arrays
+    for (i = max(start, a->trace_packed); i < len; i += TRACE_BLOCK_POINTS) {
+        int count = min(TRACE_BLOCK_POINTS, len - i);
+        for (int k = 0; k < count; k++) {
+            int j = i - a->trace_packed + k;
+            trace[k] = *traceAt(a, j);
+            if (k % 4 == 0)
+                trace_all[k / 4] = *traceAllAt(a, j);
+        }
+        if (write_chunk(sb, trace, trace_all, count))
+            return -1;
+        chunks++;
+    }
+    return chunks;
+}
+
+int stateRecord(struct stateBuffer *sb, struct aircraft *a, int incremental) {
+    // the decode thread keeps adding trace points, work on a consistent copy
+    struct aircraft copy;
+    memcpy(&copy, a, sizeof(struct aircraft));
+
+    int total = traceLen(&copy);
+    uint64_t first = traceFirstTimestamp(&copy);
+    int unchanged = (copy.chk_seen && copy.chk_seen == copy.seen
+            && total == copy.chk_trace_len && first == copy.chk_trace_first);
+    // the trace only grew since the last checkpoint
+    int append = (copy.chk_seen && copy.chk_trace_len > 0
+            && total >= copy.chk_trace_len && first == copy.chk_trace_first);
+
+    if (incremental && unchanged)
+        return 0;
+
+    // the chunks start with a state_all, the last up to 3 points are written again
+    uint32_t start = (incremental && append) ? copy.chk_trace_len - copy.chk_trace_len % 4 : 0;
+    uint32_t trace_len = total;
+
+    if (sb_reserve(sb, sizeof(uint64_t) + 4 * sizeof(uint32_t) + STATE_FIELDS_MAX))
+        return 0;
+    size_t record_pos = sb->len;
+
+    uint64_t magic = start ? STATE_RECORD_APPEND_MAGIC : STATE_RECORD_MAGIC;
+    sb_put(sb, &magic, sizeof(magic));
+
+    // written with the values this record establishes
+    copy.chk_seen = copy.seen;
+    copy.chk_trace_len = total;
+    copy.chk_trace_first = first;
+
+    size_t fields_pos = sb->len;
+    uint32_t fields_len = 0;
+    sb_put(sb, &fields_len, sizeof(fields_len));
+    write_fields(sb, &copy);
+    fields_len = sb->len - fields_pos - sizeof(fields_len);
+    memcpy(sb->buf + fields_pos, &fields_len, sizeof(fields_len));
+
+    sb_put(sb, &start, sizeof(start));
+    sb_put(sb, &trace_len, sizeof(trace_len));
+    size_t chunks_pos = sb->len;
+    uint32_t chunks = 0;
+    sb_put(sb, &chunks, sizeof(chunks));
+
+    int res = write_chunks(sb, &copy, start, total);
+    if (res < 0) {
+        // drop the partial record, the aircraft is written in full next time
+        sb->len = record_pos;
+        a->chk_seen = 0;
+        return 0;
+    }
+    chunks = res;
+    memcpy(sb->buf + chunks_pos, &chunks, sizeof(chunks));
+
+    a->chk_seen = copy.chk_seen;
+    a->chk_trace_len = copy.chk_trace_len;
+    a->chk_trace_first = copy.chk_trace_first;
+    return 1;
+}
+
+int stateRemoval(struct stateBuffer *sb, uint32_t addr) {
+    if (sb_reserve(sb, sizeof(uint64_t) + sizeof(addr)))
+        return -1;
+    uint64_t magic = STATE_REMOVAL_MAGIC;
+    sb_put(sb, &magic, sizeof(magic));
+    sb_put(sb, &addr, sizeof(addr));
+    return 0;
+}
+
+void stateHeaderInit(struct stateHeader *header, uint64_t magic, uint64_t id) {
+    memset(header, 0, sizeof(*header));
+    header->magic = magic;
+    header->version = STATE_VERSION;
+    header->size_state = sizeof(struct state);
+    header->size_state_all = sizeof(struct state_all);
+    header->id = id;
+}
+
+int64_t stateWriteSegment(int fd, struct stateBuffer *sb, const char *filename) {
+    uLongf compressed = compressBound(sb->len);
+    unsigned char *out = arenaMalloc(sizeof(struct stateSegment) + compressed);
+    if (!out || compress2(out + sizeof(struct stateSegment), &compressed, sb->buf, sb->len, 1) != Z_OK) {
+        fprintf(stderr, "%s: compressing state segment failed\n", filename);
+        arenaFree(out);
+        return -1;
+    }
+    struct stateSegment seg = {
+        .magic = STATE_SEGMENT_MAGIC,
+        .compressed = compressed,
+        .len = sb->len,
+        .crc = crc32(0, sb->buf, sb->len),
+    };
+    memcpy(out, &seg, sizeof(seg));
+    size_t total = sizeof(seg) + compressed;
+
+    // check_write() is in globe_index.c which the tests don't link
+    ssize_t res = write(fd, out, total);
+    if (res < 0)
+        perror(filename);
+    else if (res != (ssize_t) total)
+        fprintf(stderr, "%s: Only %zd of %zu bytes written!\n", filename, res, total);
+    arenaFree(out);
+    sb->len = 0;
+
+    return (res == (ssize_t) total) ? (int64_t) total : -1;
+}
+
+int stateReadAt(int fd, void *buf, size_t count, off_t off) {
+    char *p = buf;
+    while (count > 0) {
+        ssize_t res = pread(fd, p, count, off);
+        if (res <= 0)
+            return -1;
+        p += res;
+        off += res;
+        count -= res;
+    }
+    return 0;
+}
+
+// an empty aircraft with the defaults of aircraftCreate() for fields missing in the state
+static struct aircraft *new_aircraft() {
+    struct aircraft *a = malloc(sizeof(struct aircraft));
+    if (!a)
+        return NULL;
+    memset(a, 0, sizeof(struct aircraft));
+    a->size_struct_aircraft = sizeof(struct aircraft);
+    a->addrtype = ADDR_UNKNOWN;
+    a->adsb_version = -1;
+    a->adsb_hrd = HEADING_MAGNETIC;
+    a->adsb_tah = HEADING_GROUND_TRACK;
+    a->globe_index = -5;
+    return a;
+}
+
+// reset what's meaningless after loading an aircraft from the state
+static void fixup_aircraft(struct aircraft *a, uint64_t now) {
+    // just in case we have bogus values saved, make sure they time out
+    if (a->seen_pos > now + 26 * HOURS)
+        a->seen_pos = 0;
+    if (a->seen > now + 26 * HOURS)
+        a->seen = now;
+
+    if (a->globe_index > GLOBE_MAX_INDEX)
+        a->globe_index = -5;
+
+    if (a->seen > now)
+        a->seen = 0;
+}
+
+// move the trace of the previous version of a loaded aircraft over
+static void take_trace(struct aircraft *a, struct aircraft *old) {
+    a->trace_segs = old->trace_segs;
+    a->trace_segs_alloc = old->trace_segs_alloc;
+    a->trace_alloc = old->trace_alloc;
+    a->trace_len = old->trace_len;
+    a->trace_blocks = old->trace_blocks;
+    a->trace_packed = old->trace_packed;
+
+    old->trace_segs = NULL;
+    old->trace_segs_alloc = 0;
+    old->trace_alloc = 0;
+    old->trace_len = 0;
+    old->trace_blocks = NULL;
+    old->trace_packed = 0;
+}
+
+// the loaded trace is complete: seal it, leave room for new points
+static void finish_trace(struct aircraft *a, uint64_t now) {
+    traceSeal(a);
+    if (traceReserve(a, a->trace_len + GLOBE_STEP)) {
+        traceFree(a);
+        return;
+    }
+    if (a->addr == LEG_FOCUS) {
+        a->trace_next_fw = now;
+        fprintf(stderr, "%06x trace len: %d\n", a->addr, traceLen(a));
+    }
+}
+
+// append the chunks to the trace of a, returns -1 if a chunk doesn't fit the trace
+static int load_chunks(struct aircraft *a, const char *p, const char *end) {
+    struct traceBlock **tail = &a->trace_blocks;
+    while (*tail)
+        tail = &(*tail)->next;
+
+    struct state trace[TRACE_BLOCK_POINTS];
+    struct state_all trace_all[TRACE_BLOCK_POINTS / 4];
+
+    while (p < end) {
+        struct stateChunk chunk;
+        memcpy(&chunk, p, sizeof(chunk));
+        const unsigned char *data = (const unsigned char *) p + sizeof(chunk);
+        p += sizeof(chunk) + chunk.size;
+
+        if (chunk.count == 0 || chunk.count > TRACE_BLOCK_POINTS || traceLen(a) % 4 != 0
+                || traceLen(a) + chunk.count > GLOBE_TRACE_SIZE)
+            return -1;
+
+        if ((chunk.flags & STATE_CHUNK_BLOCK) && a->trace_len == 0 && chunk.count % 4 == 0) {
+            // blocks stay as they are as long as no tail points have been loaded
+            struct traceBlock *block = malloc(sizeof(struct traceBlock) + chunk.size);
+            if (!block)
+                return -1;
+            block->next = NULL;
+            block->first = chunk.first;
+            block->last = chunk.last;
+            block->size = chunk.size;
+            block->count = chunk.count;
+            block->compacted = (chunk.flags & STATE_CHUNK_COMPACTED) ? 1 : 0;
+            memcpy(block->data, data, chunk.size);
+            *tail = block;
+            tail = &block->next;
+            a->trace_packed += chunk.count;
+            continue;
+        }
+
+        if (traceDecode(data, trace, trace_all, 0, chunk.count) != data + chunk.size
+                || traceCopyIn(a, a->trace_len, trace, trace_all, chunk.count))
+            return -1;
+        a->trace_len += chunk.count;
+    }
+    return 0;
+}
+
+// format 2 record, returns -1 if the record is cut short
+static int load_record(char **p, char *end, struct stateLoad *ld, int append) {
+    uint32_t fields_len;
+    if (end - *p < (long) sizeof(fields_len))
+        return -1;
+    memcpy(&fields_len, *p, sizeof(fields_len));
+    *p += sizeof(fields_len);
+    if (end - *p < (long) fields_len + 3 * (long) sizeof(uint32_t))
+        return -1;
+
+    struct aircraft *a = new_aircraft();
+    if (!a)
+        return -1;
+
+    int res = read_fields(a, (unsigned char *) *p, (unsigned char *) *p + fields_len);
+    *p += fields_len;
+
+    uint32_t start, trace_len, chunks;
+    memcpy(&start, *p, sizeof(start));
+    *p += sizeof(start);
+    memcpy(&trace_len, *p, sizeof(trace_len));
+    *p += sizeof(trace_len);
+    memcpy(&chunks, *p, sizeof(chunks));
+    *p += sizeof(chunks);
+
+    if (res || start > trace_len || start % 4 != 0 || trace_len > GLOBE_TRACE_SIZE) {
+        free(a);
+        return -1;
+    }
+
+    // find the end of the chunks, the sizes don't depend on the trace format
+    char *chunks_p = *p;
+    for (uint32_t k = 0; k < chunks; k++) {
+        struct stateChunk chunk;
+        if (end - *p < (long) sizeof(chunk)) {
+            free(a);
+            return -1;
+        }
+        memcpy(&chunk, *p, sizeof(chunk));
+        if (end - *p - (long) sizeof(chunk) < (long) chunk.size) {
+            free(a);
+            return -1;
+        }
+        *p += sizeof(chunk) + chunk.size;
+    }
+
+    fixup_aircraft(a, ld->now);
+    // the record doesn't cover the trace if it isn't loaded, write it in full next time
+    a->chk_seen = 0;
+
+    if (!ld->traces || trace_len == 0) {
+        if (ld->traces)
+            a->chk_seen = a->seen;
+        a->chk_trace_len = 0;
+        ld->insert(a);
+        return 0;
+    }
+
+    if (append) {
+        struct aircraft *old = ld->get(a->addr);
+        int len = old ? traceLen(old) : 0;
+        if (!old || len < (int) start || len >= (int) start + 4 || (int) start < old->trace_packed) {
+            // the earlier part of the trace is missing, keep the previous version
+            fprintf(stderr, "%06x: state checkpoint doesn't match the loaded trace\n", a->addr);
+            free(a);
+            return 0;
+        }
+        // take over the trace of the previous version, the last up to 3 points are replaced
+        take_trace(a, old);
+        a->trace_len = start - a->trace_packed;
+    }
+
+    if (load_chunks(a, chunks_p, *p) || traceLen(a) != (int) trace_len) {
+        fprintf(stderr, "%06x: read trace fail\n", a->addr);
+        traceFree(a);
+        a->chk_trace_len = 0;
+        ld->insert(a);
+        return 0;
+    }
+    finish_trace(a, ld->now);
+
+    // the log can be replayed on top of this record
+    a->chk_seen = a->seen;
+    a->chk_trace_len = traceLen(a);
+    a->chk_trace_first = traceFirstTimestamp(a);
+
+    ld->insert(a);
+    return 0;
+}
+
+// parse records up to the end of the segment, returns 0 if all records were complete
+static int load_records(char *p, char *end, struct stateLoad *ld) {
+    while (end - p > 0) {
+        uint64_t magic;
+        if (end - p < (long) sizeof(magic))
+            return -1;
+        memcpy(&magic, p, sizeof(magic));
+        p += sizeof(magic);
+
+        if (magic == STATE_REMOVAL_MAGIC) {
+            uint32_t addr;
+            if (end - p < (long) sizeof(addr))
+                return -1;
+            memcpy(&addr, p, sizeof(addr));
+            p += sizeof(addr);
+            ld->remove(addr);
+            continue;
+        }
+        if (magic != STATE_RECORD_MAGIC && magic != STATE_RECORD_APPEND_MAGIC)
+            return -1;
+        if (load_record(&p, end, ld, magic == STATE_RECORD_APPEND_MAGIC))
+            return -1;
+    }
+    return 0;
+}
+
+off_t stateLoadSegments(int fd, off_t off, struct stateLoad *ld, const char *filename) {
+    unsigned char *in = NULL;
+    char *raw = NULL;
+    size_t in_alloc = 0;
+    size_t raw_alloc = 0;
+
+    struct stateSegment seg;
+    while (stateReadAt(fd, &seg, sizeof(seg), off) == 0) {
+        if (seg.magic != STATE_SEGMENT_MAGIC)
+            break;
+        if (seg.compressed > in_alloc) {
+            free(in);
+            in_alloc = seg.compressed;
+            in = malloc(in_alloc);
+        }
+        if (seg.len >= raw_alloc) {
+            free(raw);
+            raw_alloc = seg.len + 1;
+            raw = malloc(raw_alloc);
+        }
+        if (!in || !raw) {
+            fprintf(stderr, "%s: malloc failure!\n", filename);
+            in_alloc = raw_alloc = 0;
+            break;
+        }
+        uLongf len = seg.len;
+        if (stateReadAt(fd, in, seg.compressed, off + sizeof(seg))
+                || uncompress((unsigned char *) raw, &len, in, seg.compressed) != Z_OK
+                || len != seg.len
+                || crc32(0, (unsigned char *) raw, len) != seg.crc) {
+            break;
+        }
+        if (load_records(raw, raw + len, ld))
+            fprintf(stderr, "Incomplete state segment: %s\n", filename);
+
+        off += sizeof(seg) + seg.compressed;
+    }
+    free(in);
+    free(raw);
+    return off;
+}
+
+// struct aircraftV1 to struct aircraft, member by member
+static void convert_v1(struct aircraft *a, const struct aircraftV1 *v1) {
+#define CONVERT_FIELD(tag, member) memcpy(&a->member, &v1->member, sizeof(a->member));
+#define CONVERT_BITFIELD(tag, member) a->member = v1->member;
+    STATE_FIELDS_V1(CONVERT_FIELD)
+    STATE_BITFIELDS(CONVERT_BITFIELD)
+    STATE_VALIDITY(CONVERT_FIELD)
+#undef CONVERT_FIELD
+#undef CONVERT_BITFIELD
+}
+
+struct aircraft *stateLoadV1(char **p, char *end, struct stateLoad *ld) {
+    struct aircraftV1 v1;
+    if (end - *p < (long) sizeof(v1))
+        return NULL;
+    memcpy(&v1, *p, sizeof(v1));
+    *p += sizeof(v1);
+
+    if (v1.size_struct_aircraft != sizeof(struct aircraftV1)) {
+        fprintf(stderr, "state format 1: sizeof(struct aircraft) doesn't match, unable to read state!\n");
+        return NULL;
+    }
+
+    // the trace follows whenever trace_len > 0
+    int len = v1.trace_len;
+    long size_state = (long) len * sizeof(struct state);
+    long size_all = (long) (len + 3) / 4 * sizeof(struct state_all);
+    if (len < 0 || len > 1024 * 1024 || end - *p < size_state + size_all) {
+        fprintf(stderr, "%06x: read trace fail\n", v1.addr);
+        return NULL;
+    }
+    char *state_p = *p;
+    char *all_p = *p + size_state;
+    *p += size_state + size_all;
+
+    struct aircraft *a = new_aircraft();
+    if (!a)
+        return NULL;
+    convert_v1(a, &v1);
+    fixup_aircraft(a, ld->now);
+
+    if (ld->traces && len > 0 && len <= GLOBE_TRACE_SIZE) {
+        if (traceCopyIn(a, 0, state_p, all_p, len) == 0) {
+            a->trace_len = len;
+            finish_trace(a, ld->now);
+        } else {
+            fprintf(stderr, "%06x: read trace fail\n", a->addr);
+            traceFree(a);
+        }
+    }
+
+    ld->insert(a);
+    return a;
+}
+
+int stateLoadV1Blob(char *p, char *end, struct stateLoad *ld) {
+    while (end - p >= (long) sizeof(uint64_t)) {
+        uint64_t magic;
+        memcpy(&magic, p, sizeof(magic));
+        p += sizeof(magic);
+
+        if (magic == STATE_MAGIC - 1)
+            return 0;
+        // a record that can't be read leaves no way to find the next one
+        if (magic != STATE_MAGIC || !stateLoadV1(&p, end, ld))
+            return -1;
+    }
+    return -1;
+}
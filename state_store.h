@@ -0,0 +1,180 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// state_store.h: serialization of the aircraft state (state_dir)
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef STATE_STORE_H
+#define STATE_STORE_H
+
+// The files and the checkpoint schedule are handled in globe_index.c, this
+// is the record format, kept free of Modes so it can be tested on its own.
+//
+// Both files: struct stateHeader | segment*
+// segment: struct stateSegment | compressed records (flushed at STATE_FLUSH_SIZE)
+// record: magic | uint32_t fields_len | fields | uint32_t start | uint32_t trace_len
+//         | uint32_t chunks | chunk*
+//         or STATE_REMOVAL_MAGIC | uint32_t addr
+// field: uint16_t tag | uint16_t len | value
+// chunk: struct stateChunk | points in the block encoding of trace_store.h
+//
+// The aircraft is stored field by field (see STATE_FIELDS), unknown tags or
+// fields that changed size are skipped and keep their default on loading,
+// so the state survives changes to struct aircraft.
+//
+// The trace points start to trace_len - 1 follow as chunks of at most
+// TRACE_BLOCK_POINTS points.  Sealed blocks are written as they are in
+// memory and loaded back as blocks without being decoded, the tail is
+// encoded the same way.  start is a multiple of 4, a record with start > 0
+// only has the points since the last checkpoint.  The header records the
+// size of struct state / state_all: if they change, the traces are dropped
+// but the aircraft are kept.
+//
+// A removal record drops an aircraft that timed out since the previous
+// checkpoint, so replaying the log doesn't bring it back.
+
+#define STATE_VERSION 3
+
+#define STATE_SNAPSHOT_MAGIC2 0x7ba09e63757918eeULL
+#define STATE_LOG_MAGIC2 0x7ba09e63757919eeULL
+#define STATE_RECORD_MAGIC 0x7ba09e6375791aeeULL // full aircraft record
+#define STATE_RECORD_APPEND_MAGIC 0x7ba09e6375791beeULL // aircraft record with only the new trace points
+#define STATE_REMOVAL_MAGIC 0x7ba09e6375791ceeULL // aircraft removed from the table
+#define STATE_SEGMENT_MAGIC 0x7ba09e63757917eeULL
+
+// format 1: STATE_MAGIC | struct aircraftV1 | state[trace_len] | state_all[(trace_len + 3) / 4]
+// repeated, STATE_MAGIC - 1 marks the end
+#define STATE_MAGIC 0x7ba09e63757913eeULL
+
+#define STATE_FLUSH_SIZE (4 * 1024 * 1024)
+
+struct stateHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint16_t size_state; // sizeof(struct state)
+    uint16_t size_state_all; // sizeof(struct state_all)
+    uint64_t id;
+};
+
+struct stateSegment {
+    uint64_t magic;
+    uint32_t compressed; // bytes following this header
+    uint32_t len; // uncompressed bytes
+    uint32_t crc; // crc32 of the uncompressed bytes
+    uint32_t reserved;
+};
+
+#define STATE_CHUNK_BLOCK 1 // a sealed block
+#define STATE_CHUNK_COMPACTED 2 // the block was thinned out by traceCompact()
+
+struct stateChunk {
+    uint64_t first; // timestamp of the first point
+    uint64_t last; // timestamp of the last point
+    uint32_t size; // bytes of data following
+    uint16_t count; // number of points
+    uint16_t flags;
+};
+
+// tag, member: tags must never be reused or renumbered, new fields get new tags
+// the members of format 1 (state_v1.h), converted field by field
+#define STATE_FIELDS_V1(F) \
+    F(1, addr) F(2, addrtype) F(3, seen) F(4, seen_pos) F(5, messages) \
+    F(6, trace_full_write) F(7, signalNext) F(8, altitude_baro) F(9, alt_reliable) \
+    F(10, altitude_geom) F(11, geom_delta) F(12, trace_next_mw) F(13, trace_next_fw) \
+    F(14, trace_llat) F(15, trace_llon) F(19, signalLevel) F(20, rr_lat) F(21, rr_lon) F(22, rr_seen) \
+    F(23, category_updated) F(24, category) F(25, receiverCountMlat) F(26, addrtype_updated) \
+    F(27, tat) F(28, no_signal_count) F(29, receiverIdsNext) F(30, seenPosReliable) \
+    F(31, lastPosReceiverId) F(32, pos_nic) F(33, pos_rc) F(34, lat) F(35, lon) \
+    F(36, pos_reliable_odd) F(37, pos_reliable_even) F(38, gs_last_pos) F(39, wind_speed) \
+    F(40, wind_direction) F(41, wind_altitude) F(42, oat) F(43, wind_updated) \
+    F(44, oat_updated) F(45, baro_rate) F(46, geom_rate) F(47, ias) F(48, tas) \
+    F(49, squawk) F(50, nav_altitude_mcp) F(51, nav_altitude_fms) F(52, cpr_odd_lat) \
+    F(53, cpr_odd_lon) F(54, cpr_odd_nic) F(55, cpr_odd_rc) F(56, cpr_even_lat) \
+    F(57, cpr_even_lon) F(58, cpr_even_nic) F(59, cpr_even_rc) F(60, nav_qnh) \
+    F(61, nav_heading) F(62, gs) F(63, mach) F(64, track) F(65, track_rate) F(66, roll) \
+    F(67, mag_heading) F(68, true_heading) F(69, calc_track) F(70, next_reduce_forward_DF11) \
+    F(71, callsign) F(72, emergency) F(73, airground) F(74, nav_modes) F(75, cpr_odd_type) \
+    F(76, cpr_even_type) F(77, nav_altitude_src) F(78, modeA_hit) F(79, modeC_hit) \
+    F(80, adsb_version) F(81, adsr_version) F(82, tisb_version) F(83, adsb_hrd) \
+    F(84, adsb_tah) F(85, globe_index) F(86, sil_type) F(87, seenPosGlobal) \
+    F(88, latReliable) F(89, lonReliable) F(90, typeCode) F(91, registration) \
+    F(92, typeLong) F(93, dbFlags) F(94, receiverIds)
+
+#define STATE_FIELDS(F) STATE_FIELDS_V1(F) \
+    F(16, chk_seen) F(17, chk_trace_first) F(18, chk_trace_len) F(95, trace_last_leg) \
+    F(96, trace_compacted)
+
+// bit fields, stored as one byte each
+#define STATE_BITFIELDS(F) \
+    F(100, nic_a) F(101, nic_c) F(102, nic_baro) F(103, nac_p) F(104, nac_v) F(105, sil) \
+    F(106, gva) F(107, sda) F(108, alert) F(109, spi) F(110, pos_surface) F(111, last_cpr_type)
+
+// data_validity, stored as updated | next_reduce_forward | source | last_source | stale
+#define STATE_VALIDITY(F) \
+    F(128, callsign_valid) F(129, altitude_baro_valid) F(130, altitude_geom_valid) \
+    F(131, geom_delta_valid) F(132, gs_valid) F(133, ias_valid) F(134, tas_valid) \
+    F(135, mach_valid) F(136, track_valid) F(137, track_rate_valid) F(138, roll_valid) \
+    F(139, mag_heading_valid) F(140, true_heading_valid) F(141, baro_rate_valid) \
+    F(142, geom_rate_valid) F(143, nic_a_valid) F(144, nic_c_valid) F(145, nic_baro_valid) \
+    F(146, nac_p_valid) F(147, nac_v_valid) F(148, sil_valid) F(149, gva_valid) \
+    F(150, sda_valid) F(151, squawk_valid) F(152, emergency_valid) F(153, airground_valid) \
+    F(154, nav_qnh_valid) F(155, nav_altitude_mcp_valid) F(156, nav_altitude_fms_valid) \
+    F(157, nav_altitude_src_valid) F(158, nav_heading_valid) F(159, nav_modes_valid) \
+    F(160, cpr_odd_valid) F(161, cpr_even_valid) F(162, position_valid) F(163, alert_valid) \
+    F(164, spi_valid)
+
+struct stateBuffer {
+    unsigned char *buf;
+    size_t len;
+    size_t alloc;
+};
+
+// how the loaded aircraft end up in the aircraft table
+struct stateLoad {
+    uint64_t now;
+    int size_state; // size of a trace point in the file
+    int size_state_all;
+    int traces; // load the traces: trace points in the file match struct state / state_all
+    // returns the aircraft already loaded for addr or NULL
+    struct aircraft *(*get)(uint32_t addr);
+    // takes the aircraft, replacing the one with the same addr
+    void (*insert)(struct aircraft *a);
+    // drops the aircraft with this addr if there is one
+    void (*remove)(uint32_t addr);
+};
+
+// should the aircraft be saved at all
+int stateInclude(struct aircraft *a);
+// add the record for an aircraft to the buffer
+// incremental: skip unchanged aircraft, only write new trace points if possible
+// returns 1 if a record was added
+int stateRecord(struct stateBuffer *sb, struct aircraft *a, int incremental);
+// add a removal record, returns -1 on allocation failure
+int stateRemoval(struct stateBuffer *sb, uint32_t addr);
+void stateHeaderInit(struct stateHeader *header, uint64_t magic, uint64_t id);
+// compress the buffer into one segment and write it, returns bytes written or -1
+int64_t stateWriteSegment(int fd, struct stateBuffer *sb, const char *filename);
+
+// pread() of exactly count bytes, returns -1 on failure / end of file
+int stateReadAt(int fd, void *buf, size_t count, off_t off);
+// load the segments starting at off one by one
+// returns the offset after the last complete segment
+off_t stateLoadSegments(int fd, off_t off, struct stateLoad *ld, const char *filename);
+
+// format 1: the records of a blob_XX file, returns 0 if it was complete
+int stateLoadV1Blob(char *p, char *end, struct stateLoad *ld);
+// format 1: one aircraft without the magic (the per aircraft files)
+struct aircraft *stateLoadV1(char **p, char *end, struct stateLoad *ld);
+
+#endif
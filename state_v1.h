@@ -0,0 +1,223 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// state_v1.h: struct aircraft as stored in state format 1
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef STATE_V1_H
+#define STATE_V1_H
+
+// State format 1 (blob_XX.gz / blob_XX and the per aircraft files in
+// state_dir/XX) is a raw copy of struct aircraft followed by the trace.
+// This is the struct as those files were written, frozen: it's only used to
+// convert them (state_store.c), never change it.  The member types
+// (data_validity, the enums) and struct state / state_all still have the
+// same layout.
+
+struct aircraftV1
+{
+  struct aircraftV1 *next; // Next aircraft in our linked list
+  uint32_t addr; // ICAO address
+  addrtype_t addrtype; // highest priority address type seen for this aircraft
+  uint64_t seen; // Time (millis) at which the last packet was received
+  uint64_t seen_pos; // Time (millis) at which the last position was received
+
+  uint32_t size_struct_aircraft; // size of this struct
+  uint32_t messages; // Number of Mode S messages received
+  int trace_len; // current number of points in the trace
+  int trace_write; // signal for writing the trace
+  int trace_full_write; // signal for writing the complete trace
+  int trace_alloc; // current number of allocated points
+  int destroy; // aircraft is being deleted
+  int signalNext; // next index of signalLevel to use
+
+  // ----
+
+  struct state *trace; // array of positions representing the aircrafts trace/trail
+  struct state_all *trace_all;
+  int altitude_baro; // Altitude (Baro)
+  int alt_reliable;
+  int altitude_geom; // Altitude (Geometric)
+  int geom_delta; // Difference between Geometric and Baro altitudes
+
+  uint64_t trace_next_mw; // timestamp for next full trace write to /run (tmpfs)
+  uint64_t trace_next_fw; // timestamp for next full trace write to history_dir (disk)
+  double trace_llat; // last saved lat
+  double trace_llon; // last saved lon
+
+  // ----
+
+  double signalLevel[8]; // Last 8 Signal Amplitudes
+
+  // ----
+
+  float rr_lat; // very rough receiver latitude
+  float rr_lon; // very rough receiver longitude
+  uint64_t rr_seen; // when we noted this rough position
+  uint64_t category_updated;
+  unsigned category; // Aircraft category A0 - D7 encoded as a single hex byte. 00 = unset
+  uint16_t receiverCountMlat;
+  uint16_t paddingabc;
+
+
+  uint64_t padding23;
+  uint64_t addrtype_updated;
+  float tat;
+  uint16_t no_signal_count; // consecutive messages without signal strength specified
+  uint16_t receiverIdsNext;
+  uint64_t seenPosReliable; // last time we saw a reliable position
+  uint64_t lastPosReceiverId;
+
+  // ---- the following section has 9 instead of 8 times 8 bytes. but that's not critical as long as the 8 byte alignment is ok
+
+  unsigned pos_nic; // NIC of last computed position
+  unsigned pos_rc; // Rc of last computed position
+  double lat; // Coordinates obtained from CPR encoded data
+  double lon; // Coordinates obtained from CPR encoded data
+  int pos_reliable_odd; // Number of good global CPRs, indicates position reliability
+  int pos_reliable_even;
+  int padding1234; // unused
+  float gs_last_pos; // Save a groundspeed associated with the last position
+
+  float wind_speed;
+  float wind_direction;
+  int wind_altitude;
+  float oat;
+  uint64_t wind_updated;
+  uint64_t oat_updated;
+
+  // ----
+
+  int baro_rate; // Vertical rate (barometric)
+  int geom_rate; // Vertical rate (geometric)
+  unsigned ias;
+  unsigned tas;
+  unsigned squawk; // Squawk
+  unsigned padding2344;
+  unsigned nav_altitude_mcp; // FCU/MCP selected altitude
+  unsigned nav_altitude_fms; // FMS selected altitude
+  unsigned cpr_odd_lat;
+  unsigned cpr_odd_lon;
+  unsigned cpr_odd_nic;
+  unsigned cpr_odd_rc;
+  unsigned cpr_even_lat;
+  unsigned cpr_even_lon;
+  unsigned cpr_even_nic;
+  unsigned cpr_even_rc;
+
+  // ----
+
+  float nav_qnh; // Altimeter setting (QNH/QFE), millibars
+  float nav_heading; // target heading, degrees (0-359)
+  float gs;
+  float mach;
+  float track; // Ground track
+  float track_rate; // Rate of change of ground track, degrees/second
+  float roll; // Roll angle, degrees right
+  float mag_heading; // Magnetic heading
+
+  float true_heading; // True heading
+  float calc_track; // Calculated Ground track
+  uint64_t next_reduce_forward_DF11;
+  char callsign[16]; // Flight number
+
+  // ----
+
+  emergency_t emergency; // Emergency/priority status
+  airground_t airground; // air/ground status
+  nav_modes_t nav_modes; // enabled modes (autopilot, vnav, etc)
+  cpr_type_t cpr_odd_type;
+  cpr_type_t cpr_even_type;
+  nav_altitude_source_t nav_altitude_src;  // source of altitude used by automation
+  int modeA_hit; // did our squawk match a possible mode A reply in the last check period?
+  int modeC_hit; // did our altitude match a possible mode C reply in the last check period?
+
+  // data extracted from opstatus etc
+  int adsb_version; // ADS-B version (from ADS-B operational status); -1 means no ADS-B messages seen
+  int adsr_version; // As above, for ADS-R messages
+  int tisb_version; // As above, for TIS-B messages
+  heading_type_t adsb_hrd; // Heading Reference Direction setting (from ADS-B operational status)
+  heading_type_t adsb_tah; // Track Angle / Heading setting (from ADS-B operational status)
+  int globe_index; // custom index of the planes area on the globe
+  sil_type_t sil_type; // SIL supplement from TSS or opstatus
+
+  unsigned nic_a : 1; // NIC supplement A from opstatus
+  unsigned nic_c : 1; // NIC supplement C from opstatus
+  unsigned nic_baro : 1; // NIC baro supplement from TSS or opstatus
+  unsigned nac_p : 4; // NACp from TSS or opstatus
+  unsigned nac_v : 3; // NACv from airborne velocity or opstatus
+  unsigned sil : 2; // SIL from TSS or opstatus
+  unsigned gva : 2; // GVA from opstatus
+  unsigned sda : 2; // SDA from opstatus
+  unsigned alert : 1; // FS Flight status alert bit
+  unsigned spi : 1; // FS Flight status SPI (Special Position Identification) bit
+  unsigned pos_surface : 1; // (a->airground == AG_GROUND) associated with current position
+  unsigned last_cpr_type : 2; // mm->cpr_type associated with current position
+  // 20 bit ??
+  unsigned padding_b : 11;
+  // 32 bit !!
+
+  // ----
+
+  data_validity callsign_valid;
+  data_validity altitude_baro_valid;
+  data_validity altitude_geom_valid;
+  data_validity geom_delta_valid;
+  data_validity gs_valid;
+  data_validity ias_valid;
+  data_validity tas_valid;
+  data_validity mach_valid;
+  data_validity track_valid;
+  data_validity track_rate_valid;
+  data_validity roll_valid;
+  data_validity mag_heading_valid;
+  data_validity true_heading_valid;
+  data_validity baro_rate_valid;
+  data_validity geom_rate_valid;
+  data_validity nic_a_valid;
+  data_validity nic_c_valid;
+  data_validity nic_baro_valid;
+  data_validity nac_p_valid;
+  data_validity nac_v_valid;
+  data_validity sil_valid;
+  data_validity gva_valid;
+  data_validity sda_valid;
+  data_validity squawk_valid;
+  data_validity emergency_valid;
+  data_validity airground_valid;
+  data_validity nav_qnh_valid;
+  data_validity nav_altitude_mcp_valid;
+  data_validity nav_altitude_fms_valid;
+  data_validity nav_altitude_src_valid;
+  data_validity nav_heading_valid;
+  data_validity nav_modes_valid;
+  data_validity cpr_odd_valid; // Last seen even CPR message
+  data_validity cpr_even_valid; // Last seen odd CPR message
+  data_validity position_valid;
+  data_validity alert_valid;
+  data_validity spi_valid;
+
+  uint64_t seenPosGlobal; // seen global CPR or other hopefully reliable position
+  double latReliable; // last reliable position based on json_reliable threshold
+  double lonReliable; // last reliable position based on json_reliable threshold
+  char typeCode[4];
+  char registration[12];
+  char typeLong[63];
+  uint8_t dbFlags;
+  uint16_t receiverIds[12];
+
+  struct modesMessage *first_message; // A copy of the first message we received for this aircraft.
+};
+
+#endif
@@ -0,0 +1,454 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// statetests.c - round trip tests for the state checkpoints
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+#include "state_v1.h"
+
+#define POINTS 3001
+#define MORE_POINTS 500
+#define NOW 1600000000000ULL
+
+// deterministic pseudo random numbers so failures are reproducible
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+static uint32_t rnd(uint32_t n) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t) ((rng_state * 0x2545F4914F6CDD1DULL) >> 32) % n;
+}
+
+static void fill_bytes(void *p, size_t len) {
+    for (size_t k = 0; k < len; k++)
+        ((unsigned char *) p)[k] = rnd(256);
+}
+
+// a straight flight with a bit of noise, the first part compacts well
+static void fill_trace(struct state *trace, struct state_all *trace_all, int len) {
+    memset(trace, 0, len * sizeof(struct state));
+    memset(trace_all, 0, (len + 3) / 4 * sizeof(struct state_all));
+    uint64_t ts = NOW - 20 * HOURS;
+    for (int i = 0; i < len; i++) {
+        struct state *s = &trace[i];
+        ts += 1000 + rnd(8000);
+        s->timestamp = ts;
+        s->lat = 50000000 + i * 300 + rnd(20);
+        s->lon = 8000000 + i * 500 + rnd(20);
+        s->altitude = 1400;
+        s->gs = 4500 + rnd(3);
+        s->track = 900;
+        s->flags.altitude_valid = 1;
+        s->flags.gs_valid = 1;
+        s->flags.track_valid = 1;
+        if (i % 4 == 0)
+            fill_bytes(&trace_all[i / 4], sizeof(struct state_all));
+    }
+}
+
+// all saved fields random, the ones loading sanitizes plausible
+#define RANDOM_FIELD(tag, member) fill_bytes(&a->member, sizeof(a->member));
+#define RANDOM_BITFIELD(tag, member) a->member = rnd(2);
+#define RANDOM_VALIDITY(tag, member) { \
+    fill_bytes(&a->member.updated, 8); \
+    fill_bytes(&a->member.next_reduce_forward, 8); \
+    a->member.source = rnd(10); \
+    a->member.last_source = rnd(10); \
+    a->member.stale = rnd(2); }
+
+static void fill_aircraft(struct aircraft *a) {
+    STATE_FIELDS(RANDOM_FIELD)
+    STATE_BITFIELDS(RANDOM_BITFIELD)
+    STATE_VALIDITY(RANDOM_VALIDITY)
+    a->seen = NOW - 1000;
+    a->seen_pos = NOW - 2000;
+    a->globe_index = 1000;
+    a->messages = 1000;
+}
+
+static void fill_aircraft_v1(struct aircraftV1 *a) {
+    STATE_FIELDS_V1(RANDOM_FIELD)
+    STATE_BITFIELDS(RANDOM_BITFIELD)
+    STATE_VALIDITY(RANDOM_VALIDITY)
+    a->seen = NOW - 1000;
+    a->seen_pos = NOW - 2000;
+    a->globe_index = 1000;
+}
+
+// the aircraft table of the loader
+#define TABLE_SIZE 16
+static struct aircraft *table[TABLE_SIZE];
+
+static struct aircraft *table_get(uint32_t addr) {
+    for (int k = 0; k < TABLE_SIZE; k++) {
+        if (table[k] && table[k]->addr == addr)
+            return table[k];
+    }
+    return NULL;
+}
+
+static void free_aircraft(struct aircraft *a) {
+    traceFree(a);
+    free(a);
+}
+
+static void table_insert(struct aircraft *a) {
+    for (int k = 0; k < TABLE_SIZE; k++) {
+        if (table[k] && table[k]->addr == a->addr) {
+            free_aircraft(table[k]);
+            table[k] = a;
+            return;
+        }
+    }
+    for (int k = 0; k < TABLE_SIZE; k++) {
+        if (!table[k]) {
+            table[k] = a;
+            return;
+        }
+    }
+    free_aircraft(a);
+}
+
+static void table_remove(uint32_t addr) {
+    for (int k = 0; k < TABLE_SIZE; k++) {
+        if (table[k] && table[k]->addr == addr) {
+            free_aircraft(table[k]);
+            table[k] = NULL;
+        }
+    }
+}
+
+static void table_clear() {
+    for (int k = 0; k < TABLE_SIZE; k++) {
+        if (table[k])
+            free_aircraft(table[k]);
+        table[k] = NULL;
+    }
+}
+
+static void load_init(struct stateLoad *ld) {
+    memset(ld, 0, sizeof(*ld));
+    ld->now = NOW;
+    ld->size_state = sizeof(struct state);
+    ld->size_state_all = sizeof(struct state_all);
+    ld->traces = 1;
+    ld->get = table_get;
+    ld->insert = table_insert;
+    ld->remove = table_remove;
+}
+
+// the saved fields of a and b are equal, b being a struct aircraft or aircraftV1
+#define CHECK_FIELD(tag, member) \
+    if (memcmp(&a->member, &b->member, sizeof(a->member))) { \
+        fprintf(stderr, "%s: FAIL: %s differs\n", name, #member); \
+        ok = 0; \
+    }
+#define CHECK_BITFIELD(tag, member) \
+    if (a->member != b->member) { \
+        fprintf(stderr, "%s: FAIL: %s differs\n", name, #member); \
+        ok = 0; \
+    }
+#define CHECK_VALIDITY(tag, member) \
+    if (a->member.updated != b->member.updated \
+            || a->member.next_reduce_forward != b->member.next_reduce_forward \
+            || a->member.source != b->member.source \
+            || a->member.last_source != b->member.last_source \
+            || a->member.stale != b->member.stale) { \
+        fprintf(stderr, "%s: FAIL: %s differs\n", name, #member); \
+        ok = 0; \
+    }
+
+static int compare_fields(const char *name, struct aircraft *a, struct aircraft *b) {
+    int ok = 1;
+    STATE_FIELDS(CHECK_FIELD)
+    STATE_BITFIELDS(CHECK_BITFIELD)
+    STATE_VALIDITY(CHECK_VALIDITY)
+    return ok;
+}
+
+static int compare_fields_v1(const char *name, struct aircraft *a, struct aircraftV1 *b) {
+    int ok = 1;
+    STATE_FIELDS_V1(CHECK_FIELD)
+    STATE_BITFIELDS(CHECK_BITFIELD)
+    STATE_VALIDITY(CHECK_VALIDITY)
+    return ok;
+}
+
+static int compare_trace(const char *name, struct aircraft *a, struct state *trace, struct state_all *trace_all, int len) {
+    if (traceLen(a) != len) {
+        fprintf(stderr, "%s: FAIL: %d trace points instead of %d\n", name, traceLen(a), len);
+        return 0;
+    }
+    struct traceView tv;
+    if (traceViewGet(a, &tv))
+        return 0;
+    int ok = 1;
+    for (int i = 0; i < len && ok; i++) {
+        if (memcmp(&tv.trace[i], &trace[i], sizeof(struct state))
+                || (i % 4 == 0 && memcmp(&tv.trace_all[i / 4], &trace_all[i / 4], sizeof(struct state_all)))) {
+            fprintf(stderr, "%s: FAIL: trace point %d differs\n", name, i);
+            ok = 0;
+        }
+    }
+    traceViewFree(&tv);
+    return ok;
+}
+
+static int compacted_blocks(struct aircraft *a) {
+    int n = 0;
+    for (struct traceBlock *block = a->trace_blocks; block; block = block->next)
+        n += block->compacted;
+    return n;
+}
+
+// a snapshot and an appended checkpoint written to a file and loaded again
+static int testRoundTrip() {
+    const char *name = "testRoundTrip";
+    struct state *trace = malloc((POINTS + MORE_POINTS) * sizeof(struct state));
+    struct state_all *trace_all = malloc((POINTS + MORE_POINTS + 3) / 4 * sizeof(struct state_all));
+    fill_trace(trace, trace_all, POINTS + MORE_POINTS);
+
+    struct aircraft *a = calloc(1, sizeof(struct aircraft));
+    fill_aircraft(a);
+    traceCopyIn(a, 0, trace, trace_all, POINTS);
+    a->trace_len = POINTS;
+    traceSeal(a);
+    // thin out the oldest blocks, those are saved with their compacted flag
+    // and trace_compacted
+    a->trace_compacted = 0;
+    double max_error = 0;
+    int budget = POINTS;
+    int removed = traceCompact(a, trace[1000].timestamp, NULL, 0, &budget, &max_error);
+    int compacted = compacted_blocks(a);
+
+    FILE *f = tmpfile();
+    int fd = fileno(f);
+    struct stateHeader header;
+    stateHeaderInit(&header, STATE_SNAPSHOT_MAGIC2, 1);
+    int ok = (write(fd, &header, sizeof(header)) == sizeof(header));
+
+    struct stateBuffer sb = { 0 };
+    ok &= stateRecord(&sb, a, 0);
+    ok &= (stateWriteSegment(fd, &sb, name) > 0);
+
+    // new points and changed fields since the snapshot: an append record
+    int tail = a->trace_len;
+    traceCopyIn(a, tail, trace + POINTS, trace_all + (POINTS - POINTS % 4) / 4, MORE_POINTS);
+    a->trace_len = tail + MORE_POINTS;
+    a->seen += 500;
+    a->altitude_baro = 12345;
+    ok &= stateRecord(&sb, a, 1);
+    uint64_t magic;
+    memcpy(&magic, sb.buf, sizeof(magic));
+    if (magic != STATE_RECORD_APPEND_MAGIC) {
+        fprintf(stderr, "%s: FAIL: checkpoint isn't an append record\n", name);
+        ok = 0;
+    }
+    ok &= (stateWriteSegment(fd, &sb, name) > 0);
+    // nothing changed, nothing written
+    ok &= !stateRecord(&sb, a, 1);
+    arenaFree(sb.buf);
+
+    struct stateLoad ld;
+    load_init(&ld);
+    off_t end = lseek(fd, 0, SEEK_END);
+    if (stateLoadSegments(fd, sizeof(header), &ld, name) != end) {
+        fprintf(stderr, "%s: FAIL: not all segments loaded\n", name);
+        ok = 0;
+    }
+
+    struct aircraft *b = table_get(a->addr);
+    if (!b) {
+        fprintf(stderr, "%s: FAIL: aircraft not loaded\n", name);
+        ok = 0;
+    } else {
+        // the compacted trace as saved
+        struct traceView tv;
+        traceViewGet(a, &tv);
+        ok &= compare_fields(name, b, a);
+        ok &= compare_trace(name, b, tv.trace, tv.trace_all, POINTS + MORE_POINTS - removed);
+        traceViewFree(&tv);
+        if (removed == 0 || compacted_blocks(b) != compacted) {
+            fprintf(stderr, "%s: FAIL: %d compacted blocks loaded, %d saved (%d points removed)\n",
+                    name, compacted_blocks(b), compacted, removed);
+            ok = 0;
+        }
+    }
+
+    table_clear();
+    fclose(f);
+    free_aircraft(a);
+    free(trace);
+    free(trace_all);
+    fprintf(stderr, "%s:%*s%s\n", name, (int) (19 - strlen(name)), "", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// a log cut short within its last segment: the complete segments are
+// replayed, including the removal of an aircraft, the rest is ignored
+static int testTruncatedLog() {
+    const char *name = "testTruncatedLog";
+    int len = POINTS + 2 * MORE_POINTS;
+    struct state *trace = malloc(len * sizeof(struct state));
+    struct state_all *trace_all = malloc((len + 3) / 4 * sizeof(struct state_all));
+    fill_trace(trace, trace_all, len);
+
+    struct aircraft *a = calloc(1, sizeof(struct aircraft));
+    struct aircraft *b = calloc(1, sizeof(struct aircraft));
+    fill_aircraft(a);
+    fill_aircraft(b);
+    b->addr = a->addr + 1;
+    traceCopyIn(a, 0, trace, trace_all, POINTS);
+    a->trace_len = POINTS;
+    traceCopyIn(b, 0, trace, trace_all, 100);
+    b->trace_len = 100;
+
+    FILE *snapshot = tmpfile();
+    FILE *log = tmpfile();
+    struct stateHeader header;
+    stateHeaderInit(&header, STATE_SNAPSHOT_MAGIC2, 1);
+    int ok = (write(fileno(snapshot), &header, sizeof(header)) == sizeof(header));
+    ok &= (write(fileno(log), &header, sizeof(header)) == sizeof(header));
+
+    struct stateBuffer sb = { 0 };
+    ok &= stateRecord(&sb, a, 0) & stateRecord(&sb, b, 0);
+    ok &= (stateWriteSegment(fileno(snapshot), &sb, name) > 0);
+
+    // first checkpoint: new points for a
+    int tail = a->trace_len;
+    traceCopyIn(a, tail, trace + POINTS, trace_all + (POINTS - POINTS % 4) / 4, MORE_POINTS);
+    a->trace_len = tail + MORE_POINTS;
+    a->seen += 500;
+    ok &= stateRecord(&sb, a, 1);
+    ok &= (stateWriteSegment(fileno(log), &sb, name) > 0);
+
+    // second checkpoint: b timed out
+    ok &= (stateRemoval(&sb, b->addr) == 0);
+    ok &= (stateWriteSegment(fileno(log), &sb, name) > 0);
+    off_t complete = lseek(fileno(log), 0, SEEK_END);
+
+    // the expected result, the third checkpoint is lost
+    struct aircraft expected = *a;
+    struct traceView tv;
+    traceViewGet(a, &tv);
+
+    int from = POINTS + MORE_POINTS;
+    tail = a->trace_len;
+    traceCopyIn(a, tail, trace + from, trace_all + (from - from % 4) / 4, MORE_POINTS);
+    a->trace_len = tail + MORE_POINTS;
+    a->seen += 500;
+    ok &= stateRecord(&sb, a, 1);
+    off_t size = complete + stateWriteSegment(fileno(log), &sb, name);
+    arenaFree(sb.buf);
+    // crash in the middle of writing the last segment
+    ok &= (ftruncate(fileno(log), complete + (size - complete) / 2) == 0);
+
+    struct stateLoad ld;
+    load_init(&ld);
+    ok &= (stateLoadSegments(fileno(snapshot), sizeof(header), &ld, name) == lseek(fileno(snapshot), 0, SEEK_END));
+    if (stateLoadSegments(fileno(log), sizeof(header), &ld, name) != complete) {
+        fprintf(stderr, "%s: FAIL: the incomplete segment wasn't detected\n", name);
+        ok = 0;
+    }
+
+    struct aircraft *c = table_get(a->addr);
+    if (!c) {
+        fprintf(stderr, "%s: FAIL: aircraft not loaded\n", name);
+        ok = 0;
+    } else {
+        ok &= compare_fields(name, c, &expected);
+        ok &= compare_trace(name, c, tv.trace, tv.trace_all, tv.len);
+    }
+    if (table_get(b->addr)) {
+        fprintf(stderr, "%s: FAIL: removed aircraft came back\n", name);
+        ok = 0;
+    }
+
+    traceViewFree(&tv);
+    table_clear();
+    fclose(snapshot);
+    fclose(log);
+    free_aircraft(a);
+    free_aircraft(b);
+    free(trace);
+    free(trace_all);
+    fprintf(stderr, "%s:%*s%s\n", name, (int) (19 - strlen(name)), "", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// a blob_XX file of format 1 as the previous versions wrote it
+static int testFormat1() {
+    const char *name = "testFormat1";
+    int len = 1001;
+    size_t size_state = len * sizeof(struct state);
+    size_t size_all = (len + 3) / 4 * sizeof(struct state_all);
+    struct state *trace = malloc(size_state);
+    struct state_all *trace_all = malloc(size_all);
+    fill_trace(trace, trace_all, len);
+
+    struct aircraftV1 *v1 = calloc(1, sizeof(struct aircraftV1));
+    fill_aircraft_v1(v1);
+    v1->size_struct_aircraft = sizeof(struct aircraftV1);
+    v1->trace_len = len;
+    v1->trace_alloc = len + 100;
+
+    uint64_t magic = STATE_MAGIC;
+    uint64_t end_magic = STATE_MAGIC - 1;
+    size_t bytes = sizeof(magic) + sizeof(struct aircraftV1) + size_state + size_all + sizeof(end_magic);
+    char *buf = malloc(bytes);
+    char *p = buf;
+    memcpy(p, &magic, sizeof(magic));
+    p += sizeof(magic);
+    memcpy(p, v1, sizeof(struct aircraftV1));
+    p += sizeof(struct aircraftV1);
+    memcpy(p, trace, size_state);
+    p += size_state;
+    memcpy(p, trace_all, size_all);
+    p += size_all;
+    memcpy(p, &end_magic, sizeof(end_magic));
+
+    struct stateLoad ld;
+    load_init(&ld);
+    int ok = (stateLoadV1Blob(buf, buf + bytes, &ld) == 0);
+
+    struct aircraft *a = table_get(v1->addr);
+    if (!a) {
+        fprintf(stderr, "%s: FAIL: aircraft not loaded\n", name);
+        ok = 0;
+    } else {
+        ok &= compare_fields_v1(name, a, v1);
+        ok &= compare_trace(name, a, trace, trace_all, len);
+    }
+
+    table_clear();
+    free(buf);
+    free(v1);
+    free(trace);
+    free(trace_all);
+    fprintf(stderr, "%s:%*s%s\n", name, (int) (19 - strlen(name)), "", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    MODES_NOTUSED(argc);
+    MODES_NOTUSED(argv);
+
+    int ok = 1;
+    ok &= testRoundTrip();
+    ok &= testTruncatedLog();
+    ok &= testFormat1();
+    return ok ? 0 : 1;
+}
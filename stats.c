@@ -155,6 +155,23 @@ void display_stats(struct stats *st) {
             st->cpr_filtered);
 
     printf("%u non-ES altitude messages from ES-equipped aircraft ignored\n", st->suppressed_altitude_messages);
+    printf("%u ICAO filter lookups\n"
+            "  %u matched a known address\n"
+            "  %u did not match\n"
+            "    %u rejected by the bloom filter\n",
+            st->icao_filter_hits + st->icao_filter_misses,
+            st->icao_filter_hits,
+            st->icao_filter_misses,
+            st->icao_filter_bloom_rejects);
+    for (j = 0; j < ICAO_FILTER_PROBE_BUCKETS; ++j)
+        printf("  %u lookups probing %d%s slot groups\n", st->icao_filter_probes[j], j + 1,
+                (j == ICAO_FILTER_PROBE_BUCKETS - 1) ? " or more" : "");
+    printf("%"PRIu64" bytes of state written\n"
+            "  %u checkpoints appended\n"
+            "  %u snapshots written\n",
+            st->state_bytes_written,
+            st->state_checkpoints,
+            st->state_compactions);
     printf("%u unique aircraft tracks\n", st->unique_aircraft);
     printf("%u aircraft tracks where only one message was seen\n", st->single_message_aircraft);
 
@@ -279,12 +296,21 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
     add_timespecs(&st1->reader_cpu, &st2->reader_cpu, &target->reader_cpu);
     add_timespecs(&st1->background_cpu, &st2->background_cpu, &target->background_cpu);
     add_timespecs(&st1->aircraft_json_cpu, &st2->aircraft_json_cpu, &target->aircraft_json_cpu);
-    add_timespecs(&st1->globe_json_cpu, &st2->globe_json_cpu, &target->globe_json_cpu);
+    target->aircraft_json_objects = st1->aircraft_json_objects + st2->aircraft_json_objects;
+    target->aircraft_json_serialized = st1->aircraft_json_serialized + st2->aircraft_json_serialized;
+    for (i = 0; i < GLOBE_THREADS; i++) {
+        add_timespecs(&st1->globe_json_cpu[i], &st2->globe_json_cpu[i], &target->globe_json_cpu[i]);
+    }
     add_timespecs(&st1->heatmap_and_state_cpu, &st2->heatmap_and_state_cpu, &target->heatmap_and_state_cpu);
     add_timespecs(&st1->remove_stale_cpu, &st2->remove_stale_cpu, &target->remove_stale_cpu);
     for (i = 0; i < TRACE_THREADS; i ++) {
         add_timespecs(&st1->trace_json_cpu[i], &st2->trace_json_cpu[i], &target->trace_json_cpu[i]);
+        target->trace_json_files[i] = st1->trace_json_files[i] + st2->trace_json_files[i];
     }
+    target->trace_bundle_files = st1->trace_bundle_files + st2->trace_bundle_files;
+    add_timespecs(&st1->trace_bundle_cpu, &st2->trace_bundle_cpu, &target->trace_bundle_cpu);
+    target->trace_compact_points = st1->trace_compact_points + st2->trace_compact_points;
+    target->trace_compact_max_error = fmaxf(st1->trace_compact_max_error, st2->trace_compact_max_error);
     for (i = 0; i < NUM_TYPES; i ++) {
         target->pos_by_type[i] = st1->pos_by_type[i] + st2->pos_by_type[i];
     }
@@ -341,6 +367,18 @@ void add_stats(const struct stats *st1, const struct stats *st2, struct stats *t
 
     target->suppressed_altitude_messages = st1->suppressed_altitude_messages + st2->suppressed_altitude_messages;
 
+    // icao filter
+    target->icao_filter_hits = st1->icao_filter_hits + st2->icao_filter_hits;
+    target->icao_filter_misses = st1->icao_filter_misses + st2->icao_filter_misses;
+    target->icao_filter_bloom_rejects = st1->icao_filter_bloom_rejects + st2->icao_filter_bloom_rejects;
+    for (i = 0; i < ICAO_FILTER_PROBE_BUCKETS; ++i)
+        target->icao_filter_probes[i] = st1->icao_filter_probes[i] + st2->icao_filter_probes[i];
+
+    // state checkpoints
+    target->state_bytes_written = st1->state_bytes_written + st2->state_bytes_written;
+    target->state_checkpoints = st1->state_checkpoints + st2->state_checkpoints;
+    target->state_compactions = st1->state_compactions + st2->state_compactions;
+
     // aircraft
     target->unique_aircraft = st1->unique_aircraft + st2->unique_aircraft;
     target->single_message_aircraft = st1->single_message_aircraft + st2->single_message_aircraft;
@@ -471,6 +509,27 @@ static char * appendStatsJson(char *p, char *end, struct stats *st, const char *
     }
 
 
+    p = safe_snprintf(p, end,
+            ",\"icao_filter\":{\"hits\":%u"
+            ",\"misses\":%u"
+            ",\"bloom_rejects\":%u",
+            st->icao_filter_hits,
+            st->icao_filter_misses,
+            st->icao_filter_bloom_rejects);
+    for (i = 0; i < ICAO_FILTER_PROBE_BUCKETS; ++i) {
+        if (i == 0) p = safe_snprintf(p, end, ",\"probes\":[%u", st->icao_filter_probes[i]);
+        else p = safe_snprintf(p, end, ",%u", st->icao_filter_probes[i]);
+    }
+    p = safe_snprintf(p, end, "]}");
+
+    p = safe_snprintf(p, end,
+            ",\"state\":{\"bytes_written\":%"PRIu64
+            ",\"checkpoints\":%u"
+            ",\"snapshots\":%u}",
+            st->state_bytes_written,
+            st->state_checkpoints,
+            st->state_compactions);
+
     p = safe_snprintf(p, end, ",\"position_count_by_type\": {");
     for (int i = 0; i < NUM_TYPES; i++) {
         const char *key = addrtype_enum_string(i);
@@ -498,6 +557,15 @@ static char * appendStatsJson(char *p, char *end, struct stats *st, const char *
         p = safe_snprintf(p, end, "]}");
     }
 
+    // cpu of each thread writing globe tiles, their sum is cpu.globe_json
+    uint64_t globe_json_cpu_millis = 0;
+    for (i = 0; i < Modes.json_globe_threads; i++) {
+        uint64_t millis = (uint64_t) st->globe_json_cpu[i].tv_sec * 1000UL + st->globe_json_cpu[i].tv_nsec / 1000000UL;
+        p = safe_snprintf(p, end, "%s%llu", i ? "," : ",\"globe_json_cpu\":[", (unsigned long long) millis);
+        globe_json_cpu_millis += millis;
+    }
+    p = safe_snprintf(p, end, "]");
+
     {
         //uint64_t demod_cpu_millis = (uint64_t) st->demod_cpu.tv_sec * 1000UL + st->demod_cpu.tv_nsec / 1000000UL;
 #define CPU_MILLIS(x) uint64_t x##_cpu_millis = (uint64_t) st->x##_cpu.tv_sec * 1000UL + st->x##_cpu.tv_nsec / 1000000UL
@@ -505,13 +573,14 @@ static char * appendStatsJson(char *p, char *end, struct stats *st, const char *
         CPU_MILLIS(reader);
         CPU_MILLIS(background);
         CPU_MILLIS(aircraft_json);
-        CPU_MILLIS(globe_json);
         CPU_MILLIS(heatmap_and_state);
         CPU_MILLIS(remove_stale);
 #undef CPU_MILLIS
-        uint64_t trace_json_cpu_millis_sum = 0;
+        uint64_t trace_json_cpu_millis_sum = (uint64_t) st->trace_bundle_cpu.tv_sec * 1000UL + st->trace_bundle_cpu.tv_nsec / 1000000UL;
+        uint32_t trace_files = st->trace_bundle_files;
         for (i = 0; i < TRACE_THREADS; i ++) {
             trace_json_cpu_millis_sum += (uint64_t) st->trace_json_cpu[i].tv_sec * 1000UL + st->trace_json_cpu[i].tv_nsec / 1000000UL;
+            trace_files += st->trace_json_files[i];
         }
 
         p = safe_snprintf(p, end,
@@ -536,6 +605,9 @@ static char * appendStatsJson(char *p, char *end, struct stats *st, const char *
                 ",\"trace_json\":%llu"
                 ",\"heatmap_and_state\":%llu"
                 ",\"remove_stale\":%llu}"
+                ",\"aircraft_json\":{\"objects\":%u,\"serialized\":%u}"
+                ",\"trace_files\":%u"
+                ",\"trace_compact\":{\"points\":%u,\"max_error\":%.1f}"
                 ",\"tracks\":{\"all\":%u"
                 ",\"single_message\":%u}"
                 ",\"messages\":%u"
@@ -564,6 +636,11 @@ static char * appendStatsJson(char *p, char *end, struct stats *st, const char *
             (unsigned long long) trace_json_cpu_millis_sum,
             (unsigned long long) heatmap_and_state_cpu_millis,
             (unsigned long long) remove_stale_cpu_millis,
+            st->aircraft_json_objects,
+            st->aircraft_json_serialized,
+            trace_files,
+            st->trace_compact_points,
+            st->trace_compact_max_error,
             st->unique_aircraft,
             st->single_message_aircraft,
             st->messages_total,
@@ -575,7 +652,7 @@ static char * appendStatsJson(char *p, char *end, struct stats *st, const char *
 
 struct char_buffer generateStatsJson() {
     struct char_buffer cb;
-    char *buf = (char *) malloc(64 * 1024), *p = buf, *end = buf + 64 * 1024;
+    char *buf = (char *) arenaMalloc(64 * 1024), *p = buf, *end = buf + 64 * 1024;
 
     p = safe_snprintf(p, end,
             "{ \"now\" : %.1f",
@@ -608,14 +685,16 @@ struct char_buffer generateStatsJson() {
 
 struct char_buffer generatePromFile() {
     struct char_buffer cb;
-    char *buf = (char *) malloc(64 * 1024), *p = buf, *end = buf + 64 * 1024;
+    char *buf = (char *) arenaMalloc(64 * 1024), *p = buf, *end = buf + 64 * 1024;
     uint64_t now = mstime();
 
     struct stats *st = &Modes.stats_1min;
 
-    unsigned long long trace_json_cpu_millis_sum = 0;
+    unsigned long long trace_json_cpu_millis_sum = (uint64_t) st->trace_bundle_cpu.tv_sec * 1000UL + st->trace_bundle_cpu.tv_nsec / 1000000UL;
+    uint32_t trace_files = st->trace_bundle_files;
     for (int i = 0; i < TRACE_THREADS; i ++) {
         trace_json_cpu_millis_sum += (uint64_t) st->trace_json_cpu[i].tv_sec * 1000UL + st->trace_json_cpu[i].tv_nsec / 1000000UL;
+        trace_files += st->trace_json_files[i];
     }
 
     p = safe_snprintf(p, end, "readsb_aircraft_adsb_version_zero %u\n", Modes.readsb_aircraft_adsb_version_0);
@@ -663,11 +742,22 @@ struct char_buffer generatePromFile() {
     p = safe_snprintf(p, end, "readsb_cpu_demod %llu\n", CPU_MILLIS(demod));
     p = safe_snprintf(p, end, "readsb_cpu_reader %llu\n", CPU_MILLIS(reader));
     p = safe_snprintf(p, end, "readsb_cpu_aircraft_json %llu\n", CPU_MILLIS(aircraft_json));
-    p = safe_snprintf(p, end, "readsb_cpu_globe_json %llu\n", CPU_MILLIS(globe_json));
+    unsigned long long globe_json_cpu_millis_sum = 0;
+    for (int i = 0; i < Modes.json_globe_threads; i++) {
+        unsigned long long millis = (unsigned long long) st->globe_json_cpu[i].tv_sec * 1000UL + st->globe_json_cpu[i].tv_nsec / 1000000UL;
+        p = safe_snprintf(p, end, "readsb_cpu_globe_json_thread{thread=\"%d\"} %llu\n", i, millis);
+        globe_json_cpu_millis_sum += millis;
+    }
+    p = safe_snprintf(p, end, "readsb_cpu_globe_json %llu\n", globe_json_cpu_millis_sum);
     p = safe_snprintf(p, end, "readsb_cpu_heatmap_and_state %llu\n", CPU_MILLIS(heatmap_and_state));
     p = safe_snprintf(p, end, "readsb_cpu_remove_stale %llu\n", CPU_MILLIS(remove_stale));
     p = safe_snprintf(p, end, "readsb_cpu_trace_json %llu\n", trace_json_cpu_millis_sum);
 #undef CPU_MILLIS
+    p = safe_snprintf(p, end, "readsb_aircraft_json_objects %u\n", st->aircraft_json_objects);
+    p = safe_snprintf(p, end, "readsb_aircraft_json_serialized %u\n", st->aircraft_json_serialized);
+    p = safe_snprintf(p, end, "readsb_trace_json_files %u\n", trace_files);
+    p = safe_snprintf(p, end, "readsb_trace_compact_points_removed %u\n", st->trace_compact_points);
+    p = safe_snprintf(p, end, "readsb_trace_compact_max_error_meters %.1f\n", st->trace_compact_max_error);
     p = safe_snprintf(p, end, "readsb_distance_max %u\n", (uint32_t) st->distance_max);
     if (st->distance_min < 1E42)
         p = safe_snprintf(p, end, "readsb_distance_min %u\n", (uint32_t) st->distance_min);
@@ -692,6 +782,17 @@ struct char_buffer generatePromFile() {
 
     p = safe_snprintf(p, end, "readsb_network_malformed_beast_bytes %u\n", st->remote_malformed_beast);
 
+    p = safe_snprintf(p, end, "readsb_icao_filter_hits %u\n", st->icao_filter_hits);
+    p = safe_snprintf(p, end, "readsb_icao_filter_misses %u\n", st->icao_filter_misses);
+    p = safe_snprintf(p, end, "readsb_icao_filter_bloom_rejects %u\n", st->icao_filter_bloom_rejects);
+    for (int i = 0; i < ICAO_FILTER_PROBE_BUCKETS; i++)
+        p = safe_snprintf(p, end, "readsb_icao_filter_probes{groups=\"%d%s\"} %u\n", i + 1,
+                (i == ICAO_FILTER_PROBE_BUCKETS - 1) ? "+" : "", st->icao_filter_probes[i]);
+
+    p = safe_snprintf(p, end, "readsb_state_bytes_written %"PRIu64"\n", st->state_bytes_written);
+    p = safe_snprintf(p, end, "readsb_state_checkpoints %u\n", st->state_checkpoints);
+    p = safe_snprintf(p, end, "readsb_state_snapshots %u\n", st->state_compactions);
+
     p = safe_snprintf(p, end, "readsb_tracks_all %u\n", st->unique_aircraft);
     p = safe_snprintf(p, end, "readsb_tracks_single_message %u\n", st->single_message_aircraft);
 
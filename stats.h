@@ -82,8 +82,15 @@ struct stats
   struct timespec reader_cpu;
   struct timespec background_cpu;
   struct timespec aircraft_json_cpu;
+  uint32_t aircraft_json_objects; // objects written to aircraft.json
+  uint32_t aircraft_json_serialized; // of those, objects not taken from the cached fragment
   struct timespec trace_json_cpu[TRACE_THREADS];
-  struct timespec globe_json_cpu;
+  uint32_t trace_json_files[TRACE_THREADS]; // files written by the trace threads
+  uint32_t trace_bundle_files; // trace bundles written by the globe thread
+  struct timespec trace_bundle_cpu; // counted as trace_json, it replaces work the trace threads used to do
+  uint32_t trace_compact_points; // trace points removed by --trace-compact-age
+  float trace_compact_max_error; // largest distance of a removed point from the compacted trace, meters
+  struct timespec globe_json_cpu[GLOBE_THREADS]; // [0]: the globe thread, the others: its workers
   struct timespec heatmap_and_state_cpu;
   struct timespec remove_stale_cpu;
   // remote messages:
@@ -118,6 +125,19 @@ struct stats
   uint32_t pos_garbage;
   uint32_t pos_by_type[NUM_TYPES];
 
+  // icao filter lookups:
+  uint32_t icao_filter_hits;
+  uint32_t icao_filter_misses;
+  uint32_t icao_filter_bloom_rejects; // misses answered by the bloom filter alone
+  // lookups by number of probed slot groups: 1, 2, 3, 4, 5 or more
+#define ICAO_FILTER_PROBE_BUCKETS 5
+  uint32_t icao_filter_probes[ICAO_FILTER_PROBE_BUCKETS];
+
+  // state checkpoints:
+  uint64_t state_bytes_written;
+  uint32_t state_checkpoints; // changes appended to a shard log
+  uint32_t state_compactions; // full snapshots of a shard
+
   // number of altitude messages ignored because
   // we had a recent DF17/18 altitude
   uint32_t suppressed_altitude_messages;
@@ -0,0 +1,724 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// trace_store.c: packed storage for older trace points
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+// the changed bytes of a state_all are marked in a 64 bit mask
+_Static_assert(sizeof(struct state_all) <= 64, "struct state_all too large for the block encoding");
+_Static_assert(sizeof(struct state_flags) == 2, "struct state_flags is expected to be 16 bit");
+
+// worst case: 10 bytes timestamp, 3 flags, 5 + 5 lat / lon, 4 * 3 for the int16 fields
+#define POINT_MAX_BYTES 35
+#define ALL_MAX_BYTES (10 + sizeof(struct state_all))
+#define BLOCK_MAX_BYTES (TRACE_BLOCK_POINTS * POINT_MAX_BYTES + TRACE_BLOCK_POINTS / 4 * ALL_MAX_BYTES)
+
+static inline unsigned char *put_varint(unsigned char *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static inline const unsigned char *get_varint(const unsigned char *p, uint64_t *v) {
+    uint64_t res = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        res |= (uint64_t) (*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    res |= (uint64_t) *p++ << shift;
+    *v = res;
+    return p;
+}
+
+static inline const unsigned char *skip_varint(const unsigned char *p) {
+    while (*p++ & 0x80)
+        ;
+    return p;
+}
+
+static inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static inline uint16_t flags_bits(const struct state *s) {
+    uint16_t bits;
+    memcpy(&bits, &s->flags, sizeof(bits));
+    return bits;
+}
+
+size_t traceEncodeBound(int count) {
+    return count * POINT_MAX_BYTES + (count / 4 + 1) * ALL_MAX_BYTES;
+}
+
+unsigned char *traceEncode(unsigned char *p, const struct state *trace, const struct state_all *trace_all, int start, int count) {
+    struct state prev;
+    struct state_all prev_all;
+    memset(&prev, 0, sizeof(prev));
+    memset(&prev_all, 0, sizeof(prev_all));
+
+    for (int i = start; i < start + count; i++) {
+        const struct state *s = &trace[i];
+
+        p = put_varint(p, zigzag((int64_t) s->timestamp - (int64_t) prev.timestamp));
+        p = put_varint(p, flags_bits(s) ^ flags_bits(&prev));
+        p = put_varint(p, zigzag((int64_t) s->lat - prev.lat));
+        p = put_varint(p, zigzag((int64_t) s->lon - prev.lon));
+        p = put_varint(p, zigzag(s->altitude - prev.altitude));
+        p = put_varint(p, zigzag(s->gs - prev.gs));
+        p = put_varint(p, zigzag(s->track - prev.track));
+        p = put_varint(p, zigzag(s->rate - prev.rate));
+        prev = *s;
+
+        if (i % 4 == 0) {
+            const unsigned char *all = (const unsigned char *) &trace_all[i / 4];
+            const unsigned char *last = (const unsigned char *) &prev_all;
+            uint64_t mask = 0;
+            for (size_t k = 0; k < sizeof(struct state_all); k++) {
+                if (all[k] != last[k])
+                    mask |= (1ULL << k);
+            }
+            p = put_varint(p, mask);
+            for (size_t k = 0; k < sizeof(struct state_all); k++) {
+                if (mask & (1ULL << k))
+                    *p++ = all[k];
+            }
+            memcpy(&prev_all, all, sizeof(prev_all));
+        }
+    }
+    return p;
+}
+
+struct traceBlock *traceBlockPack(const struct state *trace, const struct state_all *trace_all, int count) {
+    unsigned char buf[BLOCK_MAX_BYTES];
+    unsigned char *p = traceEncode(buf, trace, trace_all, 0, count);
+
+    size_t size = p - buf;
+    struct traceBlock *block = malloc(sizeof(struct traceBlock) + size);
+    if (!block)
+        return NULL;
+    block->next = NULL;
+    block->first = trace[0].timestamp;
+    block->last = trace[count - 1].timestamp;
+    block->size = size;
+    block->count = count;
+    block->compacted = 0;
+    memcpy(block->data, buf, size);
+    return block;
+}
+
+const unsigned char *traceDecode(const unsigned char *p, struct state *trace, struct state_all *trace_all, int start, int count) {
+    struct state prev;
+    struct state_all prev_all;
+    memset(&prev, 0, sizeof(prev));
+    memset(&prev_all, 0, sizeof(prev_all));
+
+    for (int i = start; i < start + count; i++) {
+        struct state *s = &trace[i];
+        uint64_t v;
+
+        p = get_varint(p, &v);
+        s->timestamp = prev.timestamp + unzigzag(v);
+        p = get_varint(p, &v);
+        uint16_t bits = flags_bits(&prev) ^ (uint16_t) v;
+        memcpy(&s->flags, &bits, sizeof(bits));
+        p = get_varint(p, &v);
+        s->lat = prev.lat + unzigzag(v);
+        p = get_varint(p, &v);
+        s->lon = prev.lon + unzigzag(v);
+        p = get_varint(p, &v);
+        s->altitude = prev.altitude + unzigzag(v);
+        p = get_varint(p, &v);
+        s->gs = prev.gs + unzigzag(v);
+        p = get_varint(p, &v);
+        s->track = prev.track + unzigzag(v);
+        p = get_varint(p, &v);
+        s->rate = prev.rate + unzigzag(v);
+        prev = *s;
+
+        if (i % 4 == 0) {
+            unsigned char *all = (unsigned char *) &trace_all[i / 4];
+            uint64_t mask;
+            p = get_varint(p, &mask);
+            memcpy(all, &prev_all, sizeof(prev_all));
+            for (size_t k = 0; k < sizeof(struct state_all); k++) {
+                if (mask & (1ULL << k))
+                    all[k] = *p++;
+            }
+            memcpy(&prev_all, all, sizeof(prev_all));
+        }
+    }
+    return p;
+}
+
+void traceBlockUnpack(const struct traceBlock *block, struct state *trace, struct state_all *trace_all) {
+    traceDecode(block->data, trace, trace_all, 0, block->count);
+}
+
+// freed segments are kept for reuse up to this number
+#define SEG_POOL_MAX 4096
+
+static struct traceSeg *segPool;
+static int segPoolSize;
+static pthread_mutex_t segPoolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+struct traceSeg *traceSegAlloc() {
+    pthread_mutex_lock(&segPoolMutex);
+    struct traceSeg *seg = segPool;
+    if (seg) {
+        segPool = seg->next;
+        segPoolSize--;
+    }
+    pthread_mutex_unlock(&segPoolMutex);
+
+    if (!seg)
+        seg = malloc(sizeof(struct traceSeg));
+    return seg;
+}
+
+void traceSegFree(struct traceSeg *seg) {
+    if (!seg)
+        return;
+    pthread_mutex_lock(&segPoolMutex);
+    if (segPoolSize < SEG_POOL_MAX) {
+        seg->next = segPool;
+        segPool = seg;
+        segPoolSize++;
+        seg = NULL;
+    }
+    pthread_mutex_unlock(&segPoolMutex);
+    free(seg);
+}
+
+// remove the first n segments, the pointers of the others move down
+static void drop_segs(struct aircraft *a, int n) {
+    int count = a->trace_alloc / TRACE_SEG_POINTS;
+    for (int k = 0; k < n; k++)
+        traceSegFree(a->trace_segs[k]);
+    memmove(a->trace_segs, a->trace_segs + n, (count - n) * sizeof(struct traceSeg *));
+    a->trace_alloc -= n * TRACE_SEG_POINTS;
+}
+
+int traceReserve(struct aircraft *a, int n) {
+    int count = a->trace_alloc / TRACE_SEG_POINTS;
+    int needed = (n + TRACE_SEG_POINTS - 1) / TRACE_SEG_POINTS;
+
+    if (needed > a->trace_segs_alloc || needed < a->trace_segs_alloc / 4) {
+        // only the array of pointers is reallocated, the points stay where they are
+        int segs_alloc = max(needed * 2, 4);
+        struct traceSeg **segs = realloc(a->trace_segs, segs_alloc * sizeof(struct traceSeg *));
+        if (!segs && needed > a->trace_segs_alloc) {
+            fprintf(stderr, "traceReserve: realloc failure!\n");
+            return -1;
+        }
+        if (segs) {
+            // a shrinking realloc doesn't fail in practice, keep the old array if it does
+            if (count > needed) {
+                for (int k = needed; k < count; k++)
+                    traceSegFree(segs[k]);
+                count = needed;
+                a->trace_alloc = count * TRACE_SEG_POINTS;
+            }
+            a->trace_segs = segs;
+            a->trace_segs_alloc = segs_alloc;
+        }
+    }
+
+    while (count > needed) {
+        traceSegFree(a->trace_segs[--count]);
+        a->trace_alloc = count * TRACE_SEG_POINTS;
+    }
+    while (count < needed) {
+        struct traceSeg *seg = traceSegAlloc();
+        if (!seg) {
+            fprintf(stderr, "traceReserve: malloc failure!\n");
+            return -1;
+        }
+        a->trace_segs[count++] = seg;
+        a->trace_alloc = count * TRACE_SEG_POINTS;
+    }
+    return 0;
+}
+
+int traceCopyIn(struct aircraft *a, int start, const void *trace, const void *trace_all, int n) {
+    if (n <= 0)
+        return 0;
+    if (start + n > a->trace_alloc && traceReserve(a, start + n))
+        return -1;
+
+    const char *src = trace;
+    for (int i = start; i < start + n; ) {
+        int chunk = min(TRACE_SEG_POINTS - i % TRACE_SEG_POINTS, start + n - i);
+        memcpy(traceAt(a, i), src, chunk * sizeof(struct state));
+        src += chunk * sizeof(struct state);
+        i += chunk;
+    }
+
+    const char *src_all = trace_all;
+    for (int i = start - start % 4; i < start + n; ) {
+        int chunk = min(TRACE_SEG_POINTS - i % TRACE_SEG_POINTS, start + n - i);
+        int count = (chunk + 3) / 4;
+        memcpy(traceAllAt(a, i), src_all, count * sizeof(struct state_all));
+        src_all += count * sizeof(struct state_all);
+        i += chunk;
+    }
+    return 0;
+}
+
+_Static_assert(TRACE_BLOCK_POINTS % TRACE_SEG_POINTS == 0, "blocks must consist of whole segments");
+
+void traceSeal(struct aircraft *a) {
+    struct traceBlock **tail = &a->trace_blocks;
+    while (*tail)
+        tail = &(*tail)->next;
+
+    const int segs = TRACE_BLOCK_POINTS / TRACE_SEG_POINTS;
+    struct state trace[TRACE_BLOCK_POINTS];
+    struct state_all trace_all[TRACE_BLOCK_POINTS / 4];
+
+    while (a->trace_len >= TRACE_TAIL_POINTS + TRACE_BLOCK_POINTS) {
+        for (int k = 0; k < segs; k++) {
+            memcpy(trace + k * TRACE_SEG_POINTS, a->trace_segs[k]->trace, sizeof(a->trace_segs[k]->trace));
+            memcpy(trace_all + k * TRACE_SEG_POINTS / 4, a->trace_segs[k]->trace_all, sizeof(a->trace_segs[k]->trace_all));
+        }
+        struct traceBlock *block = traceBlockPack(trace, trace_all, TRACE_BLOCK_POINTS);
+        if (!block)
+            break;
+        *tail = block;
+        tail = &block->next;
+
+        drop_segs(a, segs);
+        a->trace_len -= TRACE_BLOCK_POINTS;
+        a->trace_packed += TRACE_BLOCK_POINTS;
+    }
+}
+
+int traceDropOldest(struct aircraft *a) {
+    struct traceBlock *block = a->trace_blocks;
+    if (block) {
+        int n = block->count;
+        a->trace_blocks = block->next;
+        a->trace_packed -= n;
+        free(block);
+        return n;
+    }
+    if (a->trace_len > TRACE_SEG_POINTS) {
+        drop_segs(a, 1);
+        a->trace_len -= TRACE_SEG_POINTS;
+        return TRACE_SEG_POINTS;
+    }
+    // the segment being appended to stays allocated
+    int n = a->trace_len;
+    a->trace_len = 0;
+    return n;
+}
+
+uint64_t traceOldestLast(struct aircraft *a) {
+    if (a->trace_blocks)
+        return a->trace_blocks->last;
+    if (a->trace_len > TRACE_SEG_POINTS)
+        return traceAt(a, TRACE_SEG_POINTS - 1)->timestamp;
+    return a->trace_len ? traceAt(a, a->trace_len - 1)->timestamp : 0;
+}
+
+// Compaction: the interior points of a block are dropped as long as the
+// position interpolated by time from the kept neighbours stays within
+// COMPACT_EPSILON of them (synchronized euclidean distance, Douglas-Peucker
+// on the time parametrized path).  Distances use a local equirectangular
+// approximation, good enough at this scale.
+
+#define COMPACT_EPSILON 100.0 // meters
+#define COMPACT_ALT_EPSILON 8 // 200 ft in the 25 ft units of state.altitude
+#define COMPACT_MAX_GAP (2 * MINUTES)
+#define COMPACT_METERS (111195.0 / 1E6) // per 1E-6 degree of latitude
+
+static int flags_equal(const struct state *s1, const struct state *s2) {
+    struct state_flags f1 = s1->flags, f2 = s2->flags;
+    f1.leg_marker = f2.leg_marker = 0;
+    return memcmp(&f1, &f2, sizeof(f1)) == 0;
+}
+
+// error of point k against the interpolation between s and e in units of the epsilons,
+// *meters is the horizontal part
+static double compact_error(const struct state *trace, int s, int e, int k, double *meters) {
+    const struct state *ps = &trace[s], *pe = &trace[e], *pk = &trace[k];
+    double f = 0;
+    if (pe->timestamp > ps->timestamp)
+        f = (double) (pk->timestamp - ps->timestamp) / (double) (pe->timestamp - ps->timestamp);
+
+    int64_t dlon = (int64_t) pe->lon - ps->lon;
+    if (dlon > 180000000)
+        dlon -= 360000000;
+    if (dlon < -180000000)
+        dlon += 360000000;
+    double lat = ps->lat + f * (pe->lat - ps->lat);
+    double lon = ps->lon + f * dlon;
+    double dy = pk->lat - lat;
+    double dx = remainder(pk->lon - lon, 360E6) * cos(lat * (M_PI / 180E6));
+    double horizontal = sqrt(dx * dx + dy * dy) * COMPACT_METERS;
+    *meters = horizontal;
+
+    double err = horizontal / COMPACT_EPSILON;
+    // altitude_valid is the same for all points between s and e
+    if (ps->flags.altitude_valid) {
+        double alt = ps->altitude + f * (pe->altitude - ps->altitude);
+        err = fmax(err, fabs(pk->altitude - alt) / COMPACT_ALT_EPSILON);
+    }
+    return err;
+}
+
+static void compact_segment(const struct state *trace, char *keep, int s, int e) {
+    if (e - s < 2)
+        return;
+    int worst = s + 1;
+    double max = -1;
+    for (int k = s + 1; k < e; k++) {
+        double meters;
+        double err = compact_error(trace, s, e, k, &meters);
+        if (err > max) {
+            max = err;
+            worst = k;
+        }
+    }
+    if (max <= 1 && trace[e].timestamp - trace[s].timestamp <= COMPACT_MAX_GAP)
+        return;
+    keep[worst] = 1;
+    compact_segment(trace, keep, s, worst);
+    compact_segment(trace, keep, worst, e);
+}
+
+// errors of the points not kept against their kept neighbours, returns the worst point (-1: none)
+static int compact_worst(const struct state *trace, const char *keep, int n, double *max_err, double *max_meters) {
+    int worst = -1;
+    *max_err = 0;
+    *max_meters = 0;
+    int s = 0;
+    for (int e = 1; e < n; e++) {
+        if (!keep[e])
+            continue;
+        for (int k = s + 1; k < e; k++) {
+            double meters;
+            double err = compact_error(trace, s, e, k, &meters);
+            if (worst < 0 || err > *max_err) {
+                *max_err = err;
+                worst = k;
+            }
+            *max_meters = fmax(*max_meters, meters);
+        }
+        s = e;
+    }
+    return worst;
+}
+
+// compact one block, index is the trace index of its first point, the points up to
+// done were thinned out before, returns the new block or NULL if nothing was removed
+static struct traceBlock *compact_block(const struct traceBlock *block, int index, uint64_t done,
+        const int *keep_idx, int keep_len, double *max_error) {
+    struct state trace[TRACE_BLOCK_POINTS], out[TRACE_BLOCK_POINTS];
+    struct state_all trace_all[TRACE_BLOCK_POINTS / 4], out_all[TRACE_BLOCK_POINTS / 4];
+    char keep[TRACE_BLOCK_POINTS] = { 0 };
+    int n = block->count;
+
+    traceBlockUnpack(block, trace, trace_all);
+
+    keep[0] = keep[n - 1] = 1;
+    // a block sealed after loading the state can start with points thinned out already
+    for (int i = 0; i < n && trace[i].timestamp <= done; i++)
+        keep[i] = 1;
+    for (int i = 1; i < n; i++) {
+        // ground / air transitions, validity changes, stale points
+        if (!flags_equal(&trace[i - 1], &trace[i]))
+            keep[i - 1] = keep[i] = 1;
+    }
+    for (int i = 4; i < n; i += 4) {
+        const struct state_all *prev = &trace_all[i / 4 - 1], *all = &trace_all[i / 4];
+        if (memcmp(prev->callsign, all->callsign, sizeof(all->callsign)) || prev->squawk != all->squawk)
+            keep[i] = 1;
+    }
+    for (int k = 0; k < keep_len; k++) {
+        int i = keep_idx[k] - index;
+        if (i >= 0 && i < n)
+            keep[i] = 1;
+    }
+
+    int s = 0;
+    for (int e = 1; e < n; e++) {
+        if (keep[e]) {
+            compact_segment(trace, keep, s, e);
+            s = e;
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < n; i++)
+        kept += keep[i];
+
+    // blocks hold a multiple of 4 points: put back the worst of the removed ones
+    double err, meters;
+    while (kept % 4) {
+        int worst = compact_worst(trace, keep, n, &err, &meters);
+        keep[worst] = 1;
+        kept++;
+    }
+    if (kept == n)
+        return NULL;
+
+    compact_worst(trace, keep, n, &err, &meters);
+    *max_error = fmax(*max_error, meters);
+
+    int j = 0;
+    for (int i = 0; i < n; i++) {
+        if (!keep[i])
+            continue;
+        out[j] = trace[i];
+        // newest state_all at or before point i
+        if (j % 4 == 0)
+            out_all[j / 4] = trace_all[i / 4];
+        j++;
+    }
+    return traceBlockPack(out, out_all, kept);
+}
+
+int traceCompact(struct aircraft *a, uint64_t before, const int *keep, int keep_len, int *budget, double *max_error) {
+    int removed = 0;
+    int index = 0;
+    struct traceBlock **prev = &a->trace_blocks;
+    for (struct traceBlock *block = a->trace_blocks; block && block->last < before && *budget > 0; block = *prev) {
+        // keep is sorted, skip the indexes before this block
+        while (keep_len > 0 && *keep < index) {
+            keep++;
+            keep_len--;
+        }
+        // index and keep refer to the trace before this call
+        int count = block->count;
+        if (block->last <= a->trace_compacted)
+            block->compacted = 1;
+        if (!block->compacted) {
+            (*budget)--;
+            struct traceBlock *compacted = compact_block(block, index, a->trace_compacted, keep, keep_len, max_error);
+            if (compacted) {
+                compacted->next = block->next;
+                *prev = compacted;
+                free(block);
+                block = compacted;
+                removed += count - block->count;
+            }
+            block->compacted = 1;
+            a->trace_compacted = block->last;
+        }
+        index += count;
+        prev = &block->next;
+    }
+    a->trace_packed -= removed;
+    return removed;
+}
+
+void traceFree(struct aircraft *a) {
+    while (a->trace_blocks) {
+        struct traceBlock *block = a->trace_blocks;
+        a->trace_blocks = block->next;
+        free(block);
+    }
+    for (int k = 0; k < a->trace_alloc / TRACE_SEG_POINTS; k++)
+        traceSegFree(a->trace_segs[k]);
+    free(a->trace_segs);
+    a->trace_segs = NULL;
+    a->trace_segs_alloc = 0;
+    a->trace_alloc = 0;
+    a->trace_len = 0;
+    a->trace_packed = 0;
+}
+
+// index in the block of the first point with a timestamp >= timestamp,
+// only the timestamps are decoded and only up to that point
+static int block_find_timestamp(const struct traceBlock *block, uint64_t timestamp) {
+    if (block->first >= timestamp)
+        return 0;
+    const unsigned char *p = block->data;
+    uint64_t ts = 0;
+    for (int i = 0; i < block->count; i++) {
+        uint64_t v;
+        p = get_varint(p, &v);
+        ts += unzigzag(v);
+        if (ts >= timestamp)
+            return i;
+        // flags, lat, lon, altitude, gs, track, rate
+        for (int k = 0; k < 7; k++)
+            p = skip_varint(p);
+        if (i % 4 == 0) {
+            uint64_t mask;
+            p = get_varint(p, &mask);
+            // one byte per changed byte of the state_all
+            for (; mask; mask &= mask - 1)
+                p++;
+        }
+    }
+    return block->count;
+}
+
+int traceFindTimestamp(struct aircraft *a, uint64_t timestamp) {
+    int packed = a->trace_packed;
+    int i = 0;
+    // block->last is the index: only the block containing the point is decoded
+    for (struct traceBlock *block = a->trace_blocks; block && i < packed; block = block->next) {
+        if (block->last >= timestamp)
+            return i + block_find_timestamp(block, timestamp);
+        i += block->count;
+    }
+
+    // the tail can grow while we're reading it, only use what is there now
+    int lo = 0, hi = a->trace_len;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (traceAt(a, mid)->timestamp < timestamp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return packed + lo;
+}
+
+int traceFindRange(struct aircraft *a, uint64_t from, uint64_t to, int *start) {
+    *start = traceFindTimestamp(a, from);
+    if (to <= from)
+        return 0;
+    return traceFindTimestamp(a, to) - *start;
+}
+
+int traceViewFindTimestamp(const struct traceView *tv, uint64_t timestamp) {
+    int lo = 0, hi = tv->len;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (tv->trace[mid].timestamp < timestamp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int traceViewFindRange(const struct traceView *tv, uint64_t from, uint64_t to, int *start) {
+    *start = traceViewFindTimestamp(tv, from);
+    if (to <= from)
+        return 0;
+    return traceViewFindTimestamp(tv, to) - *start;
+}
+
+void traceIterInit(struct traceIter *it, struct aircraft *a, int start) {
+    it->a = a;
+    it->packed = a->trace_packed;
+    // the tail can grow while we're reading it, only use what is there now
+    it->len = it->packed + a->trace_len;
+    it->i = max(0, start);
+    it->decoded = 0;
+    it->block = a->trace_blocks;
+    it->block_start = 0;
+    while (it->block && it->block_start + it->block->count <= it->i) {
+        it->block_start += it->block->count;
+        it->block = it->block->next;
+    }
+}
+
+struct state *traceIterNext(struct traceIter *it, struct state_all **all) {
+    int i = it->i;
+    if (i >= it->len)
+        return NULL;
+    it->i++;
+
+    if (i >= it->packed) {
+        int j = i - it->packed;
+        *all = (j % 4 == 0) ? traceAllAt(it->a, j) : NULL;
+        return traceAt(it->a, j);
+    }
+
+    if (i >= it->decoded) {
+        traceBlockUnpack(it->block, it->buf, it->buf_all);
+        it->buf_start = it->block_start;
+        it->decoded = it->block_start + it->block->count;
+        it->block_start = it->decoded;
+        it->block = it->block->next;
+    }
+    int k = i - it->buf_start;
+    *all = (k % 4 == 0) ? &it->buf_all[k / 4] : NULL;
+    return &it->buf[k];
+}
+
+int traceViewGet(struct aircraft *a, struct traceView *tv) {
+    return traceViewGetFrom(a, tv, 0);
+}
+
+int traceViewGetFrom(struct aircraft *a, struct traceView *tv, int from) {
+    // the tail can grow while we're reading it, only use what is there now
+    int tail = a->trace_len;
+    int packed = a->trace_packed;
+    int len = packed + tail;
+
+    // keep the view aligned to the state_all
+    int first = min(max(0, from), len);
+    first -= first % 4;
+
+    tv->first = first;
+    tv->len = len - first;
+    tv->trace = malloc(max(tv->len, 1) * sizeof(struct state));
+    tv->trace_all = malloc(max((tv->len + 3) / 4, 1) * sizeof(struct state_all));
+    if (!tv->trace || !tv->trace_all) {
+        fprintf(stderr, "traceViewGet: malloc failure!\n");
+        traceViewFree(tv);
+        return -1;
+    }
+
+    int i = 0;
+    for (struct traceBlock *block = a->trace_blocks; block && i < packed; block = block->next) {
+        int end = i + block->count;
+        if (i >= first) {
+            traceBlockUnpack(block, tv->trace + i - first, tv->trace_all + (i - first) / 4);
+        } else if (end > first) {
+            struct state buf[TRACE_BLOCK_POINTS];
+            struct state_all buf_all[TRACE_BLOCK_POINTS / 4];
+            traceBlockUnpack(block, buf, buf_all);
+            memcpy(tv->trace, buf + first - i, (end - first) * sizeof(struct state));
+            memcpy(tv->trace_all, buf_all + (first - i) / 4, (end - first) / 4 * sizeof(struct state_all));
+        }
+        i = end;
+    }
+    for (int j = 0; j < tail; j += TRACE_SEG_POINTS) {
+        int end = min(j + TRACE_SEG_POINTS, tail);
+        int k = max(j, first - packed);
+        if (k >= end)
+            continue;
+        struct traceSeg *seg = a->trace_segs[j / TRACE_SEG_POINTS];
+        memcpy(tv->trace + packed + k - first, seg->trace + k - j, (end - k) * sizeof(struct state));
+        memcpy(tv->trace_all + (packed + k - first) / 4, seg->trace_all + (k - j) / 4, (end - k + 3) / 4 * sizeof(struct state_all));
+    }
+
+    return 0;
+}
+
+void traceViewFree(struct traceView *tv) {
+    free(tv->trace);
+    free(tv->trace_all);
+    tv->trace = NULL;
+    tv->trace_all = NULL;
+    tv->first = 0;
+    tv->len = 0;
+}
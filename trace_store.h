@@ -0,0 +1,158 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// trace_store.h: packed storage for older trace points
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef TRACE_STORE_H
+#define TRACE_STORE_H
+
+// A trace consists of a list of sealed blocks (a->trace_blocks, the oldest
+// a->trace_packed points) followed by the unpacked tail (a->trace_len points).
+// The tail is stored in fixed size segments drawn from a pool, a->trace_segs
+// points to them in order, a->trace_alloc is the number of points they hold.
+// New points are only ever added to the tail, the decode thread writes into
+// the allocated segments.  Segments are only added, removed or sealed into
+// blocks by resize_trace() with all other threads locked.
+//
+// Block encoding, per point: zigzag varint deltas to the previous point for
+// timestamp, lat, lon, altitude, gs, track and rate, the flags xor the
+// previous flags as a varint.  Per state_all (every 4th point): a varint
+// bitmask of the bytes that differ from the previous state_all, followed
+// by those bytes.
+
+#define TRACE_SEG_POINTS 32 // points per tail segment, multiple of 4
+#define TRACE_BLOCK_POINTS 256 // points per block, multiple of TRACE_SEG_POINTS, compacted blocks have fewer
+#define TRACE_TAIL_POINTS 512 // points always kept unpacked (recent trace, appending)
+
+struct traceSeg {
+    struct traceSeg *next; // pool free list
+    struct state trace[TRACE_SEG_POINTS];
+    struct state_all trace_all[TRACE_SEG_POINTS / 4];
+};
+
+struct traceBlock {
+    struct traceBlock *next;
+    uint64_t first; // timestamp of the first point
+    uint64_t last; // timestamp of the last point
+    uint32_t size; // bytes of data
+    uint16_t count; // number of points, a multiple of 4
+    uint16_t compacted; // thinned out by traceCompact()
+    unsigned char data[];
+};
+
+// walks the points of a trace in order, blocks are decoded one at a time
+struct traceIter {
+    struct aircraft *a;
+    struct traceBlock *block; // next block to decode
+    int i; // index of the next point
+    int len; // number of points when the iteration started
+    int packed;
+    int block_start; // index of the first point of block
+    int buf_start; // index of buf[0]
+    int decoded; // points up to this index are in buf
+    struct state buf[TRACE_BLOCK_POINTS];
+    struct state_all buf_all[TRACE_BLOCK_POINTS / 4];
+};
+
+// decoded copy of the trace as flat arrays, for random access
+// trace[0] is point first of the trace (a multiple of 4), 0 unless made by traceViewGetFrom()
+struct traceView {
+    struct state *trace;
+    struct state_all *trace_all;
+    int first;
+    int len; // number of points in the view
+};
+
+// the block encoding of the points start to start + count - 1, the state_all of
+// point i (i divisible by 4) is trace_all[i / 4], returns the end of the output
+unsigned char *traceEncode(unsigned char *p, const struct state *trace, const struct state_all *trace_all, int start, int count);
+// bytes traceEncode() needs at most for count points
+size_t traceEncodeBound(int count);
+// the reverse, fills the same indexes, returns the end of the input
+const unsigned char *traceDecode(const unsigned char *p, struct state *trace, struct state_all *trace_all, int start, int count);
+
+// count: number of points, a multiple of 4, at most TRACE_BLOCK_POINTS
+struct traceBlock *traceBlockPack(const struct state *trace, const struct state_all *trace_all, int count);
+void traceBlockUnpack(const struct traceBlock *block, struct state *trace, struct state_all *trace_all);
+
+struct traceSeg *traceSegAlloc();
+void traceSegFree(struct traceSeg *seg);
+
+// resize the tail to hold at least n points, returns -1 on allocation failure
+int traceReserve(struct aircraft *a, int n);
+// copy n points to the tail starting at point start, the state_all of every 4th point
+// is expected at all (not aligned, as read from a file), returns -1 on allocation failure
+int traceCopyIn(struct aircraft *a, int start, const void *trace, const void *trace_all, int n);
+// seal the older part of the tail into blocks, keeps TRACE_TAIL_POINTS unpacked
+void traceSeal(struct aircraft *a);
+// drop the oldest block or tail segment, returns the number of points removed
+int traceDropOldest(struct aircraft *a);
+// timestamp of the newest point traceDropOldest() would remove
+uint64_t traceOldestLast(struct aircraft *a);
+// thin out the blocks with all points before the timestamp before, each block is
+// compacted once: blocks up to a->trace_compacted are skipped (it is kept in the
+// state, the flag of the block is lost when the trace is loaded into the tail)
+// keep: sorted trace indexes that must be kept (leg markers)
+// budget: blocks that may be compacted, decremented, stops at 0
+// returns the number of points removed, *max_error is raised to the largest
+// distance in meters of a removed point from the compacted trace
+int traceCompact(struct aircraft *a, uint64_t before, const int *keep, int keep_len, int *budget, double *max_error);
+// free blocks and segments
+void traceFree(struct aircraft *a);
+
+// Time index: the timestamps of a trace are ascending, the blocks know their
+// first and last timestamp.  Finding a point costs a walk over the block
+// list, decoding the timestamps of one block and a binary search of the tail.
+
+// index of the first point with a timestamp >= timestamp (traceLen() if there is none)
+int traceFindTimestamp(struct aircraft *a, uint64_t timestamp);
+// the points with from <= timestamp < to: returns their number, *start is the index of the first
+int traceFindRange(struct aircraft *a, uint64_t from, uint64_t to, int *start);
+
+void traceIterInit(struct traceIter *it, struct aircraft *a, int start);
+// returns NULL after the last point, *all is set for every 4th point and NULL otherwise
+struct state *traceIterNext(struct traceIter *it, struct state_all **all);
+
+// returns -1 on allocation failure
+int traceViewGet(struct aircraft *a, struct traceView *tv);
+// only the points from index from (rounded down to a multiple of 4) to the end
+int traceViewGetFrom(struct aircraft *a, struct traceView *tv, int from);
+void traceViewFree(struct traceView *tv);
+// the same for a view, indexes relative to the view, binary search
+int traceViewFindTimestamp(const struct traceView *tv, uint64_t timestamp);
+int traceViewFindRange(const struct traceView *tv, uint64_t from, uint64_t to, int *start);
+
+// total number of points
+static inline int traceLen(struct aircraft *a) {
+    return a->trace_packed + a->trace_len;
+}
+
+// point i of the tail
+static inline struct state *traceAt(struct aircraft *a, int i) {
+    return &a->trace_segs[i / TRACE_SEG_POINTS]->trace[i % TRACE_SEG_POINTS];
+}
+
+// state_all belonging to point i of the tail (i divisible by 4)
+static inline struct state_all *traceAllAt(struct aircraft *a, int i) {
+    return &a->trace_segs[i / TRACE_SEG_POINTS]->trace_all[(i % TRACE_SEG_POINTS) / 4];
+}
+
+static inline uint64_t traceFirstTimestamp(struct aircraft *a) {
+    if (a->trace_blocks)
+        return a->trace_blocks->first;
+    return a->trace_len ? traceAt(a, 0)->timestamp : 0;
+}
+
+#endif
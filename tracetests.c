@@ -0,0 +1,592 @@
+// Part of readsb, a Mode-S/ADSB/TIS message decoder.
+//
+// tracetests.c - round trip tests and benchmark for the packed trace blocks
+//
+// This file is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This file is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "readsb.h"
+
+#define POINTS (16 * 1024)
+
+// deterministic pseudo random numbers so failures are reproducible
+static uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+static uint32_t rnd(uint32_t n) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t) ((rng_state * 0x2545F4914F6CDD1DULL) >> 32) % n;
+}
+
+static double elapsed(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// a plausible flight: small steps in time and position, slowly changing
+// speed / altitude, now and then a change in the flags or the state_all
+static void fill_trace(struct state *trace, struct state_all *trace_all, int len, int noisy) {
+    memset(trace, 0, len * sizeof(struct state));
+    memset(trace_all, 0, (len + 3) / 4 * sizeof(struct state_all));
+
+    uint64_t ts = 1600000000000ULL;
+    // unsigned: the noisy steps wrap around
+    uint32_t lat = 50123456, lon = 8123456;
+    int16_t alt = 400, gs = 4500, track = 900, rate = 0;
+    struct state_all all;
+    memset(&all, 0, sizeof(all));
+    memcpy(all.callsign, "DLH123  ", 8);
+    all.squawk = 0x1000;
+
+    for (int i = 0; i < len; i++) {
+        ts += noisy ? rnd(1u << 30) : 1000 + rnd(15000);
+        lat += noisy ? rnd(1u << 31) : (uint32_t) ((int32_t) rnd(2000) - 700);
+        lon += noisy ? rnd(1u << 31) : (uint32_t) ((int32_t) rnd(2000) - 300);
+        alt += noisy ? (int16_t) rnd(65536) : (int16_t) rnd(9) - 4;
+        gs += noisy ? (int16_t) rnd(65536) : (int16_t) rnd(5) - 2;
+        track += noisy ? (int16_t) rnd(65536) : (int16_t) rnd(21) - 10;
+        rate = noisy ? (int16_t) rnd(65536) : (int16_t) rnd(64) - 32;
+
+        struct state *s = &trace[i];
+        s->timestamp = ts;
+        s->lat = (int32_t) lat;
+        s->lon = (int32_t) lon;
+        s->altitude = alt;
+        s->gs = gs;
+        s->track = track;
+        s->rate = rate;
+        s->flags.altitude_valid = 1;
+        s->flags.gs_valid = 1;
+        s->flags.track_valid = 1;
+        s->flags.rate_valid = (noisy || rnd(10)) ? 1 : 0;
+        s->flags.stale = (noisy || !rnd(50)) ? 1 : 0;
+        s->flags.leg_marker = !rnd(200);
+        s->flags.padding = noisy ? rnd(128) - 64 : 0;
+
+        if (i % 4 == 0) {
+            unsigned char *bytes = (unsigned char *) &all;
+            int changes = noisy ? 64 : rnd(4);
+            for (int k = 0; k < changes; k++)
+                bytes[rnd(sizeof(all))] = rnd(256);
+            trace_all[i / 4] = all;
+        }
+    }
+}
+
+static int compare(const char *name, struct state *t0, struct state_all *a0,
+        struct state *t1, struct state_all *a1, int len) {
+    for (int i = 0; i < len; i++) {
+        if (memcmp(&t0[i], &t1[i], sizeof(struct state))) {
+            fprintf(stderr, "%s: FAIL: point %d differs\n", name, i);
+            return 0;
+        }
+    }
+    for (int i = 0; i < (len + 3) / 4; i++) {
+        if (memcmp(&a0[i], &a1[i], sizeof(struct state_all))) {
+            fprintf(stderr, "%s: FAIL: state_all %d differs\n", name, i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static struct aircraft *make_aircraft(struct state *trace, struct state_all *trace_all, int len) {
+    struct aircraft *a = calloc(1, sizeof(struct aircraft));
+    traceReserve(a, len + GLOBE_STEP);
+    traceCopyIn(a, 0, trace, trace_all, len);
+    a->trace_len = len;
+    return a;
+}
+
+static void free_aircraft(struct aircraft *a) {
+    traceFree(a);
+    free(a);
+}
+
+// the iterator yields the same points as the view, from any starting point
+static int check_iter(struct aircraft *a, struct state *trace, struct state_all *trace_all, int len) {
+    int starts[] = { 0, 1, 4, TRACE_BLOCK_POINTS - 1, TRACE_BLOCK_POINTS + 3, len / 2, len - 1, len };
+    for (size_t n = 0; n < sizeof(starts) / sizeof(starts[0]); n++) {
+        if (starts[n] < 0 || starts[n] > len)
+            continue;
+        struct traceIter it;
+        struct state *state;
+        struct state_all *all;
+        int i = starts[n];
+        traceIterInit(&it, a, i);
+        for (; (state = traceIterNext(&it, &all)); i++) {
+            if (memcmp(state, &trace[i], sizeof(struct state))
+                    || (i % 4 == 0) != (all != NULL)
+                    || (all && memcmp(all, &trace_all[i / 4], sizeof(struct state_all)))) {
+                fprintf(stderr, "testSealView: FAIL: iterator differs at %d (start %d)\n", i, starts[n]);
+                return 0;
+            }
+        }
+        if (i != len) {
+            fprintf(stderr, "testSealView: FAIL: iterator ended at %d of %d\n", i, len);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// every block decodes to exactly the points it was made from
+static int testBlockRoundTrip(int noisy) {
+    const char *name = noisy ? "testBlockNoise" : "testBlockRoundTrip";
+    struct state trace[TRACE_BLOCK_POINTS], out[TRACE_BLOCK_POINTS];
+    struct state_all trace_all[TRACE_BLOCK_POINTS / 4], out_all[TRACE_BLOCK_POINTS / 4];
+    int ok = 1;
+    for (int round = 0; round < 200 && ok; round++) {
+        fill_trace(trace, trace_all, TRACE_BLOCK_POINTS, noisy);
+        struct traceBlock *block = traceBlockPack(trace, trace_all, TRACE_BLOCK_POINTS);
+        memset(out, 0xff, sizeof(out));
+        memset(out_all, 0xff, sizeof(out_all));
+        traceBlockUnpack(block, out, out_all);
+        ok = compare(name, trace, trace_all, out, out_all, TRACE_BLOCK_POINTS);
+        free(block);
+    }
+    fprintf(stderr, "%s:%*s%s\n", name, (int) (19 - strlen(name)), "", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// any range of points, as written by generateTraceBin(), stays within traceEncodeBound()
+static int testEncodeRange() {
+    int len = 3 * TRACE_BLOCK_POINTS;
+    struct state *trace = malloc(len * sizeof(struct state)), *out = malloc(len * sizeof(struct state));
+    struct state_all *trace_all = malloc(len / 4 * sizeof(struct state_all)), *out_all = malloc(len / 4 * sizeof(struct state_all));
+    unsigned char *buf = malloc(traceEncodeBound(len));
+    int ok = 1;
+    for (int round = 0; round < 400 && ok; round++) {
+        fill_trace(trace, trace_all, len, round % 2);
+        int start = rnd(len);
+        int count = rnd(len - start) + 1;
+        memset(out, 0xff, len * sizeof(struct state));
+        memset(out_all, 0xff, len / 4 * sizeof(struct state_all));
+        unsigned char *end = traceEncode(buf, trace, trace_all, start, count);
+        const unsigned char *read = traceDecode(buf, out, out_all, start, count);
+        if ((size_t) (end - buf) > traceEncodeBound(count) || read != end) {
+            fprintf(stderr, "testEncodeRange: FAIL: %d points: %zu bytes, bound %zu, decoded %zu\n",
+                    count, (size_t) (end - buf), traceEncodeBound(count), (size_t) (read - buf));
+            ok = 0;
+            break;
+        }
+        for (int i = start; i < start + count && ok; i++) {
+            if (memcmp(&trace[i], &out[i], sizeof(struct state))
+                    || (i % 4 == 0 && memcmp(&trace_all[i / 4], &out_all[i / 4], sizeof(struct state_all)))) {
+                fprintf(stderr, "testEncodeRange: FAIL: point %d differs (start %d)\n", i, start);
+                ok = 0;
+            }
+        }
+    }
+    free(trace);
+    free(out);
+    free(trace_all);
+    free(out_all);
+    free(buf);
+    fprintf(stderr, "testEncodeRange:    %s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// sealing, dropping blocks and reading the trace over blocks + tail
+static int testSealView() {
+    struct state *trace = malloc(POINTS * sizeof(struct state));
+    struct state_all *trace_all = malloc(POINTS / 4 * sizeof(struct state_all));
+    int ok = 1;
+
+    int lengths[] = { 0, 1, 5, TRACE_TAIL_POINTS + TRACE_BLOCK_POINTS - 1,
+        TRACE_TAIL_POINTS + TRACE_BLOCK_POINTS, POINTS - 3, POINTS };
+    for (size_t n = 0; n < sizeof(lengths) / sizeof(lengths[0]) && ok; n++) {
+        int len = lengths[n];
+        fill_trace(trace, trace_all, len, 0);
+        struct aircraft *a = make_aircraft(trace, trace_all, len);
+
+        traceSeal(a);
+        if (traceLen(a) != len || a->trace_len < (len < TRACE_TAIL_POINTS ? len : TRACE_TAIL_POINTS)
+                || a->trace_packed % TRACE_BLOCK_POINTS
+                || (len && traceFirstTimestamp(a) != trace[0].timestamp)) {
+            fprintf(stderr, "testSealView: FAIL: len %d packed %d tail %d\n", len, a->trace_packed, a->trace_len);
+            ok = 0;
+        }
+
+        struct traceView tv = { 0 };
+        if (ok && (traceViewGet(a, &tv) || tv.len != len
+                    || !compare("testSealView", trace, trace_all, tv.trace, tv.trace_all, len)))
+            ok = 0;
+        traceViewFree(&tv);
+
+        // partial views start at a multiple of 4 and end with the trace
+        int froms[] = { 1, TRACE_BLOCK_POINTS + 6, len - TRACE_TAIL_POINTS - 3, len - 7 };
+        for (size_t k = 0; k < sizeof(froms) / sizeof(froms[0]) && ok; k++) {
+            int from = froms[k];
+            if (from < 0 || from > len)
+                continue;
+            int first = from - from % 4;
+            if (traceViewGetFrom(a, &tv, from) || tv.first != first || tv.len != len - first
+                    || !compare("testSealView", trace + first, trace_all + first / 4, tv.trace, tv.trace_all, tv.len))
+                ok = 0;
+            traceViewFree(&tv);
+        }
+
+        if (ok && !check_iter(a, trace, trace_all, len))
+            ok = 0;
+
+        // binary search over blocks and tail gives the same as a linear scan
+        for (int k = 0; k < 50 && ok && len; k++) {
+            uint64_t ts = trace[0].timestamp - 1000 + rnd(trace[len - 1].timestamp - trace[0].timestamp + 2000);
+            if (k == 0)
+                ts = trace[rnd(len)].timestamp; // exact match
+            int expected = 0;
+            while (expected < len && trace[expected].timestamp < ts)
+                expected++;
+            if (traceFindTimestamp(a, ts) != expected) {
+                fprintf(stderr, "testSealView: FAIL: traceFindTimestamp %d, expected %d\n", traceFindTimestamp(a, ts), expected);
+                ok = 0;
+            }
+
+            uint64_t to = ts + rnd(3 * HOURS);
+            int expected_count = 0;
+            while (expected + expected_count < len && trace[expected + expected_count].timestamp < to)
+                expected_count++;
+            int start;
+            int count = traceFindRange(a, ts, to, &start);
+            if (start != expected || count != expected_count) {
+                fprintf(stderr, "testSealView: FAIL: traceFindRange %d %d, expected %d %d\n", start, count, expected, expected_count);
+                ok = 0;
+            }
+            if (traceViewGetFrom(a, &tv, len / 2) == 0) {
+                int view_expected = expected > tv.first ? expected - tv.first : 0;
+                int view_count = traceViewFindRange(&tv, ts, to, &start);
+                int view_expected_count = 0;
+                while (view_expected + view_expected_count < tv.len && tv.trace[view_expected + view_expected_count].timestamp < to)
+                    view_expected_count++;
+                if (start != view_expected || view_count != view_expected_count) {
+                    fprintf(stderr, "testSealView: FAIL: traceViewFindRange %d %d, expected %d %d\n", start, view_count, view_expected, view_expected_count);
+                    ok = 0;
+                }
+                traceViewFree(&tv);
+            }
+        }
+
+        // dropping the oldest block / segment leaves the rest of the trace untouched
+        int dropped = traceDropOldest(a);
+        if (ok && (traceViewGet(a, &tv) || tv.len != len - dropped
+                    || !compare("testSealView", trace + dropped, trace_all + dropped / 4, tv.trace, tv.trace_all, len - dropped)))
+            ok = 0;
+        traceViewFree(&tv);
+
+        free_aircraft(a);
+    }
+
+    free(trace);
+    free(trace_all);
+    fprintf(stderr, "testSealView:       %s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// appending point by point like the decode thread, resizing like resize_trace()
+static int testAppend() {
+    struct state *trace = malloc(POINTS * sizeof(struct state));
+    struct state_all *trace_all = malloc(POINTS / 4 * sizeof(struct state_all));
+    fill_trace(trace, trace_all, POINTS, 0);
+    struct aircraft *a = calloc(1, sizeof(struct aircraft));
+    int ok = 1;
+
+    int first = 0; // index of the first point still in the trace
+    for (int i = 0; i < POINTS && ok; i++) {
+        if (a->trace_len + GLOBE_STEP / 2 >= a->trace_alloc) {
+            if (i % 3000 < 100) {
+                int dropped = traceDropOldest(a);
+                first += dropped;
+            }
+            traceSeal(a);
+            traceReserve(a, a->trace_len + GLOBE_STEP);
+        }
+        *traceAt(a, a->trace_len) = trace[i];
+        if (a->trace_len % 4 == 0)
+            *traceAllAt(a, a->trace_len) = trace_all[i / 4];
+        a->trace_len++;
+
+        if (traceLen(a) != i + 1 - first || first % 4) {
+            fprintf(stderr, "testAppend: FAIL: length %d, expected %d\n", traceLen(a), i + 1 - first);
+            ok = 0;
+        }
+    }
+
+    struct traceView tv = { 0 };
+    if (ok && (traceViewGet(a, &tv) || tv.len != POINTS - first
+                || !compare("testAppend", trace + first, trace_all + first / 4, tv.trace, tv.trace_all, tv.len)))
+        ok = 0;
+    if (ok && (a->trace_len >= TRACE_TAIL_POINTS + TRACE_BLOCK_POINTS || !a->trace_blocks)) {
+        fprintf(stderr, "testAppend: FAIL: tail not sealed (%d points)\n", a->trace_len);
+        ok = 0;
+    }
+    traceViewFree(&tv);
+
+    free_aircraft(a);
+    free(trace);
+    free(trace_all);
+    fprintf(stderr, "testAppend:         %s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// a smoother flight than fill_trace(): straight legs with turns, climbs and descents,
+// a ground phase now and then
+static void fill_smooth(struct state *trace, struct state_all *trace_all, int len) {
+    fill_trace(trace, trace_all, len, 0);
+    double lat = 50.1, lon = 8.1, alt = 200;
+    double heading = 0.3, climb = 0;
+    for (int i = 0; i < len; i++) {
+        struct state *s = &trace[i];
+        if (i % 500 == 0)
+            heading += ((int) rnd(200) - 100) / 100.0;
+        if (i % 300 == 0)
+            climb = ((int) rnd(3) - 1) * 2;
+        double dt = (s->timestamp - (i ? trace[i - 1].timestamp : s->timestamp)) / 8000.0;
+        lat += 0.002 * dt * cos(heading);
+        lon += 0.002 * dt * sin(heading);
+        alt = fmax(0, fmin(1600, alt + climb * dt));
+        s->lat = (int32_t) nearbyint((lat + ((int) rnd(100) - 50) * 1e-6) * 1E6);
+        s->lon = (int32_t) nearbyint((lon + ((int) rnd(100) - 50) * 1e-6) * 1E6);
+        s->altitude = (int16_t) alt;
+        s->flags.stale = 0;
+        s->flags.rate_valid = 1;
+        s->flags.leg_marker = 0;
+        s->flags.on_ground = (i / 1000) % 7 == 3;
+        // new squawk every 2000 points
+        if (i % 4 == 0) {
+            trace_all[i / 4] = trace_all[0];
+            trace_all[i / 4].squawk = 0x1000 + i / 2000;
+        }
+    }
+}
+
+// distance in meters of point k from the time interpolation between s and e
+static double interpolation_error(const struct state *s, const struct state *e, const struct state *k) {
+    double f = (double) (k->timestamp - s->timestamp) / (double) (e->timestamp - s->timestamp);
+    double lat = (s->lat + f * (e->lat - s->lat)) / 1E6;
+    double lon = (s->lon + f * (e->lon - s->lon)) / 1E6;
+    return greatcircle(lat, lon, k->lat / 1E6, k->lon / 1E6);
+}
+
+// thinning out the older blocks: the kept points are a subset of the original ones
+// including the required ones and the removed ones are close to the compacted trace
+static int testCompact() {
+    struct state *trace = malloc(POINTS * sizeof(struct state));
+    struct state_all *trace_all = malloc(POINTS / 4 * sizeof(struct state_all));
+    int len = POINTS;
+    fill_smooth(trace, trace_all, len);
+    struct aircraft *a = make_aircraft(trace, trace_all, len);
+    traceSeal(a);
+    int ok = 1;
+
+    int keep[] = { 301, 1001, 2050, 5003 };
+    int keep_len = sizeof(keep) / sizeof(keep[0]);
+    uint64_t before = trace[len / 2].timestamp;
+    double max_error = 0;
+    int budget = len;
+    int removed = traceCompact(a, before, keep, keep_len, &budget, &max_error);
+
+    // every original point is either kept or its error is within the bound
+    struct traceView tv = { 0 };
+    if (removed <= 0 || traceLen(a) != len - removed || traceViewGet(a, &tv) || tv.len != len - removed) {
+        fprintf(stderr, "testCompact: FAIL: removed %d, len %d\n", removed, traceLen(a));
+        ok = 0;
+    }
+    char *kept = calloc(len, 1);
+    int j = 0;
+    for (int i = 0; i < len && ok; i++) {
+        if (j < tv.len && !memcmp(&tv.trace[j], &trace[i], sizeof(struct state))) {
+            kept[i] = 1;
+            // state_all: the newest one at or before the point
+            if (j % 4 == 0 && memcmp(&tv.trace_all[j / 4], &trace_all[i / 4], sizeof(struct state_all))) {
+                fprintf(stderr, "testCompact: FAIL: state_all of point %d\n", i);
+                ok = 0;
+            }
+            j++;
+        }
+    }
+    if (ok && j != tv.len) {
+        fprintf(stderr, "testCompact: FAIL: point %d of the compacted trace is not an original point\n", j);
+        ok = 0;
+    }
+
+    double worst = 0;
+    int last_kept = 0;
+    for (int i = 1; i < len && ok; i++) {
+        if (!kept[i])
+            continue;
+        for (int k = last_kept + 1; k < i; k++)
+            worst = fmax(worst, interpolation_error(&trace[last_kept], &trace[i], &trace[k]));
+        last_kept = i;
+    }
+    // 1 % for the equirectangular approximation
+    if (ok && (worst > 101 || fabs(worst - max_error) > 0.01 * worst + 0.5)) {
+        fprintf(stderr, "testCompact: FAIL: max error %.1f m, reported %.1f m\n", worst, max_error);
+        ok = 0;
+    }
+
+    // block ends, keep and flag transitions are kept, nothing after before is touched
+    for (int k = 0; k < keep_len && ok; k++)
+        ok = kept[keep[k]];
+    for (int i = 1; i < len && ok; i++) {
+        if (trace[i].flags.on_ground != trace[i - 1].flags.on_ground || i % TRACE_BLOCK_POINTS == 0)
+            ok = kept[i] && kept[i - 1];
+        if (trace[i].timestamp >= before)
+            ok = ok && kept[i];
+    }
+    if (!ok)
+        fprintf(stderr, "testCompact: FAIL: required point removed\n");
+
+    for (struct traceBlock *block = a->trace_blocks; block && ok; block = block->next) {
+        if (block->count % 4 || block->compacted != (block->last < before)) {
+            fprintf(stderr, "testCompact: FAIL: block of %d points, compacted %d\n", block->count, block->compacted);
+            ok = 0;
+        }
+    }
+
+    if (ok && !check_iter(a, tv.trace, tv.trace_all, tv.len))
+        ok = 0;
+    for (int k = 0; k < 50 && ok; k++) {
+        uint64_t ts = trace[rnd(len)].timestamp + rnd(2) - 1;
+        int expected = traceViewFindTimestamp(&tv, ts);
+        if (traceFindTimestamp(a, ts) != expected) {
+            fprintf(stderr, "testCompact: FAIL: traceFindTimestamp %d, expected %d\n", traceFindTimestamp(a, ts), expected);
+            ok = 0;
+        }
+    }
+
+    // blocks are only compacted once
+    if (ok && traceCompact(a, before, NULL, 0, &budget, &max_error) != 0) {
+        fprintf(stderr, "testCompact: FAIL: compacted twice\n");
+        ok = 0;
+    }
+
+    // also after a restart: the trace loaded into the tail is sealed into blocks with
+    // other boundaries, only trace_compacted tells which points were thinned out
+    struct aircraft *b = make_aircraft(tv.trace, tv.trace_all, tv.len);
+    b->trace_compacted = a->trace_compacted;
+    traceSeal(b);
+    if (ok && (a->trace_compacted == 0 || traceCompact(b, before, NULL, 0, &budget, &max_error) != 0)) {
+        fprintf(stderr, "testCompact: FAIL: compacted again after loading\n");
+        ok = 0;
+    }
+    free_aircraft(b);
+
+    // the budget limits the blocks compacted per call
+    b = make_aircraft(trace, trace_all, len);
+    traceSeal(b);
+    budget = 1;
+    removed = traceCompact(b, before, NULL, 0, &budget, &max_error);
+    int blocks = 0;
+    for (struct traceBlock *block = b->trace_blocks; block; block = block->next)
+        blocks += block->compacted;
+    if (ok && (removed <= 0 || budget != 0 || blocks != 1 || b->trace_compacted != b->trace_blocks->last)) {
+        fprintf(stderr, "testCompact: FAIL: budget, %d blocks compacted\n", blocks);
+        ok = 0;
+    }
+    free_aircraft(b);
+
+    int count = a->trace_blocks ? a->trace_blocks->count : 0;
+    if (ok && traceDropOldest(a) != count) {
+        fprintf(stderr, "testCompact: FAIL: traceDropOldest\n");
+        ok = 0;
+    }
+
+    traceViewFree(&tv);
+    free(kept);
+    free_aircraft(a);
+    free(trace);
+    free(trace_all);
+    fprintf(stderr, "testCompact:        %s\n", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+static void benchmark() {
+    struct state *trace = malloc(POINTS * sizeof(struct state));
+    struct state_all *trace_all = malloc(POINTS / 4 * sizeof(struct state_all));
+    fill_trace(trace, trace_all, POINTS, 0);
+    struct aircraft *a = make_aircraft(trace, trace_all, POINTS);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    traceSeal(a);
+    double pack = elapsed(&start);
+
+    size_t bytes = 0;
+    for (struct traceBlock *block = a->trace_blocks; block; block = block->next)
+        bytes += sizeof(struct traceBlock) + block->size;
+    double flat = sizeof(struct state) + sizeof(struct state_all) / 4.0;
+
+    int rounds = 200;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < rounds; i++) {
+        struct traceView tv;
+        traceViewGet(a, &tv);
+        traceViewFree(&tv);
+    }
+    double unpack = elapsed(&start);
+
+    fprintf(stderr, "packed: %.1f bytes per point (flat %.1f), pack %.1f Mpoints/s, unpack %.1f Mpoints/s\n",
+            bytes / (double) a->trace_packed, flat,
+            a->trace_packed / pack / 1e6, a->trace_packed * (double) rounds / unpack / 1e6);
+
+    int finds = 100000;
+    uint64_t first = trace[0].timestamp;
+    uint64_t span = trace[POINTS - 1].timestamp - first;
+    volatile int sink = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < finds; i++)
+        sink += traceFindTimestamp(a, first + rnd(span));
+    double find = elapsed(&start);
+    fprintf(stderr, "traceFindTimestamp: %.2f us per call (%d points)\n", find / finds * 1e6, POINTS);
+    free_aircraft(a);
+
+    fill_smooth(trace, trace_all, POINTS);
+    a = make_aircraft(trace, trace_all, POINTS);
+    traceSeal(a);
+    size_t before = 0, after = 0;
+    for (struct traceBlock *block = a->trace_blocks; block; block = block->next)
+        before += sizeof(struct traceBlock) + block->size;
+    int packed = a->trace_packed;
+    double max_error = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int budget = POINTS;
+    int removed = traceCompact(a, UINT64_MAX, NULL, 0, &budget, &max_error);
+    double compact = elapsed(&start);
+    for (struct traceBlock *block = a->trace_blocks; block; block = block->next)
+        after += sizeof(struct traceBlock) + block->size;
+    fprintf(stderr, "traceCompact: %d of %d points removed, max error %.1f m, %zu -> %zu bytes, %.1f Mpoints/s\n",
+            removed, packed, max_error, before, after, packed / compact / 1e6);
+
+    free_aircraft(a);
+    free(trace);
+    free(trace_all);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && !strcmp(argv[1], "benchmark")) {
+        benchmark();
+        return 0;
+    }
+
+    int ok = 1;
+    ok &= testBlockRoundTrip(0);
+    ok &= testBlockRoundTrip(1);
+    ok &= testEncodeRange();
+    ok &= testSealView();
+    ok &= testAppend();
+    ok &= testCompact();
+    return ok ? 0 : 1;
+}
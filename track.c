@@ -60,6 +60,18 @@ uint32_t modeAC_lastcount[4096];
 uint32_t modeAC_match[4096];
 uint32_t modeAC_age[4096];
 
+// Mode A/C match index:
+// aircraft by squawk and by mode C altitude band, updated as messages come in
+// so trackMatchAC only needs to look at codes with recent replies
+static struct aircraft *modeA_index[4096];
+static struct aircraft *modeC_index[MODEAC_C_BANDS];
+// mode A/C codes (as index) with a nonzero reply count
+static uint16_t modeAC_active[4096];
+static int modeAC_active_len;
+
+// blocks traceCompact() may still thin out in this removeStale pass
+static int compactBudget;
+
 static void cleanupAircraft(struct aircraft *a);
 static void globe_stuff(struct aircraft *a, struct modesMessage *mm, double new_lat, double new_lon, uint64_t now);
 static void showPositionDebug(struct aircraft *a, struct modesMessage *mm, uint64_t now);
@@ -156,45 +168,6 @@ static int compare_validity(const data_validity *lhs, const data_validity *rhs)
 // CPR position updating
 //
 
-// Distance between points on a spherical earth.
-// This has up to 0.5% error because the earth isn't actually spherical
-// (but we don't use it in situations where that matters)
-
-double greatcircle(double lat0, double lon0, double lat1, double lon1) {
-    double dlat, dlon;
-
-    lat0 = lat0 * M_PI / 180.0;
-    lon0 = lon0 * M_PI / 180.0;
-    lat1 = lat1 * M_PI / 180.0;
-    lon1 = lon1 * M_PI / 180.0;
-
-    dlat = fabs(lat1 - lat0);
-    dlon = fabs(lon1 - lon0);
-
-    // use haversine for small distances for better numerical stability
-    if (dlat < 0.001 && dlon < 0.001) {
-        double a = sin(dlat / 2) * sin(dlat / 2) + cos(lat0) * cos(lat1) * sin(dlon / 2) * sin(dlon / 2);
-        return 6371e3 * 2 * atan2(sqrt(a), sqrt(1.0 - a));
-    }
-
-    // spherical law of cosines
-    return 6371e3 * acos(sin(lat0) * sin(lat1) + cos(lat0) * cos(lat1) * cos(dlon));
-}
-
-static float bearing(double lat0, double lon0, double lat1, double lon1) {
-    lat0 = lat0 * M_PI / 180.0;
-    lon0 = lon0 * M_PI / 180.0;
-    lat1 = lat1 * M_PI / 180.0;
-    lon1 = lon1 * M_PI / 180.0;
-
-    double y = sin(lon1-lon0)*cos(lat1);
-    double x = cos(lat0)*sin(lat1) - sin(lat0)*cos(lat1)*cos(lon1-lon0);
-    double res = (atan2(y, x) * 180 / M_PI + 360);
-    while (res > 360)
-        res -= 360;
-    return (float) res;
-}
-
 static void update_range_histogram(double lat, double lon) {
     double range = 0;
     int valid_latlon = Modes.bUserFlags & MODES_USER_LATLON_VALID;
@@ -228,7 +201,7 @@ static void update_range_histogram(double lat, double lon) {
 
 static int speed_check(struct aircraft *a, datasource_t source, double lat, double lon, struct modesMessage *mm) {
     uint64_t elapsed;
-    double distance;
+    double distance = 0;
     double range;
     double speed;
     double calc_track = 0;
@@ -300,10 +273,7 @@ static int speed_check(struct aircraft *a, datasource_t source, double lat, doub
             speed = 200;
     }
 
-    // find actual distance
-    distance = greatcircle(oldLat, oldLon, lat, lon);
-
-    if (!surface && distance > 1 && source > SOURCE_MLAT
+    if (!surface && greatcircle_cmp(oldLat, oldLon, lat, lon, 1) > 0 && source > SOURCE_MLAT
             && trackDataAge(now, &a->track_valid) < 7 * 1000
             && trackDataAge(now, &a->position_valid) < 7 * 1000
             && (oldLat != lat || oldLon != lon)
@@ -322,7 +292,11 @@ static int speed_check(struct aircraft *a, datasource_t source, double lat, doub
     // plus distance covered at the given speed for the elapsed time + 1 seconds.
     range = (surface ? 0.1e3 : 0.0e3) + ((elapsed + 1000.0) / 1000.0) * (speed * 1852.0 / 3600.0);
 
-    inrange = (distance <= range);
+    inrange = (greatcircle_cmp(oldLat, oldLon, lat, lon, range) <= 0);
+
+    // the actual distance is only needed when the check failed and for the debug output
+    if (!inrange || Modes.debug_cpr || Modes.debug_speed_check || a->addr == Modes.cpr_focus)
+        distance = greatcircle(oldLat, oldLon, lat, lon);
 
     if ((source > SOURCE_MLAT && track_diff < 190 && !inrange && (Modes.debug_cpr || Modes.debug_speed_check))
             || (a->addr == Modes.cpr_focus && distance > 0.1)) {
@@ -454,8 +428,8 @@ static int doGlobalCPR(struct aircraft *a, struct modesMessage *mm, double *lat,
 
     // check max range
     if (Modes.maxRange > 0 && (Modes.bUserFlags & MODES_USER_LATLON_VALID)) {
-        double range = greatcircle(Modes.fUserLat, Modes.fUserLon, *lat, *lon);
-        if (range > Modes.maxRange) {
+        if (greatcircle_cmp(Modes.fUserLat, Modes.fUserLon, *lat, *lon, Modes.maxRange) > 0) {
+            double range = greatcircle(Modes.fUserLat, Modes.fUserLon, *lat, *lon);
             if (a->addr == Modes.cpr_focus || Modes.debug_cpr) {
                 fprintf(stderr, "Global range check failed: %06x: %.3f,%.3f, max range %.1fkm, actual %.1fkm\n",
                         a->addr, *lat, *lon, Modes.maxRange / 1000.0, range / 1000.0);
@@ -557,8 +531,7 @@ static int doLocalCPR(struct aircraft *a, struct modesMessage *mm, double *lat,
 
     // check range limit
     if (range_limit > 0) {
-        double range = greatcircle(reflat, reflon, *lat, *lon);
-        if (range > range_limit) {
+        if (greatcircle_cmp(reflat, reflon, *lat, *lon, range_limit) > 0) {
             Modes.stats_current.cpr_local_range_checks++;
             return (-1);
         }
@@ -1077,6 +1050,94 @@ static int altitude_to_feet(int raw, altitude_unit_t unit) {
     }
 }
 
+static void modeACIndexUnlink(struct aircraft *a, int kind) {
+    int bucket = a->modeAC_bucket[kind] - 1;
+    if (bucket < 0)
+        return;
+
+    struct aircraft **heads = kind ? modeC_index : modeA_index;
+    struct aircraft *next = a->modeAC_next[kind];
+    struct aircraft *prev = a->modeAC_prev[kind];
+
+    if (prev)
+        prev->modeAC_next[kind] = next;
+    else
+        heads[bucket] = next;
+    if (next)
+        next->modeAC_prev[kind] = prev;
+
+    a->modeAC_next[kind] = NULL;
+    a->modeAC_prev[kind] = NULL;
+    a->modeAC_bucket[kind] = 0;
+}
+
+static void modeACIndexSet(struct aircraft *a, int kind, int bucket) {
+    if (a->modeAC_bucket[kind] - 1 == bucket)
+        return;
+
+    modeACIndexUnlink(a, kind);
+
+    if (bucket < 0)
+        return;
+
+    struct aircraft **heads = kind ? modeC_index : modeA_index;
+    a->modeAC_next[kind] = heads[bucket];
+    a->modeAC_prev[kind] = NULL;
+    if (heads[bucket])
+        heads[bucket]->modeAC_prev[kind] = a;
+    heads[bucket] = a;
+    a->modeAC_bucket[kind] = bucket + 1;
+}
+
+// move the aircraft to the index buckets for its current squawk / altitude
+// validity is checked when matching, the buckets only depend on the values
+static void modeACIndexUpdate(struct aircraft *a) {
+    int bucketA = -1;
+    int bucketC = -1;
+
+    if (trackDataValid(&a->squawk_valid))
+        bucketA = modeAToIndex(a->squawk);
+
+    if (trackDataValid(&a->altitude_baro_valid)) {
+        bucketC = (a->altitude_baro + 49) / 100 + MODEAC_C_OFFSET;
+        if (bucketC < 0 || bucketC >= MODEAC_C_BANDS)
+            bucketC = -1;
+    }
+
+    modeACIndexSet(a, 0, bucketA);
+    modeACIndexSet(a, 1, bucketC);
+}
+
+void modeACIndexRemove(struct aircraft *a) {
+    modeACIndexUnlink(a, 0);
+    modeACIndexUnlink(a, 1);
+}
+
+// undo a message: restore the copy of the aircraft made before it was applied,
+// except for the data other threads replace while the message is processed
+static void restoreScratch(struct aircraft *a) {
+    struct aircraft *scratch = Modes.scratch;
+
+    pthread_mutex_lock(&Modes.traceBundleMutex);
+    pthread_mutex_lock(&Modes.jsonFragMutex);
+
+    scratch->trace_recent = a->trace_recent;
+    scratch->legs = a->legs;
+
+    scratch->json_frag = a->json_frag;
+    scratch->json_frag_len = a->json_frag_len;
+    scratch->json_frag_hole = a->json_frag_hole;
+    scratch->json_frag_expire = a->json_frag_expire;
+    scratch->json_frag_version = a->json_frag_version;
+    // the fragment might show the state being undone
+    scratch->json_version = a->json_version + 1;
+
+    memcpy(a, scratch, sizeof(struct aircraft));
+
+    pthread_mutex_unlock(&Modes.jsonFragMutex);
+    pthread_mutex_unlock(&Modes.traceBundleMutex);
+}
+
 //
 //=========================================================================
 //
@@ -1089,7 +1150,9 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
 
     if (mm->msgtype == 32) {
         // Mode A/C, just count it (we ignore SPI)
-        modeAC_count[modeAToIndex(mm->squawk)]++;
+        unsigned i = modeAToIndex(mm->squawk);
+        if (modeAC_count[i]++ == 0)
+            modeAC_active[modeAC_active_len++] = i;
         return NULL;
     }
 
@@ -1106,6 +1169,10 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
         a = aircraftCreate(mm); // ., create a new record for it,
     }
 
+    // the db was reloaded since registration / type were looked up
+    if (a->dbGeneration != Modes.dbGeneration)
+        updateTypeReg(a);
+
     bool haveScratch = false;
     if (mm->cpr_valid || mm->sbs_pos_valid) {
         memcpy(Modes.scratch, a, sizeof(struct aircraft));
@@ -1143,6 +1210,10 @@ struct aircraft *trackUpdateFromMessage(struct modesMessage *mm) {
 
     a->messages++;
 
+    // the fields of the aircraft.json object are written in too many places to track
+    // them one by one, any message can change them (messages / seen / rssi are written live)
+    a->json_version++;
+
     // update addrtype
     if (a->addrtype_updated > now)
         a->addrtype_updated = now;
@@ -1590,13 +1661,13 @@ end_alt:
         int old_jaero = 0;
         if (mm->source == SOURCE_JAERO && a->trace_len > 0) {
             for (int i = max(0, a->trace_len - 10); i < a->trace_len; i++) {
-                if ( (int32_t) (mm->decoded_lat * 1E6) == a->trace[i].lat
-                        && (int32_t) (mm->decoded_lon * 1E6) == a->trace[i].lon )
+                if ( (int32_t) (mm->decoded_lat * 1E6) == traceAt(a, i)->lat
+                        && (int32_t) (mm->decoded_lon * 1E6) == traceAt(a, i)->lon )
                     old_jaero = 1;
             }
         }
         // avoid using already received positions
-        if (old_jaero || greatcircle(a->lat, a->lon, mm->decoded_lat, mm->decoded_lon) < 1) {
+        if (old_jaero || greatcircle_cmp(a->lat, a->lon, mm->decoded_lat, mm->decoded_lon, 1) < 0) {
         } else if (
                 mm->source != SOURCE_PRIO
                 && !speed_check(a, mm->source, mm->decoded_lat, mm->decoded_lon, mm)
@@ -1649,7 +1720,7 @@ end_alt:
     }
 
     if (haveScratch && (mm->garbage || mm->pos_bad || mm->duplicate)) {
-        memcpy(a, Modes.scratch, sizeof(struct aircraft));
+        restoreScratch(a);
         if (mm->pos_bad) {
             position_bad(mm, a);
         }
@@ -1660,6 +1731,9 @@ end_alt:
         a->first_message = NULL;
     }
 
+    if (Modes.mode_ac)
+        modeACIndexUpdate(a);
+
     return (a);
 }
 
@@ -1670,64 +1744,52 @@ end_alt:
 // Periodically match up mode A/C results with mode S results
 
 static void trackMatchAC(uint64_t now) {
-    // clear match flags
-    for (unsigned i = 0; i < 4096; ++i) {
-        modeAC_match[i] = 0;
-    }
-
-    // scan aircraft list, look for matches
-    for (int j = 0; j < AIRCRAFT_BUCKETS; j++) {
-        for (struct aircraft *a = Modes.aircraft[j]; a; a = a->next) {
-            if ((now - a->seen) > 5000) {
-                continue;
-            }
-
-            // match on Mode A
-            if (trackDataValid(&a->squawk_valid)) {
-                unsigned i = modeAToIndex(a->squawk);
-                if ((modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES) {
-                    a->modeA_hit = 1;
-                    modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
-                }
-            }
+    for (int k = 0; k < modeAC_active_len; k++) {
+        unsigned i = modeAC_active[k];
 
-            // match on Mode C (+/- 100ft)
-            if (trackDataValid(&a->altitude_baro_valid)) {
-                int modeC = (a->altitude_baro + 49) / 100;
+        // clear match flag
+        modeAC_match[i] = 0;
 
-                unsigned modeA = modeCToModeA(modeC);
-                unsigned i = modeAToIndex(modeA);
-                if (modeA && (modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES) {
-                    a->modeC_hit = 1;
-                    modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
-                }
+        if ((modeAC_count[i] - modeAC_lastcount[i]) < TRACK_MODEAC_MIN_MESSAGES)
+            continue;
 
-                modeA = modeCToModeA(modeC + 1);
-                i = modeAToIndex(modeA);
-                if (modeA && (modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES) {
-                    a->modeC_hit = 1;
-                    modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
-                }
+        // match on Mode A
+        for (struct aircraft *a = modeA_index[i]; a; a = a->modeAC_next[0]) {
+            if ((now - a->seen) > 5000 || !trackDataValid(&a->squawk_valid))
+                continue;
+            a->modeA_hit = 1;
+            modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
+        }
 
-                modeA = modeCToModeA(modeC - 1);
-                i = modeAToIndex(modeA);
-                if (modeA && (modeAC_count[i] - modeAC_lastcount[i]) >= TRACK_MODEAC_MIN_MESSAGES) {
-                    a->modeC_hit = 1;
-                    modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
-                }
+        // match on Mode C (+/- 100ft)
+        int modeC = modeAToModeC(indexToModeA(i));
+        if (modeC == INVALID_ALTITUDE)
+            continue;
+        for (int band = modeC - 1; band <= modeC + 1; band++) {
+            int bucket = band + MODEAC_C_OFFSET;
+            if (bucket < 0 || bucket >= MODEAC_C_BANDS)
+                continue;
+            for (struct aircraft *a = modeC_index[bucket]; a; a = a->modeAC_next[1]) {
+                if ((now - a->seen) > 5000 || !trackDataValid(&a->altitude_baro_valid))
+                    continue;
+                a->modeC_hit = 1;
+                modeAC_match[i] = (modeAC_match[i] ? 0xFFFFFFFF : a->addr);
             }
         }
     }
 
     // reset counts for next time
-    for (unsigned i = 0; i < 4096; ++i) {
-        if (!modeAC_count[i])
-            continue;
+    for (int k = 0; k < modeAC_active_len; ) {
+        unsigned i = modeAC_active[k];
 
         if ((modeAC_count[i] - modeAC_lastcount[i]) < TRACK_MODEAC_MIN_MESSAGES) {
             if (++modeAC_age[i] > 15) {
                 // not heard from for a while, clear it out
                 modeAC_lastcount[i] = modeAC_count[i] = modeAC_age[i] = 0;
+                modeAC_match[i] = 0;
+                // swap in the last active code and look at this position again
+                modeAC_active[k] = modeAC_active[--modeAC_active_len];
+                continue;
             }
         } else {
             // this one is live
@@ -1742,6 +1804,7 @@ static void trackMatchAC(uint64_t now) {
         }
 
         modeAC_lastcount[i] = modeAC_count[i];
+        k++;
     }
 }
 
@@ -1769,6 +1832,8 @@ static void trackRemoveStaleAircraft(struct aircraft **freeList, uint64_t now) {
     if (Modes.api)
         apiClear();
 
+    compactBudget = TRACE_COMPACT_BLOCKS;
+
     int fullWrite = 0;
     if (Modes.doFullTraceWrite) {
         Modes.doFullTraceWrite = 0;
@@ -1803,6 +1868,10 @@ static void trackRemoveStaleAircraft(struct aircraft **freeList, uint64_t now) {
 
                 // remove from the globeList
                 set_globe_index(a, -5);
+                // and from the mode A/C match index
+                modeACIndexRemove(a);
+                // and from the state, replaying the log mustn't bring it back
+                save_removed(a);
 
                 // Remove the element from the linked list, with care
                 // if we are removing the first element
@@ -1838,7 +1907,11 @@ static void trackRemoveStaleAircraft(struct aircraft **freeList, uint64_t now) {
                             a->trace_write = 1;
                         }
 
-                        if (fullWrite) {
+                        if (fullWrite && Modes.globe_history_pack) {
+                            // appending to the packs is cheap, no need to hurry: spread over 15 mins
+                            a->trace_next_fw = now + random() % (15 * MINUTES);
+                            a->trace_full_write = 0xc0ffee;
+                        } else if (fullWrite) {
                             if (now < a->seen_pos + 3 * HOURS) {
                                 a->trace_next_fw = now + random() % (2 * MINUTES); // spread over 2 mins
                                 a->trace_full_write = 0xc0ffee;
@@ -1926,6 +1999,10 @@ void trackPeriodicUpdate() {
 
     netFreeClients();
 
+    // swap in the db if the db thread has loaded a new one
+    // (aircraft pick up the changes lazily)
+    dbFinishUpdate();
+
     end_cpu_timing(&start_time, &Modes.stats_current.remove_stale_cpu);
     int64_t elapsed = stopWatch(&watch);
 
@@ -1963,12 +2040,6 @@ void trackPeriodicUpdate() {
     if (Modes.netReceiverIdJson && Modes.json_dir && upcount % 5 == 2)
         writeJsonToFile(Modes.json_dir, "receivers.json", generateReceiversJson());
 
-    // one iteration later, finish db update if db was updated
-    dbFinishUpdate();
-    // db update check every 5 min
-    if (upcount % 300 == 0)
-        dbUpdate();
-
     end_cpu_timing(&start_time, &Modes.stats_current.heatmap_and_state_cpu);
 }
 
@@ -2010,8 +2081,7 @@ static void cleanupAircraft(struct aircraft *a) {
 static void globe_stuff(struct aircraft *a, struct modesMessage *mm, double new_lat, double new_lon, uint64_t now) {
 
     if (trackDataAge(now, &a->track_valid) >= 10000 && a->seen_pos) {
-        double distance = greatcircle(a->lat, a->lon, new_lat, new_lon);
-        if (distance > 100)
+        if (greatcircle_cmp(a->lat, a->lon, new_lat, new_lon, 100) > 0)
             a->calc_track = bearing(a->lat, a->lon, new_lat, new_lon);
     }
 
@@ -2019,20 +2089,19 @@ static void globe_stuff(struct aircraft *a, struct modesMessage *mm, double new_
 
     if (Modes.keep_traces) {
 
-        if (!a->trace) {
+        if (!a->trace_alloc) {
 
-            a->trace_alloc = GLOBE_STEP;
-            a->trace = malloc(a->trace_alloc * sizeof(struct state));
-            a->trace_all = malloc((1 + a->trace_alloc / 4) * sizeof(struct state_all));
-            a->trace->timestamp = now;
+            if (traceReserve(a, GLOBE_STEP))
+                goto no_save_state;
+            traceAt(a, 0)->timestamp = now;
             a->trace_full_write = 9999; // rewrite full history file
 
             //fprintf(stderr, "%06x: new trace\n", a->addr);
 
         } else if (a->trace_len > 5) {
             for (int i = a->trace_len - 1; i >= a->trace_len - 5; i--) {
-                if ( (int32_t) (new_lat * 1E6) == a->trace[i].lat
-                        && (int32_t) (new_lon * 1E6) == a->trace[i].lon ) {
+                if ( (int32_t) (new_lat * 1E6) == traceAt(a, i)->lat
+                        && (int32_t) (new_lon * 1E6) == traceAt(a, i)->lon ) {
                     return;
                 }
             }
@@ -2046,9 +2115,7 @@ static void globe_stuff(struct aircraft *a, struct modesMessage *mm, double new_
             goto no_save_state;
         }
 
-        struct state *trace = a->trace;
-
-        struct state *new = &(trace[a->trace_len]);
+        struct state *new = traceAt(a, a->trace_len);
         memset(new, 0, sizeof(struct state));
 
         if (now > a->seenPosReliable + 15 * SECONDS) {
@@ -2079,7 +2146,7 @@ static void globe_stuff(struct aircraft *a, struct modesMessage *mm, double new_
 
 
 
-        last = &(trace[a->trace_len-1]);
+        last = traceAt(a, a->trace_len - 1);
         float track_diff = fabs(track - last->track / 10.0);
         uint64_t elapsed = now - last->timestamp;
         if (now < last->timestamp)
@@ -2097,12 +2164,10 @@ static void globe_stuff(struct aircraft *a, struct modesMessage *mm, double new_
             goto save_state;
         }
 
-        double distance = greatcircle(a->trace_llat, a->trace_llon, new_lat, new_lon);
-
         // record non moving targets every 10 minutes
         if (elapsed > 20 * Modes.json_trace_interval)
             goto save_state;
-        if (distance < 40)
+        if (greatcircle_cmp(a->trace_llat, a->trace_llon, new_lat, new_lon, 40) < 0)
             goto no_save_state;
 
         if (elapsed > Modes.json_trace_interval) // default 30000 ms
@@ -2116,6 +2181,7 @@ static void globe_stuff(struct aircraft *a, struct modesMessage *mm, double new_
             goto save_state;
 
         if (on_ground) {
+            double distance = greatcircle(a->trace_llat, a->trace_llon, new_lat, new_lon);
             if (distance * track_diff > 200)
                 goto save_state;
 
@@ -2241,7 +2307,7 @@ save_state:
         // trace_all stuff:
 
         if (a->trace_len % 4 == 0) {
-            struct state_all *new_all = &(a->trace_all[a->trace_len/4]);
+            struct state_all *new_all = traceAllAt(a, a->trace_len);
             memset(new_all, 0, sizeof(struct state_all));
 
             to_state_all(a, new_all, now);
@@ -2337,14 +2403,10 @@ static void resize_trace(struct aircraft *a, uint64_t now) {
         return;
     }
 
-    if (a->trace_len == 0) {
-
-        free(a->trace);
-        free(a->trace_all);
+    if (traceLen(a) == 0) {
 
-        a->trace_alloc = 0;
-        a->trace = NULL;
-        a->trace_all = NULL;
+        traceFree(a);
+        legsFree(a);
 
         unlink_trace(a);
         // if the trace length is zero, the trace is deleted from run
@@ -2360,62 +2422,52 @@ static void resize_trace(struct aircraft *a, uint64_t now) {
     if (a->addr & MODES_NON_ICAO_ADDRESS)
         keep_after = now - TRACK_AIRCRAFT_NON_ICAO_TTL;
 
-    if (a->trace_len == GLOBE_TRACE_SIZE || a->trace->timestamp < keep_after - 20 * MINUTES ) {
-        int new_start = a->trace_len;
+    // the tail can fill its segments before the next call, keep some room
+    int near_limit = (traceLen(a) + 4 * GLOBE_STEP >= GLOBE_TRACE_SIZE);
 
-        if (a->trace_len + GLOBE_STEP / 2 >= GLOBE_TRACE_SIZE) {
-            new_start = GLOBE_TRACE_SIZE / 64;
-        } else {
-            int found = 0;
-            for (int i = 0; i < a->trace_len; i++) {
-                struct state *state = &a->trace[i];
-                if (state->timestamp > keep_after) {
-                    new_start = i;
-                    found = 1;
+    if (near_limit)
+        fprintf(stderr, "Quite a long trace: %06x (%d).\n", a->addr, traceLen(a));
+
+    if (near_limit || traceFirstTimestamp(a) < keep_after - 20 * MINUTES ) {
+        // expired points are freed a whole block / segment at a time
+        int dropped = 0;
+        while (traceLen(a) > 0) {
+            if (near_limit) {
+                if (dropped >= GLOBE_TRACE_SIZE / 64 && traceLen(a) + 4 * GLOBE_STEP < GLOBE_TRACE_SIZE)
                     break;
-                }
+            } else if (traceOldestLast(a) > keep_after) {
+                break;
             }
-            if (!found)
-                new_start = a->trace_len;
-        }
-
-        if (new_start != a->trace_len) {
-            new_start -= (new_start % 4);
-
-            if (new_start % 4 != 0)
-                fprintf(stderr, "not divisible by 4: %d %d\n", new_start, a->trace_len);
+            dropped += traceDropOldest(a);
         }
 
-
-        a->trace_len -= new_start;
-
-        memmove(a->trace, a->trace + new_start, a->trace_len * sizeof(struct state));
-        memmove(a->trace_all, a->trace_all + new_start / 4, a->trace_len / 4 * sizeof(struct state_all));
-
         //a->trace_write = 1;
         //a->trace_full_write = 9999; // rewrite full history file
-
     }
 
-    if (a->trace_len && a->trace_len + GLOBE_STEP / 2 >= a->trace_alloc) {
-        a->trace_alloc = a->trace_alloc * 5 / 4;
-        if (a->trace_alloc > GLOBE_TRACE_SIZE)
-            a->trace_alloc = GLOBE_TRACE_SIZE;
-        a->trace = realloc(a->trace, a->trace_alloc * sizeof(struct state));
-        a->trace_all = realloc(a->trace_all, (1 + a->trace_alloc / 4) * sizeof(struct state_all));
-
-        if (a->trace_len >= GLOBE_TRACE_SIZE / 2)
-            fprintf(stderr, "Quite a long trace: %06x (%d).\n", a->addr, a->trace_len);
+    // keep the unpacked tail short, older points are packed into blocks
+    traceSeal(a);
 
-        if (a->trace_alloc > GLOBE_TRACE_SIZE)
-            fprintf(stderr, "GLOBE_TRACE_SIZE EXCEEDED!: %06x (%d).\n", a->addr, a->trace_len);
+    // runs under lockThreads(): the budget bounds the work per pass, the
+    // remaining blocks are picked up by the next call for this aircraft
+    if (Modes.trace_compact_age && now > Modes.trace_compact_age && compactBudget > 0) {
+        // the leg markers are only valid if the front of the trace wasn't dropped
+        struct legState *ls = a->legs;
+        int valid = (ls && ls->first_ts == traceFirstTimestamp(a));
+        double max_error = 0;
+        int removed = traceCompact(a, now - Modes.trace_compact_age,
+                valid ? ls->markers : NULL, valid ? ls->markers_len : 0, &compactBudget, &max_error);
+        if (removed) {
+            // the indexes changed, start the leg detection over and save the whole trace
+            legsFree(a);
+            a->chk_trace_len = 0;
+            Modes.stats_current.trace_compact_points += removed;
+            Modes.stats_current.trace_compact_max_error = fmaxf(Modes.stats_current.trace_compact_max_error, max_error);
+        }
     }
 
-    if (a->trace_len < (a->trace_alloc * 7 / 10) && a->trace_alloc >= 2 * GLOBE_STEP) {
-        a->trace_alloc = a->trace_alloc * 4 / 5;
-        a->trace = realloc(a->trace, a->trace_alloc * sizeof(struct state));
-        a->trace_all = realloc(a->trace_all, (1 + a->trace_alloc / 4) * sizeof(struct state_all));
-    }
+    // room for the points added until the next call, unused segments go back to the pool
+    traceReserve(a, a->trace_len + GLOBE_STEP);
 }
 
 void to_state_all(struct aircraft *a, struct state_all *new, uint64_t now) {
@@ -2550,10 +2602,10 @@ static void calc_wind(struct aircraft *a, uint64_t now) {
 
     // don't use this code for now
     /*
-    if (a->trace && a->trace_len >= 2) {
-        struct state *last = &(a->trace[a->trace_len-1]);
+    if (a->trace_alloc && a->trace_len >= 2) {
+        struct state *last = traceAt(a, a->trace_len - 1);
         if (now + 1500 < last->timestamp)
-            last = &(a->trace[a->trace_len-2]);
+            last = traceAt(a, a->trace_len - 2);
         float track_diff = fabs(a->track - last->track / 10.0);
         if (last->flags.track_valid && track_diff > 0.5)
             return;
@@ -2776,10 +2828,10 @@ static const char *source_string(datasource_t source) {
 void freeAircraft(struct aircraft *a) {
         if (a->first_message)
             free(a->first_message);
-        if (a->trace) {
-            free(a->trace);
-            free(a->trace_all);
-        }
+        traceFree(a);
+        legsFree(a);
+        free(a->trace_recent);
+        free(a->json_frag);
         free(a);
 }
 void updateValidities(struct aircraft *a, uint64_t now) {
@@ -2787,51 +2839,61 @@ void updateValidities(struct aircraft *a, uint64_t now) {
         set_globe_index(a, -5);
     }
 
-    if (now > a->category_updated + 2 * HOURS)
-        a->category = 0;
+    // anything expiring changes the aircraft.json object
+    int expired = 0;
 
-    updateValidity(&a->callsign_valid, now, 2 * TRACK_EXPIRE_LONG);
-    updateValidity(&a->altitude_baro_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->altitude_geom_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->geom_delta_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->gs_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->ias_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->tas_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->mach_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->track_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->track_rate_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->roll_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->mag_heading_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->true_heading_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->baro_rate_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->geom_rate_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->squawk_valid, now, TRACK_EXPIRE_LONG);
-    updateValidity(&a->airground_valid, now, TRACK_EXPIRE_LONG);
-    updateValidity(&a->nav_qnh_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->nav_altitude_mcp_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->nav_altitude_fms_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->nav_altitude_src_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->nav_heading_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->nav_modes_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->cpr_odd_valid, now, TRACK_EXPIRE + 30 * SECONDS);
-    updateValidity(&a->cpr_even_valid, now, TRACK_EXPIRE + 30 * SECONDS);
-    updateValidity(&a->position_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->nic_a_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->nic_c_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->nic_baro_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->nac_p_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->sil_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->gva_valid, now, TRACK_EXPIRE);
-    updateValidity(&a->sda_valid, now, TRACK_EXPIRE);
+    if (a->category && now > a->category_updated + 2 * HOURS) {
+        a->category = 0;
+        expired = 1;
+    }
+
+    expired |= updateValidity(&a->callsign_valid, now, 2 * TRACK_EXPIRE_LONG);
+    expired |= updateValidity(&a->altitude_baro_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->altitude_geom_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->geom_delta_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->gs_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->ias_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->tas_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->mach_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->track_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->track_rate_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->roll_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->mag_heading_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->true_heading_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->baro_rate_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->geom_rate_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->squawk_valid, now, TRACK_EXPIRE_LONG);
+    expired |= updateValidity(&a->airground_valid, now, TRACK_EXPIRE_LONG);
+    expired |= updateValidity(&a->nav_qnh_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->nav_altitude_mcp_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->nav_altitude_fms_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->nav_altitude_src_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->nav_heading_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->nav_modes_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->cpr_odd_valid, now, TRACK_EXPIRE + 30 * SECONDS);
+    expired |= updateValidity(&a->cpr_even_valid, now, TRACK_EXPIRE + 30 * SECONDS);
+    expired |= updateValidity(&a->position_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->nic_a_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->nic_c_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->nic_baro_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->nac_p_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->sil_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->gva_valid, now, TRACK_EXPIRE);
+    expired |= updateValidity(&a->sda_valid, now, TRACK_EXPIRE);
 
     // reset position reliability when no position was received for 2 minutes
-    if (trackDataAge(now, &a->position_valid) > 2 * MINUTES || now > a->seenPosGlobal + 10 * MINUTES) {
+    if ((a->pos_reliable_odd || a->pos_reliable_even)
+            && (trackDataAge(now, &a->position_valid) > 2 * MINUTES || now > a->seenPosGlobal + 10 * MINUTES)) {
         a->pos_reliable_odd = 0;
         a->pos_reliable_even = 0;
+        expired = 1;
     }
 
     if (a->altitude_baro_valid.source == SOURCE_INVALID)
         a->alt_reliable = 0;
+
+    if (expired)
+        a->json_version++;
 }
 
 static void showPositionDebug(struct aircraft *a, struct modesMessage *mm, uint64_t now) {
@@ -2885,10 +2947,9 @@ static void incrementReliable(struct aircraft *a, struct modesMessage *mm, uint6
 
     if (mm->source > SOURCE_JAERO && now > a->seenPosReliable + 2 * MINUTES
             && a->pos_reliable_odd <= 0 && a->pos_reliable_even <= 0) {
-        double distance = greatcircle(a->latReliable, a->lonReliable, mm->decoded_lat, mm->decoded_lon);
         // if aircraft is close to last reliable position, treat new position as reliable immediately.
         // based on 2 minutes, 12 km equals 360 km/h or 194 knots
-        if (distance < 12e3) {
+        if (greatcircle_cmp(a->latReliable, a->lonReliable, mm->decoded_lat, mm->decoded_lon, 12e3) < 0) {
             a->pos_reliable_odd = max(1, Modes.json_reliable);
             a->pos_reliable_even = max(1, Modes.json_reliable);
             if (a->addr == Modes.cpr_focus)
@@ -251,17 +251,17 @@ struct aircraft
 
   uint32_t size_struct_aircraft; // size of this struct
   uint32_t messages; // Number of Mode S messages received
-  int trace_len; // current number of points in the trace
+  int trace_len; // number of points in trace_segs, see traceLen() for the whole trace
   int trace_write; // signal for writing the trace
   int trace_full_write; // signal for writing the complete trace
-  int trace_alloc; // current number of allocated points
+  int trace_alloc; // number of points trace_segs can hold
   int destroy; // aircraft is being deleted
   int signalNext; // next index of signalLevel to use
 
   // ----
 
-  struct state *trace; // array of positions representing the aircrafts trace/trail
-  struct state_all *trace_all;
+  struct traceSeg **trace_segs; // segments holding the unpacked part of the trace (trace_store.h)
+  int trace_segs_alloc; // size of the trace_segs array
   int altitude_baro; // Altitude (Baro)
   int alt_reliable;
   int altitude_geom; // Altitude (Geometric)
@@ -271,6 +271,21 @@ struct aircraft
   uint64_t trace_next_fw; // timestamp for next full trace write to history_dir (disk)
   double trace_llat; // last saved lat
   double trace_llon; // last saved lon
+  uint64_t chk_seen; // seen at the last state checkpoint
+  uint64_t chk_trace_first; // timestamp of the first trace point at the last state checkpoint
+  int chk_trace_len; // trace points covered by the last state checkpoint
+  int trace_packed; // number of points in trace_blocks, trace_segs holds the points after those
+  struct traceBlock *trace_blocks; // older trace points, see trace_store.h
+  uint64_t trace_last_leg; // timestamp of the last leg marker set by mark_legs
+  uint64_t trace_compacted; // trace points up to this timestamp were thinned out by traceCompact()
+  struct legState *legs; // leg detection state, see legs.h
+  struct traceBlob *trace_recent; // gzipped recent trace for the tile bundles, see globe_index.h
+  char *json_frag; // cached aircraft.json object without the live fields, see sprintAircraftCached()
+  uint64_t json_frag_expire; // a time dependent part of the fragment changes at this time
+  uint32_t json_version; // bumped when the aircraft.json object may have changed
+  uint32_t json_frag_version; // json_version the fragment was made from
+  uint16_t json_frag_len;
+  uint16_t json_frag_hole; // offset of the seen_pos value, 0: no position in the fragment
 
   // ----
 
@@ -358,6 +373,10 @@ struct aircraft
   nav_altitude_source_t nav_altitude_src;  // source of altitude used by automation
   int modeA_hit; // did our squawk match a possible mode A reply in the last check period?
   int modeC_hit; // did our altitude match a possible mode C reply in the last check period?
+  // mode A/C match index, [0]: aircraft with the same squawk, [1]: same mode C altitude band
+  struct aircraft *modeAC_next[2];
+  struct aircraft *modeAC_prev[2];
+  int modeAC_bucket[2]; // bucket + 1, 0 when not in the index
 
   // data extracted from opstatus etc
   int adsb_version; // ADS-B version (from ADS-B operational status); -1 means no ADS-B messages seen
@@ -431,6 +450,7 @@ struct aircraft
   char registration[12];
   char typeLong[63];
   uint8_t dbFlags;
+  uint32_t dbGeneration; // Modes.dbGeneration when registration / type were last looked up
   uint16_t receiverIds[RECEIVERIDBUFFER]; // RECEIVERIDBUFFER = 12
 
   struct modesMessage *first_message; // A copy of the first message we received for this aircraft.
@@ -444,20 +464,24 @@ extern uint32_t modeAC_count[4096];
 extern uint32_t modeAC_match[4096];
 extern uint32_t modeAC_age[4096];
 
-/* is this bit of data valid? */
-static inline void
+// mode C altitude bands are offset by 13 (-1200 ft) to match modeCToModeA()
+#define MODEAC_C_OFFSET 13
+#define MODEAC_C_BANDS 4096
+
+void modeACIndexRemove(struct aircraft *a);
+
+/* is this bit of data valid? returns 1 if it just expired */
+static inline int
 updateValidity (data_validity *v, uint64_t now, uint64_t expiration_timeout)
 {
     if (v->source == SOURCE_INVALID)
-        return;
+        return 0;
     v->stale = (now > v->updated + TRACK_STALE);
-    if (v->source == SOURCE_JAERO) {
-        if (now > v->updated + TRACK_EXPIRE_JAERO)
-            v->source = SOURCE_INVALID;
-    } else {
-        if (now > v->updated + expiration_timeout)
-            v->source = SOURCE_INVALID;
+    if (now > v->updated + (v->source == SOURCE_JAERO ? TRACK_EXPIRE_JAERO : expiration_timeout)) {
+        v->source = SOURCE_INVALID;
+        return 1;
     }
+    return 0;
 }
 
 /* is this bit of data valid? */
@@ -487,8 +511,6 @@ trackDataAge (uint64_t now, const data_validity *v)
   return (now - v->updated);
 }
 
-// calculate great circle distance in meters
-double greatcircle(double lat0, double lon0, double lat1, double lon1);
 void to_state_all(struct aircraft *a, struct state_all *new, uint64_t now);
 
 /* Update aircraft state from data in the provided mesage.
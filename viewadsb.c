@@ -116,6 +116,7 @@ static void view1090InitConfig(void) {
 static void view1090Init(void) {
 
     pthread_mutex_init(&Modes.data_mutex, NULL);
+    pthread_mutex_init(&Modes.dbUpdateMutex, NULL);
     pthread_cond_init(&Modes.data_cond, NULL);
 
 #ifdef _WIN32